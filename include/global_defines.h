@@ -81,6 +81,10 @@
 // CLK_OUT & DATA_OUT are inverted
 //#define INVERTED_LINES
 
+// Run the real 1541 ROM and custom drive code on a 6502 core (ESP32 only)
+// Needs the 1541 ROM in /.sys/1541.rom, started with OPEN 15,8,15,"@1541"
+//#define TRUE_DRIVE
+
 #if defined(ESP8266)
     // ESP8266 GPIO to C64 IEC Serial Port
     #define IEC_PIN_ATN          D5    // IO14  INPUT/OUTPUT
@@ -99,6 +103,24 @@
 #endif
 
 
+/*
+ * Virtual Printer
+ */
+
+// MPS-801 on devices 4 and 5, jobs are rendered to /print/
+// Off by default, a real printer on the bus uses the same devices
+//#define VIRTUAL_PRINTER
+
+
+/*
+ * Virtual Network Device
+ */
+
+// TCP/UDP/HTTP connections as channels of this device
+// Off by default, a real drive may be set to the same device
+//#define NETWORK_DEVICE 12
+
+
 /*
  * LED Functions
  */
@@ -285,7 +285,8 @@ IEC::BusState IEC::service(Data& iec_data)
 
 IEC::BusState IEC::deviceListen(Data& iec_data)
 {
-	byte i=0;
+	// Keeps its capacity, receiving a command never allocates after the first
+	iec_data.content.reserve(IEC_CMD_MAX_LENGTH);
 
 	// Okay, we will listen.
 	// Debug_printf("(20 LISTEN) (%.2d DEVICE) ", iec_data.device);
@@ -323,22 +324,29 @@ IEC::BusState IEC::deviceListen(Data& iec_data)
 
 			if(c == IEC_UNLISTEN)
 			{
-				mstr::rtrimA0(iec_data.content);
+				// Drop the CR that ends a PRINT# line, but keep CRs inside
+				// the command as they may be binary arguments (P command).
+				// M-W and M-E data is binary to the end, it is left as it came.
+				std::string &content = iec_data.content;
+				bool binary = content.size() > 2 && content[0] == 'M' && content[1] == '-' && (content[2] == 'W' || content[2] == 'E');
+				if(!binary)
+				{
+					if(content.size() && content.back() == 0x0D)
+						content.pop_back();
+					mstr::rtrimA0(content);
+				}
 				Debug_printf(" [%s] (3F UNLISTEN)\r\n", iec_data.content.c_str());
 				break;
 			}
 
-			if(i >= IEC_CMD_MAX_LENGTH)
+			if(iec_data.content.size() >= IEC_CMD_MAX_LENGTH)
 			{
 				// Buffer is going to overflow, this is an error condition
 				// FIXME: here we should propagate the error type being overflow so that reading error channel can give right code out.
 				Debug_printv("IEC_CMD_MAX_LENGTH");
 				return BUS_ERROR;
 			}
-			if(c != 0x0D)
-			{
-				iec_data.content += (uint8_t)c;
-			}
+			iec_data.content += (uint8_t)c;
 		}
 	}
 
@@ -463,10 +471,20 @@ bool IEC::send(uint8_t data)
 
 bool IEC::send(std::string data)
 {
-	for (size_t i = 0; i < data.length(); ++i)
-		send(data[i]);
+	return send((const uint8_t *)data.data(), data.length()) == data.length();
+}
 
-	return true;
+size_t IEC::send(const uint8_t *data, size_t len, bool eoi)
+{
+	size_t i = 0;
+	for ( ; i < len; i++ )
+	{
+		bool success = ( eoi && i == len - 1 ) ? sendEOI(data[i]) : send(data[i]);
+		if ( !success )
+			break;
+	}
+
+	return i;
 }
 
 
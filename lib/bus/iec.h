@@ -28,7 +28,7 @@
 #include "protocol/cbmstandardserial.h"
 //#include "protocol/jiffydos.h"
 
-#define	IEC_CMD_MAX_LENGTH 	100
+#define	IEC_CMD_MAX_LENGTH 	255	// longest file name a C64 can send
 
 using namespace Protocol;
 
@@ -86,6 +86,10 @@ public:
 	bool send(byte data);
 	bool send(std::string data);
 
+	// Sends a block of bytes, the last one with EOI if requested.
+	// Returns how many bytes went out before the host stopped listening.
+	size_t send(const uint8_t *data, size_t len, bool eoi = false);
+
 	// Same as IEC_send, but indicating that this is the last byte.
 	bool sendEOI(byte data);
 
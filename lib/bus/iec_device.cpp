@@ -21,6 +21,7 @@
 #include "iec_device.h"
 #include "iec.h"
 #include "wrappers/iec_buffer.h"
+#include "wrappers/read_ahead.h"
 
 using namespace CBM;
 using namespace Protocol;
@@ -81,79 +82,92 @@ uint8_t iecDevice::service(void)
 	// Did anything happen from the controller side?
 	else if (bus_state not_eq IEC::BUS_IDLE)
 	{
-		Debug_printf("DEVICE: [%d] ", m_iec_data.device);
+		auto attached = m_attached.find(m_iec_data.device);
+		if ( attached != m_attached.end() )
+			attached->second->dispatch(bus_state);
+		else
+			dispatch(bus_state);
+	}
+	//Debug_printv("mode[%d] command[%.2X] channel[%.2X] state[%d]", mode, m_iec_data.command, m_iec_data.channel, m_openState);
 
-		if (m_iec_data.command == IEC::IEC_OPEN)
-		{
-			Debug_printf("OPEN CHANNEL %d\r\n", m_iec_data.channel);
-			if (m_iec_data.channel == 0)
-				Debug_printf("LOAD \"%s\",%d\r\n", m_iec_data.content.c_str(), m_iec_data.device);
-			else if (m_iec_data.channel == 1)
-				Debug_printf("SAVE \"%s\",%d\r\n", m_iec_data.content.c_str(), m_iec_data.device);
-			else {
-				Debug_printf("OPEN #,%d,%d,\"%s\"\r\n", m_iec_data.device, m_iec_data.channel, m_iec_data.content.c_str());
-			}
+	return bus_state;
+} // service
 
-			// Open Named Channel
-			handleOpen(m_iec_data);
 
-			// Open either file or prg for reading, writing or single line command on the command channel.
-			if (bus_state == IEC::BUS_COMMAND)
-			{
-				// Process a command
-				Debug_printv("[Process a command]");
-				handleListenCommand(m_iec_data);
-			}
-			else if (bus_state == IEC::BUS_LISTEN)
-			{
-				// Receive data
-				Debug_printv("[Receive data]");
-				handleListenData();
-			}
+void iecDevice::dispatch(IEC::BusState bus_state)
+{
+	Debug_printf("DEVICE: [%d] ", m_iec_data.device);
+
+	if (m_iec_data.command == IEC::IEC_OPEN)
+	{
+		Debug_printf("OPEN CHANNEL %d\r\n", m_iec_data.channel);
+		if (m_iec_data.channel == 0)
+			Debug_printf("LOAD \"%s\",%d\r\n", m_iec_data.content.c_str(), m_iec_data.device);
+		else if (m_iec_data.channel == 1)
+			Debug_printf("SAVE \"%s\",%d\r\n", m_iec_data.content.c_str(), m_iec_data.device);
+		else {
+			Debug_printf("OPEN #,%d,%d,\"%s\"\r\n", m_iec_data.device, m_iec_data.channel, m_iec_data.content.c_str());
 		}
-		else if (m_iec_data.command == IEC::IEC_SECOND) // data channel opened
+
+		// Open Named Channel
+		handleOpen(m_iec_data);
+
+		// Open either file or prg for reading, writing or single line command on the command channel.
+		if (bus_state == IEC::BUS_COMMAND)
 		{
-			Debug_printf("DATA CHANNEL %d\r\n", m_iec_data.channel);
-			if (bus_state == IEC::BUS_COMMAND)
-			{
-				// Process a command
-				Debug_printv("[Process a command]");
-				handleListenCommand(m_iec_data);
-			}
-			else if (bus_state == IEC::BUS_LISTEN)
-			{
-				// Receive data
-				Debug_printv("[Receive data]");
-				handleListenData();
-			}
-			else if (bus_state == IEC::BUS_TALK)
-			{
-				// Send data
-				Debug_printv("[Send data]");
-				if (m_iec_data.channel == CMD_CHANNEL)
-				{
-					handleListenCommand(m_iec_data);		 // This is typically an empty command,
-				}
-
-				handleTalk(m_iec_data.channel);
-			}
+			// Process a command
+			Debug_printv("[Process a command]");
+			handleListenCommand(m_iec_data);
+		}
+		else if (bus_state == IEC::BUS_LISTEN)
+		{
+			// Receive data
+			Debug_printv("[Receive data]");
+			handleListenData();
+		}
+	}
+	else if (m_iec_data.command == IEC::IEC_SECOND) // data channel opened
+	{
+		Debug_printf("DATA CHANNEL %d\r\n", m_iec_data.channel);
+		if (bus_state == IEC::BUS_COMMAND)
+		{
+			// Process a command
+			Debug_printv("[Process a command]");
+			handleListenCommand(m_iec_data);
 		}
-		else if (m_iec_data.command == IEC::IEC_CLOSE)
+		else if (bus_state == IEC::BUS_LISTEN)
 		{
-			Debug_printf("CLOSE CHANNEL %d\r\n", m_iec_data.channel);
-			if(m_iec_data.channel > 0)
+			// Receive data
+			Debug_printv("[Receive data]");
+			handleListenData();
+		}
+		else if (bus_state == IEC::BUS_TALK)
+		{
+			// Send data
+			Debug_printv("[Send data]");
+			if (m_iec_data.channel == CMD_CHANNEL)
 			{
-				handleClose(m_iec_data);
+				handleListenCommand(m_iec_data);		 // This is typically an empty command,
 			}
+
+			handleTalk(m_iec_data.channel);
 		}
 	}
-	//Debug_printv("mode[%d] command[%.2X] channel[%.2X] state[%d]", mode, m_iec_data.command, m_iec_data.channel, m_openState);
+	else if (m_iec_data.command == IEC::IEC_CLOSE)
+	{
+		Debug_printf("CLOSE CHANNEL %d\r\n", m_iec_data.channel);
+		handleClose(m_iec_data);
+	}
+} // dispatch
 
-	return bus_state;
-} // service
+void iecDevice::attach(uint8_t device, iecDevice *handler)
+{
+	m_attached[device] = handler;
+	m_iec.enableDevice(device);
+} // attach
 
 
-Channel iecDevice::channelSelect(IEC::Data &iec_data)
+Channel &iecDevice::channelSelect(IEC::Data &iec_data)
 {
 	size_t key = (iec_data.device * 100) + iec_data.channel;
 	if(channels.find(key)!=channels.end()) {
@@ -165,16 +179,407 @@ Channel iecDevice::channelSelect(IEC::Data &iec_data)
 	newChannel.url = iec_data.content;
 	Debug_printv("CHANNEL device[%d] channel[%d] url[%s]", iec_data.device, iec_data.channel, iec_data.content.c_str());
 
-	channels.insert(std::make_pair(key, newChannel));
-	return newChannel;
+	channels.insert(std::make_pair(key, std::move(newChannel)));
+	return channels.at(key);
 }
 
 bool iecDevice::channelClose(IEC::Data &iec_data, bool close_all)
 {
+	if ( close_all )
+	{
+		// Close every channel of this device
+		size_t count = 0;
+		for ( auto it = channels.begin(); it != channels.end(); )
+		{
+			if ( it->first / 100 == iec_data.device )
+			{
+				it->second.close();
+				it = channels.erase(it);
+				count++;
+			}
+			else
+				it++;
+		}
+		return count;
+	}
+
 	size_t key = (iec_data.device * 100) + iec_data.channel;
 	if(channels.find(key)!=channels.end()) {
+		channels.at(key).close();
 		return channels.erase(key);
 	}
 
 	return false;
 }
+
+
+/********************************************************
+ * Channel
+ ********************************************************/
+
+bool Channel::open(std::string u, bool write, uint8_t length)
+{
+	close();
+
+	url = u;
+	cursor = 0;
+	writing = write;
+	record_length = length;
+	// A 1541 refuses records longer than this
+	if ( record_length > CHANNEL_RECORD_SIZE )
+		return false;
+
+	std::unique_ptr<MFile> file(MFSOwner::File(url));
+	if ( file == nullptr )
+		return false;
+
+	if ( writing )
+	{
+		ostream.reset(file->outputStream());
+		m_buffer.reset(new uint8_t[CHANNEL_WRITE_SIZE]);
+	}
+	else
+	{
+		if ( record_length && !file->exists() )
+		{
+			// Create the relative file and tag it with its record length
+			ostream.reset(file->outputStream());
+			if ( ostream == nullptr || !ostream->setRecordLength(record_length) )
+			{
+				close();
+				return false;
+			}
+		}
+
+		istream.reset(file->inputStream());
+		m_buffer.reset(new uint8_t[CHANNEL_BUFFER_SIZE]);
+
+		// Network files are read ahead while the bus is idle
+		if ( !record_length && istream != nullptr && istream->isOpen() && ReadAheadIStream::wanted(file.get()) )
+			istream.reset(new ReadAheadIStream(istream.release()));
+
+		if ( istream != nullptr && istream->isOpen() )
+		{
+			// An existing relative file knows its own record length
+			if ( istream->recordLength() )
+				record_length = istream->recordLength();
+			if ( record_length > CHANNEL_RECORD_SIZE )
+			{
+				close();
+				return false;
+			}
+			m_size = istream->size();
+		}
+
+		// Records can be rewritten, unless the media is read only
+		if ( record_length && ostream == nullptr )
+			ostream.reset(file->outputStream());
+	}
+
+	Debug_printv("url[%s] writing[%d] record_length[%d] open[%d]", url.c_str(), writing, record_length, isOpen());
+	return isOpen();
+}
+
+void Channel::close(void)
+{
+	// Commit whatever is still queued
+	flushBehind(false);
+	flush(true);
+
+	if ( istream != nullptr )
+		istream->close();
+	if ( ostream != nullptr )
+		ostream->close();
+
+	istream.reset();
+	ostream.reset();
+	m_buffer.reset();
+	block.reset();
+	m_head = m_tail = 0;
+	m_size = 0;
+	m_dirty = false;
+	m_queued = 0;
+	m_flushed = 0;
+	m_failed = false;
+	resume.clear();
+	resume_end = false;
+	utf8_tail.clear();
+}
+
+// Reads from a stream opened elsewhere, like a prefetched program
+bool Channel::open(std::string u, MIStream *stream)
+{
+	close();
+
+	url = u;
+	cursor = 0;
+	writing = false;
+	record_length = 0;
+
+	istream.reset(stream);
+	m_buffer.reset(new uint8_t[CHANNEL_BUFFER_SIZE]);
+	if ( isOpen() )
+		m_size = istream->size();
+
+	return isOpen();
+}
+
+// A 256 byte sector buffer for the block commands
+bool Channel::openBuffer(void)
+{
+	close();
+
+	url = "#";
+	cursor = 0;
+	writing = false;
+	record_length = 0;
+
+	block.reset(new uint8_t[256]());
+	block_pointer = 0;
+	block_last = 255;
+	return true;
+}
+
+bool Channel::isOpen(void)
+{
+	if ( block != nullptr )
+		return true;
+
+	if ( record_length )
+		return ( istream != nullptr && istream->isOpen() ) || ( ostream != nullptr && ostream->isOpen() );
+
+	if ( writing )
+		return ( ostream != nullptr && ostream->isOpen() );
+
+	return ( istream != nullptr && istream->isOpen() );
+}
+
+// Keep the unread bytes and top up the rest of the buffer from the stream
+bool Channel::fill(void)
+{
+	if ( m_dirty && ostream != nullptr )
+	{
+		// Reopen both streams so reads see the records written so far. The
+		// input stream is made anew, one in a disk image can't be reopened.
+		ostream->close();
+		ostream->open();
+		if ( istream != nullptr )
+			istream->close();
+		std::unique_ptr<MFile> file(MFSOwner::File(url));
+		istream.reset(file->inputStream());
+		if ( istream == nullptr || !istream->isOpen() || !istream->seek(cursor) )
+			return false;
+		m_dirty = false;
+	}
+
+	if ( istream == nullptr || m_buffer == nullptr )
+		return false;
+
+	size_t remaining = m_tail - m_head;
+	if ( remaining && m_head )
+		memmove(m_buffer.get(), m_buffer.get() + m_head, remaining);
+	m_head = 0;
+	m_tail = remaining;
+
+	size_t bytesRead = istream->read(m_buffer.get() + m_tail, CHANNEL_BUFFER_SIZE - m_tail);
+	m_tail += bytesRead;
+
+	return bytesRead > 0;
+}
+
+int16_t Channel::peek(void)
+{
+	if ( m_head >= m_tail && !fill() )
+		return -1;
+
+	return m_buffer[m_head];
+}
+
+void Channel::next(void)
+{
+	if ( m_head < m_tail )
+	{
+		m_head++;
+		cursor++;
+	}
+}
+
+bool Channel::isLast(void)
+{
+	if ( m_tail - m_head > 1 )
+		return false;
+
+	// Only the peeked byte is buffered, see if the stream has more
+	return !fill();
+}
+
+bool Channel::seek(size_t pos)
+{
+	if ( m_dirty )
+	{
+		// fill() reopens the stream at the cursor
+		m_head = m_tail = 0;
+		cursor = pos;
+		return true;
+	}
+
+	if ( istream == nullptr )
+		return false;
+
+	// Still inside the read-ahead buffer?
+	size_t start = cursor - m_head;
+	if ( pos >= start && pos < start + m_tail )
+	{
+		m_head = pos - start;
+		cursor = pos;
+		return true;
+	}
+
+	if ( !istream->seek(pos) )
+		return false;
+
+	m_head = m_tail = 0;
+	cursor = pos;
+	return true;
+}
+
+// Bytes received from the bus are queued here at bus speed
+bool Channel::put(uint8_t b)
+{
+	if ( m_buffer == nullptr || m_failed || pending() == CHANNEL_WRITE_SIZE )
+		return false;
+
+	m_buffer[m_queued % CHANNEL_WRITE_SIZE] = b;
+	m_queued++;
+	cursor++;
+	return true;
+}
+
+// Drain the ring to ostream. Writes end on chunk boundaries of the file so
+// the flash sees few, aligned writes. Only a commit writes a partial chunk.
+bool Channel::flush(bool all)
+{
+	if ( !writing || m_buffer == nullptr )
+		return !m_failed;
+
+	while ( pending() && !m_failed )
+	{
+		size_t count = CHANNEL_WRITE_CHUNK - (m_flushed % CHANNEL_WRITE_CHUNK);
+		if ( count > pending() )
+		{
+			if ( !all )
+				break;
+			count = pending();
+		}
+
+		// Don't wrap around the end of the ring in one write
+		size_t head = m_flushed % CHANNEL_WRITE_SIZE;
+		if ( count > CHANNEL_WRITE_SIZE - head )
+			count = CHANNEL_WRITE_SIZE - head;
+
+		size_t bytesWritten = ( ostream != nullptr ) ? ostream->write(m_buffer.get() + head, count) : 0;
+		if ( bytesWritten != count )
+		{
+			Debug_printv("write failed url[%s] offset[%d] count[%d] written[%d]", url.c_str(), m_flushed, count, bytesWritten);
+			m_failed = true;
+			break;
+		}
+
+		m_flushed += count;
+	}
+
+	return !m_failed;
+}
+
+bool Channel::flushBehind(bool on)
+{
+#if defined(ESP32)
+	if ( on && m_stopped && writing && m_buffer != nullptr )
+	{
+		m_behind = true;
+		m_stopped = false;
+		if ( xTaskCreatePinnedToCore(flushTask, "flush", 4096, this, 1, nullptr, 0) != pdPASS )
+		{
+			m_behind = false;
+			m_stopped = true;
+		}
+	}
+	else if ( !on )
+	{
+		m_behind = false;
+		while ( !m_stopped )
+			delay(1);
+	}
+	return !m_stopped;
+#else
+	return false;
+#endif
+}
+
+#if defined(ESP32)
+void Channel::flushTask(void *parameter)
+{
+	auto channel = (Channel *)parameter;
+
+	while ( channel->m_behind && channel->flush() )
+		delay(1);
+
+	channel->m_stopped = true;
+	vTaskDelete(nullptr);
+}
+#endif
+
+// P command: move to a record (1 based) and a byte within it (1 based)
+bool Channel::position(uint16_t record, uint8_t offset)
+{
+	if ( !record_length )
+		return false;
+
+	if ( record ) record--;
+	if ( offset ) offset--;
+
+	size_t pos = ((size_t)record * record_length) + offset;
+	if ( pos < m_size && seek(pos) )
+		return true;
+
+	// Record is past the end, writing to it will expand the file
+	m_head = m_tail = 0;
+	cursor = pos;
+	return false;
+}
+
+// Write into the current record, expanding the file with empty records first
+size_t Channel::write(const uint8_t *buf, size_t size)
+{
+	if ( ostream == nullptr || !ostream->isOpen() )
+		return 0;
+
+	if ( record_length )
+	{
+		size_t record_start = cursor - (cursor % record_length);
+		if ( m_size < record_start )
+		{
+			// Empty records start with $FF
+			uint8_t empty[CHANNEL_RECORD_SIZE];
+			memset(empty, 0, record_length);
+			empty[0] = 0xFF;
+
+			m_size -= m_size % record_length;
+			ostream->seek(m_size);
+			while ( m_size < record_start && ostream->write(empty, record_length) == record_length )
+				m_size += record_length;
+		}
+		ostream->seek(cursor);
+	}
+
+	size_t bytesWritten = ostream->write(buf, size);
+	cursor += bytesWritten;
+	if ( cursor > m_size )
+		m_size = cursor;
+
+	// Drop the read-ahead, it may hold the old contents
+	m_head = m_tail = 0;
+	m_dirty = true;
+
+	return bytesWritten;
+}
@@ -58,16 +58,86 @@
 class CommandPathTuple {
 public:
 	std::string command;
-	std::string fullPath;
 	std::string rawPath;
 };
 
+#define CHANNEL_BUFFER_SIZE 256	// read-ahead per open data channel
+#if defined(ESP32)
+#define CHANNEL_WRITE_SIZE 4096	// write-behind ring per channel open for writing
+#else
+#define CHANNEL_WRITE_SIZE 1024
+#endif
+#define CHANNEL_WRITE_CHUNK 256	// ring is drained in writes of this size, aligned in the file
+#define CHANNEL_RECORD_SIZE 254	// longest record of a relative file
+
+// A named channel (0-14) with its own open stream. The channel keeps the
+// stream and position between TALKs so several files can be read in turns.
 class Channel
 {
 public:
 	std::string url;
-	uint32_t cursor;
-	bool writing;
+	uint32_t cursor = 0;	// position of the next byte to be sent/received
+	bool writing = false;
+	uint8_t record_length = 0;	// relative files only, 0 for everything else
+
+	std::unique_ptr<MIStream> istream;
+	std::unique_ptr<MOStream> ostream;
+
+	bool open(std::string url, bool write = false, uint8_t length = 0);
+	bool open(std::string url, MIStream *stream);	// reads from a stream opened elsewhere
+	void close(void);
+	bool isOpen(void);
+
+	// Read-ahead
+	int16_t peek(void);		// next byte without consuming it, -1 at end
+	void next(void);		// consume the byte returned by peek()
+	bool isLast(void);		// is the peeked byte the last one of the stream?
+	bool seek(size_t pos);
+
+	// Bytes a TALK had ready when ATN ended it, the next TALK starts with them
+	std::string resume;
+	bool resume_end = false;	// nothing follows, the last byte goes out with EOI
+	std::string utf8_tail;		// text files, start of a sequence the next read completes
+
+	// Write-behind
+	bool put(uint8_t b);				// queue a byte, false if the ring is full
+	bool flush(bool all = false);		// drain whole chunks, or everything on commit
+	size_t pending(void) { return m_queued - m_flushed; };
+	bool failed(void) { return m_failed; };
+
+	// On ESP32 a task drains whole chunks while the bus keeps receiving,
+	// stopping waits for the write it is doing
+	bool flushBehind(bool on);
+
+	// Relative files
+	bool position(uint16_t record, uint8_t offset);
+	size_t write(const uint8_t *buf, size_t size);
+
+	// Direct access buffer, OPEN n,8,ch,"#"
+	std::unique_ptr<uint8_t[]> block;
+	uint8_t block_pointer = 0;	// next byte read or written
+	uint8_t block_last = 255;	// EOI is sent with this byte
+	bool openBuffer(void);
+
+private:
+	std::unique_ptr<uint8_t[]> m_buffer;
+	size_t m_head = 0;		// next byte in buffer
+	size_t m_tail = 0;		// end of valid data in buffer
+	// Only put() moves m_queued and only flush() moves m_flushed, so the
+	// ring needs no lock between the bus and the flush task
+	volatile size_t m_queued = 0;	// bytes put in the write ring so far
+	volatile size_t m_flushed = 0;	// bytes handed to ostream so far
+	volatile bool m_failed = false;	// ostream refused a write
+	size_t m_size = 0;		// file size, grows as records are written
+	bool m_dirty = false;	// written since istream was opened
+
+	bool fill(void);
+
+#if defined(ESP32)
+	volatile bool m_behind = false;		// the flush task should keep going
+	volatile bool m_stopped = true;		// the flush task is gone
+	static void flushTask(void *parameter);
+#endif
 };
 
 class iecDevice
@@ -87,6 +157,9 @@ public:
 	~iecDevice() {};
 
 	uint8_t service(void);
+
+	// Another device answering on the same bus, it gets everything sent to this ID
+	void attach(uint8_t device, iecDevice *handler);
 	
 	virtual uint8_t command(IEC::Data &iec_data) = 0;
 	virtual uint8_t execute(IEC::Data &iec_data) = 0;
@@ -97,6 +170,8 @@ public:
 
 protected:
 	void reset(void);
+	void dispatch(IEC::BusState bus_state);
+	std::unordered_map<uint8_t, iecDevice *> m_attached;
 
 	// handler helpers.
 	virtual void handleListenCommand(IEC::Data &iec_data) = 0;
@@ -114,10 +189,8 @@ protected:
 	
 	DeviceDB m_device;
 
-private:
-	Channel channelSelect(IEC::Data &iec_data);
+	Channel &channelSelect(IEC::Data &iec_data);
 	bool channelClose(IEC::Data &iec_data, bool close_all = false);
-
 };
 
 
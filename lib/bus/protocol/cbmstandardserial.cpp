@@ -201,6 +201,12 @@ bool CBMStandardSerial::sendByte(uint8_t data, bool signalEOI)
 	// to  accept  data.  What  happens  next  is  variable.
 	while(status(IEC_PIN_DATA) != RELEASED)
 	{
+		// The controller gave up on us, nothing of this byte went out
+		if(status(IEC_PIN_ATN) == PULLED)
+		{
+			flags or_eq ATN_PULLED;
+			return false;
+		}
 		ESP.wdtFeed();
 	}
 
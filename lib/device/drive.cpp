@@ -26,6 +26,9 @@
 #include "iec_device.h"
 #include "wrappers/iec_buffer.h"
 #include "wrappers/directory_stream.h"
+#include "wrappers/read_ahead.h"
+#include "network/http_cache.h"
+#include "network/https.h"
 
 using namespace CBM;
 using namespace Protocol;
@@ -39,9 +42,18 @@ devDrive::devDrive(IEC &iec) :
 } // ctor
 
 
+void devDrive::idle(void)
+{
+	m_prefetch.step();
+	ReadAheadIStream::service();
+	HttpCache::step();
+} // idle
+
 void devDrive::reset(void)
 {
 	m_openState = O_NOTHING;
+	m_drivecode.reset();
+	m_warp.reset();
 	setDeviceStatus(73);
 	//m_device.reset();
 } // reset
@@ -60,14 +72,9 @@ void devDrive::sendStatus(void)
 		status = "00, OK,00,00";
 
 	Debug_printv("status: %s", status.c_str());
-	Debug_print("[");
-
-	m_iec.send(status);
-
-	Debug_println(BACKSPACE "]");
 
-	// Send CR with EOI marker.
-	m_iec.sendEOI('\x0D');
+	// CR with EOI marker
+	sendProgram(status + '\x0D');
 
 	// Clear the status message
 	m_device_status.clear();
@@ -85,6 +92,10 @@ void devDrive::setDeviceStatus(int number, int track, int sector)
 		case 20:
 			m_device_status = "20,FILE NOT OPEN,00,00";
 			break;
+		// 25 WRITE ERROR - data could not be written
+		case 25:
+			m_device_status = "25,WRITE ERROR,00,00";
+			break;
 		// 26 WRITE PROTECT ON
 		case 26:
 			m_device_status = "26,WRITE PROTECT ON,00,00";
@@ -109,6 +120,10 @@ void devDrive::setDeviceStatus(int number, int track, int sector)
 		case 50:
 			m_device_status = "50,RECORD NOT PRESENT,00,00";
 			break;
+		// 51 OVERFLOW IN RECORD - too much data for the record
+		case 51:
+			m_device_status = "51,OVERFLOW IN RECORD,00,00";
+			break;
 		// 60 WRITE FILE OPEN - trying to open for wrtiting a file that is open for writing
 		case 60:
 			m_device_status = "60,WRITE FILE OPEN,00,00";
@@ -125,9 +140,17 @@ void devDrive::setDeviceStatus(int number, int track, int sector)
 		case 63:
 			m_device_status = "63,FILE EXISTS,00,00";
 			break;
-		// 65 NO BLOCK - for B-A
+		// 65 NO BLOCK - for B-A, track/sector of the next free block
 		case 65:
-			m_device_status = "65,NO BLOCK,00,00";
+			m_device_status = mstr::format("65,NO BLOCK,%.2d,%.2d", track, sector);
+			break;
+		// 66 ILLEGAL TRACK OR SECTOR
+		case 66:
+			m_device_status = mstr::format("66,ILLEGAL TRACK OR SECTOR,%.2d,%.2d", track, sector);
+			break;
+		// 70 NO CHANNEL - block command on a channel without a buffer
+		case 70:
+			m_device_status = "70,NO CHANNEL,00,00";
 			break;
 		// 73 boot message: device name, rom version etc.
 		case 73:
@@ -186,28 +209,31 @@ MFile* devDrive::getPointed(MFile* urlFile) {
 	}
 };
 
-CommandPathTuple devDrive::parseLine(std::string command, size_t channel)
+CommandPathTuple devDrive::parseLine(const DosCommand &dos, size_t channel)
 {
-
 	Debug_printv("* PARSE INCOMING LINE *******************************");
 
 	Debug_printv("we are in              [%s]", m_mfile->url.c_str());
-	Debug_printv("unprocessed user input [%s]", command.c_str());
+	Debug_printv("unprocessed user input [%s]", dos.line.str().c_str());
+
+	CommandPathTuple tuple;
+	DosToken line = dos.line;
+	DosToken path;
 
-	if (mstr::endsWith(command, "*"))
+	if ( dos.argument.size && dos.argument.back() == '*' )
 	{
 		// Find first program in listing
 		if (m_device.path().empty())
 		{
 			// If in LittleFS root then set it to FB64
 			// TODO: Load configured autoload program
-			command = SYSTEM_DIR "fb64";
+			tuple.command = tuple.rawPath = SYSTEM_DIR "fb64";
 		}
 		else
 		{
 			// Find first PRG file in current directory
 			std::unique_ptr<MFile> entry(m_mfile->getNextFileInDir());
-			std::string match = mstr::dropLast(command, 1);
+			std::string match(dos.argument.data, dos.argument.size - 1);
 			while ( entry != nullptr )
 			{
 				Debug_printv("match[%s] extension[%s]", match.c_str(), entry->extension.c_str());
@@ -220,55 +246,52 @@ CommandPathTuple devDrive::parseLine(std::string command, size_t channel)
 					break;
 				}
 			}
-			command = entry->name;
+			if ( entry != nullptr )
+				tuple.command = tuple.rawPath = entry->name;
 		}
+		return tuple;
 	}
 
-	std::string guessedPath = command;
-	CommandPathTuple tuple;
-
-	mstr::toASCII(guessedPath);
-
 	// check to see if it starts with a known command token
-	if ( mstr::startsWith(command, "cd", false) ) // would be case sensitive, but I don't know the proper case
+	if ( line.startsWith("cd", false) ) // would be case sensitive, but I don't know the proper case
 	{
-		guessedPath = mstr::drop(guessedPath, 2);
+		path = line.drop(2);
 		tuple.command = "cd";
-		if ( mstr::startsWith(guessedPath, ":") || mstr::startsWith(guessedPath, " " ) ) // drop ":" if it was specified
-			guessedPath = mstr::drop(guessedPath, 1);
-		//else if ( channel != 15 )
-		//	guessedPath = command;
-
-		Debug_printv("guessedPath[%s]", guessedPath.c_str());
+		if ( path.startsWith(":") || path.startsWith(" ") ) // drop ":" if it was specified
+			path = path.drop(1);
 	}
-	else if(mstr::startsWith(command, "@info", false))
+	else if ( line.startsWith("@info", false) )
 	{
-		guessedPath = mstr::drop(guessedPath, 5);
+		path = line.drop(5);
 		tuple.command = "@info";
 	}
-	else if(mstr::startsWith(command, "@stat", false))
+	else if ( line.startsWith("@stat", false) )
 	{
-		guessedPath = mstr::drop(guessedPath, 5);
+		path = line.drop(5);
 		tuple.command = "@stat";
 	}
-	else if(mstr::startsWith(command, ":")) {
+	else if ( line.startsWith(":") )
+	{
 		// JiffyDOS eats commands it knows, it might be T: which means ASCII dump requested
-		guessedPath = mstr::drop(guessedPath, 1);
+		path = line.drop(1);
 		tuple.command = "t";
 	}
-	else if(mstr::startsWith(command, "S:")) {
+	else if ( line.startsWith("S:") )
+	{
 		// capital S = heart, that's a FAV!
-		guessedPath = mstr::drop(guessedPath, 2);
+		path = line.drop(2);
 		tuple.command = "mfav";
 	}
-	else if(mstr::startsWith(command, "MFAV:")) {
-		// capital S = heart, that's a FAV!
-		guessedPath = mstr::drop(guessedPath, 5);
+	else if ( line.startsWith("MFAV:") )
+	{
+		path = line.drop(5);
 		tuple.command = "mfav";
 	}
 	else
 	{
-		tuple.command = command;
+		// A plain file name loses drive, "@" and type/mode, commands are kept whole
+		path = ( dos.command.empty() ) ? dos.argument : line;
+		tuple.command = line.str();
 	}
 
 	// TODO more of them?
@@ -277,28 +300,13 @@ CommandPathTuple devDrive::parseLine(std::string command, size_t channel)
 	// LOAD ~/something
 	// LOAD ../something
 	// LOAD //something
-	// we HAVE TO PARSE IT OUR WAY!
-
-
-	// and to get a REAL FULL PATH that the user wanted to refer to, we CD into it, using supplied stripped path:
-	mstr::rtrim(guessedPath);
-	tuple.rawPath = guessedPath;
+	// we HAVE TO PARSE IT OUR WAY! That is only done by the commands that
+	// need a full path, see handleListenCommand.
+	tuple.rawPath = path.str();
+	mstr::toASCII(tuple.rawPath);
+	mstr::rtrim(tuple.rawPath);
 
 	Debug_printv("found command     [%s]", tuple.command.c_str());
-
-	if(guessedPath == "$")
-	{
-		Debug_printv("get directory of [%s]", m_mfile->url.c_str());
-	}
-	else if(!guessedPath.empty())
-	{
-		auto fullPath = Meat::Wrap(m_mfile->cd(guessedPath));
-
-		tuple.fullPath = fullPath->url;
-
-		Debug_printv("full referenced path [%s]", tuple.fullPath.c_str());
-	}
-
 	Debug_printv("* END OF PARSE LINE *******************************");
 
 	return tuple;
@@ -314,12 +322,34 @@ void devDrive::changeDir(std::string url)
 	Debug_printv("LOAD $");
 }
 
-void devDrive::prepareFileStream(std::string url)
+void devDrive::prepareFileStream(std::string url, uint8_t record_length)
 {
 	m_device.url(url);
 	m_filename = url;
-	m_openState = O_FILE;
-	Debug_printv("LOAD [%s]", url.c_str());
+
+	// Each channel owns its stream, so files opened on other channels stay open
+	auto &channel = channelSelect(m_iec_data);
+
+	// A plain LOAD may have been prefetched while the last part was running,
+	// other reads teach the prefetcher nothing
+	MIStream *prefetched = nullptr;
+	if ( !channel.writing && !record_length && m_iec_data.channel == 0 )
+		prefetched = m_prefetch.open(url, m_mfile->url);
+
+	if ( prefetched && channel.open(url, prefetched) )
+	{
+		m_openState = O_FILE;
+	}
+	else if ( channel.open(url, channel.writing, record_length) )
+	{
+		m_openState = O_FILE;
+	}
+	else if ( record_length )
+	{
+		// Relative file could not be created
+		setDeviceStatus(26);
+	}
+	Debug_printv("%s [%s] channel[%d]", channel.writing ? "SAVE" : "LOAD", url.c_str(), m_iec_data.channel);
 }
 
 
@@ -336,6 +366,14 @@ void devDrive::handleListenCommand(IEC::Data &iec_data)
 	size_t channel = iec_data.channel;
 	m_openState = O_NOTHING;
 
+	// A new command or status read replaces what was left of the last one
+	if ( channel == CMD_CHANNEL )
+	{
+		auto &command = channelSelect(iec_data);
+		command.resume.clear();
+		command.resume_end = false;
+	}
+
 	if (iec_data.content.size() == 0 )
 	{
 		Debug_printv("No command to process");
@@ -345,9 +383,55 @@ void devDrive::handleListenCommand(IEC::Data &iec_data)
 		return;
 	}
 
-	// 1. obtain command and fullPath
-	auto commandAndPath = parseLine(iec_data.content, channel);
-	auto referencedPath = Meat::New<MFile>(commandAndPath.fullPath);
+	// Position a relative file: "P" + channel + record low/high + byte
+	if ( channel == CMD_CHANNEL && iec_data.content[0] == 'P' && iec_data.content.size() > 1 )
+	{
+		positionRecord(iec_data.content);
+		return;
+	}
+
+	// Direct access buffer: OPEN n,8,ch,"#"
+	if ( channel != CMD_CHANNEL && iec_data.content[0] == '#' )
+	{
+		channelSelect(iec_data).openBuffer();
+		return;
+	}
+
+	// M-W/M-E drive code, content is not trimmed for these
+	if ( channel == CMD_CHANNEL && memoryCommand(iec_data.content) )
+		return;
+
+	// U1/U2 and B-R/B-W/B-P/B-A/B-F
+	if ( channel == CMD_CHANNEL && blockCommand(iec_data.content) )
+		return;
+
+	// Tokens point into iec_data.content, nothing is copied
+	DosCommand dos;
+	if ( iec_data.content[0] == '$' )
+	{
+		// Directory filters apply while the listing is rendered
+		m_filter.parse(iec_data.content.substr(1));
+		dos.parse("$", 1);
+	}
+	else if ( !dos.parse(iec_data.content) )
+	{
+		setDeviceStatus(30);
+		return;
+	}
+
+	// Relative files are opened with "NAME,L,"+CHR$(record length)
+	bool relative = ( channel != CMD_CHANNEL && dos.type == 'L' );
+	uint8_t record_length = dos.record_length;
+
+	// "NAME,S,W" writes on any data channel
+	if ( channel != CMD_CHANNEL && dos.mode == 'W' )
+		channelSelect(iec_data).writing = true;
+
+	// LOAD"*" may be answered with the warp boot stub
+	bool autoload = ( channel == READ_CHANNEL && dos.argument.size && dos.argument.back() == '*' );
+
+	// 1. obtain command and path
+	auto commandAndPath = parseLine(dos, channel);
 
 	Debug_printv("command[%s]", commandAndPath.command.c_str());
 	if (mstr::startsWith(commandAndPath.command, "$"))
@@ -363,6 +447,24 @@ void devDrive::handleListenCommand(IEC::Data &iec_data)
 	{
 		m_openState = O_ML_STATUS;
 	}
+	else if (mstr::startsWith(commandAndPath.command, "@warp", false))
+	{
+		// "@WARP" toggles, "@WARP:ON" / "@WARP:OFF" set it
+		std::string arg = mstr::drop(commandAndPath.command, 5);
+		if ( arg.empty() )
+			m_device.warp(!m_device.warp());
+		else
+			m_device.warp(mstr::endsWith(arg, "on", false));
+		Debug_printv("warp[%d]", m_device.warp());
+	}
+#if defined(TRUE_DRIVE)
+	else if (mstr::equals(commandAndPath.command, (char*)"@1541", false))
+	{
+		// The bus belongs to the emulated drive until the next reset
+		if ( !Drive1541::start(m_iec, mountedImage(), m_device.id()) )
+			setDeviceStatus(74);
+	}
+#endif
 	else if (commandAndPath.command == "mfav") {
 		// create a urlfile named like the argument, containing current m_mfile path
 		// here we don't want the full path provided by commandAndPath, though
@@ -374,9 +476,14 @@ void devDrive::handleListenCommand(IEC::Data &iec_data)
 			favStream << m_mfile->url;
 		}
 		favStream.close();
+		m_listings.clear();
 	}
 	else if(!commandAndPath.rawPath.empty())
 	{
+		// Only the commands from here on need the full path
+		auto referencedPath = Meat::Wrap(m_mfile->cd(commandAndPath.rawPath));
+		Debug_printv("full referenced path [%s]", referencedPath->url.c_str());
+
 		// 2. fullPath.extension == "URL" - change dir or load file
 		if (mstr::equals(referencedPath->extension, (char*)"url", false))
 		{
@@ -400,7 +507,16 @@ void devDrive::handleListenCommand(IEC::Data &iec_data)
 			changeDir(referencedPath->url);
 		}
 		// 3. else - stream file
-		else if ( referencedPath->exists() )
+		else if ( relative )
+		{
+			// New relative files are created, existing ones keep their record length
+			prepareFileStream(referencedPath->url, record_length);
+		}
+		else if ( autoload && m_device.warp() && prepareWarp(referencedPath->url) )
+		{
+			Debug_printv("warp [%s] size[%d]", m_filename.c_str(), m_warp_size);
+		}
+		else if ( referencedPath->exists() || channelSelect(iec_data).writing )
 		{
 			// Set File
 			prepareFileStream(referencedPath->url);
@@ -426,9 +542,31 @@ void devDrive::handleTalk(byte chan)
 {
 	Debug_printv("channel[%d] openState[%d]", chan, m_openState);
 
+	// A TALK that ATN cut short continues where it stopped, unless
+	// something new was asked for since
+	auto &channel = channelSelect(m_iec_data);
+	if ( m_openState != O_NOTHING )
+	{
+		channel.resume.clear();
+		channel.resume_end = false;
+	}
+	else if ( channel.resume_end && channel.resume.size() )
+	{
+		Debug_printv("Resuming channel[%d] (%d bytes)", chan, channel.resume.size());
+		std::string rest = std::move(channel.resume);
+		channel.resume.clear();
+		channel.resume_end = false;
+		sendProgram(rest);
+		m_openState = O_NOTHING;
+		return;
+	}
+
 	switch (m_openState)
 	{
 		case O_NOTHING:
+			// Data channel opened earlier, continue where it stopped
+			if ( chan != CMD_CHANNEL && channelSelect(m_iec_data).isOpen() )
+				sendFile();
 			break;
 
 		case O_STATUS:
@@ -455,6 +593,12 @@ void devDrive::handleTalk(byte chan)
 			// Send virtual device status
 			sendMeatloafVirtualDeviceStatus();
 			break;
+
+		case O_WARP:
+			// Send boot stub
+			if ( !sendProgram(WarpLoader::bootStub()) )
+				m_warp.reset();
+			break;
 	}
 
 	m_openState = O_NOTHING;
@@ -464,24 +608,45 @@ void devDrive::handleTalk(byte chan)
 void devDrive::handleOpen(IEC::Data &iec_data)
 {
 	Debug_printv("OPEN Named Channel (%.2d Device) (%.2d Channel)", iec_data.device, iec_data.channel);
-	auto channel = channels[iec_data.command];
+
+	// Reopening a channel drops whatever it had open before
+	auto &channel = channelSelect(iec_data);
+	channel.close();
 
 	// Are we writing?  Appending?
-	channels[iec_data.command].url = iec_data.content;
-	channels[iec_data.command].cursor = 0;
-	channels[iec_data.command].writing = 0;
+	channel.url = iec_data.content;
+	channel.cursor = 0;
+	channel.writing = ( iec_data.channel == WRITE_CHANNEL );
 } // handleOpen
 
 
 void devDrive::handleClose(IEC::Data &iec_data)
 {
 	Debug_printv("CLOSE Named Channel (%.2d Device) (%.2d Channel)", iec_data.device, iec_data.channel);
-	auto channel = channels[iec_data.command];
 
 	// If writing update BAM & Directory
+	auto &channel = channelSelect(iec_data);
+	if ( channel.writing || channel.record_length )
+	{
+		m_listings.clear();
+		m_prefetch.clear();
+	}
+
+	// Commit what is left in the write ring before the stream goes away
+	if ( channel.writing && !channel.flush(true) )
+		setDeviceStatus(25);
 
-	// Remove channel from map
+	// Close stream and remove channel from map
+	channelClose(iec_data);
 
+	// The boot stub is running by now and asks for the program
+	if ( iec_data.channel == READ_CHANNEL && m_warp != nullptr )
+	{
+		WarpLoader loader(m_iec, m_warp.get(), m_warp_size);
+		FastLoadSession session = { m_filename, m_mfile.get(), mountedImage() };
+		runLoader(loader, session);
+		m_warp.reset();
+	}
 } // handleClose
 
 
@@ -493,6 +658,7 @@ void devDrive::sendMeatloafSystemInformation()
 
 	// Reset basic memory pointer:
 	uint16_t basicPtr = C64_BASIC_START;
+	std::string program;
 
 	// #if defined(USE_LITTLEFS)
 	// FSInfo64 fs_info;
@@ -501,66 +667,67 @@ void devDrive::sendMeatloafSystemInformation()
 	char floatBuffer[10]; // buffer
 	dtostrf(getFragmentation(), 3, 2, floatBuffer);
 
-	// Send load address
-	m_iec.send(C64_BASIC_START bitand 0xff);
-	m_iec.send((C64_BASIC_START >> 8) bitand 0xff);
-	Debug_println("");
+	// Load address
+	program += (char)(C64_BASIC_START bitand 0xff);
+	program += (char)((C64_BASIC_START >> 8) bitand 0xff);
 
-	// Send List HEADER
-	sendLine(basicPtr, 0, CBM_DEL_DEL CBM_REVERSE_ON " %s V%s ", PRODUCT_ID, FW_VERSION);
+	// List HEADER
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL CBM_REVERSE_ON " %s V%s ", PRODUCT_ID, FW_VERSION);
 
 	// CPU
-	sendLine(basicPtr, 0, CBM_DEL_DEL "SYSTEM ---");
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "SYSTEM ---");
 	String sdk = String(ESP.getSdkVersion());
 	sdk.toUpperCase();
-	sendLine(basicPtr, 0, CBM_DEL_DEL "SDK VER    : %s", sdk.c_str());
-	//sendLine(basicPtr, 0, "BOOT VER   : %08X", ESP.getBootVersion());
-	//sendLine(basicPtr, 0, "BOOT MODE  : %08X", ESP.getBootMode());
-	//sendLine(basicPtr, 0, "CHIP ID    : %08X", ESP.getChipId());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "CPU MHZ    : %d MHZ", ESP.getCpuFreqMHz());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "CYCLES     : %u", ESP.getCycleCount());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "SDK VER    : %s", sdk.c_str());
+	//renderLine(program, basicPtr, 0, "BOOT VER   : %08X", ESP.getBootVersion());
+	//renderLine(program, basicPtr, 0, "BOOT MODE  : %08X", ESP.getBootMode());
+	//renderLine(program, basicPtr, 0, "CHIP ID    : %08X", ESP.getChipId());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "CPU MHZ    : %d MHZ", ESP.getCpuFreqMHz());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "CYCLES     : %u", ESP.getCycleCount());
 
 	// POWER
-	sendLine(basicPtr, 0, CBM_DEL_DEL "POWER ---");
-	//sendLine(basicPtr, 0, "VOLTAGE    : %d.%d V", ( ESP.getVcc() / 1000 ), ( ESP.getVcc() % 1000 ));
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "POWER ---");
+	//renderLine(program, basicPtr, 0, "VOLTAGE    : %d.%d V", ( ESP.getVcc() / 1000 ), ( ESP.getVcc() % 1000 ));
 
 	// RAM
-	sendLine(basicPtr, 0, CBM_DEL_DEL "MEMORY ---");
-	sendLine(basicPtr, 0, CBM_DEL_DEL "RAM SIZE   : %5d B", getTotalMemory());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "RAM FREE   : %5d B", getTotalAvailableMemory());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "RAM >BLK   : %5d B", getLargestAvailableBlock());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "RAM FRAG   : %s %%", floatBuffer);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "MEMORY ---");
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "RAM SIZE   : %5d B", getTotalMemory());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "RAM FREE   : %5d B", getTotalAvailableMemory());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "RAM >BLK   : %5d B", getLargestAvailableBlock());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "RAM FRAG   : %s %%", floatBuffer);
 
 	// ROM
-	sendLine(basicPtr, 0, CBM_DEL_DEL "ROM SIZE   : %5d B", ESP.getSketchSize() + ESP.getFreeSketchSpace());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "ROM USED   : %5d B", ESP.getSketchSize());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "ROM FREE   : %5d B", ESP.getFreeSketchSpace());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "ROM SIZE   : %5d B", ESP.getSketchSize() + ESP.getFreeSketchSpace());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "ROM USED   : %5d B", ESP.getSketchSize());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "ROM FREE   : %5d B", ESP.getFreeSketchSpace());
 
 	// FLASH
-	sendLine(basicPtr, 0, CBM_DEL_DEL "STORAGE ---");
-	sendLine(basicPtr, 0, "FLASH SIZE : %5d B", ESP.getFlashChipRealSize());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "FLASH SPEED: %d MHZ", (ESP.getFlashChipSpeed() / 1000000));
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "STORAGE ---");
+	renderLine(program, basicPtr, 0, "FLASH SIZE : %5d B", ESP.getFlashChipRealSize());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "FLASH SPEED: %d MHZ", (ESP.getFlashChipSpeed() / 1000000));
 
 	// // FILE SYSTEM
-	// sendLine(basicPtr, 0, CBM_DEL_DEL "FILE SYSTEM ---");
-	// sendLine(basicPtr, 0, CBM_DEL_DEL "TYPE       : %s", FS_TYPE);
-	// sendLine(basicPtr, 0, CBM_DEL_DEL "SIZE       : %5d B", fs_info.totalBytes);
-	// sendLine(basicPtr, 0, CBM_DEL_DEL "USED       : %5d B", fs_info.usedBytes);
-	// sendLine(basicPtr, 0, CBM_DEL_DEL "FREE       : %5d B", fs_info.totalBytes - fs_info.usedBytes);
+	// renderLine(program, basicPtr, 0, CBM_DEL_DEL "FILE SYSTEM ---");
+	// renderLine(program, basicPtr, 0, CBM_DEL_DEL "TYPE       : %s", FS_TYPE);
+	// renderLine(program, basicPtr, 0, CBM_DEL_DEL "SIZE       : %5d B", fs_info.totalBytes);
+	// renderLine(program, basicPtr, 0, CBM_DEL_DEL "USED       : %5d B", fs_info.usedBytes);
+	// renderLine(program, basicPtr, 0, CBM_DEL_DEL "FREE       : %5d B", fs_info.totalBytes - fs_info.usedBytes);
 
 	// NETWORK
-	sendLine(basicPtr, 0, CBM_DEL_DEL "NETWORK ---");
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "NETWORK ---");
 	char ip[16];
 	sprintf(ip, "%s", ipToString(WiFi.softAPIP()).c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "AP MAC     : %s", WiFi.softAPmacAddress().c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "AP IP      : %s", ip);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "AP MAC     : %s", WiFi.softAPmacAddress().c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "AP IP      : %s", ip);
 	sprintf(ip, "%s", ipToString(WiFi.localIP()).c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "STA MAC    : %s", WiFi.macAddress().c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "STA IP     : %s", ip);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "STA MAC    : %s", WiFi.macAddress().c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "STA IP     : %s", ip);
 
 	// End program with two zeros after last line. Last zero goes out as EOI.
-	m_iec.send(0);
-	m_iec.sendEOI(0);
+	program += '\0';
+	program += '\0';
+
+	sendProgram(program);
 
 	ledON();
 } // sendMeatloafSystemInformation
@@ -571,53 +738,76 @@ void devDrive::sendMeatloafVirtualDeviceStatus()
 
 	// Reset basic memory pointer:
 	uint16_t basicPtr = C64_BASIC_START;
+	std::string program;
 
-	// Send load address
-	m_iec.send(C64_BASIC_START bitand 0xff);
-	m_iec.send((C64_BASIC_START >> 8) bitand 0xff);
-	Debug_println("");
+	// Load address
+	program += (char)(C64_BASIC_START bitand 0xff);
+	program += (char)((C64_BASIC_START >> 8) bitand 0xff);
 
-	// Send List HEADER
-	sendLine(basicPtr, 0, CBM_DEL_DEL CBM_REVERSE_ON " %s V%s ", PRODUCT_ID, FW_VERSION);
+	// List HEADER
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL CBM_REVERSE_ON " %s V%s ", PRODUCT_ID, FW_VERSION);
 
 	// Current Config
-	sendLine(basicPtr, 0, CBM_DEL_DEL "DEVICE ID : %d", m_device.id());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "MEDIA     : %d", m_device.media());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "PARTITION : %d", m_device.partition());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "URL       : %s", m_device.url().c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "PATH      : %s", m_device.path().c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "ARCHIVE   : %s", m_device.archive().c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "IMAGE     : %s", m_device.image().c_str());
-	sendLine(basicPtr, 0, CBM_DEL_DEL "FILENAME  : %s", m_mfile->name.c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "DEVICE ID : %d", m_device.id());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "MEDIA     : %d", m_device.media());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "PARTITION : %d", m_device.partition());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "URL       : %s", m_device.url().c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "PATH      : %s", m_device.path().c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "ARCHIVE   : %s", m_device.archive().c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "IMAGE     : %s", m_device.image().c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "FILENAME  : %s", m_mfile->name.c_str());
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "PREFETCH  : %d HITS %d MISSES", m_prefetch.hits, m_prefetch.misses);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "LEARNED   : %d HITS", m_prefetch.learned_hits);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "HTTP CACHE: %d HITS %d MISSES", HttpCache::hits, HttpCache::misses);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "TLS       : %d HANDSHAKES %dMS %d BYTES", HttpsPool::handshakes, HttpsPool::handshake_ms, HttpsPool::heap);
+	renderLine(program, basicPtr, 0, CBM_DEL_DEL "READAHEAD : %d READS %d UNDERRUNS %d LOW", ReadAheadIStream::reads, ReadAheadIStream::underruns, ReadAheadIStream::lowest);
 
 	// End program with two zeros after last line. Last zero goes out as EOI.
-	m_iec.send(0);
-	m_iec.sendEOI(0);
+	program += '\0';
+	program += '\0';
+
+	sendProgram(program);
 
 	ledON();
 } // sendMeatloafVirtualDeviceStatus
 
 
+// Send a whole BASIC program or message in one go, the last byte goes out with EOI.
+// When ATN ends the TALK early the rest is kept for the next one.
+bool devDrive::sendProgram(const std::string &program)
+{
+	size_t len = program.size();
+	size_t sent = m_iec.send((const uint8_t *)program.data(), len, true);
+
+	if ( sent < len && ( m_iec.state() bitand ATN_PULLED ) )
+	{
+		auto &channel = channelSelect(m_iec_data);
+		channel.resume.assign(program, sent, std::string::npos);
+		channel.resume_end = true;
+		Debug_printv("ATN abort channel[%d] at [%d]", m_iec_data.channel, sent);
+	}
+
+	Debug_printf("=================================\r\n%d of %d bytes sent\r\n", sent, len);
+	return (sent == len);
+} // sendProgram
 
-// send single basic line, including heading basic pointer and terminating zero.
-uint16_t devDrive::sendLine(uint16_t &basicPtr, uint16_t blocks, const char *format, ...)
+
+// render single basic line, including heading basic pointer and terminating zero.
+uint16_t devDrive::renderLine(std::string &program, uint16_t &basicPtr, uint16_t blocks, const char *format, ...)
 {
 	// Format our string
+	char text[BASIC_LINE_MAX + 1];
 	va_list args;
 	va_start(args, format);
-	char text[vsnprintf(NULL, 0, format, args) + 1];
 	vsnprintf(text, sizeof text, format, args);
 	va_end(args);
 
-	return sendLine(basicPtr, blocks, text);
+	return renderLine(program, basicPtr, blocks, text);
 }
 
-uint16_t devDrive::sendLine(uint16_t &basicPtr, uint16_t blocks, char *text)
+uint16_t devDrive::renderLine(std::string &program, uint16_t &basicPtr, uint16_t blocks, char *text)
 {
-	byte i;
-	uint16_t b_cnt = 0;
-
-	Debug_printf("%d %s ", blocks, text);
+	Debug_printf("%d %s\r\n", blocks, text);
 
 	// Get text length
 	uint8_t len = strlen(text);
@@ -625,45 +815,24 @@ uint16_t devDrive::sendLine(uint16_t &basicPtr, uint16_t blocks, char *text)
 	// Increment next line pointer
 	basicPtr += len + 5;
 
-	// Send that pointer
-	m_iec.send(basicPtr bitand 0xFF);
-	m_iec.send(basicPtr >> 8);
+	// Add that pointer
+	program += (char)(basicPtr bitand 0xFF);
+	program += (char)(basicPtr >> 8);
 
-	// Send blocks
-	m_iec.send(blocks bitand 0xFF);
-	m_iec.send(blocks >> 8);
+	// Add blocks
+	program += (char)(blocks bitand 0xFF);
+	program += (char)(blocks >> 8);
 
-	// Send line contents
-	for (i = 0; i < len; i++)
-		m_iec.send(text[i]);
+	// Add line contents
+	program.append(text, len);
 
 	// Finish line
-	m_iec.send(0);
-
-	Debug_println("");
-
-	b_cnt += (len + 5);
-
-	return b_cnt;
-} // sendLine
-
-// uint16_t devDrive::sendHeader(uint16_t &basicPtr, const char *format, ...)
-// {
-// 	Debug_printv("formatting header");
+	program += '\0';
 
-// 	// Format our string
-// 	va_list args;
-// 	va_start(args, format);
-// 	char text[vsnprintf(NULL, 0, format, args) + 1];
-// 	vsnprintf(text, sizeof text, format, args);
-// 	va_end(args);
+	return (len + 5);
+} // renderLine
 
-// 	Debug_printv("header[%s]", text);
-
-// 	return sendHeader(basicPtr, std::string(text));
-// }
-
-uint16_t devDrive::sendHeader(uint16_t &basicPtr, std::string header, std::string id)
+uint16_t devDrive::renderHeader(std::string &program, uint16_t &basicPtr, std::string header, std::string id)
 {
 	uint16_t byte_count = 0;
 	bool sent_info = false;
@@ -681,45 +850,45 @@ uint16_t devDrive::sendHeader(uint16_t &basicPtr, std::string header, std::strin
 
 
 
-	// Send List HEADER
+	// List HEADER
 	uint8_t space_cnt = 0;
 	space_cnt = (16 - header.size()) / 2;
 	space_cnt = (space_cnt > 8 ) ? 0 : space_cnt;
 
 	//Debug_printv("header[%s] id[%s] space_cnt[%d]", header.c_str(), id.c_str(), space_cnt);
 
-	byte_count += sendLine(basicPtr, 0, CBM_REVERSE_ON "\"%*s%s%*s\" %s", space_cnt, "", header.c_str(), space_cnt, "", id.c_str());
+	byte_count += renderLine(program, basicPtr, 0, CBM_REVERSE_ON "\"%*s%s%*s\" %s", space_cnt, "", header.c_str(), space_cnt, "", id.c_str());
 
-	//byte_count += sendLine(basicPtr, 0, "\x12\"%*s%s%*s\" %.02d 2A", space_cnt, "", PRODUCT_ID, space_cnt, "", m_device.device());
-	//byte_count += sendLine(basicPtr, 0, CBM_REVERSE_ON "%s", header.c_str());
+	//byte_count += renderLine(program, basicPtr, 0, "\x12\"%*s%s%*s\" %.02d 2A", space_cnt, "", PRODUCT_ID, space_cnt, "", m_device.device());
+	//byte_count += renderLine(program, basicPtr, 0, CBM_REVERSE_ON "%s", header.c_str());
 
-	// Send Extra INFO
+	// Extra INFO
 	if (url.size())
 	{
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[URL]");
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, url.c_str());
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[URL]");
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, url.c_str());
 		sent_info = true;
 	}
 	if (path.size() > 1)
 	{
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[PATH]");
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, path.c_str());
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[PATH]");
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, path.c_str());
 		sent_info = true;
 	}
 	if (archive.size() > 1)
 	{
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[ARCHIVE]");
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, m_device.archive().c_str());
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[ARCHIVE]");
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, m_device.archive().c_str());
 	}
 	if (image.size())
 	{
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[IMAGE]");
-		byte_count += sendLine(basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, image.c_str());
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, "[IMAGE]");
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"%-*s\" NFO", 0, "", 19, image.c_str());
 		sent_info = true;
 	}
 	if (sent_info)
 	{
-		byte_count += sendLine(basicPtr, 0, "%*s\"-------------------\" NFO", 0, "");
+		byte_count += renderLine(program, basicPtr, 0, "%*s\"-------------------\" NFO", 0, "");
 	}
 
 	return byte_count;
@@ -729,59 +898,78 @@ void devDrive::sendListing()
 {
 	Debug_printf("sendListing: [%s]\r\n=================================\r\n", m_mfile->url.c_str());
 
+	// The image or folder itself tells us if it changed since we rendered it
+	time_t stamp = ( m_mfile->streamFile != nullptr ) ? m_mfile->streamFile->getLastWrite() : 0;
+
+	std::string key = m_mfile->url + "$" + m_filter.spec;
+	auto cached = m_listings.get(key, stamp);
+	if ( cached != nullptr )
+	{
+		Debug_printv("Listing from cache [%s] (%d bytes)", m_mfile->url.c_str(), cached->size());
+		sendProgram(*cached);
+		ledON();
+		return;
+	}
+
+	std::string program;
+	if ( !renderListing(program) )
+	{
+		sendFileNotFound();
+		return;
+	}
+
+	sendProgram(program);
+	m_listings.put(key, stamp, std::move(program));
+
+	ledON();
+} // sendListing
+
+bool devDrive::renderListing(std::string &program)
+{
 	uint16_t byte_count = 0;
 	std::string extension = "dir";
 
+	// Let backends that can filter on the server do it, with the pattern in
+	// ASCII like the names they hold
+	m_mfile->dir_pattern = ( m_filter.patterns.size() == 1 ) ? m_filter.patterns[0] : "";
+	mstr::toASCII(m_mfile->dir_pattern);
+	m_mfile->dir_types = m_filter.types;
+
 	std::unique_ptr<MFile> entry(m_mfile->getNextFileInDir());
 
 	if(entry == nullptr) {
-		sendFileNotFound();
-		return;
+		return false;
 	}
 
 	// Reset basic memory pointer:
 	uint16_t basicPtr = C64_BASIC_START;
+	program.reserve(LISTING_RESERVE);
 
-	// Send load address
-	m_iec.send(C64_BASIC_START bitand 0xff);
-	m_iec.send((C64_BASIC_START >> 8) bitand 0xff);
+	// Load address
+	program += (char)(C64_BASIC_START bitand 0xff);
+	program += (char)((C64_BASIC_START >> 8) bitand 0xff);
 	byte_count += 2;
-	Debug_println("");
 
-	// Send Listing Header
+	// Listing Header
 	if (m_mfile->media_header.size() == 0)
 	{
 		// Set device default Listing Header
 		char buf[7] = { '\0' };
 		sprintf(buf, "%.02d 2A", m_device.id());
-		byte_count += sendHeader(basicPtr, PRODUCT_ID, buf);
+		byte_count += renderHeader(program, basicPtr, PRODUCT_ID, buf);
 	}
 	else
 	{
-		byte_count += sendHeader(basicPtr, m_mfile->media_header.c_str(), m_mfile->media_id.c_str());
+		byte_count += renderHeader(program, basicPtr, m_mfile->media_header.c_str(), m_mfile->media_id.c_str());
 	}
 
-	// Send Directory Items
+	// Directory Items
 	while(entry != nullptr)
 	{
-		uint16_t block_cnt = entry->size() / m_mfile->media_block_size;
-		byte block_spc = 3;
-		if (block_cnt > 9)
-			block_spc--;
-		if (block_cnt > 99)
-			block_spc--;
-		if (block_cnt > 999)
-			block_spc--;
-
-		byte space_cnt = 21 - (entry->name.length() + 5);
-		if (space_cnt > 21)
-			space_cnt = 0;
+		std::string name = entry->petsciiName();
 
 		if (!entry->isDirectory())
 		{
-			// if ( block_cnt < 1)
-			// 	block_cnt = 1;
-
 			// Get extension
 			if (entry->extension.length())
 			{
@@ -798,14 +986,33 @@ void devDrive::sendListing()
 		}
 
 		// Don't show hidden folders or files
-		//Debug_printv("size[%d] name[%s]", entry->size(), entry->name.c_str());
+		bool show = (entry->name[0]!='.' || m_show_hidden);
+		show = show && m_filter.matchName(name) && m_filter.matchType(extension);
 
-		std::string name = entry->petsciiName();
-		mstr::toPETSCII(extension);
+		uint16_t block_cnt = 0;
+		if (show)
+		{
+			block_cnt = entry->size() / m_mfile->media_block_size;
+			show = m_filter.matchSize(block_cnt) && m_filter.matchDate(entry.get());
+		}
 
-		if (entry->name[0]!='.' || m_show_hidden)
+		if (show)
 		{
-			byte_count += sendLine(basicPtr, block_cnt, "%*s\"%s\"%*s %s", block_spc, "", name.c_str(), space_cnt, "", extension.c_str());
+			byte block_spc = 3;
+			if (block_cnt > 9)
+				block_spc--;
+			if (block_cnt > 99)
+				block_spc--;
+			if (block_cnt > 999)
+				block_spc--;
+
+			byte space_cnt = 21 - (entry->name.length() + 5);
+			if (space_cnt > 21)
+				space_cnt = 0;
+
+			//Debug_printv("size[%d] name[%s]", entry->size(), entry->name.c_str());
+			mstr::toPETSCII(extension);
+			byte_count += renderLine(program, basicPtr, block_cnt, "%*s\"%s\"%*s %s", block_spc, "", name.c_str(), space_cnt, "", extension.c_str());
 		}
 
 		entry.reset(m_mfile->getNextFileInDir());
@@ -813,31 +1020,30 @@ void devDrive::sendListing()
 		ledToggle(true);
 	}
 
-	// Send Listing Footer
-	byte_count += sendFooter(basicPtr, m_mfile->media_blocks_free, m_mfile->media_block_size);
+	// Listing Footer
+	byte_count += renderFooter(program, basicPtr, m_mfile->media_blocks_free, m_mfile->media_block_size);
 
 	// End program with two zeros after last line. Last zero goes out as EOI.
-	m_iec.send(0);
-	m_iec.sendEOI(0);
+	program += '\0';
+	program += '\0';
 
-	Debug_printf("=================================\r\n%d bytes sent\r\n", byte_count);
-
-	ledON();
-} // sendListing
+	Debug_printf("=================================\r\n%d bytes rendered\r\n", byte_count);
+	return true;
+} // renderListing
 
 
-uint16_t devDrive::sendFooter(uint16_t &basicPtr, uint16_t blocks_free, uint16_t block_size)
+uint16_t devDrive::renderFooter(std::string &program, uint16_t &basicPtr, uint16_t blocks_free, uint16_t block_size)
 {
-	// Send List FOOTER
+	// List FOOTER
 	// #if defined(USE_LITTLEFS)
 	uint64_t byte_count = 0;
 	if (block_size > 256)
 	{
-		byte_count = sendLine(basicPtr, blocks_free, "BLOCKS FREE. (*%d bytes)", block_size);
+		byte_count = renderLine(program, basicPtr, blocks_free, "BLOCKS FREE. (*%d bytes)", block_size);
 	}
 	else
 	{
-		byte_count = sendLine(basicPtr, blocks_free, "BLOCKS FREE.");
+		byte_count = renderLine(program, basicPtr, blocks_free, "BLOCKS FREE.");
 	}
 
 	// if (m_device.url().length() == 0)
@@ -849,18 +1055,196 @@ uint16_t devDrive::sendFooter(uint16_t &basicPtr, uint16_t blocks_free, uint16_t
 
 	return byte_count;
 	// #elif defined(USE_SPIFFS)
-	// 	return sendLine(basicPtr, 00, "UNKNOWN BLOCKS FREE.");
+	// 	return renderLine(program, basicPtr, 00, "UNKNOWN BLOCKS FREE.");
 	// #endif
 	//Debug_println("");
 }
 
 
+/********************************************************
+ * Listing filter
+ ********************************************************/
+
+void ListingFilter::parse(std::string filter)
+{
+	spec = filter;
+	patterns.clear();
+	types.clear();
+	min_blocks = 0;
+	max_blocks = 0xFFFF;
+	after = 0;
+	before = 0;
+
+	std::string options;
+	size_t equals = filter.find('=');
+	if ( equals != std::string::npos )
+	{
+		options = filter.substr(equals + 1);
+		filter = filter.substr(0, equals);
+	}
+	// Patterns follow the colon, a drive number before it is ignored
+	size_t colon = filter.find(':');
+	if ( colon != std::string::npos )
+	{
+		for ( auto &pattern : mstr::split(filter.substr(colon + 1), ',') )
+		{
+			if ( pattern.size() )
+				patterns.push_back(pattern);
+		}
+	}
+
+	for ( size_t i = 0; i < options.size(); i++ )
+	{
+		char c = options[i];
+		if ( c == '>' || c == '<' )
+		{
+			size_t end = options.find_first_not_of("0123456789", i + 1);
+			uint16_t blocks = atoi(options.substr(i + 1, end - i - 1).c_str());
+			if ( c == '>' )
+				min_blocks = blocks + 1;
+			else
+				max_blocks = ( blocks ) ? blocks - 1 : 0;
+			i = ( end == std::string::npos ) ? options.size() : end - 1;
+		}
+		else if ( c == 'T' && i + 1 < options.size() )
+		{
+			// T>MM/DD/YY or T<MM/DD/YY
+			char direction = options[++i];
+			std::string date = options.substr(i + 1, 8);
+			if ( direction == '>' )
+				after = parseDate(date);
+			else
+				before = parseDate(date);
+			i += date.size();
+		}
+		else if ( c != '\0' && strchr("PSURCD", c) )
+		{
+			types += c;
+		}
+	}
+
+	Debug_printv("spec[%s] patterns[%d] types[%s] blocks[%d-%d] after[%d] before[%d]", spec.c_str(), patterns.size(), types.c_str(), min_blocks, max_blocks, after, before);
+}
+
+time_t ListingFilter::parseDate(std::string date)
+{
+	tm t = { 0 };
+	int month = 0, day = 0, year = 0;
+	if ( sscanf(date.c_str(), "%d/%d/%d", &month, &day, &year) != 3 )
+		return 0;
+
+	t.tm_year = ( year < 70 ) ? year + 100 : year;
+	t.tm_mon = month - 1;
+	t.tm_mday = day;
+	return mktime(&t);
+}
+
+bool ListingFilter::matchName(const std::string &name)
+{
+	if ( patterns.empty() )
+		return true;
+
+	for ( auto &pattern : patterns )
+	{
+		if ( util_wildcard_match(name.c_str(), pattern.c_str()) )
+			return true;
+	}
+	return false;
+}
+
+bool ListingFilter::matchType(const std::string &extension)
+{
+	if ( types.empty() )
+		return true;
+
+	// Anything that isn't a CBM file type lists as a program
+	char type = 'P';
+	std::string ext = extension.substr(0, 3);
+	mstr::toLower(ext);
+	if ( ext == "seq" ) type = 'S';
+	else if ( ext == "usr" ) type = 'U';
+	else if ( ext == "rel" ) type = 'R';
+	else if ( ext == "cbm" ) type = 'C';
+	else if ( ext == "dir" || ext == "del" ) type = 'D';
+
+	return types.find(type) != std::string::npos;
+}
+
+bool ListingFilter::matchSize(uint16_t blocks)
+{
+	return ( blocks >= min_blocks && blocks <= max_blocks );
+}
+
+bool ListingFilter::matchDate(MFile *entry)
+{
+	if ( !after && !before )
+		return true;
+
+	// Entries without a date never match a date filter
+	time_t stamp = entry->getLastWrite();
+	if ( !stamp )
+		return false;
+
+	return ( !after || stamp > after ) && ( !before || stamp < before );
+}
+
+
+/********************************************************
+ * Listing cache
+ ********************************************************/
+
+const std::string *ListingCache::get(const std::string &url, time_t stamp)
+{
+	for ( auto it = m_listings.begin(); it != m_listings.end(); it++ )
+	{
+		if ( it->url != url )
+			continue;
+
+		// Without a stamp we can't tell if it changed, so it only lives a while
+		if ( it->stamp != stamp || ( stamp == 0 && millis() - it->rendered > LISTING_CACHE_TTL ) )
+		{
+			m_size -= it->program.size();
+			m_listings.erase(it);
+			return nullptr;
+		}
+
+		// Move to front, it is the most recently used now
+		m_listings.splice(m_listings.begin(), m_listings, it);
+		return &m_listings.front().program;
+	}
+
+	return nullptr;
+}
+
+void ListingCache::put(const std::string &url, time_t stamp, std::string program)
+{
+	if ( program.size() > LISTING_CACHE_SIZE )
+		return;
+
+	// Make room by dropping the least recently used listings
+	while ( m_listings.size() && m_size + program.size() > LISTING_CACHE_SIZE )
+	{
+		m_size -= m_listings.back().program.size();
+		m_listings.pop_back();
+	}
+
+	m_size += program.size();
+	m_listings.push_front( { url, stamp, (uint32_t)millis(), std::move(program) } );
+}
+
+void ListingCache::clear(void)
+{
+	m_listings.clear();
+	m_size = 0;
+}
+
+
 void devDrive::sendFile()
 {
 	size_t i = 0;
 	bool success = true;
 
-	uint8_t b;
+	int16_t b;
 	uint16_t bi = 0;
 	uint16_t load_address = 0;
 	uint16_t sys_address = 0;
@@ -873,19 +1257,29 @@ void devDrive::sendFile()
 	// Update device database
 	m_device.save();
 
-	std::unique_ptr<MFile> file(MFSOwner::File(m_filename));
+	auto &channel = channelSelect(m_iec_data);
 
-	if(!file->exists())
+	if ( channel.block )
+	{
+		sendBlock(channel);
+		return;
+	}
+
+	if( !channel.isOpen() || channel.writing )
 	{
 		Debug_printv("File Not Found!");
 		sendFileNotFound();
 		return;
 	}
-	Debug_printv("Sending File [%s]", file->name.c_str());
-
 
-	// TODO!!!! you should check istream for nullptr here and return error immediately if null
+	if ( channel.record_length )
+	{
+		sendRecord(channel);
+		return;
+	}
 
+	std::unique_ptr<MFile> file(MFSOwner::File(channel.url));
+	Debug_printv("Sending File [%s] channel[%d] cursor[%d]", file->name.c_str(), m_iec_data.channel, channel.cursor);
 
 	if
 	(
@@ -897,127 +1291,161 @@ void devDrive::sendFile()
 		// convert UTF8 files on the fly
 
 		Debug_printv("Sending a text file to C64 [%s]", file->url.c_str());
-        //std::unique_ptr<LinedReader> reader(new LinedReader(istream.get()));
-		auto istream = Meat::ifstream(file.get());
-		auto ostream = oiecstream();
-
-		istream.open();
-		ostream.open(&m_iec);
+		// Whole buffers through the lookup table. Transcoded bytes wait in
+		// channel.resume, one is held back for the EOI and whatever ATN
+		// stops goes out first on the next TALK.
+		uint8_t in[TEXT_CHUNK + 3];
+		uint8_t out[TEXT_CHUNK + 3];
+		bool sent_any = false;
+
+		while ( success )
+		{
+			if ( !channel.resume_end && channel.resume.size() < 2 )
+			{
+				size_t carry = channel.utf8_tail.size();
+				memcpy(in, channel.utf8_tail.data(), carry);
+				size_t count = channel.istream->read(in + carry, TEXT_CHUNK);
+				size_t len = carry + count;
+				size_t start = 0;
+
+				// Skip the BOM, EF BB BF for UTF8
+				if ( channel.cursor == 0 && len >= 3 && in[0] == 0xEF && in[1] == 0xBB && in[2] == 0xBF )
+					start = 3;
+				channel.cursor += count;
+
+				size_t consumed;
+				size_t n = U8Char::toPetscii(in + start, len - start, out, consumed);
+				consumed += start;
+
+				// Nothing more will complete a cut off sequence
+				if ( count == 0 && consumed < len )
+				{
+					out[n++] = '?';
+					consumed = len;
+				}
 
-		if(!istream.is_open()) {
-			sendFileNotFound();
-			return;
-		}
+				channel.utf8_tail.assign((const char *)in + consumed, len - consumed);
+				channel.resume.append((const char *)out, n);
+				channel.resume_end = ( count == 0 );
+			}
 
-		//we can skip the BOM here, EF BB BF for UTF8
-		auto b = (char)istream.get();
-		if(b != 0xef)
-			ostream.put(b);
-		else {
-			b = istream.get();
-			if(b != 0xbb)
-				ostream.put(b);
-			else {
-				b = istream.get();
-				if(b != 0xbf)
-					ostream.put(b); // not BOM
+			size_t len = channel.resume.size();
+			size_t ready = ( channel.resume_end || len == 0 ) ? len : len - 1;
+			if ( ready == 0 )
+			{
+				if ( channel.resume_end )
+					break;
+				continue;
 			}
+
+			size_t sent = m_iec.send((const uint8_t *)channel.resume.data(), ready, channel.resume_end);
+			channel.resume.erase(0, sent);
+			sent_any = sent_any || sent;
+			success = ( sent == ready );
+
+			if ( channel.resume_end && channel.resume.empty() )
+				break;
 		}
 
-		while(!istream.eof()) {
-			auto cp = istream.getUtf8();
+		// Nothing left to read on this channel
+		if ( success && !sent_any )
+			m_iec.sendFNF();
 
-			ostream.putUtf8(&cp);
+		if ( !success && ( m_iec.state() bitand ATN_PULLED ) )
+		{
+			Debug_printv("ATN abort channel[%d], %d bytes kept", m_iec_data.channel, channel.resume.size());
+			return;
+		}
 
-			if(ostream.bad() || istream.bad()) {
-				Debug_printv("Error sending");
-                setDeviceStatus(60); // write error
-				break;
-            }
+		if ( !success )
+		{
+			Debug_printv("Error sending");
+			setDeviceStatus(60); // write error
 		}
-		ostream.close();
-		istream.close();
 	}
 	else
 	{
-		std::unique_ptr<MIStream> istream(file->inputStream());
+		size_t len = channel.cursor + channel.istream->available();
 
-		if( istream == nullptr )
+		if ( channel.peek() < 0 )
 		{
-			sendFileNotFound();
+			// Nothing left to read on this channel
+			Debug_printv("EOF on channel[%d]", m_iec_data.channel);
+			m_iec.sendFNF();
 			return;
 		}
 
-		// Position file pointer
-		//istream->seek(m_device.position(m_iec_data.channel));
-
-
-		size_t len = istream->size();
-		size_t avail = istream->available();
-
 		// Get file load address
-		i = 2;
-		istream->read(&b, 1);
-		success = m_iec.send(b);
-		load_address = b & 0x00FF; // low byte
-		sys_address = b;
-		istream->read(&b, 1);
-		success = m_iec.send(b);
-		load_address = load_address | b << 8;  // high byte
-		sys_address += b * 256;
-
-		Debug_printv("len[%d] avail[%d] success[%d]", len, avail, success);
+		if ( channel.cursor == 0 )
+		{
+			b = channel.peek();
+			success = m_iec.send(b);
+			if ( success ) channel.next();
+			load_address = b & 0x00FF; // low byte
+			sys_address = b;
+
+			b = channel.peek();
+			if ( success && b >= 0 )
+			{
+				success = m_iec.send(b);
+				if ( success ) channel.next();
+				load_address = load_address | b << 8;  // high byte
+				sys_address += b * 256;
+			}
+		}
+		i = channel.cursor;
+
+		Debug_printv("len[%d] cursor[%d] success[%d]", len, channel.cursor, success);
 
 		Debug_printf("sendFile: [%s] [$%.4X] (%d bytes)\r\n=================================\r\n", file->url.c_str(), load_address, len);
-		while( i < len && success )
+		while( success && (b = channel.peek()) >= 0 )
 		{
-			success = istream->read(&b, 1);
-			// Debug_printv("b[%02X] success[%d]", b, success);
-			if (success)
-			{
+			bool last = channel.isLast();
+
 #ifdef DATA_STREAM
-				if (bi == 0)
-				{
-					Debug_printf(":%.4X ", load_address);
-					load_address += 8;
-				}
+			if (bi == 0)
+			{
+				Debug_printf(":%.4X ", load_address);
+				load_address += 8;
+			}
 #endif
-				if ( ++i == len )
-				{
-					success = m_iec.sendEOI(b); // indicate end of file.
-				}
-				else
-				{
-					success = m_iec.send(b);
-				}
+			if ( last )
+			{
+				success = m_iec.sendEOI(b); // indicate end of file.
+			}
+			else
+			{
+				success = m_iec.send(b);
+			}
+
+			// A byte that didn't go out stays in the read-ahead for the next TALK
+			if ( !success )
+			{
+				if ( m_iec.state() bitand ATN_PULLED )
+					Debug_printv("ATN abort channel[%d] resumes at [%d]", m_iec_data.channel, channel.cursor);
+				break;
+			}
+
+			channel.next();
+			i = channel.cursor;
 
 #ifdef DATA_STREAM
-				// Show ASCII Data
-				if (b < 32 || b >= 127)
+			// Show ASCII Data
+			if (b < 32 || b >= 127)
 				b = 46;
 
-				ba[bi++] = b;
+			ba[bi++] = b;
 
-				if(bi == 8)
-				{
-					size_t t = (i * 100) / len;
-					Debug_printf(" %s (%d %d%%) [%d]\r\n", ba, i, t, avail - 1);
-					bi = 0;
-				}
+			if(bi == 8)
+			{
+				size_t t = (len) ? (i * 100) / len : 0;
+				Debug_printf(" %s (%d %d%%)\r\n", ba, i, t);
+				bi = 0;
+			}
 #else
-				size_t t = (i * 100) / len;
-				Debug_printf("Transferring %d%% [%d, %d]      \r", t, i, avail -1);
+			size_t t = (len) ? (i * 100) / len : 0;
+			Debug_printf("Transferring %d%% [%d, %d]      \r", t, i, len);
 #endif
-			}
-
-			// // Exit if ATN is PULLED while sending
-			// if ( m_iec.state() bitand atnFlag )
-			// {
-			// 	// TODO: If sending from a named channel save file pointer position
-			// 	setDeviceStatus(74);
-			// 	success = true;
-			// 	break;
-			// }
 
 			// Toggle LED
 			if (i % 50 == 0)
@@ -1025,10 +1453,9 @@ void devDrive::sendFile()
 				ledToggle(true);
 			}
 
-			avail = istream->available();
-			//i++;
+			if ( last )
+				break;
 		}
-		istream->close();
 		Debug_printf("=================================\r\n%d of %d bytes sent [SYS%d]\r\n", i, len, sys_address);
 
 		//Debug_printv("len[%d] avail[%d] success[%d]", len, avail, success);		
@@ -1037,7 +1464,7 @@ void devDrive::sendFile()
 
 	ledON();
 
-	if (!success)
+	if (!success && !(m_iec.state() bitand ATN_PULLED))
 	{
 		Debug_println("sendFile: Transfer aborted!");
 		// TODO: Send something to signal that there was an error to the C64
@@ -1048,101 +1475,463 @@ void devDrive::sendFile()
 
 void devDrive::saveFile()
 {
-	uint16_t i = 0;
+	size_t i = 0;
 	bool done = false;
-
-	uint16_t bi = 0;
 	uint16_t load_address = 0;
-	size_t b_len = 1;
-	uint8_t b[b_len];
-	uint8_t ll[b_len];
-	uint8_t lh[b_len];
-
-#ifdef DATA_STREAM
-	char ba[9];
-	ba[8] = '\0';
-#endif
 
-	mstr::toASCII(m_filename);
-	std::unique_ptr<MFile> file(MFSOwner::File(m_filename));
-	Debug_printv("[%s]", file->url.c_str());
+	auto &channel = channelSelect(m_iec_data);
+	Debug_printv("[%s]", channel.url.c_str());
 
-	std::unique_ptr<MOStream> ostream(file->outputStream());
+	if ( channel.block )
+	{
+		saveBlock(channel);
+		return;
+	}
 
+	if ( channel.record_length && channel.isOpen() )
+	{
+		saveRecord(channel);
+		return;
+	}
 
-    if(!ostream->isOpen()) {
+    if(!channel.isOpen() || !channel.writing) {
         Debug_printv("couldn't open a stream for writing");
 		// TODO: Set status and sendFNF
 		sendFileNotFound();
         return;
     }
-    else
-	{
-	 	// Stream is open!  Let's save this!
 
-		// Get file load address
-		ll[0] = m_iec.receive();
-		load_address = *ll & 0x00FF; // low byte
-		lh[0] = m_iec.receive();
-		load_address = load_address | *lh << 8;  // high byte
-
-		Debug_printf("saveFile: [%s] [$%.4X]\r\n=================================\r\n", file->url.c_str(), load_address);
+	// Bytes go into the channel's ring at bus speed. Whole chunks are written
+	// out by a task on ESP32, elsewhere once the ring is half full, so the bus
+	// only waits for the flash when the ring is full.
+	Debug_printf("saveFile: [%s]\r\n=================================\r\n", channel.url.c_str());
+	bool behind = channel.flushBehind(true);
+	do
+	{
+		int16_t b = m_iec.receive();
+		uint8_t f = m_iec.state();
+		if ( f bitand ERROR )
+			break;
 
-		// Recieve bytes until a EOI is detected
-		do
+		if ( !channel.put(b) )
 		{
-			// Save Load Address
-			if (i == 0)
+			// Ring is full, the flash has to catch up
+			if ( behind )
 			{
-				Debug_print("[");
-				ostream->write(ll, b_len);
-				ostream->write(lh, b_len);
-				i += 2;
-				Debug_println("]");
+				while ( !channel.put(b) && !channel.failed() )
+					delay(1);
 			}
-
-#ifdef DATA_STREAM
-			if (bi == 0)
+			else if ( channel.flush() )
 			{
-				Debug_printf(":%.4X ", load_address);
-				load_address += 8;
+				channel.put(b);
 			}
-#endif
+			if ( channel.failed() )
+				break;
+		}
+		else if ( !behind && channel.pending() >= CHANNEL_WRITE_SIZE / 2 )
+		{
+			channel.flush();
+			ledToggle(true);
+		}
 
-			b[0] = m_iec.receive();
-			ostream->write(b, b_len);
-			i++;
+		// Load address
+		if ( i < 2 )
+			load_address |= (b bitand 0xFF) << (i * 8);
 
-			uint8_t f = m_iec.state();
-			done = (f bitand EOI_RECVD) or (f bitand ERROR);
+		i++;
+		done = (f bitand EOI_RECVD);
+	} while (not done);
+	channel.flushBehind(false);
 
-#ifdef DATA_STREAM
-			// Show ASCII Data
-			if (b[0] < 32 || b[0] >= 127)
-			b[0] = 46;
+	// Commit on EOI or error, a failed write shows on the command channel
+	if ( !channel.flush(true) )
+		setDeviceStatus(25);
 
-			ba[bi++] = b[0];
+	Debug_printf("=================================\r\n%d bytes saved [$%.4X]\r\n", i, load_address);
+	ledON();
+} // saveFile
 
-			if(bi == 8)
-			{
-				Debug_printf(" %s (%d)\r\n", ba, i);
-				bi = 0;
-			}
-#endif
-			// Toggle LED
-			if (0 == i % 50)
-			{
-				ledToggle(true);
-			}
-		} while (not done);
-    }
-    ostream->close(); // nor required, closes automagically
 
-	Debug_printf("=================================\r\n%d bytes saved\r\n", i);
+void devDrive::positionRecord(std::string command)
+{
+	// Channel may be given as 96 + secondary address as well
+	IEC::Data target = m_iec_data;
+	target.channel = command[1] bitand 0x0F;
+
+	uint16_t record = 1;
+	uint8_t offset = 1;
+	if ( command.size() > 3 )
+		record = (uint8_t)command[2] | ((uint8_t)command[3] << 8);
+	else if ( command.size() > 2 )
+		record = (uint8_t)command[2];
+	if ( command.size() > 4 )
+		offset = command[4];
+
+	Debug_printv("channel[%d] record[%d] offset[%d]", target.channel, record, offset);
+
+	auto &channel = channelSelect(target);
+	if ( !channel.isOpen() || !channel.record_length )
+	{
+		setDeviceStatus(61);
+		return;
+	}
+
+	if ( offset > channel.record_length )
+	{
+		setDeviceStatus(51);
+		return;
+	}
+
+	if ( !channel.position(record, offset) )
+	{
+		// Reading will fail, writing will expand the file
+		setDeviceStatus(50);
+	}
+} // positionRecord
+
+void devDrive::sendRecord(Channel &channel)
+{
+	// Send the rest of the current record without trailing zeros, like the 1541
+	uint8_t record[256];
+	size_t start = channel.cursor;
+	size_t len = channel.record_length - (start % channel.record_length);
+	size_t count = 0;
+	size_t used = 0;
+
+	int16_t b;
+	while ( count < len && (b = channel.peek()) >= 0 )
+	{
+		record[count++] = b;
+		if ( b )
+			used = count;
+		channel.next();
+	}
+
+	if ( count == 0 )
+	{
+		Debug_printv("Record not present channel[%d] cursor[%d]", m_iec_data.channel, start);
+		setDeviceStatus(50);
+		m_iec.sendFNF();
+		return;
+	}
+
+	// An all zero record is still sent as one byte
+	if ( used == 0 )
+		used = 1;
+
+	Debug_printv("channel[%d] record[%d] offset[%d] bytes[%d]", m_iec_data.channel, (start / channel.record_length) + 1, (start % channel.record_length) + 1, used);
+	for ( size_t i = 0; i < used; i++ )
+	{
+		bool success = ( i == used - 1 ) ? m_iec.sendEOI(record[i]) : m_iec.send(record[i]);
+		if ( !success )
+		{
+			// Resend the rest of the record on the next TALK
+			channel.seek(start + i);
+			break;
+		}
+	}
+
 	ledON();
+} // sendRecord
 
-	// TODO: Handle errorFlag
-} // saveFile
+void devDrive::saveRecord(Channel &channel)
+{
+	// Received bytes fill the current record, the rest of it is zeroed
+	uint8_t record[256] = { 0 };
+	size_t start = channel.cursor;
+	size_t len = channel.record_length - (start % channel.record_length);
+	size_t count = 0;
+	bool done = false;
+
+	do
+	{
+		uint8_t b = m_iec.receive();
+		uint8_t f = m_iec.state();
+		if ( f bitand ERROR )
+			break;
+
+		if ( count < len )
+			record[count] = b;
+		count++;
+
+		done = (f bitand EOI_RECVD);
+	} while (not done);
+
+	if ( count > len )
+	{
+		Debug_printv("Overflow in record, %d bytes dropped", count - len);
+		setDeviceStatus(51);
+	}
+
+	if ( channel.write(record, len) != len )
+	{
+		setDeviceStatus(26);
+	}
+
+	Debug_printv("channel[%d] record[%d] bytes[%d]", m_iec_data.channel, (start / channel.record_length) + 1, count);
+	ledON();
+} // saveRecord
+
+
+D64IStream *devDrive::mountedImage(void)
+{
+	// The current directory has to be a sector based disk image
+	const char *types[] = { "d64", "d71", "d80", "d81", "d82", "d8b", "d90", "dnp" };
+
+	if ( m_mfile->streamFile == nullptr )
+		return nullptr;
+
+	for ( auto type : types )
+	{
+		if ( mstr::equals(m_mfile->streamFile->extension, (char*)type, false) )
+			return ImageBroker::obtain<D64IStream>(m_mfile->streamFile->url);
+	}
+
+	return nullptr;
+} // mountedImage
+
+bool devDrive::blockCommand(std::string command)
+{
+	// "U1:ch,drive,track,sector" "B-P ch,pos" "B-A:drive,track,sector"
+	// Long forms like BLOCK-READ and any of space, comma or colon as separator
+	char op;
+	size_t pos;
+	if ( command.size() > 1 && command[0] == 'U' && command[1] != '\0' && strchr("12AB", command[1]) )
+	{
+		op = ( command[1] == '1' || command[1] == 'A' ) ? 'U' : 'V';
+		pos = 2;
+	}
+	else if ( command.size() > 2 && command[0] == 'B' && command[1] == '-' && command[2] != '\0' && strchr("RWPAF", command[2]) )
+	{
+		op = command[2];
+		pos = 3;
+	}
+	else
+		return false;
+
+	while ( pos < command.size() && isalpha(command[pos]) )
+		pos++;
+
+	std::vector<uint16_t> args;
+	bool digit = false;
+	for ( ; pos < command.size(); pos++ )
+	{
+		if ( isdigit(command[pos]) )
+		{
+			if ( !digit )
+				args.push_back(0);
+			args.back() = (args.back() * 10) + (command[pos] - '0');
+			digit = true;
+		}
+		else
+			digit = false;
+	}
+
+	Debug_printv("command[%c] args[%d]", op, args.size());
+
+	size_t needed = ( op == 'P' ) ? 2 : ( op == 'A' || op == 'F' ) ? 3 : 4;
+	if ( args.size() < needed )
+	{
+		setDeviceStatus(30);
+		return true;
+	}
+
+	// B-A and B-F have no channel
+	Channel *channel = nullptr;
+	if ( op != 'A' && op != 'F' )
+	{
+		IEC::Data target = m_iec_data;
+		target.channel = args[0] bitand 0x0F;
+		channel = &channelSelect(target);
+		if ( !channel->block )
+		{
+			setDeviceStatus(70);
+			return true;
+		}
+
+		if ( op == 'P' )
+		{
+			channel->block_pointer = args[1];
+			return true;
+		}
+
+		args.erase(args.begin());
+	}
+
+	auto image = mountedImage();
+	if ( image == nullptr )
+	{
+		setDeviceStatus(74);
+		return true;
+	}
+
+	uint16_t track = args[1];
+	uint16_t sector = args[2];
+	if ( track > 0xFF || sector > 0xFF || !image->isValidBlock(track, sector) )
+	{
+		setDeviceStatus(66, track, sector);
+		return true;
+	}
+
+	if ( op == 'U' || op == 'R' )
+	{
+		if ( !image->readBlock(track, sector, channel->block.get()) )
+		{
+			setDeviceStatus(66, track, sector);
+			return true;
+		}
+
+		// B-R sends only up to the last used byte given in byte 0
+		channel->block_pointer = ( op == 'R' ) ? 1 : 0;
+		channel->block_last = ( op == 'R' ) ? channel->block[0] : 255;
+		return true;
+	}
+
+	// Everything else changes the image
+	if ( !image->isWritable() )
+	{
+		setDeviceStatus(26);
+		return true;
+	}
+	m_listings.clear();
+
+	if ( op == 'V' || op == 'W' )
+	{
+		// B-W stores the buffer pointer in byte 0 as the last used byte
+		if ( op == 'W' )
+			channel->block[0] = channel->block_pointer - 1;
+
+		if ( !image->writeBlock(track, sector, channel->block.get()) )
+			setDeviceStatus(25);
+	}
+	else if ( op == 'A' )
+	{
+		uint8_t t = track;
+		uint8_t s = sector;
+		if ( !image->allocateBlock(t, s) )
+			setDeviceStatus(65, t, s);
+	}
+	else if ( op == 'F' )
+	{
+		image->deallocateBlock(track, sector);
+	}
+
+	return true;
+} // blockCommand
+
+void devDrive::sendBlock(Channel &channel)
+{
+	// From the buffer pointer up to the last byte, a new TALK resumes after ATN.
+	// A pointer past the last byte sends just that byte, and the pointer
+	// never wraps around the end of the buffer.
+	Debug_printv("channel[%d] pointer[%d] last[%d]", m_iec_data.channel, channel.block_pointer, channel.block_last);
+
+	bool last = false;
+	while ( !last )
+	{
+		uint8_t b = channel.block[channel.block_pointer];
+		last = ( channel.block_pointer >= channel.block_last || channel.block_pointer == 255 );
+
+		bool success = ( last ) ? m_iec.sendEOI(b) : m_iec.send(b);
+		if ( !success )
+			break;
+
+		if ( channel.block_pointer < 255 )
+			channel.block_pointer++;
+	}
+
+	ledON();
+} // sendBlock
+
+void devDrive::saveBlock(Channel &channel)
+{
+	bool done = false;
+	do
+	{
+		uint8_t b = m_iec.receive();
+		uint8_t f = m_iec.state();
+		if ( f bitand ERROR )
+			break;
+
+		channel.block[channel.block_pointer++] = b;
+		done = (f bitand EOI_RECVD);
+	} while (not done);
+
+	Debug_printv("channel[%d] pointer[%d]", m_iec_data.channel, channel.block_pointer);
+	ledON();
+} // saveBlock
+
+bool devDrive::memoryCommand(const std::string &command)
+{
+	// "M-W" + address low/high + count + data, "M-E" + address low/high
+	if ( command.size() < 5 || command[0] != 'M' || command[1] != '-' )
+		return false;
+
+	uint16_t address = (uint8_t)command[3] | ((uint8_t)command[4] << 8);
+	if ( command[2] == 'W' )
+	{
+		size_t len = ( command.size() > 5 ) ? (uint8_t)command[5] : 0;
+		if ( len > command.size() - 6 )
+			len = command.size() - 6;
+
+		m_drivecode.write(address, (const uint8_t *)command.data() + 6, len);
+		return true;
+	}
+	else if ( command[2] == 'E' )
+	{
+		m_drivecode.execute(address);
+		return true;
+	}
+
+	return false;
+} // memoryCommand
+
+void devDrive::runLoader(FastLoader &loader, FastLoadSession &session)
+{
+	if ( !loader.serve(session) )
+		Debug_printv("%s stopped early", loader.name());
+
+	// Whatever the loader did with ATN isn't a bus command
+	m_iec.protocol.release(IEC_PIN_CLK);
+	m_iec.protocol.release(IEC_PIN_DATA);
+	m_iec.protocol.flags = CLEAR;
+	m_listings.clear();
+} // runLoader
+
+bool devDrive::prepareWarp(std::string url)
+{
+	std::unique_ptr<MFile> file(MFSOwner::File(url));
+	std::unique_ptr<MIStream> istream(file ? file->inputStream() : nullptr);
+	if ( istream == nullptr || !istream->isOpen() )
+		return false;
+
+	// Programs that load over the stub, have no known size or don't fit in
+	// memory go the slow way
+	size_t size = istream->size();
+	if ( size < 3 || size > 0x10001 )
+		return false;
+	std::unique_ptr<uint8_t[]> program(new (std::nothrow) uint8_t[size]);
+	if ( program == nullptr )
+		return false;
+
+	size_t count = 0;
+	while ( count < size )
+	{
+		size_t n = istream->read(program.get() + count, size - count);
+		if ( n == 0 )
+			return false;
+		count += n;
+	}
+	if ( !WarpLoader::fits(program[0] | (program[1] << 8), size - 2) )
+		return false;
+
+	m_device.url(url);
+	m_filename = url;
+	m_warp = std::move(program);
+	m_warp_size = size;
+	m_openState = O_WARP;
+	return true;
+} // prepareWarp
 
 
 void devDrive::dumpState()
@@ -51,13 +51,83 @@
 #include "iec_device.h"
 
 #include "meat_io.h"
+#include "disk/d64.h"
+#include "drive/drivecode.h"
+#include "drive/prefetch.h"
+#include "drive/dos_command.h"
 #include "MemoryInfo.h"
 #include "helpers.h"
 #include "utils.h"
 #include "string_utils.h"
+#include "U8Char.h"
+
+#include <list>
+
+#if defined(TRUE_DRIVE)
+#include "drive/drive1541.h"
+#endif
 
 //#include "doscmd.h"
 
+#define BASIC_LINE_MAX		80		// longest line a listing can hold
+#define LISTING_RESERVE		1024	// initial size of a listing program
+
+#if defined(ESP32)
+#define LISTING_CACHE_SIZE	32768	// bytes of rendered listings kept
+#else
+#define LISTING_CACHE_SIZE	8192
+#endif
+#define LISTING_CACHE_TTL	60000	// ms, for sources that don't report changes
+#define TEXT_CHUNK			256		// bytes of a text file transcoded at a time
+
+// Directory listings rendered as BASIC programs, ready to be sent again.
+// An entry is used while the directory url and modification stamp match.
+class ListingCache
+{
+public:
+	const std::string *get(const std::string &url, time_t stamp);
+	void put(const std::string &url, time_t stamp, std::string program);
+	void clear(void);
+
+private:
+	struct Listing {
+		std::string url;
+		time_t stamp;
+		uint32_t rendered;	// millis() when it was rendered
+		std::string program;
+	};
+
+	std::list<Listing> m_listings;	// most recently used first
+	size_t m_size = 0;
+};
+
+// Directory filter from LOAD"$[drive]:PATTERN[,PATTERN...][=OPTIONS]"
+// OPTIONS are type letters (P S U R C, D for DIR/DEL), block counts
+// (>10 <100) and CMD style dates (T>01/31/22 T<12/31/22)
+class ListingFilter
+{
+public:
+	std::string spec;						// as typed, part of the cache key
+	std::vector<std::string> patterns;		// PETSCII wildcards, any may match
+	std::string types;						// type letters, empty for all
+	uint16_t min_blocks = 0;
+	uint16_t max_blocks = 0xFFFF;
+	time_t after = 0;
+	time_t before = 0;
+
+	void parse(std::string spec);
+	bool isActive(void) { return spec.size(); };
+
+	// Cheapest checks first, so entries are dropped before they are sized
+	bool matchName(const std::string &name);
+	bool matchType(const std::string &extension);
+	bool matchSize(uint16_t blocks);
+	bool matchDate(MFile *entry);
+
+private:
+	time_t parseDate(std::string date);
+};
+
 enum OpenState
 {
 	O_NOTHING,		// Nothing to send / File not found error
@@ -65,7 +135,8 @@ enum OpenState
 	O_FILE,			// A program file is opened
 	O_DIR,			// A listing is requested
 	O_ML_INFO,		// Meatloaf Device Info
-	O_ML_STATUS		// Meatloaf Virtual Device Status
+	O_ML_STATUS,	// Meatloaf Virtual Device Status
+	O_WARP			// Warp boot stub, the program follows on CLOSE
 };
 
 class devDrive: public iecDevice
@@ -78,6 +149,9 @@ public:
 	virtual uint8_t execute(IEC::Data &iec_data) { return 0; };
 	virtual uint8_t status(void) { return 0; };
 
+	// Background work between bus commands
+	void idle(void);
+
 protected:
 	// handler helpers.
 	virtual void handleListenCommand(IEC::Data &iec_data) override;
@@ -99,26 +173,52 @@ private:
 	bool m_show_date = false;
 	bool m_show_load_address = false;
 	void changeDir(std::string url);
-	uint16_t sendHeader(uint16_t &basicPtr, std::string header, std::string id);
-	//uint16_t sendHeader(uint16_t &basicPtr, const char *format, ...);
-	uint16_t sendLine(uint16_t &basicPtr, uint16_t blocks, char *text);
-	uint16_t sendLine(uint16_t &basicPtr, uint16_t blocks, const char *format, ...);
-	uint16_t sendFooter(uint16_t &basicPtr, uint16_t blocks_free, uint16_t block_size);
+	uint16_t renderHeader(std::string &program, uint16_t &basicPtr, std::string header, std::string id);
+	uint16_t renderLine(std::string &program, uint16_t &basicPtr, uint16_t blocks, char *text);
+	uint16_t renderLine(std::string &program, uint16_t &basicPtr, uint16_t blocks, const char *format, ...);
+	uint16_t renderFooter(std::string &program, uint16_t &basicPtr, uint16_t blocks_free, uint16_t block_size);
+	bool renderListing(std::string &program);
+	bool sendProgram(const std::string &program);
 	void sendListing();
+	ListingCache m_listings;
+	ListingFilter m_filter;
 
 	// File LOAD / SAVE
-	void prepareFileStream(std::string url);
+	void prepareFileStream(std::string url, uint8_t record_length = 0);
+	Prefetcher m_prefetch;
 	MFile* getPointed(MFile* urlFile);
 	void sendFile();
 	void saveFile();
 
+	// Relative files
+	void positionRecord(std::string command);
+	void sendRecord(Channel &channel);
+	void saveRecord(Channel &channel);
+
+	// Block access on disk images
+	D64IStream *mountedImage(void);
+	bool blockCommand(std::string command);
+	void sendBlock(Channel &channel);
+	void saveBlock(Channel &channel);
+
+	// Drive code uploads, run natively when recognised
+	bool memoryCommand(const std::string &command);
+	void runLoader(FastLoader &loader, FastLoadSession &session);
+	DriveCode m_drivecode;
+
+	// Warp autoboot, per device. The program is in memory before the stub
+	// goes out, the transfer has no time to wait for the media.
+	bool prepareWarp(std::string url);
+	std::unique_ptr<uint8_t[]> m_warp;
+	size_t m_warp_size = 0;
+
 	// Device Status
 	std::string m_device_status = "";
 	void sendStatus(void);
 	void sendFileNotFound(void);
 	void setDeviceStatus(int number, int track=0, int sector=0);
 
-	CommandPathTuple parseLine(std::string commandLne, size_t channel);
+	CommandPathTuple parseLine(const DosCommand &dos, size_t channel);
 
 	// This is set after an open command and determines what to send next
 	byte m_openState;
@@ -0,0 +1,177 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "dos_command.h"
+
+#include <cctype>
+#include <cstring>
+
+static bool isSpace(char c)
+{
+	return c == ' ' || c == '\xA0';
+}
+
+static bool sameChar(char a, char b, bool case_sensitive)
+{
+	return ( a == b ) || ( !case_sensitive && std::toupper((uint8_t)a) == std::toupper((uint8_t)b) );
+}
+
+bool DosToken::equals(const char *text, bool case_sensitive) const
+{
+	return strlen(text) == size && startsWith(text, case_sensitive);
+}
+
+bool DosToken::startsWith(const char *text, bool case_sensitive) const
+{
+	size_t i = 0;
+	for ( ; text[i]; i++ )
+	{
+		if ( i >= size || !sameChar(data[i], text[i], case_sensitive) )
+			return false;
+	}
+	return true;
+}
+
+DosToken DosToken::drop(size_t count) const
+{
+	if ( count > size )
+		count = size;
+	return DosToken(data + count, size - count);
+}
+
+DosToken DosToken::trim(void) const
+{
+	size_t start = 0;
+	size_t end = size;
+	while ( start < end && isSpace(data[start]) )
+		start++;
+	while ( end > start && isSpace(data[end - 1]) )
+		end--;
+	return DosToken(data + start, end - start);
+}
+
+
+void DosCommand::reset(void)
+{
+	command = argument = DosToken();
+	drive = -1;
+	replace = false;
+	name_count = source_count = 0;
+	type = mode = 0;
+	record_length = 0;
+}
+
+bool DosCommand::parse(const char *text, size_t len)
+{
+	reset();
+	if ( len > 255 )
+		return false;
+
+	line = DosToken(text, len);
+
+	// A ":" separates a command or drive from its arguments, unless it
+	// starts "://" of an url
+	size_t colon = 0;
+	while ( colon < len && text[colon] != ':' )
+		colon++;
+	bool url = ( colon + 2 < len && text[colon + 1] == '/' && text[colon + 2] == '/' );
+
+	DosToken rest = line;
+	if ( colon < len && !url )
+	{
+		DosToken head(text, colon);
+		rest = line.drop(colon + 1);
+
+		if ( head.size && isdigit((uint8_t)head.back()) )
+		{
+			drive = head.back() - '0';
+			head.size--;
+		}
+
+		// "@0:NAME" replaces, "@INFO:" is a command
+		if ( head.equals("@") )
+		{
+			replace = true;
+			head.size = 0;
+		}
+		command = head;
+	}
+
+	return split(rest);
+}
+
+// names=sources,type,mode
+bool DosCommand::split(DosToken text)
+{
+	DosToken *list = names;
+	uint8_t *count = &name_count;
+	size_t start = 0;
+	bool end = false;
+
+	for ( size_t i = 0; i <= text.size && !end; i++ )
+	{
+		char c = ( i < text.size ) ? text[i] : ',';
+		if ( c != ',' && c != '=' )
+			continue;
+
+		DosToken token = DosToken(text.data + start, i - start);
+		start = i + 1;
+
+		// One letter after the names is a type or a mode
+		if ( c == ',' && *count && list == names && token.size == 1 && token[0] && !type && strchr("PSUL", std::toupper((uint8_t)token[0])) )
+		{
+			type = std::toupper((uint8_t)token[0]);
+
+			// The record length is a byte and may even be a ","
+			if ( type == 'L' && i + 1 < text.size )
+			{
+				record_length = text[i + 1];
+				end = true;
+			}
+			continue;
+		}
+		if ( c == ',' && *count && list == names && token.size == 1 && token[0] && !mode && strchr("RWAM", std::toupper((uint8_t)token[0])) )
+		{
+			mode = std::toupper((uint8_t)token[0]);
+			continue;
+		}
+		if ( type || mode )
+			return false;
+
+		if ( *count == DOS_NAMES_MAX )
+			return false;
+		list[(*count)++] = token;
+
+		if ( c == '=' )
+		{
+			if ( list == sources )
+				return false;
+			list = sources;
+			count = &source_count;
+		}
+	}
+
+	// The argument ends where type and mode start
+	argument = text;
+	if ( name_count )
+	{
+		const DosToken &last = ( source_count ) ? sources[source_count - 1] : names[name_count - 1];
+		argument.size = last.data + last.size - text.data;
+	}
+
+	return true;
+}
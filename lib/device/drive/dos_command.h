@@ -0,0 +1,82 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// CBM DOS file names and commands, tokenized where they were received:
+//   [@][drive]:name[,name...][=[drive:]source[,source...]][,type[,mode]]
+//   command[drive]:arguments            S0:NAME  R:NEW=OLD  C:NEW=A,B  N:NAME,ID
+// Tokens point into the parsed line, nothing is allocated or copied.
+//
+// http://www.zimmers.net/anonftp/pub/cbm/manuals/drives/1541-II_Users_Guide.pdf
+
+#ifndef DEVICE_DRIVE_DOS_COMMAND_H
+#define DEVICE_DRIVE_DOS_COMMAND_H
+
+#include "../../../include/global_defines.h"
+
+#include <string>
+
+#define DOS_NAMES_MAX	4	// names on either side of the "="
+
+// A piece of the line, not terminated
+class DosToken
+{
+public:
+	const char *data = nullptr;
+	uint8_t size = 0;
+
+	DosToken() {};
+	DosToken(const char *d, size_t s): data(d), size(s) {};
+
+	bool empty(void) const { return size == 0; };
+	char operator[](size_t i) const { return data[i]; };
+	char back(void) const { return data[size - 1]; };
+
+	bool equals(const char *text, bool case_sensitive = true) const;
+	bool startsWith(const char *text, bool case_sensitive = true) const;
+	DosToken drop(size_t count) const;
+	DosToken trim(void) const;		// spaces and shifted spaces at both ends
+	std::string str(void) const { return std::string(data, size); };
+};
+
+class DosCommand
+{
+public:
+	// False on a syntax error
+	bool parse(const char *line, size_t len);
+	bool parse(const std::string &line) { return parse(line.data(), line.size()); };
+
+	DosToken line;				// everything, for commands with their own syntax
+	DosToken command;			// before the ":", without drive and "@"; "S" of "S0:NAME"
+	DosToken argument;			// after the ":" up to type and mode, the whole line without one
+	int8_t drive = -1;			// -1 when none given
+	bool replace = false;		// "@:NAME" and "@0:NAME"
+
+	DosToken names[DOS_NAMES_MAX];
+	uint8_t name_count = 0;
+	DosToken sources[DOS_NAMES_MAX];	// after the "="
+	uint8_t source_count = 0;
+
+	char type = 0;				// P, S, U, L or 0, "=" sets it for directory filters
+	char mode = 0;				// R, W, A, M or 0
+	uint8_t record_length = 0;	// ",L," + CHR$(length)
+
+private:
+	void reset(void);
+	bool split(DosToken text);
+};
+
+#endif // DEVICE_DRIVE_DOS_COMMAND_H
@@ -0,0 +1,540 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "drive1541.h"
+
+// 4 bit nybble to 5 bit GCR
+static const uint8_t gcr_encode[16] = {
+	0x0A, 0x0B, 0x12, 0x13, 0x0E, 0x0F, 0x16, 0x17,
+	0x09, 0x19, 0x1A, 0x1B, 0x0D, 0x1D, 0x1E, 0x15
+};
+
+// Track length in bytes for each density, tracks 31+, 25-30, 18-24, 1-17
+static const uint16_t track_size[4] = { 6250, 6666, 7142, 7692 };
+
+static uint8_t trackDensity(uint8_t track)
+{
+	return (track < 18) + (track < 25) + (track < 31);
+}
+
+// 4 bytes become 5 GCR bytes
+static void gcrEncode(const uint8_t *in, uint8_t *out)
+{
+	uint64_t bits = 0;
+	for ( uint8_t i = 0; i < 4; i++ )
+		bits = (bits << 10) | (gcr_encode[in[i] >> 4] << 5) | gcr_encode[in[i] & 0x0F];
+
+	for ( int8_t i = 4; i >= 0; i-- )
+	{
+		out[i] = bits & 0xFF;
+		bits >>= 8;
+	}
+}
+
+// 5 GCR bytes back to 4 bytes, false on an invalid code
+static bool gcrDecode(const uint8_t *in, uint8_t *out)
+{
+	uint64_t bits = 0;
+	for ( uint8_t i = 0; i < 5; i++ )
+		bits = (bits << 8) | in[i];
+
+	for ( int8_t i = 7; i >= 0; i-- )
+	{
+		uint8_t code = bits & 0x1F;
+		bits >>= 5;
+
+		uint8_t nybble = 0;
+		while ( nybble < 16 && gcr_encode[nybble] != code )
+			nybble++;
+		if ( nybble == 16 )
+			return false;
+
+		if ( i & 1 )
+			out[i >> 1] = nybble;
+		else
+			out[i >> 1] |= nybble << 4;
+	}
+
+	return true;
+}
+
+
+Drive1541 *Drive1541::m_active = nullptr;
+
+Drive1541::Drive1541(IEC &iec) :
+	cpu(*this),
+	m_iec(iec)
+{
+	memset(m_ram, 0, sizeof(m_ram));
+	memset(m_sync, 0, sizeof(m_sync));
+}
+
+Drive1541::~Drive1541()
+{
+	saveTrack();
+}
+
+bool Drive1541::loadROM(std::string url)
+{
+	std::unique_ptr<MFile> file(MFSOwner::File(url));
+	if ( file == nullptr )
+		return false;
+
+	std::unique_ptr<MIStream> istream(file->inputStream());
+	if ( istream == nullptr || !istream->isOpen() )
+	{
+		Debug_printv("No drive ROM at [%s]", url.c_str());
+		return false;
+	}
+
+	m_rom.reset(new uint8_t[0x4000]);
+	size_t size = istream->read(m_rom.get(), 0x4000);
+	istream->close();
+
+	Debug_printv("ROM [%s] size[%d]", url.c_str(), size);
+	return size == 0x4000;
+}
+
+void Drive1541::insert(D64IStream *image)
+{
+	saveTrack();
+
+	m_image = image;
+	m_protected = ( image == nullptr || !image->isWritable() );
+
+	// Disk ID from the BAM goes into every sector header
+	uint8_t bam[256];
+	if ( image != nullptr && image->readBlock(18, 0, bam) )
+	{
+		m_id[0] = bam[0xA2];
+		m_id[1] = bam[0xA3];
+	}
+
+	loadTrack();
+}
+
+void Drive1541::reset(uint8_t device)
+{
+	via1.reset();
+	via2.reset();
+
+	// Device number jumpers on PB5/PB6
+	via1.input_b = ((device - 8) & 0x03) << 5;
+	via1.input_a = 0xFF;
+	via2.input_b = 0xFF;
+
+	cpu.reset();
+}
+
+
+/********************************************************
+ * Memory map
+ ********************************************************/
+
+uint8_t Drive1541::read(uint16_t address)
+{
+	if ( address < 0x1800 )
+		return m_ram[address & 0x07FF];
+
+	if ( address < 0x1C00 )
+	{
+		if ( (address & 0x0F) == MOS6522::ORB )
+			sampleBus();
+		return via1.read(address);
+	}
+
+	if ( address < 0x2000 )
+	{
+		// SYNC is active low on PB7, write protect low on PB4
+		via2.input_b = (via2.input_b & 0x6F) | (m_at_sync ? 0 : 0x80) | (m_protected ? 0 : 0x10);
+		return via2.read(address);
+	}
+
+	if ( address >= 0x8000 && m_rom )
+		return m_rom[address & 0x3FFF];
+
+	// Open bus
+	return address >> 8;
+}
+
+void Drive1541::write(uint16_t address, uint8_t value)
+{
+	if ( address < 0x1800 )
+	{
+		m_ram[address & 0x07FF] = value;
+	}
+	else if ( address < 0x1C00 )
+	{
+		via1.write(address, value);
+		driveBus();
+	}
+	else if ( address < 0x2000 )
+	{
+		via2.write(address, value);
+		step(via2.portB() & 0x03);
+	}
+}
+
+
+/********************************************************
+ * Serial bus
+ ********************************************************/
+
+// VIA1 PB0 DATA IN, PB2 CLK IN, PB7 ATN IN, all high while the line is pulled
+void Drive1541::sampleBus(void)
+{
+	uint8_t pb = via1.input_b & 0x60;
+	if ( attached )
+	{
+		if ( m_data_out || m_iec.protocol.status(IEC_PIN_DATA) == PULLED )
+			pb |= 0x01;
+		if ( m_clk_out || m_iec.protocol.status(IEC_PIN_CLK) == PULLED )
+			pb |= 0x04;
+	}
+	if ( m_atn )
+		pb |= 0x80;
+
+	via1.input_b = pb;
+}
+
+// PB1 DATA OUT, PB3 CLK OUT, PB4 ATNA. DATA is also pulled in hardware
+// while ATN and ATNA disagree, that is the automatic ATN acknowledge.
+void Drive1541::driveBus(void)
+{
+	uint8_t pb = via1.portB();
+	bool atna = pb & 0x10;
+
+	m_data_out = ( pb & 0x02 ) || ( m_atn != atna );
+	m_clk_out = ( pb & 0x08 );
+
+	if ( !attached )
+		return;
+
+	if ( m_data_out )
+		m_iec.protocol.pull(IEC_PIN_DATA);
+	else
+		m_iec.protocol.release(IEC_PIN_DATA);
+
+	if ( m_clk_out )
+		m_iec.protocol.pull(IEC_PIN_CLK);
+	else
+		m_iec.protocol.release(IEC_PIN_CLK);
+}
+
+
+/********************************************************
+ * Disk
+ ********************************************************/
+
+void Drive1541::setSync(uint16_t pos, bool sync)
+{
+	if ( sync )
+		m_sync[pos >> 3] |= 1 << (pos & 7);
+	else
+		m_sync[pos >> 3] &= ~(1 << (pos & 7));
+}
+
+// Header and data block of one sector, returns the next position
+uint16_t Drive1541::encodeSector(uint16_t pos, uint8_t track, uint8_t sector, const uint8_t *data, uint16_t gap)
+{
+	uint8_t raw[260];
+	uint8_t *out = m_track.get();
+
+	// Header block
+	for ( uint8_t i = 0; i < 5; i++, pos++ )
+	{
+		out[pos] = 0xFF;
+		setSync(pos, true);
+	}
+	uint8_t header[8] = { 0x08, (uint8_t)(sector ^ track ^ m_id[1] ^ m_id[0]), sector, track, m_id[1], m_id[0], 0x0F, 0x0F };
+	gcrEncode(header, out + pos);
+	gcrEncode(header + 4, out + pos + 5);
+	pos += 10;
+	for ( uint8_t i = 0; i < 9; i++ )
+		out[pos++] = 0x55;
+
+	// Data block
+	for ( uint8_t i = 0; i < 5; i++, pos++ )
+	{
+		out[pos] = 0xFF;
+		setSync(pos, true);
+	}
+	uint8_t checksum = 0;
+	raw[0] = 0x07;
+	for ( uint16_t i = 0; i < 256; i++ )
+	{
+		raw[i + 1] = data[i];
+		checksum ^= data[i];
+	}
+	raw[257] = checksum;
+	raw[258] = raw[259] = 0;
+	for ( uint16_t i = 0; i < 260; i += 4, pos += 5 )
+		gcrEncode(raw + i, out + pos);
+
+	for ( uint16_t i = 0; i < gap; i++ )
+		out[pos++] = 0x55;
+
+	return pos;
+}
+
+// GCR encode the track under the head from the image sectors
+void Drive1541::loadTrack(void)
+{
+	saveTrack();
+
+	if ( !m_track )
+		m_track.reset(new uint8_t[GCR_TRACK_SIZE]);
+	memset(m_sync, 0, sizeof(m_sync));
+	m_track_size = 0;
+
+	// Half tracks and missing tracks read as no signal at all
+	uint8_t track = m_halftrack / 2;
+	if ( m_image == nullptr || (m_halftrack & 1) || !m_image->isValidBlock(track, 0) )
+		return;
+
+	uint8_t sectors = 0;
+	while ( m_image->isValidBlock(track, sectors) )
+		sectors++;
+
+	m_track_size = track_size[trackDensity(track)];
+	uint16_t gap = (m_track_size - (sectors * 354)) / sectors;
+
+	uint8_t data[256];
+	uint16_t pos = 0;
+	for ( uint8_t sector = 0; sector < sectors; sector++ )
+	{
+		if ( !m_image->readBlock(track, sector, data) )
+			memset(data, 0, sizeof(data));
+		pos = encodeSector(pos, track, sector, data, gap);
+	}
+	while ( pos < m_track_size )
+		m_track[pos++] = 0x55;
+
+	if ( m_head >= m_track_size )
+		m_head = 0;
+
+	Debug_printv("track[%d] sectors[%d] bytes[%d]", track, sectors, m_track_size);
+}
+
+// Decode what the drive wrote back into image sectors
+void Drive1541::saveTrack(void)
+{
+	if ( !m_dirty || m_image == nullptr || m_track_size == 0 )
+		return;
+	m_dirty = false;
+
+	uint8_t track = m_halftrack / 2;
+	uint8_t *gcr = m_track.get();
+	int16_t sector = -1;
+	uint8_t raw[260];
+	uint8_t buf[5];
+
+	// Walk one revolution plus a data block, starting right after a sync
+	for ( uint32_t pos = 0; pos < (uint32_t)m_track_size * 2; pos++ )
+	{
+		uint16_t p = pos % m_track_size;
+		if ( !isSync(p) || isSync((p + 1) % m_track_size) )
+			continue;
+
+		uint16_t start = (p + 1) % m_track_size;
+		for ( uint8_t i = 0; i < 5; i++ )
+			buf[i] = gcr[(start + i) % m_track_size];
+		if ( !gcrDecode(buf, raw) )
+			continue;
+
+		if ( raw[0] == 0x08 )
+		{
+			sector = raw[2];
+		}
+		else if ( raw[0] == 0x07 && sector >= 0 )
+		{
+			bool ok = true;
+			for ( uint16_t i = 0; i < 65 && ok; i++ )
+			{
+				for ( uint8_t j = 0; j < 5; j++ )
+					buf[j] = gcr[(start + (i * 5) + j) % m_track_size];
+				ok = gcrDecode(buf, raw + (i * 4));
+			}
+
+			if ( ok && m_image->isValidBlock(track, sector) )
+				m_image->writeBlock(track, sector, raw + 1);
+			sector = -1;
+		}
+
+		if ( pos >= m_track_size && sector < 0 )
+			break;
+	}
+
+	Debug_printv("track[%d] written back", track);
+}
+
+// Stepper phases on VIA2 PB0/PB1, one phase is one half track
+void Drive1541::step(uint8_t phase)
+{
+	if ( phase == m_phase )
+		return;
+
+	if ( phase == ((m_phase + 1) & 0x03) && m_halftrack < 84 )
+		m_halftrack++;
+	else if ( phase == ((m_phase - 1) & 0x03) && m_halftrack > 2 )
+		m_halftrack--;
+	m_phase = phase;
+
+	loadTrack();
+}
+
+// The disk moves under the head at the speed set with the density bits
+// on VIA2 PB5/PB6. Every byte read or written pulses BYTE READY, which
+// sets V through SO while the byte ready enable (VIA2 CA2) is high.
+void Drive1541::rotate(uint8_t cycles)
+{
+	uint8_t pb = via2.portB();
+	if ( !(pb & 0x04) || m_track_size == 0 )
+		return;
+
+	m_rotation += cycles;
+	uint8_t per_byte = 26 + ((3 - ((pb >> 5) & 0x03)) * 2);
+	while ( m_rotation >= per_byte )
+	{
+		m_rotation -= per_byte;
+		m_head = ( m_head + 1 < m_track_size ) ? m_head + 1 : 0;
+
+		if ( !via2.CB2() )
+		{
+			// Write mode, back to back $FF bytes are a sync mark
+			uint8_t b = via2.portA();
+			m_track[m_head] = b;
+			setSync(m_head, b == 0xFF && m_last_written == 0xFF);
+			if ( b == 0xFF && m_last_written == 0xFF )
+				setSync(m_head ? m_head - 1 : m_track_size - 1, true);
+			m_last_written = b;
+			m_at_sync = false;
+			m_dirty = true;
+		}
+		else
+		{
+			m_last_written = 0;
+			m_at_sync = isSync(m_head);
+			if ( m_at_sync )
+				continue;
+			via2.input_a = m_track[m_head];
+		}
+
+		if ( via2.CA2() )
+			cpu.setOverflow();
+		via2.setCA1(false);
+		via2.setCA1(true);
+	}
+}
+
+
+/********************************************************
+ * Execution
+ ********************************************************/
+
+void Drive1541::run(uint32_t cycles)
+{
+	uint64_t until = cpu.cycles + cycles;
+	while ( cpu.cycles < until )
+	{
+		// ATN reaches VIA1 CA1 through an inverter
+		if ( attached )
+		{
+			bool atn = ( m_iec.protocol.status(IEC_PIN_ATN) == PULLED );
+			if ( atn != m_atn )
+			{
+				m_atn = atn;
+				via1.setCA1(atn);
+				driveBus();
+			}
+		}
+
+		uint8_t used = cpu.step();
+		via1.tick(used);
+		via2.tick(used);
+		rotate(used);
+		cpu.irq(via1.irq() || via2.irq());
+	}
+}
+
+bool Drive1541::start(IEC &iec, D64IStream *image, uint8_t device)
+{
+#if defined(ESP32)
+	if ( m_active != nullptr )
+		return false;
+
+	auto drive = new Drive1541(iec);
+	if ( !drive->loadROM() )
+	{
+		delete drive;
+		return false;
+	}
+
+	drive->insert(image);
+	drive->reset(device);
+	drive->attached = true;
+	m_active = drive;
+
+	// Core 1 runs the loop, the drive gets core 0 to itself
+	disableCore0WDT();
+	xTaskCreatePinnedToCore(task, "drive1541", 4096, drive, 1, nullptr, 0);
+	Debug_printv("True drive started, device[%d]", device);
+	return true;
+#else
+	// Not enough CPU for real time without a second core
+	return false;
+#endif
+}
+
+void Drive1541::stop(void)
+{
+#if defined(ESP32)
+	if ( m_active != nullptr )
+		m_active->m_stop = true;
+#endif
+}
+
+#if defined(ESP32)
+// Runs DRIVE_SLICE cycles at a time and waits for real time to catch up,
+// until stopped or the bus is reset
+void Drive1541::task(void *parameter)
+{
+	auto drive = (Drive1541 *)parameter;
+	uint32_t next = micros();
+
+	while ( !drive->m_stop && drive->m_iec.protocol.status(IEC_PIN_RESET) != PULLED )
+	{
+		drive->run(DRIVE_SLICE);
+
+		next += DRIVE_SLICE * 1000000 / DRIVE_CLOCK;
+		int32_t ahead = next - micros();
+		if ( ahead > 0 )
+			delayMicroseconds(ahead);
+		else if ( ahead < -10000 )
+			next = micros();	// too far behind, don't try to catch up
+	}
+
+	drive->m_iec.protocol.release(IEC_PIN_CLK);
+	drive->m_iec.protocol.release(IEC_PIN_DATA);
+	Debug_printv("True drive stopped at cycle[%llu]", drive->cpu.cycles);
+
+	m_active = nullptr;
+	delete drive;
+	enableCore0WDT();
+	vTaskDelete(nullptr);
+}
+#endif
@@ -0,0 +1,113 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// True drive mode, the 1541 itself running its own ROM and whatever
+// custom drive code gets uploaded with M-W/M-E
+//
+// http://www.zimmers.net/anonftp/pub/cbm/schematics/drives/new/1541/
+// https://ist.uwaterloo.ca/~schepers/formats/G64.TXT
+// http://www.unusedino.de/ec64/technical/aay/c1541/
+
+#ifndef DEVICE_DRIVE_DRIVE1541_H
+#define DEVICE_DRIVE_DRIVE1541_H
+
+#include "../../../include/global_defines.h"
+
+#include "iec.h"
+#include "disk/d64.h"
+
+#include "mos6502.h"
+#include "mos6522.h"
+
+#define DRIVE_ROM			SYSTEM_DIR "1541.rom"	// 16K, $C000-$FFFF
+#define DRIVE_CLOCK			1000000					// cycles per second
+#define DRIVE_SLICE			1000					// cycles run between real time checks
+#define GCR_TRACK_SIZE		7692					// bytes on the longest track
+
+class Drive1541: public MOS6502Bus
+{
+public:
+	Drive1541(IEC &iec);
+	~Drive1541();
+
+	bool loadROM(std::string url = DRIVE_ROM);
+	void insert(D64IStream *image);
+	void reset(uint8_t device = 8);
+
+	// Runs at least this many cycles as fast as possible
+	void run(uint32_t cycles);
+
+	// Bus pins are only touched once attached
+	bool attached = false;
+
+	MOS6502 cpu;
+	MOS6522 via1;	// $1800 serial bus
+	MOS6522 via2;	// $1C00 disk controller
+
+	// MOS6502Bus
+	uint8_t read(uint16_t address) override;
+	void write(uint16_t address, uint8_t value) override;
+
+	// One drive at a time runs on its own core, the high level
+	// drive emulation stays away from the bus meanwhile
+	static bool start(IEC &iec, D64IStream *image, uint8_t device);
+	static void stop(void);
+	static bool running(void) { return m_active != nullptr; };
+
+private:
+	IEC &m_iec;
+	uint8_t m_ram[2048];
+	std::unique_ptr<uint8_t[]> m_rom;
+
+	// Serial bus
+	bool m_atn = false;			// lines as seen by the drive, true when pulled
+	bool m_clk_out = false;
+	bool m_data_out = false;
+	void sampleBus(void);
+	void driveBus(void);
+
+	// Disk
+	D64IStream *m_image = nullptr;
+	bool m_protected = true;
+	uint8_t m_id[2] = { 0x41, 0x41 };
+	uint8_t m_halftrack = 36;	// head over track 18
+	uint8_t m_phase = 0;
+	std::unique_ptr<uint8_t[]> m_track;
+	uint8_t m_sync[GCR_TRACK_SIZE / 8 + 1];
+	uint16_t m_track_size = 0;
+	uint16_t m_head = 0;
+	uint16_t m_rotation = 0;	// cycles towards the next byte
+	bool m_at_sync = false;
+	bool m_dirty = false;
+	uint8_t m_last_written = 0;
+
+	void rotate(uint8_t cycles);
+	void step(uint8_t phase);
+	void loadTrack(void);
+	void saveTrack(void);
+	void setSync(uint16_t pos, bool sync);
+	bool isSync(uint16_t pos) { return m_sync[pos >> 3] & (1 << (pos & 7)); };
+	uint16_t encodeSector(uint16_t pos, uint8_t track, uint8_t sector, const uint8_t *data, uint16_t gap);
+
+	static Drive1541 *m_active;
+#if defined(ESP32)
+	static void task(void *parameter);
+	bool m_stop = false;
+#endif
+};
+
+#endif // DEVICE_DRIVE_DRIVE1541_H
@@ -0,0 +1,148 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "drivecode.h"
+
+
+/********************************************************
+ * Transfer primitives
+ ********************************************************/
+
+void FastLoader::setLines(bool clk, bool data)
+{
+	if ( clk )
+		m_iec.protocol.release(IEC_PIN_CLK);
+	else
+		m_iec.protocol.pull(IEC_PIN_CLK);
+
+	if ( data )
+		m_iec.protocol.release(IEC_PIN_DATA);
+	else
+		m_iec.protocol.pull(IEC_PIN_DATA);
+}
+
+bool FastLoader::waitLine(uint8_t pin, bool state, size_t timeout)
+{
+	return m_iec.protocol.timeoutWait(pin, state, timeout) != TIMED_OUT;
+}
+
+bool FastLoader::sendATN(uint8_t b)
+{
+	bool atn = m_iec.protocol.status(IEC_PIN_ATN);
+	for ( uint8_t i = 0; i < 4; i++ )
+	{
+		atn = !atn;
+		if ( !waitLine(IEC_PIN_ATN, atn) )
+			return false;
+
+		setLines(b & 0x01, b & 0x02);
+		b >>= 2;
+	}
+
+	return true;
+}
+
+
+/********************************************************
+ * Loaders
+ ********************************************************/
+
+// Assembled from:
+//   $0300 stock vectors with IMAIN pointing at $0334
+//   $0334 SEI, IMAIN back to $A483, release the bus
+//         address and length from the drive, then the data
+//         CLI, RUN when it landed at $0801 else READY.
+//   $03A4 one byte, 4 times: toggle ATN, wait, shift in DATA/CLK
+static const uint8_t warp_stub[] = {
+	0x00, 0x03, 0x8B, 0xE3, 0x34, 0x03, 0x7C, 0xA5, 0x1A, 0xA7, 0xE4, 0xA7, 0x86, 0xAE, 0x00, 0x00,
+	0x00, 0x00, 0x4C, 0x48, 0xB2, 0x00, 0x31, 0xEA, 0x66, 0xFE, 0x47, 0xFE, 0x4A, 0xF3, 0x91, 0xF2,
+	0x0E, 0xF2, 0x50, 0xF2, 0x33, 0xF3, 0x57, 0xF1, 0xCA, 0xF1, 0xED, 0xF6, 0x3E, 0xF1, 0x2F, 0xF3,
+	0x66, 0xFE, 0xA5, 0xF4, 0xED, 0xF5, 0x78, 0xA9, 0x83, 0x8D, 0x02, 0x03, 0xA9, 0xA4, 0x8D, 0x03,
+	0x03, 0xAD, 0x00, 0xDD, 0x29, 0x07, 0x8D, 0x00, 0xDD, 0x20, 0xA4, 0x03, 0x85, 0xAE, 0x20, 0xA4,
+	0x03, 0x85, 0xAF, 0x20, 0xA4, 0x03, 0x85, 0xFC, 0x20, 0xA4, 0x03, 0x85, 0xFD, 0xA9, 0x00, 0x85,
+	0xFE, 0xA5, 0xAE, 0xC9, 0x01, 0xD0, 0x08, 0xA5, 0xAF, 0xC9, 0x08, 0xD0, 0x02, 0xE6, 0xFE, 0xA5,
+	0xFC, 0x05, 0xFD, 0xF0, 0x18, 0x20, 0xA4, 0x03, 0xA0, 0x00, 0x91, 0xAE, 0xE6, 0xAE, 0xD0, 0x02,
+	0xE6, 0xAF, 0xA5, 0xFC, 0xD0, 0x02, 0xC6, 0xFD, 0xC6, 0xFC, 0x4C, 0x6D, 0x03, 0x58, 0xA5, 0xFE,
+	0xF0, 0x11, 0xA5, 0xAE, 0x85, 0x2D, 0xA5, 0xAF, 0x85, 0x2E, 0x20, 0x33, 0xA5, 0x20, 0x59, 0xA6,
+	0x4C, 0xAE, 0xA7, 0x4C, 0x74, 0xA4, 0xA2, 0x04, 0xAD, 0x00, 0xDD, 0x49, 0x08, 0x8D, 0x00, 0xDD,
+	0xA0, 0x06, 0x88, 0xD0, 0xFD, 0xAD, 0x00, 0xDD, 0x29, 0xC0, 0x46, 0xFB, 0x46, 0xFB, 0x05, 0xFB,
+	0x85, 0xFB, 0xCA, 0xD0, 0xE3, 0x60,
+};
+
+std::string WarpLoader::bootStub(void)
+{
+	return std::string((const char *)warp_stub, sizeof(warp_stub));
+}
+
+bool WarpLoader::serve(FastLoadSession &session)
+{
+	if ( m_size < 3 )
+		return false;
+
+	// The stub owns ATN once the KERNAL is done with its UNLISTEN
+	setLines(true, true);
+	if ( !waitLine(IEC_PIN_ATN, RELEASED) )
+		return false;
+
+	size_t size = m_size - 2;
+	uint8_t header[4] = { m_program[0], m_program[1], (uint8_t)(size & 0xFF), (uint8_t)(size >> 8) };
+	for ( uint8_t i = 0; i < 4; i++ )
+	{
+		if ( !sendATN(header[i]) )
+			return false;
+	}
+
+	for ( size_t i = 2; i < m_size; i++ )
+	{
+		if ( !sendATN(m_program[i]) )
+			return false;
+		if ( (i bitand 0xFF) == 0 )
+			ledToggle(true);
+	}
+
+	setLines(true, true);
+	return true;
+}
+
+
+/********************************************************
+ * Uploads
+ ********************************************************/
+
+void DriveCode::reset(void)
+{
+	m_crc = 0xFFFFFFFF;
+	m_size = 0;
+}
+
+// CRC-32 over the uploaded bytes in the order they arrive
+void DriveCode::write(uint16_t address, const uint8_t *data, uint8_t len)
+{
+	for ( uint8_t i = 0; i < len; i++ )
+	{
+		m_crc ^= data[i];
+		for ( uint8_t bit = 0; bit < 8; bit++ )
+			m_crc = (m_crc >> 1) ^ (0xEDB88320 & -(m_crc & 1));
+	}
+	m_size += len;
+}
+
+void DriveCode::execute(uint16_t address)
+{
+	Debug_printv("Drive code: crc[%08X] address[%04X] size[%d]", crc(), address, m_size);
+	reset();
+}
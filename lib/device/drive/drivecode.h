@@ -0,0 +1,107 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// Drive code uploaded with M-W is CRC'd and logged with its start address
+// when M-E starts it, so the fastloaders worth implementing natively can be
+// found. There are none yet: each has to be checked against a capture of
+// its real drive code first, a guessed protocol corrupts loads.
+//
+// https://www.sd2iec.de/gitweb/?p=sd2iec.git;a=blob;f=README
+// https://codebase64.org/doku.php?id=base:loaders
+
+#ifndef DEVICE_DRIVE_DRIVECODE_H
+#define DEVICE_DRIVE_DRIVECODE_H
+
+#include "../../../include/global_defines.h"
+
+#include "iec.h"
+#include "meat_io.h"
+#include "disk/d64.h"
+
+#define FASTLOAD_TIMEOUT		1000000	// us the host may take between transfers
+
+// What a loader gets to work with
+struct FastLoadSession {
+	std::string url;			// file opened on channel 0, empty if none
+	MFile *directory;			// current directory for loaders that send a name
+	D64IStream *image;			// for sector based loaders, null unless on a disk image
+};
+
+class FastLoader
+{
+public:
+	FastLoader(IEC &iec) : m_iec(iec) {};
+	virtual ~FastLoader() {};
+
+	virtual const char *name(void) = 0;
+
+	// Serves the host until it is done with the loader
+	virtual bool serve(FastLoadSession &session) = 0;
+
+protected:
+	IEC &m_iec;
+
+	// 1 bits are released lines
+	void setLines(bool clk, bool data);
+	bool waitLine(uint8_t pin, bool state, size_t timeout = FASTLOAD_TIMEOUT);
+
+	// Two bits per ATN edge from the host, low bits first on CLK and DATA
+	bool sendATN(uint8_t b);
+};
+
+// Warp mode, no drive code at all: LOAD"*",8,1 gets a boot stub that
+// autostarts through the BASIC main loop vector and fetches the real
+// program two bits per ATN edge. The stub samples a fixed time after each
+// edge and can't wait, so the whole program is read into memory first.
+class WarpLoader: public FastLoader
+{
+public:
+	WarpLoader(IEC &iec, const uint8_t *program, size_t size) : FastLoader(iec), m_program(program), m_size(size) {};
+	const char *name(void) override { return "Warp"; };
+	bool serve(FastLoadSession &session) override;
+
+	// Loads at $0300 over the stock KERNAL vectors, the receiver sits in
+	// the cassette buffer so programs touching $0300-$03FF can't use it
+	static std::string bootStub(void);
+	static bool fits(uint16_t address, size_t size) { return size > 0 && (address >= 0x0400 || address + size <= 0x0300) && address + size <= 0x10000; };
+
+private:
+	const uint8_t *m_program;	// load address first
+	size_t m_size;
+};
+
+// Uploads since the last reset or M-E
+class DriveCode
+{
+public:
+	void reset(void);
+
+	// M-W, adds to the upload CRC
+	void write(uint16_t address, const uint8_t *data, uint8_t len);
+
+	// M-E, logs the upload and starts over
+	void execute(uint16_t address);
+
+	uint32_t crc(void) { return ~m_crc; };
+	size_t size(void) { return m_size; };
+
+private:
+	uint32_t m_crc = 0xFFFFFFFF;
+	size_t m_size = 0;
+};
+
+#endif // DEVICE_DRIVE_DRIVECODE_H
@@ -0,0 +1,419 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "mos6502.h"
+
+enum AddressMode : uint8_t
+{
+	IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABX, ABY, IND, IZX, IZY, REL
+};
+
+static const uint8_t modes[256] = {
+//  0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+	IMP, IZX, IMP, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, ACC, IMM, ABS, ABS, ABS, ABS,	// 0
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,	// 1
+	ABS, IZX, IMP, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, ACC, IMM, ABS, ABS, ABS, ABS,	// 2
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,	// 3
+	IMP, IZX, IMP, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, ACC, IMM, ABS, ABS, ABS, ABS,	// 4
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,	// 5
+	IMP, IZX, IMP, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, ACC, IMM, IND, ABS, ABS, ABS,	// 6
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,	// 7
+	IMM, IZX, IMM, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,	// 8
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPY, ZPY, IMP, ABY, IMP, ABY, ABX, ABX, ABY, ABY,	// 9
+	IMM, IZX, IMM, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,	// A
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPY, ZPY, IMP, ABY, IMP, ABY, ABX, ABX, ABY, ABY,	// B
+	IMM, IZX, IMM, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,	// C
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX,	// D
+	IMM, IZX, IMM, IZX, ZP,  ZP,  ZP,  ZP,  IMP, IMM, IMP, IMM, ABS, ABS, ABS, ABS,	// E
+	REL, IZY, IMP, IZY, ZPX, ZPX, ZPX, ZPX, IMP, ABY, IMP, ABY, ABX, ABX, ABX, ABX	// F
+};
+
+// Base cycles, page crossing and taken branches are added as they happen
+static const uint8_t timing[256] = {
+//  0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+	7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,	// 0
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 1
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,	// 2
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 3
+	6, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 3, 4, 6, 6,	// 4
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 5
+	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 5, 4, 6, 6,	// 6
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// 7
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,	// 8
+	2, 6, 2, 6, 4, 4, 4, 4, 2, 5, 2, 5, 5, 5, 5, 5,	// 9
+	2, 6, 2, 6, 3, 3, 3, 3, 2, 2, 2, 2, 4, 4, 4, 4,	// A
+	2, 5, 2, 5, 4, 4, 4, 4, 2, 4, 2, 4, 4, 4, 4, 4,	// B
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,	// C
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,	// D
+	2, 6, 2, 8, 3, 3, 5, 5, 2, 2, 2, 2, 4, 4, 6, 6,	// E
+	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7	// F
+};
+
+
+void MOS6502::reset(void)
+{
+	a = x = y = 0;
+	s = 0xFD;
+	p = FLAG_U | FLAG_I;
+	pc = read16(0xFFFC);
+	cycles = 0;
+	m_irq = false;
+	m_nmi = false;
+}
+
+void MOS6502::address(uint8_t mode)
+{
+	uint16_t base;
+
+	m_crossed = false;
+	switch (mode)
+	{
+		case IMM:
+		case REL:
+			m_address = pc++;
+			break;
+		case ZP:
+			m_address = read(pc++);
+			break;
+		case ZPX:
+			m_address = (read(pc++) + x) & 0xFF;
+			break;
+		case ZPY:
+			m_address = (read(pc++) + y) & 0xFF;
+			break;
+		case ABS:
+			m_address = read16(pc);
+			pc += 2;
+			break;
+		case ABX:
+			base = read16(pc);
+			pc += 2;
+			m_address = base + x;
+			m_crossed = (base ^ m_address) & 0xFF00;
+			break;
+		case ABY:
+			base = read16(pc);
+			pc += 2;
+			m_address = base + y;
+			m_crossed = (base ^ m_address) & 0xFF00;
+			break;
+		case IND:
+			// The high byte doesn't carry into the next page
+			base = read16(pc);
+			pc += 2;
+			m_address = read(base) | (read((base & 0xFF00) | ((base + 1) & 0xFF)) << 8);
+			break;
+		case IZX:
+			base = (read(pc++) + x) & 0xFF;
+			m_address = read(base) | (read((base + 1) & 0xFF) << 8);
+			break;
+		case IZY:
+			base = read(pc++);
+			base = read(base) | (read((base + 1) & 0xFF) << 8);
+			m_address = base + y;
+			m_crossed = (base ^ m_address) & 0xFF00;
+			break;
+		default:
+			break;
+	}
+}
+
+uint8_t MOS6502::branch(bool taken)
+{
+	int8_t offset = read(m_address);
+	if ( !taken )
+		return 0;
+
+	uint16_t target = pc + offset;
+	uint8_t extra = ((pc ^ target) & 0xFF00) ? 2 : 1;
+	pc = target;
+	return extra;
+}
+
+void MOS6502::interrupt(uint16_t vector, bool brk)
+{
+	push(pc >> 8);
+	push(pc & 0xFF);
+	push((p | FLAG_U | (brk ? FLAG_B : 0)) & ~(brk ? 0 : FLAG_B));
+	p |= FLAG_I;
+	pc = read16(vector);
+}
+
+void MOS6502::adc(uint8_t value)
+{
+	uint16_t sum = a + value + (p & FLAG_C);
+
+	if ( p & FLAG_D )
+	{
+		// NMOS decimal mode, Z comes from the binary result
+		uint16_t lo = (a & 0x0F) + (value & 0x0F) + (p & FLAG_C);
+		if ( lo > 9 )
+			lo += 6;
+		uint16_t hi = (a >> 4) + (value >> 4) + (lo > 0x0F);
+		setFlag(FLAG_Z, !(sum & 0xFF));
+		setFlag(FLAG_N, hi & 0x08);
+		setFlag(FLAG_V, ~(a ^ value) & (a ^ (hi << 4)) & 0x80);
+		if ( hi > 9 )
+			hi += 6;
+		setFlag(FLAG_C, hi > 0x0F);
+		a = (hi << 4) | (lo & 0x0F);
+		return;
+	}
+
+	setFlag(FLAG_C, sum > 0xFF);
+	setFlag(FLAG_V, ~(a ^ value) & (a ^ sum) & 0x80);
+	a = sum;
+	setNZ(a);
+}
+
+void MOS6502::sbc(uint8_t value)
+{
+	uint16_t diff = a - value - !(p & FLAG_C);
+
+	if ( p & FLAG_D )
+	{
+		// NMOS decimal mode, flags come from the binary result
+		int16_t lo = (a & 0x0F) - (value & 0x0F) - !(p & FLAG_C);
+		int16_t hi = (a >> 4) - (value >> 4);
+		if ( lo < 0 )
+		{
+			lo -= 6;
+			hi--;
+		}
+		if ( hi < 0 )
+			hi -= 6;
+		setFlag(FLAG_C, diff < 0x100);
+		setFlag(FLAG_V, (a ^ value) & (a ^ diff) & 0x80);
+		setNZ(diff);
+		a = (hi << 4) | (lo & 0x0F);
+		return;
+	}
+
+	setFlag(FLAG_C, diff < 0x100);
+	setFlag(FLAG_V, (a ^ value) & (a ^ diff) & 0x80);
+	a = diff;
+	setNZ(a);
+}
+
+void MOS6502::compare(uint8_t reg, uint8_t value)
+{
+	setFlag(FLAG_C, reg >= value);
+	setNZ(reg - value);
+}
+
+uint8_t MOS6502::asl(uint8_t value)
+{
+	setFlag(FLAG_C, value & 0x80);
+	value <<= 1;
+	setNZ(value);
+	return value;
+}
+
+uint8_t MOS6502::lsr(uint8_t value)
+{
+	setFlag(FLAG_C, value & 0x01);
+	value >>= 1;
+	setNZ(value);
+	return value;
+}
+
+uint8_t MOS6502::rol(uint8_t value)
+{
+	uint8_t carry = p & FLAG_C;
+	setFlag(FLAG_C, value & 0x80);
+	value = (value << 1) | carry;
+	setNZ(value);
+	return value;
+}
+
+uint8_t MOS6502::ror(uint8_t value)
+{
+	uint8_t carry = p & FLAG_C;
+	setFlag(FLAG_C, value & 0x01);
+	value = (value >> 1) | (carry << 7);
+	setNZ(value);
+	return value;
+}
+
+uint8_t MOS6502::step(void)
+{
+	if ( m_nmi )
+	{
+		m_nmi = false;
+		interrupt(0xFFFA, false);
+		cycles += 7;
+		return 7;
+	}
+
+	if ( m_irq && !(p & FLAG_I) )
+	{
+		interrupt(0xFFFE, false);
+		cycles += 7;
+		return 7;
+	}
+
+	uint8_t opcode = read(pc++);
+	uint8_t mode = modes[opcode];
+	uint8_t used = timing[opcode];
+	uint8_t value;
+
+	address(mode);
+
+	// Read instructions pay for crossing a page, stores and RMW already do
+	#define PENALTY() used += m_crossed
+	// Read-modify-write on memory or the accumulator
+	#define MODIFY(op) \
+		if ( mode == ACC ) a = op(a); \
+		else { value = read(m_address); write(m_address, value); write(m_address, op(value)); }
+
+	switch (opcode)
+	{
+		// Loads and stores
+		case 0xA9: case 0xA5: case 0xB5: case 0xAD: case 0xBD: case 0xB9: case 0xA1: case 0xB1:
+			a = read(m_address); setNZ(a); PENALTY(); break;
+		case 0xA2: case 0xA6: case 0xB6: case 0xAE: case 0xBE:
+			x = read(m_address); setNZ(x); PENALTY(); break;
+		case 0xA0: case 0xA4: case 0xB4: case 0xAC: case 0xBC:
+			y = read(m_address); setNZ(y); PENALTY(); break;
+		case 0x85: case 0x95: case 0x8D: case 0x9D: case 0x99: case 0x81: case 0x91:
+			write(m_address, a); break;
+		case 0x86: case 0x96: case 0x8E:
+			write(m_address, x); break;
+		case 0x84: case 0x94: case 0x8C:
+			write(m_address, y); break;
+
+		// Transfers
+		case 0xAA: x = a; setNZ(x); break;
+		case 0xA8: y = a; setNZ(y); break;
+		case 0x8A: a = x; setNZ(a); break;
+		case 0x98: a = y; setNZ(a); break;
+		case 0xBA: x = s; setNZ(x); break;
+		case 0x9A: s = x; break;
+
+		// Stack
+		case 0x48: push(a); break;
+		case 0x68: a = pull(); setNZ(a); break;
+		case 0x08: push(p | FLAG_B | FLAG_U); break;
+		case 0x28: p = (pull() & ~FLAG_B) | FLAG_U; break;
+
+		// Logic and arithmetic
+		case 0x29: case 0x25: case 0x35: case 0x2D: case 0x3D: case 0x39: case 0x21: case 0x31:
+			a &= read(m_address); setNZ(a); PENALTY(); break;
+		case 0x09: case 0x05: case 0x15: case 0x0D: case 0x1D: case 0x19: case 0x01: case 0x11:
+			a |= read(m_address); setNZ(a); PENALTY(); break;
+		case 0x49: case 0x45: case 0x55: case 0x4D: case 0x5D: case 0x59: case 0x41: case 0x51:
+			a ^= read(m_address); setNZ(a); PENALTY(); break;
+		case 0x69: case 0x65: case 0x75: case 0x6D: case 0x7D: case 0x79: case 0x61: case 0x71:
+			adc(read(m_address)); PENALTY(); break;
+		case 0xE9: case 0xEB: case 0xE5: case 0xF5: case 0xED: case 0xFD: case 0xF9: case 0xE1: case 0xF1:
+			sbc(read(m_address)); PENALTY(); break;
+		case 0xC9: case 0xC5: case 0xD5: case 0xCD: case 0xDD: case 0xD9: case 0xC1: case 0xD1:
+			compare(a, read(m_address)); PENALTY(); break;
+		case 0xE0: case 0xE4: case 0xEC:
+			compare(x, read(m_address)); break;
+		case 0xC0: case 0xC4: case 0xCC:
+			compare(y, read(m_address)); break;
+		case 0x24: case 0x2C:
+			value = read(m_address);
+			p = (p & ~(FLAG_N | FLAG_V | FLAG_Z)) | (value & (FLAG_N | FLAG_V)) | ((a & value) ? 0 : FLAG_Z);
+			break;
+
+		// Increments and decrements
+		case 0xE6: case 0xF6: case 0xEE: case 0xFE:
+			value = read(m_address); write(m_address, value); write(m_address, ++value); setNZ(value); break;
+		case 0xC6: case 0xD6: case 0xCE: case 0xDE:
+			value = read(m_address); write(m_address, value); write(m_address, --value); setNZ(value); break;
+		case 0xE8: setNZ(++x); break;
+		case 0xC8: setNZ(++y); break;
+		case 0xCA: setNZ(--x); break;
+		case 0x88: setNZ(--y); break;
+
+		// Shifts
+		case 0x0A: case 0x06: case 0x16: case 0x0E: case 0x1E: MODIFY(asl); break;
+		case 0x4A: case 0x46: case 0x56: case 0x4E: case 0x5E: MODIFY(lsr); break;
+		case 0x2A: case 0x26: case 0x36: case 0x2E: case 0x3E: MODIFY(rol); break;
+		case 0x6A: case 0x66: case 0x76: case 0x6E: case 0x7E: MODIFY(ror); break;
+
+		// Jumps and calls
+		case 0x4C: case 0x6C: pc = m_address; break;
+		case 0x20:
+			pc--;
+			push(pc >> 8);
+			push(pc & 0xFF);
+			pc = m_address;
+			break;
+		case 0x60: pc = pull(); pc |= pull() << 8; pc++; break;
+		case 0x40:
+			p = (pull() & ~FLAG_B) | FLAG_U;
+			pc = pull();
+			pc |= pull() << 8;
+			break;
+		case 0x00:
+			pc++;
+			interrupt(0xFFFE, true);
+			break;
+
+		// Branches
+		case 0x10: used += branch(!(p & FLAG_N)); break;
+		case 0x30: used += branch(p & FLAG_N); break;
+		case 0x50: used += branch(!(p & FLAG_V)); break;
+		case 0x70: used += branch(p & FLAG_V); break;
+		case 0x90: used += branch(!(p & FLAG_C)); break;
+		case 0xB0: used += branch(p & FLAG_C); break;
+		case 0xD0: used += branch(!(p & FLAG_Z)); break;
+		case 0xF0: used += branch(p & FLAG_Z); break;
+
+		// Flags
+		case 0x18: p &= ~FLAG_C; break;
+		case 0x38: p |= FLAG_C; break;
+		case 0x58: p &= ~FLAG_I; break;
+		case 0x78: p |= FLAG_I; break;
+		case 0xB8: p &= ~FLAG_V; break;
+		case 0xD8: p &= ~FLAG_D; break;
+		case 0xF8: p |= FLAG_D; break;
+
+		// Undocumented but stable
+		case 0xA7: case 0xB7: case 0xAF: case 0xBF: case 0xA3: case 0xB3:
+			a = x = read(m_address); setNZ(a); PENALTY(); break;
+		case 0x87: case 0x97: case 0x8F: case 0x83:
+			write(m_address, a & x); break;
+		case 0xC7: case 0xD7: case 0xCF: case 0xDF: case 0xDB: case 0xC3: case 0xD3:
+			value = read(m_address) - 1; write(m_address, value); compare(a, value); break;
+		case 0xE7: case 0xF7: case 0xEF: case 0xFF: case 0xFB: case 0xE3: case 0xF3:
+			value = read(m_address) + 1; write(m_address, value); sbc(value); break;
+		case 0x07: case 0x17: case 0x0F: case 0x1F: case 0x1B: case 0x03: case 0x13:
+			value = asl(read(m_address)); write(m_address, value); a |= value; setNZ(a); break;
+		case 0x27: case 0x37: case 0x2F: case 0x3F: case 0x3B: case 0x23: case 0x33:
+			value = rol(read(m_address)); write(m_address, value); a &= value; setNZ(a); break;
+		case 0x47: case 0x57: case 0x4F: case 0x5F: case 0x5B: case 0x43: case 0x53:
+			value = lsr(read(m_address)); write(m_address, value); a ^= value; setNZ(a); break;
+		case 0x67: case 0x77: case 0x6F: case 0x7F: case 0x7B: case 0x63: case 0x73:
+			value = ror(read(m_address)); write(m_address, value); adc(value); break;
+
+		// NOP, the multi byte NOPs already skipped their operand
+		case 0x1C: case 0x3C: case 0x5C: case 0x7C: case 0xDC: case 0xFC:
+			PENALTY(); break;
+		default:
+			break;
+	}
+
+	#undef PENALTY
+	#undef MODIFY
+
+	cycles += used;
+	return used;
+}
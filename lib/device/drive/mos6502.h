@@ -0,0 +1,105 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// http://www.6502.org/tutorials/6502opcodes.html
+// https://www.masswerk.at/6502/6502_instruction_set.html
+// http://www.oxyron.de/html/opcodes02.html
+
+#ifndef DEVICE_DRIVE_MOS6502_H
+#define DEVICE_DRIVE_MOS6502_H
+
+#include <stdint.h>
+
+// Whatever the CPU is wired to
+class MOS6502Bus
+{
+public:
+	virtual uint8_t read(uint16_t address) = 0;
+	virtual void write(uint16_t address, uint8_t value) = 0;
+};
+
+// NMOS 6502 with instruction level cycle counts, page crossing and branch
+// penalties included. The stable undocumented opcodes some drive code relies
+// on (LAX SAX DCP ISC SLO RLA SRE RRA) are there, the rest run as NOPs.
+class MOS6502
+{
+public:
+	MOS6502(MOS6502Bus &bus) : m_bus(bus) {};
+
+	uint8_t a = 0;
+	uint8_t x = 0;
+	uint8_t y = 0;
+	uint8_t s = 0xFD;
+	uint8_t p = 0x24;
+	uint16_t pc = 0;
+	uint64_t cycles = 0;	// total since reset
+
+	void reset(void);
+
+	// Runs one instruction, or takes a pending interrupt, returns its cycles
+	uint8_t step(void);
+
+	void irq(bool line) { m_irq = line; };	// level triggered
+	void nmi(void) { m_nmi = true; };		// edge triggered
+	void setOverflow(void) { p |= FLAG_V; };	// SO pin, BYTE READY on the 1541
+
+private:
+	enum {
+		FLAG_C = 0x01,
+		FLAG_Z = 0x02,
+		FLAG_I = 0x04,
+		FLAG_D = 0x08,
+		FLAG_B = 0x10,
+		FLAG_U = 0x20,
+		FLAG_V = 0x40,
+		FLAG_N = 0x80
+	};
+
+	MOS6502Bus &m_bus;
+	bool m_irq = false;
+	bool m_nmi = false;
+
+	uint16_t m_address = 0;		// effective address of the current instruction
+	bool m_crossed = false;		// indexing crossed a page
+
+	inline uint8_t read(uint16_t address) { return m_bus.read(address); };
+	inline void write(uint16_t address, uint8_t value) { m_bus.write(address, value); };
+	inline uint16_t read16(uint16_t address) { return read(address) | (read(address + 1) << 8); };
+	inline void push(uint8_t value) { write(0x100 | s--, value); };
+	inline uint8_t pull(void) { return read(0x100 | ++s); };
+
+	inline void setNZ(uint8_t value) {
+		p = (p & ~(FLAG_N | FLAG_Z)) | (value & FLAG_N) | (value ? 0 : FLAG_Z);
+	};
+	inline void setFlag(uint8_t flag, bool on) {
+		p = on ? (p | flag) : (p & ~flag);
+	};
+
+	void address(uint8_t mode);
+	uint8_t branch(bool taken);
+	void interrupt(uint16_t vector, bool brk);
+
+	void adc(uint8_t value);
+	void sbc(uint8_t value);
+	void compare(uint8_t reg, uint8_t value);
+	uint8_t asl(uint8_t value);
+	uint8_t lsr(uint8_t value);
+	uint8_t rol(uint8_t value);
+	uint8_t ror(uint8_t value);
+};
+
+#endif // DEVICE_DRIVE_MOS6502_H
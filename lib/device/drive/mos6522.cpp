@@ -0,0 +1,187 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "mos6522.h"
+
+void MOS6522::reset(void)
+{
+	m_ora = m_orb = 0;
+	m_ddra = m_ddrb = 0;
+	m_t1 = m_t1_latch = 0xFFFF;
+	m_t2 = 0xFFFF;
+	m_t2_latch = 0xFF;
+	m_t1_armed = m_t2_armed = false;
+	m_sr = m_acr = m_pcr = 0;
+	m_ifr = m_ier = 0;
+}
+
+uint8_t MOS6522::read(uint8_t reg)
+{
+	switch (reg & 0x0F)
+	{
+		case ORB:
+			m_ifr &= ~(IRQ_CB1 | IRQ_CB2);
+			return portB();
+		case ORA:
+			m_ifr &= ~(IRQ_CA1 | IRQ_CA2);
+			// fall through
+		case ORA_NH:
+			return ( m_acr & 0x01 ) ? m_ira : portA();
+		case DDRB:
+			return m_ddrb;
+		case DDRA:
+			return m_ddra;
+		case T1CL:
+			m_ifr &= ~IRQ_T1;
+			return m_t1 & 0xFF;
+		case T1CH:
+			return m_t1 >> 8;
+		case T1LL:
+			return m_t1_latch & 0xFF;
+		case T1LH:
+			return m_t1_latch >> 8;
+		case T2CL:
+			m_ifr &= ~IRQ_T2;
+			return m_t2 & 0xFF;
+		case T2CH:
+			return m_t2 >> 8;
+		case SR:
+			return m_sr;
+		case ACR:
+			return m_acr;
+		case PCR:
+			return m_pcr;
+		case IFR:
+			return m_ifr | (irq() ? 0x80 : 0);
+		case IER:
+			return m_ier | 0x80;
+	}
+
+	return 0xFF;
+}
+
+void MOS6522::write(uint8_t reg, uint8_t value)
+{
+	switch (reg & 0x0F)
+	{
+		case ORB:
+			m_ifr &= ~(IRQ_CB1 | IRQ_CB2);
+			m_orb = value;
+			break;
+		case ORA:
+			m_ifr &= ~(IRQ_CA1 | IRQ_CA2);
+			// fall through
+		case ORA_NH:
+			m_ora = value;
+			break;
+		case DDRB:
+			m_ddrb = value;
+			break;
+		case DDRA:
+			m_ddra = value;
+			break;
+		case T1CL:
+		case T1LL:
+			m_t1_latch = (m_t1_latch & 0xFF00) | value;
+			break;
+		case T1CH:
+			// Loads the counter and starts it
+			m_t1_latch = (m_t1_latch & 0x00FF) | (value << 8);
+			m_t1 = m_t1_latch;
+			m_ifr &= ~IRQ_T1;
+			m_t1_armed = true;
+			break;
+		case T1LH:
+			m_t1_latch = (m_t1_latch & 0x00FF) | (value << 8);
+			m_ifr &= ~IRQ_T1;
+			break;
+		case T2CL:
+			m_t2_latch = value;
+			break;
+		case T2CH:
+			m_t2 = m_t2_latch | (value << 8);
+			m_ifr &= ~IRQ_T2;
+			m_t2_armed = true;
+			break;
+		case SR:
+			m_sr = value;
+			break;
+		case ACR:
+			m_acr = value;
+			break;
+		case PCR:
+			m_pcr = value;
+			break;
+		case IFR:
+			// Writing ones clears flags
+			m_ifr &= ~(value & 0x7F);
+			break;
+		case IER:
+			if ( value & 0x80 )
+				m_ier |= value & 0x7F;
+			else
+				m_ier &= ~(value & 0x7F);
+			break;
+	}
+}
+
+void MOS6522::tick(uint8_t cycles)
+{
+	// Timer 1, free running reloads from the latch
+	if ( m_t1 < cycles )
+	{
+		if ( m_t1_armed )
+		{
+			m_ifr |= IRQ_T1;
+			m_t1_armed = ( m_acr & 0x40 );
+		}
+		uint16_t over = cycles - m_t1 - 1;
+		m_t1 = ( m_acr & 0x40 ) ? m_t1_latch - (over % (m_t1_latch + 2)) : 0xFFFF - over;
+	}
+	else
+		m_t1 -= cycles;
+
+	// Timer 2 one shot, counting PB6 pulses isn't used by the 1541
+	if ( !(m_acr & 0x20) )
+	{
+		if ( m_t2 < cycles )
+		{
+			if ( m_t2_armed )
+				m_ifr |= IRQ_T2;
+			m_t2_armed = false;
+		}
+		m_t2 -= cycles;
+	}
+}
+
+void MOS6522::setCA1(bool level)
+{
+	// PCR bit 0 selects the active edge, 1 for rising
+	if ( level != m_ca1 && level == (m_pcr & 0x01) )
+	{
+		m_ifr |= IRQ_CA1;
+		m_ira = input_a;
+	}
+	m_ca1 = level;
+}
+
+void MOS6522::setCB1(bool level)
+{
+	if ( level != m_cb1 && level == ((m_pcr >> 4) & 0x01) )
+		m_ifr |= IRQ_CB1;
+	m_cb1 = level;
+}
@@ -0,0 +1,86 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// http://archive.6502.org/datasheets/mos_6522_preliminary_nov_1977.pdf
+// http://www.zimmers.net/anonftp/pub/cbm/documents/chipdata/6522-VIA.txt
+
+#ifndef DEVICE_DRIVE_MOS6522_H
+#define DEVICE_DRIVE_MOS6522_H
+
+#include <stdint.h>
+
+// VIA 6522 ports, both timers, CA1/CB1 edges and CA2/CB2 manual output.
+// The shift register is not used by the 1541 and not emulated.
+class MOS6522
+{
+public:
+	enum Register {
+		ORB = 0, ORA, DDRB, DDRA, T1CL, T1CH, T1LL, T1LH,
+		T2CL, T2CH, SR, ACR, PCR, IFR, IER, ORA_NH
+	};
+
+	enum Interrupt {
+		IRQ_CA2 = 0x01,
+		IRQ_CA1 = 0x02,
+		IRQ_SR = 0x04,
+		IRQ_CB2 = 0x08,
+		IRQ_CB1 = 0x10,
+		IRQ_T2 = 0x20,
+		IRQ_T1 = 0x40
+	};
+
+	// Levels on the pins driven from outside, outputs override them
+	uint8_t input_a = 0xFF;
+	uint8_t input_b = 0xFF;
+
+	void reset(void);
+	uint8_t read(uint8_t reg);
+	void write(uint8_t reg, uint8_t value);
+	void tick(uint8_t cycles);
+
+	uint8_t portA(void) { return (m_ora & m_ddra) | (input_a & ~m_ddra); };
+	uint8_t portB(void) { return (m_orb & m_ddrb) | (input_b & ~m_ddrb); };
+
+	void setCA1(bool level);
+	void setCB1(bool level);
+	bool CA2(void) { return (m_pcr & 0x0E) != 0x0C; };	// high unless held low
+	bool CB2(void) { return (m_pcr & 0xE0) != 0xC0; };
+
+	bool irq(void) { return m_ifr & m_ier & 0x7F; };
+
+private:
+	uint8_t m_ora = 0;
+	uint8_t m_orb = 0;
+	uint8_t m_ddra = 0;
+	uint8_t m_ddrb = 0;
+	uint8_t m_ira = 0;		// latched on CA1 when enabled in ACR
+	uint16_t m_t1 = 0xFFFF;
+	uint16_t m_t1_latch = 0xFFFF;
+	uint16_t m_t2 = 0xFFFF;
+	uint8_t m_t2_latch = 0xFF;
+	bool m_t1_armed = false;
+	bool m_t2_armed = false;
+	uint8_t m_sr = 0;
+	uint8_t m_acr = 0;
+	uint8_t m_pcr = 0;
+	uint8_t m_ifr = 0;
+	uint8_t m_ier = 0;
+	bool m_ca1 = true;
+	bool m_cb1 = true;
+};
+
+#endif // DEVICE_DRIVE_MOS6522_H
@@ -0,0 +1,166 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "prefetch.h"
+
+#include "string_utils.h"
+#include "wrappers/read_ahead.h"
+
+MIStream *Prefetcher::open(const std::string &url, const std::string &directory)
+{
+	MIStream *istream = nullptr;
+
+	if ( m_ready && m_url == url )
+	{
+		hits++;
+		if ( m_from_learned )
+			learned_hits++;
+		istream = new MemoryIStream(m_data);
+	}
+	else
+		misses++;
+
+	Debug_printv("url[%s] hit[%d] hits[%d] misses[%d]", url.c_str(), istream != nullptr, hits, misses);
+
+	if ( m_last.size() && m_directory == directory && m_last != url )
+		learn(m_last, url);
+
+	m_last = url;
+	m_directory = directory;
+	predict();
+	return istream;
+}
+
+void Prefetcher::clear(void)
+{
+	m_state = IDLE;
+	m_istream.reset();
+	m_dir.reset();
+	m_url.clear();
+	m_data.reset();
+	m_ready = false;
+}
+
+void Prefetcher::learn(const std::string &from, const std::string &to)
+{
+	for ( auto it = m_learned.begin(); it != m_learned.end(); it++ )
+	{
+		if ( it->from == from )
+		{
+			it->to = to;
+			m_learned.splice(m_learned.begin(), m_learned, it);
+			return;
+		}
+	}
+
+	if ( m_learned.size() >= PREFETCH_LEARNED )
+		m_learned.pop_back();
+	m_learned.push_front( { from, to } );
+}
+
+void Prefetcher::predict(void)
+{
+	clear();
+
+	// Local files load at bus speed anyway, only the network is worth the RAM
+	std::unique_ptr<MFile> last(MFSOwner::File(m_last));
+	if ( !ReadAheadIStream::network(last.get()) )
+		return;
+
+	for ( auto &sequence : m_learned )
+	{
+		if ( sequence.from == m_last )
+		{
+			m_predicted = sequence.to;
+			m_from_learned = true;
+			m_state = FETCH;
+			return;
+		}
+	}
+
+	// Nothing learned yet, find the program after this one
+	m_from_learned = false;
+	m_dir.reset(MFSOwner::File(m_directory));
+	m_found_last = false;
+	m_state = ( m_dir != nullptr ) ? SCAN : IDLE;
+}
+
+void Prefetcher::step(void)
+{
+	if ( m_state == SCAN )
+		scan();
+	else if ( m_state == FETCH )
+		fetch();
+}
+
+// One directory entry per step
+void Prefetcher::scan(void)
+{
+	std::unique_ptr<MFile> entry(m_dir->getNextFileInDir());
+	if ( entry == nullptr )
+	{
+		m_dir.reset();
+		m_state = IDLE;
+		return;
+	}
+
+	if ( !m_found_last )
+	{
+		m_found_last = ( entry->url == m_last );
+		return;
+	}
+
+	if ( mstr::startsWith(entry->extension, "prg") && entry->size() <= PREFETCH_SIZE )
+	{
+		m_predicted = entry->url;
+		m_dir.reset();
+		m_state = FETCH;
+	}
+}
+
+// One chunk per step, the file is only used once it is complete
+void Prefetcher::fetch(void)
+{
+	if ( m_istream == nullptr )
+	{
+		std::unique_ptr<MFile> file(MFSOwner::File(m_predicted));
+		m_istream.reset(file ? file->inputStream() : nullptr);
+		if ( m_istream == nullptr || !m_istream->isOpen() || m_istream->size() > PREFETCH_SIZE )
+		{
+			m_istream.reset();
+			m_state = IDLE;
+			return;
+		}
+
+		m_url = m_predicted;
+		m_data = std::make_shared<std::string>();
+		m_data->reserve(m_istream->size());
+		m_ready = false;
+	}
+
+	uint8_t buffer[PREFETCH_CHUNK];
+	size_t count = m_istream->read(buffer, sizeof(buffer));
+	m_data->append((const char *)buffer, count);
+
+	if ( count == 0 || m_data->size() > PREFETCH_SIZE )
+	{
+		m_ready = ( count == 0 && m_data->size() > 0 );
+		m_istream.reset();
+		m_state = IDLE;
+		Debug_printv("url[%s] ready[%d] size[%d]", m_url.c_str(), m_ready, m_data->size());
+	}
+}
@@ -0,0 +1,91 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// Multi part loads: while the C64 runs one part, the part most likely
+// loaded next is read into RAM. Which one is learned from earlier runs,
+// the next program in directory order is the guess until then.
+
+#ifndef DEVICE_DRIVE_PREFETCH_H
+#define DEVICE_DRIVE_PREFETCH_H
+
+#include "../../../include/global_defines.h"
+
+#include <list>
+
+#include "meat_io.h"
+
+#if defined(ESP32)
+#define PREFETCH_SIZE		65536	// largest file prefetched
+#else
+#define PREFETCH_SIZE		8192
+#endif
+#define PREFETCH_LEARNED	32		// load sequences remembered
+#define PREFETCH_CHUNK		256		// bytes read per idle step
+
+class Prefetcher
+{
+public:
+	// A LOAD (secondary address 0) of url from directory, returns the
+	// prefetched file or nullptr
+	MIStream *open(const std::string &url, const std::string &directory);
+
+	// A small piece of the work at a time, call while the bus is idle
+	void step(void);
+
+	// Anything written may have changed what was prefetched
+	void clear(void);
+
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	uint32_t learned_hits = 0;	// hits from a learned sequence, not directory order
+
+private:
+	// Urls include the image or directory they are in
+	struct Sequence {
+		std::string from;
+		std::string to;
+	};
+	std::list<Sequence> m_learned;		// most recently confirmed first
+
+	enum State {
+		IDLE,
+		SCAN,		// walking the directory for the file after m_last
+		FETCH,		// reading m_predicted
+	};
+	State m_state = IDLE;
+
+	std::string m_last;				// last url loaded
+	std::string m_directory;
+	std::string m_predicted;
+	bool m_from_learned = false;
+
+	std::unique_ptr<MFile> m_dir;
+	bool m_found_last = false;
+	std::unique_ptr<MIStream> m_istream;
+
+	// The one file prefetched, complete once m_ready
+	std::string m_url;
+	std::shared_ptr<std::string> m_data;
+	bool m_ready = false;
+
+	void learn(const std::string &from, const std::string &to);
+	void predict(void);
+	void scan(void);
+	void fetch(void);
+};
+
+#endif // DEVICE_DRIVE_PREFETCH_H
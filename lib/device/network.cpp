@@ -0,0 +1,424 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "network.h"
+
+using namespace CBM;
+using namespace Protocol;
+
+
+/********************************************************
+ * Ring
+ ********************************************************/
+
+bool NetRing::begin(void)
+{
+	m_ring.reset(new (std::nothrow) uint8_t[NETWORK_RING_SIZE]);
+	m_head = m_tail = 0;
+	return m_ring != nullptr;
+}
+
+size_t NetRing::put(const uint8_t *data, size_t len)
+{
+	if ( len > room() )
+		len = room();
+
+	for ( size_t i = 0; i < len; i++ )
+		m_ring[(m_head + i) bitand (NETWORK_RING_SIZE - 1)] = data[i];
+	m_head += len;
+	return len;
+}
+
+size_t NetRing::peek(uint8_t *data, size_t len)
+{
+	if ( len > available() )
+		len = available();
+
+	for ( size_t i = 0; i < len; i++ )
+		data[i] = m_ring[(m_tail + i) bitand (NETWORK_RING_SIZE - 1)];
+	return len;
+}
+
+
+/********************************************************
+ * Connections
+ ********************************************************/
+
+bool NetChannel::open(std::string url)
+{
+	m_url = url;
+	if ( mstr::startsWith(url, "tcp://", false) )
+		m_protocol = NET_TCP;
+	else if ( mstr::startsWith(url, "udp://", false) )
+		m_protocol = NET_UDP;
+	else if ( mstr::startsWith(url, "http://", false) )
+		m_protocol = NET_HTTP;
+	else
+	{
+		message = "UNKNOWN PROTOCOL";
+		return false;
+	}
+
+	if ( !rx.begin() || !tx.begin() )
+	{
+		message = "OUT OF MEMORY";
+		return false;
+	}
+
+	// host[:port]/path, HTTP/1.0 so the body is never chunked
+	if ( m_protocol == NET_HTTP )
+	{
+		std::string address = url.substr(7);
+		size_t slash = address.find('/');
+		m_path = ( slash == std::string::npos ) ? "/" : address.substr(slash);
+		m_host = address.substr(0, slash);
+		size_t colon = m_host.rfind(':');
+		m_port = ( colon == std::string::npos ) ? 80 : atoi(m_host.substr(colon + 1).c_str());
+		m_host = m_host.substr(0, colon);
+		m_line.clear();
+		m_code = 0;
+		m_body = false;
+	}
+	else
+	{
+		// host:port after the scheme, no host means listen on the port
+		std::string address = url.substr(6);
+		size_t colon = address.rfind(':');
+		if ( colon == std::string::npos )
+		{
+			message = "NO PORT";
+			return false;
+		}
+		m_host = address.substr(0, colon);
+		m_port = atoi(address.substr(colon + 1).c_str());
+		if ( m_protocol == NET_TCP && m_host.empty() )
+			m_protocol = NET_LISTEN;
+	}
+
+	message = "OK";
+	return true;
+}
+
+void NetChannel::close(void)
+{
+	m_client.stop();
+	m_udp.stop();
+	m_server.reset();
+	m_body = false;
+	m_started = false;
+}
+
+void NetChannel::start(void)
+{
+	m_started = true;
+
+	switch ( m_protocol )
+	{
+		case NET_TCP:
+		case NET_HTTP:
+			// Only the connect blocks, for up to NETWORK_CONNECT_TIMEOUT
+#if defined(ESP32)
+			if ( !m_client.connect(m_host.c_str(), m_port, NETWORK_CONNECT_TIMEOUT) )
+#else
+			m_client.setTimeout(NETWORK_CONNECT_TIMEOUT);
+			if ( !m_client.connect(m_host.c_str(), m_port) )
+#endif
+			{
+				message = "CONNECT FAILED";
+				break;
+			}
+			m_client.setNoDelay(true);
+
+			// A request this small goes out without waiting
+			if ( m_protocol == NET_HTTP )
+			{
+				std::string request = mstr::format("GET %s HTTP/1.0\r\nHost: %s\r\nUser-Agent: %s\r\nConnection: close\r\n\r\n",
+					m_path.c_str(), m_host.c_str(), USER_AGENT);
+				m_client.write((const uint8_t *)request.data(), request.size());
+			}
+			break;
+
+		case NET_LISTEN:
+			m_server.reset(new WiFiServer(m_port));
+			m_server->begin();
+			message = "LISTENING";
+			break;
+
+		case NET_UDP:
+			m_udp.begin(m_port);
+			break;
+	}
+
+	Debug_printv("url[%s] message[%s]", m_url.c_str(), message.c_str());
+}
+
+void NetChannel::poll(void)
+{
+	if ( !m_started )
+		start();
+
+	switch ( m_protocol )
+	{
+		case NET_TCP:
+		case NET_LISTEN:
+			pollClient();
+			break;
+		case NET_UDP:
+			pollUDP();
+			break;
+		case NET_HTTP:
+			pollHTTP();
+			break;
+	}
+}
+
+void NetChannel::pollClient(void)
+{
+	uint8_t buffer[128];
+
+	// One caller at a time, a new one is taken once the last hung up
+	if ( m_server && !m_client.connected() )
+	{
+		WiFiClient client = m_server->available();
+		if ( client )
+		{
+			m_client = client;
+			m_client.setNoDelay(true);
+			message = "CONNECTED";
+		}
+	}
+
+	while ( tx.available() && m_client.connected() )
+	{
+		size_t count = tx.peek(buffer, sizeof(buffer));
+		size_t written = m_client.write(buffer, count);
+		tx.consume(written);
+		if ( written < count )
+			break;
+	}
+
+	while ( rx.room() && m_client.available() > 0 )
+	{
+		size_t count = ( rx.room() < sizeof(buffer) ) ? rx.room() : sizeof(buffer);
+		int got = m_client.read(buffer, count);
+		if ( got <= 0 )
+			break;
+		rx.put(buffer, got);
+	}
+}
+
+void NetChannel::pollUDP(void)
+{
+	uint8_t buffer[128];
+
+	// What was queued since the last poll goes out as one datagram
+	if ( tx.available() && !m_host.empty() )
+	{
+		m_udp.beginPacket(m_host.c_str(), m_port);
+		while ( tx.available() )
+		{
+			size_t count = tx.peek(buffer, sizeof(buffer));
+			m_udp.write(buffer, count);
+			tx.consume(count);
+		}
+		m_udp.endPacket();
+	}
+
+	// Datagrams that don't fit are cut short
+	if ( m_udp.parsePacket() > 0 )
+	{
+		int got;
+		while ( (got = m_udp.read(buffer, sizeof(buffer))) > 0 )
+			rx.put(buffer, got);
+	}
+}
+
+void NetChannel::pollHTTP(void)
+{
+	// PRINT# on a request has nowhere to go
+	tx.consume(tx.available());
+
+	// Only the headers that arrived so far, an empty line ends them
+	while ( !m_body && m_client.available() > 0 )
+	{
+		int c = m_client.read();
+		if ( c < 0 )
+			break;
+
+		if ( c == '\n' )
+		{
+			if ( m_code == 0 )
+			{
+				// "HTTP/1.1 200 OK"
+				size_t space = m_line.find(' ');
+				m_code = ( space != std::string::npos ) ? atoi(m_line.c_str() + space + 1) : 1;
+				if ( m_code < 200 || m_code > 299 )
+					message = mstr::format("HTTP %d", m_code);
+			}
+			else if ( m_line.empty() )
+				m_body = true;
+			m_line.clear();
+		}
+		else if ( c != '\r' && m_line.size() < NETWORK_HEADER_SIZE )
+			m_line += (char)c;
+	}
+
+	if ( m_body )
+		pollClient();
+}
+
+bool NetChannel::connected(void)
+{
+	switch ( m_protocol )
+	{
+		case NET_TCP:
+		case NET_LISTEN:
+			return m_client.connected();
+		case NET_UDP:
+			return m_started;
+		case NET_HTTP:
+			return m_client.connected() || m_client.available() > 0;
+	}
+
+	return false;
+}
+
+
+/********************************************************
+ * Device
+ ********************************************************/
+
+devNetwork::devNetwork(IEC &iec) : iecDevice(iec)
+{
+} // ctor
+
+void devNetwork::poll(void)
+{
+	for ( auto &channel : m_channels )
+	{
+		if ( channel )
+			channel->poll();
+	}
+} // poll
+
+void devNetwork::handleOpen(IEC::Data &iec_data)
+{
+	Debug_printv("OPEN network (%.2d Device) (%.2d Channel)", iec_data.device, iec_data.channel);
+
+	// Reopening a channel hangs up whatever it had open before
+	if ( channel(iec_data.channel) )
+	{
+		m_channels[iec_data.channel]->close();
+		m_channels[iec_data.channel].reset();
+	}
+} // handleOpen
+
+void devNetwork::handleListenCommand(IEC::Data &iec_data)
+{
+	std::string content = iec_data.content;
+
+	if ( iec_data.channel == CMD_CHANNEL )
+	{
+		// "S" + channel picks the channel the status is about
+		if ( content.size() == 2 && content[0] == 'S' && (uint8_t)content[1] < CMD_CHANNEL )
+			m_status_channel = content[1];
+		return;
+	}
+
+	// The connection is made by poll(), the bus doesn't wait for it
+	mstr::toASCII(content);
+	auto net = new NetChannel();
+	m_channels[iec_data.channel].reset(net);
+	m_status_channel = iec_data.channel;
+	if ( !net->open(content) )
+		Debug_printv("url[%s] %s", content.c_str(), net->message.c_str());
+} // handleListenCommand
+
+void devNetwork::handleListenData(void)
+{
+	bool done = false;
+	uint8_t b;
+
+	// Only the ring is touched here, bytes that don't fit are counted and dropped
+	NetChannel *net = channel(m_iec_data.channel);
+	m_status_channel = m_iec_data.channel;
+	do
+	{
+		b = m_iec.receive();
+		uint8_t f = m_iec.state();
+		if ( f bitand ERROR )
+			break;
+
+		if ( net == nullptr || net->tx.put(&b, 1) == 0 )
+		{
+			if ( net )
+				net->dropped++;
+		}
+
+		done = (f bitand EOI_RECVD);
+	} while (not done);
+} // handleListenData
+
+void devNetwork::handleTalk(byte chan)
+{
+	uint8_t buffer[256];
+
+	if ( chan == CMD_CHANNEL )
+	{
+		sendStatus();
+		return;
+	}
+
+	// Whatever arrived so far, EOI on the last byte. Nothing at all
+	// times out on the host, GET# returns an empty string then.
+	NetChannel *net = channel(chan);
+	m_status_channel = chan;
+	size_t count = ( net ) ? net->rx.peek(buffer, sizeof(buffer)) : 0;
+	if ( count == 0 )
+	{
+		m_iec.sendFNF();
+		return;
+	}
+
+	net->rx.consume(m_iec.send(buffer, count, true));
+} // handleTalk
+
+void devNetwork::handleClose(IEC::Data &iec_data)
+{
+	Debug_printv("CLOSE network (%.2d Device) (%.2d Channel)", iec_data.device, iec_data.channel);
+
+	if ( channel(iec_data.channel) )
+	{
+		m_channels[iec_data.channel]->close();
+		m_channels[iec_data.channel].reset();
+	}
+} // handleClose
+
+// "bytes waiting,room to send,connected,message"
+void devNetwork::sendStatus(void)
+{
+	NetChannel *net = channel(m_status_channel);
+	std::string status;
+	if ( net )
+		status = mstr::format("%d,%d,%d,%s", net->rx.available(), net->tx.room(), net->connected(), net->message.c_str());
+	else
+		status = "0,0,0,NOT OPEN";
+
+	Debug_printv("channel[%d] status[%s]", m_status_channel, status.c_str());
+	m_iec.send(status);
+	m_iec.sendEOI('\x0D');
+} // sendStatus
@@ -0,0 +1,149 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// Network device, every channel is a connection:
+//   OPEN 2,12,2,"TCP://HOST:PORT"   connect
+//   OPEN 2,12,2,"TCP://:PORT"       wait for someone to connect
+//   OPEN 2,12,2,"UDP://HOST:PORT"   datagrams, each PRINT# is one
+//   OPEN 2,12,2,"HTTP://HOST/PATH"  GET, the body is read with GET#
+// PRINT# queues data, GET# returns what arrived so far or nothing at all.
+// Reading channel 15 gives "bytes waiting,room to send,connected,message"
+// for the channel selected with PRINT#15,"S"+CHR$(channel), or the last used.
+//
+// https://github.com/FujiNetWIFI/fujinet-platformio/wiki/N:-Devicespec
+
+#ifndef DEVICE_NETWORK_H
+#define DEVICE_NETWORK_H
+
+#include "../../include/global_defines.h"
+#include "../../include/cbmdefines.h"
+#include "../../include/petscii.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#endif
+#include <WiFiUdp.h>
+
+#include "iec.h"
+#include "iec_device.h"
+
+#include "helpers.h"
+#include "utils.h"
+#include "string_utils.h"
+
+#if defined(ESP32)
+#define NETWORK_RING_SIZE		2048	// per direction and channel, power of two
+#else
+#define NETWORK_RING_SIZE		512
+#endif
+#define NETWORK_CONNECT_TIMEOUT	3000	// ms, the one time poll() may stall
+#define NETWORK_HEADER_SIZE		256		// longest HTTP header line kept
+
+// Byte ring, the bus and poll() each only ever touch one end
+class NetRing
+{
+public:
+	bool begin(void);
+	size_t available(void) { return m_head - m_tail; };
+	size_t room(void) { return NETWORK_RING_SIZE - available(); };
+
+	size_t put(const uint8_t *data, size_t len);
+	size_t peek(uint8_t *data, size_t len);
+	void consume(size_t len) { m_tail += len; };
+
+private:
+	std::unique_ptr<uint8_t[]> m_ring;
+	size_t m_head = 0;
+	size_t m_tail = 0;
+};
+
+class NetChannel
+{
+public:
+	enum Protocol {
+		NET_TCP,
+		NET_LISTEN,
+		NET_UDP,
+		NET_HTTP
+	};
+
+	NetRing rx;		// network to C64
+	NetRing tx;		// C64 to network
+	size_t dropped = 0;
+	std::string message = "OK";
+
+	bool open(std::string url);
+	void close(void);
+
+	// Moves data between the rings and the network stack
+	void poll(void);
+	bool connected(void);
+
+private:
+	Protocol m_protocol;
+	std::string m_url;
+	std::string m_host;
+	uint16_t m_port = 0;
+	bool m_started = false;		// connect happens on the first poll, not on the bus
+
+	WiFiClient m_client;
+	std::unique_ptr<WiFiServer> m_server;
+	WiFiUDP m_udp;
+
+	// HTTP response headers are read a poll at a time like any other data
+	std::string m_path;
+	std::string m_line;			// header line so far
+	uint16_t m_code = 0;		// from the status line
+	bool m_body = false;		// headers are over
+
+	void start(void);
+	void pollClient(void);
+	void pollUDP(void);
+	void pollHTTP(void);
+};
+
+class devNetwork: public iecDevice
+{
+public:
+	devNetwork(IEC &iec);
+	virtual ~devNetwork() {};
+
+ 	virtual uint8_t command(IEC::Data &iec_data) { return 0; };
+	virtual uint8_t execute(IEC::Data &iec_data) { return 0; };
+	virtual uint8_t status(void) { return 0; };
+
+	// Call while the bus is idle
+	void poll(void);
+
+protected:
+	virtual void handleListenCommand(IEC::Data &iec_data) override;
+	virtual void handleListenData(void) override;
+	virtual void handleTalk(byte chan) override;
+	virtual void handleOpen(IEC::Data &iec_data) override;
+	virtual void handleClose(IEC::Data &iec_data) override;
+
+private:
+	std::unique_ptr<NetChannel> m_channels[CBM::CMD_CHANNEL];
+	uint8_t m_status_channel = 2;
+
+	NetChannel *channel(uint8_t chan) { return ( chan < CBM::CMD_CHANNEL ) ? m_channels[chan].get() : nullptr; };
+	void sendStatus(void);
+};
+
+#endif // DEVICE_NETWORK_H
@@ -0,0 +1,564 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+#include "printer.h"
+
+#if defined(ESP8266)
+#include <ESP8266HTTPClient.h>
+#elif defined(ESP32)
+#include <HTTPClient.h>
+#endif
+
+using namespace CBM;
+using namespace Protocol;
+
+// 5x7 ASCII $20-$7E, one byte per column, bit 0 on top
+static const uint8_t font[] = {
+	0x00, 0x00, 0x00, 0x00, 0x00,	// space
+	0x00, 0x00, 0x5F, 0x00, 0x00,	// !
+	0x00, 0x07, 0x00, 0x07, 0x00,	// "
+	0x14, 0x7F, 0x14, 0x7F, 0x14,	// #
+	0x24, 0x2A, 0x7F, 0x2A, 0x12,	// $
+	0x23, 0x13, 0x08, 0x64, 0x62,	// %
+	0x36, 0x49, 0x56, 0x20, 0x50,	// &
+	0x00, 0x05, 0x03, 0x00, 0x00,	// '
+	0x00, 0x1C, 0x22, 0x41, 0x00,	// (
+	0x00, 0x41, 0x22, 0x1C, 0x00,	// )
+	0x14, 0x08, 0x3E, 0x08, 0x14,	// *
+	0x08, 0x08, 0x3E, 0x08, 0x08,	// +
+	0x00, 0x50, 0x30, 0x00, 0x00,	// ,
+	0x08, 0x08, 0x08, 0x08, 0x08,	// -
+	0x00, 0x60, 0x60, 0x00, 0x00,	// .
+	0x20, 0x10, 0x08, 0x04, 0x02,	// /
+	0x3E, 0x51, 0x49, 0x45, 0x3E,	// 0
+	0x00, 0x42, 0x7F, 0x40, 0x00,	// 1
+	0x42, 0x61, 0x51, 0x49, 0x46,	// 2
+	0x21, 0x41, 0x45, 0x4B, 0x31,	// 3
+	0x18, 0x14, 0x12, 0x7F, 0x10,	// 4
+	0x27, 0x45, 0x45, 0x45, 0x39,	// 5
+	0x3C, 0x4A, 0x49, 0x49, 0x30,	// 6
+	0x01, 0x71, 0x09, 0x05, 0x03,	// 7
+	0x36, 0x49, 0x49, 0x49, 0x36,	// 8
+	0x06, 0x49, 0x49, 0x29, 0x1E,	// 9
+	0x00, 0x36, 0x36, 0x00, 0x00,	// :
+	0x00, 0x56, 0x36, 0x00, 0x00,	// ;
+	0x08, 0x14, 0x22, 0x41, 0x00,	// <
+	0x14, 0x14, 0x14, 0x14, 0x14,	// =
+	0x00, 0x41, 0x22, 0x14, 0x08,	// >
+	0x02, 0x01, 0x51, 0x09, 0x06,	// ?
+	0x32, 0x49, 0x79, 0x41, 0x3E,	// @
+	0x7E, 0x11, 0x11, 0x11, 0x7E,	// A
+	0x7F, 0x49, 0x49, 0x49, 0x36,	// B
+	0x3E, 0x41, 0x41, 0x41, 0x22,	// C
+	0x7F, 0x41, 0x41, 0x22, 0x1C,	// D
+	0x7F, 0x49, 0x49, 0x49, 0x41,	// E
+	0x7F, 0x09, 0x09, 0x09, 0x01,	// F
+	0x3E, 0x41, 0x49, 0x49, 0x7A,	// G
+	0x7F, 0x08, 0x08, 0x08, 0x7F,	// H
+	0x00, 0x41, 0x7F, 0x41, 0x00,	// I
+	0x20, 0x40, 0x41, 0x3F, 0x01,	// J
+	0x7F, 0x08, 0x14, 0x22, 0x41,	// K
+	0x7F, 0x40, 0x40, 0x40, 0x40,	// L
+	0x7F, 0x02, 0x0C, 0x02, 0x7F,	// M
+	0x7F, 0x04, 0x08, 0x10, 0x7F,	// N
+	0x3E, 0x41, 0x41, 0x41, 0x3E,	// O
+	0x7F, 0x09, 0x09, 0x09, 0x06,	// P
+	0x3E, 0x41, 0x51, 0x21, 0x5E,	// Q
+	0x7F, 0x09, 0x19, 0x29, 0x46,	// R
+	0x46, 0x49, 0x49, 0x49, 0x31,	// S
+	0x01, 0x01, 0x7F, 0x01, 0x01,	// T
+	0x3F, 0x40, 0x40, 0x40, 0x3F,	// U
+	0x1F, 0x20, 0x40, 0x20, 0x1F,	// V
+	0x3F, 0x40, 0x38, 0x40, 0x3F,	// W
+	0x63, 0x14, 0x08, 0x14, 0x63,	// X
+	0x07, 0x08, 0x70, 0x08, 0x07,	// Y
+	0x61, 0x51, 0x49, 0x45, 0x43,	// Z
+	0x00, 0x7F, 0x41, 0x41, 0x00,	// [
+	0x02, 0x04, 0x08, 0x10, 0x20,	// backslash
+	0x00, 0x41, 0x41, 0x7F, 0x00,	// ]
+	0x04, 0x02, 0x01, 0x02, 0x04,	// ^
+	0x40, 0x40, 0x40, 0x40, 0x40,	// _
+	0x00, 0x01, 0x02, 0x04, 0x00,	// `
+	0x20, 0x54, 0x54, 0x54, 0x78,	// a
+	0x7F, 0x48, 0x44, 0x44, 0x38,	// b
+	0x38, 0x44, 0x44, 0x44, 0x20,	// c
+	0x38, 0x44, 0x44, 0x48, 0x7F,	// d
+	0x38, 0x54, 0x54, 0x54, 0x18,	// e
+	0x08, 0x7E, 0x09, 0x01, 0x02,	// f
+	0x0C, 0x52, 0x52, 0x52, 0x3E,	// g
+	0x7F, 0x08, 0x04, 0x04, 0x78,	// h
+	0x00, 0x44, 0x7D, 0x40, 0x00,	// i
+	0x20, 0x40, 0x44, 0x3D, 0x00,	// j
+	0x7F, 0x10, 0x28, 0x44, 0x00,	// k
+	0x00, 0x41, 0x7F, 0x40, 0x00,	// l
+	0x7C, 0x04, 0x18, 0x04, 0x78,	// m
+	0x7C, 0x08, 0x04, 0x04, 0x78,	// n
+	0x38, 0x44, 0x44, 0x44, 0x38,	// o
+	0x7C, 0x14, 0x14, 0x14, 0x08,	// p
+	0x08, 0x14, 0x14, 0x18, 0x7C,	// q
+	0x7C, 0x08, 0x04, 0x04, 0x08,	// r
+	0x48, 0x54, 0x54, 0x54, 0x20,	// s
+	0x04, 0x3F, 0x44, 0x40, 0x20,	// t
+	0x3C, 0x40, 0x40, 0x20, 0x7C,	// u
+	0x1C, 0x20, 0x40, 0x20, 0x1C,	// v
+	0x3C, 0x40, 0x30, 0x40, 0x3C,	// w
+	0x44, 0x28, 0x10, 0x28, 0x44,	// x
+	0x0C, 0x50, 0x50, 0x50, 0x3C,	// y
+	0x44, 0x64, 0x54, 0x4C, 0x44,	// z
+	0x00, 0x08, 0x36, 0x41, 0x00,	// {
+	0x00, 0x00, 0x7F, 0x00, 0x00,	// |
+	0x00, 0x41, 0x36, 0x08, 0x00,	// }
+	0x10, 0x08, 0x08, 0x10, 0x08,	// ~
+};
+
+// Shown for PETSCII graphics characters
+static const uint8_t graphic[] = { 0x55, 0x2A, 0x55, 0x2A, 0x55 };
+
+
+/********************************************************
+ * Spool
+ ********************************************************/
+
+bool PrinterSpool::put(uint8_t b)
+{
+	if ( m_head - m_tail >= PRINTER_SPOOL_SIZE )
+		return false;
+
+	m_ring[m_head bitand (PRINTER_SPOOL_SIZE - 1)] = b;
+	m_head++;
+	return true;
+}
+
+int16_t PrinterSpool::get(void)
+{
+	if ( m_tail == m_head )
+		return -1;
+
+	uint8_t b = m_ring[m_tail bitand (PRINTER_SPOOL_SIZE - 1)];
+	m_tail++;
+	return b;
+}
+
+void PrinterSpool::endJob(void)
+{
+	// Too many jobs waiting, the newest one runs on into the next
+	if ( (uint16_t)(m_jobs - m_jobs_done) >= PRINTER_JOBS )
+	{
+		m_job_end[(m_jobs - 1) bitand (PRINTER_JOBS - 1)] = m_head;
+		return;
+	}
+
+	m_job_end[m_jobs bitand (PRINTER_JOBS - 1)] = m_head;
+	m_jobs++;
+}
+
+
+/********************************************************
+ * MPS-801 rendering
+ ********************************************************/
+
+// PETSCII in the current character set to ASCII, 0 for graphics
+static uint8_t toASCII(uint8_t c, bool lowercase)
+{
+	if ( c >= 0x41 && c <= 0x5A )
+		return ( lowercase ) ? c + 0x20 : c;
+	if ( c >= 0xC1 && c <= 0xDA )
+		return ( lowercase ) ? c - 0x80 : 0;
+	if ( c >= 0x61 && c <= 0x7A )
+		return ( lowercase ) ? c - 0x20 : 0;
+	if ( c >= 0x20 && c <= 0x5F )
+		return c;
+	if ( c == 0xA0 )
+		return ' ';
+
+	return 0;
+}
+
+MOStream *MPS801::create(std::string name)
+{
+	std::unique_ptr<MFile> file(MFSOwner::File(PRINTER_DIR + name));
+	return ( file ) ? file->outputStream() : nullptr;
+}
+
+bool MPS801::begin(void)
+{
+	std::unique_ptr<MFile> dir(MFSOwner::File(PRINTER_DIR));
+	if ( dir != nullptr && !dir->exists() )
+		dir->mkDir();
+
+	// Jobs are numbered from the first name not taken yet
+	while ( true )
+	{
+		m_job = mstr::format("job%04d", m_next++);
+		std::unique_ptr<MFile> file(MFSOwner::File(PRINTER_DIR + m_job + ".txt"));
+		if ( file == nullptr || !file->exists() )
+			break;
+	}
+
+	m_text.reset(create(m_job + ".txt"));
+	m_raw.reset(create(m_job + ".seq"));
+	m_page = 0;
+	m_lowercase = m_reverse = m_double = m_graphics = false;
+	m_pending = 0;
+	m_dot = 0;
+	m_line.clear();
+	memset(m_band, 0, sizeof(m_band));
+	m_band_used = false;
+	newPage();
+
+	Debug_printv("job[%s]", m_job.c_str());
+	return m_text != nullptr;
+}
+
+void MPS801::end(void)
+{
+	if ( m_dot || m_line.size() )
+		newLine();
+	endPage();
+
+	m_text.reset();
+	m_raw.reset();
+	post(m_job + ".txt", "text/plain");
+	post(m_job + ".seq", "application/octet-stream");
+	Debug_printv("job[%s] pages[%d]", m_job.c_str(), m_page);
+}
+
+void MPS801::feed(uint8_t c)
+{
+	if ( m_raw )
+		m_raw->write(&c, 1);
+
+	// Arguments of 16 (print position), 27 16 (dot position), 26 (repeat)
+	if ( m_pending )
+	{
+		m_args[m_argc++] = c;
+		if ( m_pending == 27 && m_argc == 3 )
+		{
+			uint16_t dot = (m_args[1] << 8) | m_args[2];
+			while ( m_args[0] == 16 && m_dot < dot && m_dot < PRINTER_DOTS )
+				m_band[m_dot++] = 0;
+			m_pending = 0;
+		}
+		else if ( m_pending == 16 && m_argc == 2 )
+		{
+			uint8_t position = (m_args[0] - '0') * 10 + (m_args[1] - '0');
+			while ( m_line.size() < position && m_line.size() < PRINTER_COLUMNS )
+				m_line += ' ';
+			while ( m_dot < position * 6 && m_dot < PRINTER_DOTS )
+				m_band[m_dot++] = 0;
+			m_pending = 0;
+		}
+		else if ( m_pending == 26 && m_argc == 2 )
+		{
+			uint16_t count = ( m_args[0] ) ? m_args[0] : 256;
+			while ( count-- )
+				column(m_args[1] bitand 0x7F);
+			m_pending = 0;
+		}
+		return;
+	}
+
+	// Graphic mode takes every byte with the top bit set as a dot column
+	if ( m_graphics && (c bitand 0x80) )
+	{
+		column(c bitand 0x7F);
+		return;
+	}
+
+	switch ( c )
+	{
+		case 8:
+			m_graphics = true;
+			break;
+		case 15:
+			m_graphics = m_double = false;
+			break;
+		case 14:
+			m_double = true;
+			m_graphics = false;
+			break;
+		case 18:
+			m_reverse = true;
+			break;
+		case 146:
+			m_reverse = false;
+			break;
+		case 17:
+			m_lowercase = true;
+			break;
+		case 145:
+			m_lowercase = false;
+			break;
+		case 10:
+		case 13:
+			newLine();
+			break;
+		case 16:
+		case 26:
+		case 27:
+			m_pending = c;
+			m_argc = 0;
+			break;
+		default:
+			if ( !m_graphics && (c bitand 0x7F) >= 0x20 )
+				print(c);
+	}
+}
+
+void MPS801::print(uint8_t c)
+{
+	uint8_t ascii = toASCII(c, m_lowercase);
+	const uint8_t *glyph = ( ascii && ascii < 0x7F ) ? &font[(ascii - 0x20) * 5] : graphic;
+
+	// Wrap before the character, not halfway through it
+	uint8_t width = ( m_double ) ? 12 : 6;
+	if ( m_dot + width > PRINTER_DOTS )
+		newLine();
+
+	m_line += ( ascii ) ? (char)ascii : '#';
+	for ( uint8_t i = 0; i < 6; i++ )
+	{
+		uint8_t dots = ( i < 5 ) ? glyph[i] : 0;
+		if ( m_reverse )
+			dots ^= 0x7F;
+		column(dots);
+		if ( m_double )
+			column(dots);
+	}
+}
+
+void MPS801::column(uint8_t dots)
+{
+	if ( m_dot >= PRINTER_DOTS )
+		newLine();
+
+	m_band[m_dot++] = dots;
+	m_band_used = true;
+}
+
+void MPS801::newLine(void)
+{
+	if ( m_text )
+	{
+		m_line += '\n';
+		m_text->write((const uint8_t *)m_line.data(), m_line.size());
+	}
+
+	// Graphic lines butt against each other, text lines get a gap
+	uint8_t rows = ( m_graphics ) ? 7 : 9;
+	if ( m_rows + rows > PRINTER_PAGE_ROWS )
+		newPage();
+	writeRows(rows);
+
+	memset(m_band, 0, sizeof(m_band));
+	m_band_used = false;
+	m_dot = 0;
+	m_line.clear();
+	m_reverse = false;
+}
+
+// PBM, a row is PRINTER_DOTS bits with the leftmost dot in the top bit
+void MPS801::writeRows(uint8_t count)
+{
+	uint8_t row[PRINTER_DOTS / 8];
+
+	for ( uint8_t r = 0; r < count; r++ )
+	{
+		memset(row, 0, sizeof(row));
+		for ( uint16_t x = 0; m_band_used && r < 7 && x < PRINTER_DOTS; x++ )
+		{
+			if ( m_band[x] bitand (1 << r) )
+				row[x >> 3] |= 0x80 >> (x bitand 7);
+		}
+		if ( m_bitmap )
+			m_bitmap->write(row, sizeof(row));
+	}
+	m_rows += count;
+}
+
+void MPS801::newPage(void)
+{
+	endPage();
+
+	m_page++;
+	m_rows = 0;
+	m_bitmap.reset(create(mstr::format("%s-%d.pbm", m_job.c_str(), m_page)));
+	if ( m_bitmap )
+	{
+		std::string header = mstr::format("P4\n%d %d\n", PRINTER_DOTS, PRINTER_PAGE_ROWS);
+		m_bitmap->write((const uint8_t *)header.data(), header.size());
+	}
+}
+
+void MPS801::endPage(void)
+{
+	if ( m_bitmap == nullptr )
+		return;
+
+	// Pages are always full height
+	bool used = m_band_used;
+	m_band_used = false;
+	while ( m_rows < PRINTER_PAGE_ROWS )
+		writeRows(1);
+	m_band_used = used;
+
+	m_bitmap.reset();
+	post(mstr::format("%s-%d.pbm", m_job.c_str(), m_page), "image/x-portable-bitmap");
+}
+
+// Lets HTTPClient read a rendered file
+class RenderedStream: public Stream
+{
+public:
+	RenderedStream(MIStream *istream) : m_istream(istream) {};
+
+	int available() override { return m_istream->available(); };
+	int read() override
+	{
+		uint8_t b;
+		return ( m_istream->read(&b, 1) == 1 ) ? b : -1;
+	};
+	int peek() override { return -1; };
+	size_t write(uint8_t b) override { return 0; };
+	void flush() override {};
+
+private:
+	MIStream *m_istream;
+};
+
+void MPS801::post(std::string name, const char *type)
+{
+	if ( strlen(PRINTER_POST_URL) == 0 )
+		return;
+
+	std::unique_ptr<MFile> file(MFSOwner::File(PRINTER_DIR + name));
+	std::unique_ptr<MIStream> istream(file ? file->inputStream() : nullptr);
+	if ( istream == nullptr || !istream->isOpen() )
+		return;
+
+	WiFiClient client;
+	HTTPClient http;
+	http.setUserAgent(USER_AGENT);
+	if ( !http.begin(client, PRINTER_POST_URL) )
+		return;
+
+	http.addHeader("Content-Type", type);
+	http.addHeader("X-Filename", name.c_str());
+	RenderedStream stream(istream.get());
+	int code = http.sendRequest("POST", &stream, istream->size());
+	http.end();
+	istream.reset();
+
+	// Files that didn't make it stay on LittleFS
+	Debug_printv("POST [%s] code[%d]", name.c_str(), code);
+	if ( code >= 200 && code < 300 )
+		file->remove();
+}
+
+
+/********************************************************
+ * Device
+ ********************************************************/
+
+devPrinter::devPrinter(IEC &iec) : iecDevice(iec)
+{
+} // ctor
+
+void devPrinter::handleOpen(IEC::Data &iec_data)
+{
+	Debug_printv("OPEN printer (%.2d Device) (%.2d Channel)", iec_data.device, iec_data.channel);
+} // handleOpen
+
+void devPrinter::handleListenCommand(IEC::Data &iec_data)
+{
+	// Printers have no commands, a file name on OPEN is ignored
+	Debug_printv("[%s]", iec_data.content.c_str());
+} // handleListenCommand
+
+void devPrinter::handleListenData(void)
+{
+	bool done = false;
+
+	// Secondary address 7 prints in lower case, 0 in upper case
+	uint8_t secondary = m_iec_data.channel;
+	if ( secondary != m_secondary && (secondary == 0 || secondary == 7) )
+		m_spool.put( ( secondary == 7 ) ? 17 : 145 );
+	m_secondary = secondary;
+
+	// Only the spool is touched here, a full spool drops bytes rather than
+	// holding up the bus
+	do
+	{
+		int16_t b = m_iec.receive();
+		uint8_t f = m_iec.state();
+		if ( f bitand ERROR )
+			break;
+
+		if ( !m_spool.put(b) )
+			m_spool.dropped++;
+
+		done = (f bitand EOI_RECVD);
+	} while (not done);
+
+	if ( m_spool.dropped )
+		Debug_printv("spool full, dropped[%d]", m_spool.dropped);
+} // handleListenData
+
+void devPrinter::handleTalk(byte chan)
+{
+	// Nothing to say
+} // handleTalk
+
+void devPrinter::handleClose(IEC::Data &iec_data)
+{
+	Debug_printv("CLOSE printer (%.2d Device) (%.2d Channel)", iec_data.device, iec_data.channel);
+	m_spool.endJob();
+	m_secondary = 0xFF;
+} // handleClose
+
+void devPrinter::renderSlice(size_t count)
+{
+	while ( count-- )
+	{
+		if ( m_spool.jobEnded() )
+		{
+			if ( m_printing )
+				m_mps801.end();
+			m_printing = false;
+			m_spool.jobDone();
+			break;
+		}
+
+		int16_t b = m_spool.get();
+		if ( b < 0 )
+			break;
+
+		if ( !m_printing )
+		{
+			m_mps801.begin();
+			m_printing = true;
+		}
+		m_mps801.feed(b);
+	}
+} // renderSlice
+
+void devPrinter::render(void)
+{
+	// LittleFS has no locking, so files are only written from the main loop
+	// while the bus is idle, a slice at a time
+	renderSlice(PRINTER_SLICE);
+} // render
@@ -0,0 +1,149 @@
+// Meatloaf - A Commodore 64/128 multi-device emulator
+// https://github.com/idolpx/meatloaf
+// Copyright(C) 2020 James Johnston
+//
+// Meatloaf is free software : you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Meatloaf is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Meatloaf. If not, see <http://www.gnu.org/licenses/>.
+
+// MPS-801/1525 printer. The bus only fills the spool, jobs are rendered
+// later to text and PBM page bitmaps on LittleFS and optionally posted.
+//
+// http://www.zimmers.net/anonftp/pub/cbm/manuals/printers/MPS-801_Printer_Users_Manual.pdf
+// http://netpbm.sourceforge.net/doc/pbm.html
+
+#ifndef DEVICE_PRINTER_H
+#define DEVICE_PRINTER_H
+
+#include "../../include/global_defines.h"
+#include "../../include/cbmdefines.h"
+#include "../../include/petscii.h"
+
+#include "iec.h"
+#include "iec_device.h"
+
+#include "meat_io.h"
+#include "helpers.h"
+#include "utils.h"
+#include "string_utils.h"
+
+#define PRINTER_DIR				"/print/"	// rendered jobs
+#define PRINTER_POST_URL		""			// when set, every rendered file is POSTed here
+#if defined(ESP32)
+#define PRINTER_SPOOL_SIZE		16384		// power of two
+#define PRINTER_SLICE			256			// bytes rendered per idle loop
+#else
+#define PRINTER_SPOOL_SIZE		2048
+#define PRINTER_SLICE			64
+#endif
+#define PRINTER_JOBS			8			// closed jobs waiting to render, power of two
+#define PRINTER_COLUMNS			80
+#define PRINTER_DOTS			(PRINTER_COLUMNS * 6)
+#define PRINTER_PAGE_ROWS		(66 * 9)	// 66 text lines of 7 dots and a 2 dot gap
+
+// Single producer (bus) single consumer (renderer) byte ring
+class PrinterSpool
+{
+public:
+	bool put(uint8_t b);
+	int16_t get(void);
+	size_t available(void) { return m_head - m_tail; };
+
+	// Positions after the last byte of each closed job, oldest first
+	void endJob(void);
+	bool jobEnded(void) { return m_jobs != m_jobs_done && m_tail == m_job_end[m_jobs_done bitand (PRINTER_JOBS - 1)]; };
+	void jobDone(void) { if ( m_jobs != m_jobs_done ) m_jobs_done++; };
+
+	size_t dropped = 0;
+
+private:
+	uint8_t m_ring[PRINTER_SPOOL_SIZE];
+	volatile size_t m_head = 0;		// bytes put so far
+	volatile size_t m_tail = 0;		// bytes taken so far
+	size_t m_job_end[PRINTER_JOBS];
+	volatile uint16_t m_jobs = 0;		// jobs closed so far
+	uint16_t m_jobs_done = 0;
+};
+
+// Interprets the MPS-801 control codes, text lines and dot rows come out
+class MPS801
+{
+public:
+	bool begin(void);
+	void feed(uint8_t c);
+	void end(void);
+
+private:
+	std::string m_job;		// job name, pages get a suffix
+	uint16_t m_page = 0;
+	uint16_t m_next = 1;	// first job number that may be free
+
+	std::unique_ptr<MOStream> m_text;
+	std::unique_ptr<MOStream> m_raw;
+	std::unique_ptr<MOStream> m_bitmap;
+	uint16_t m_rows = 0;	// dot rows on the current page
+
+	// Line being printed, one byte per dot column, bit 0 on top
+	uint8_t m_band[PRINTER_DOTS];
+	uint16_t m_dot = 0;
+	std::string m_line;
+	bool m_band_used = false;
+
+	// Modes and multi byte codes
+	bool m_lowercase = false;
+	bool m_reverse = false;
+	bool m_double = false;
+	bool m_graphics = false;
+	uint8_t m_pending = 0;	// control code waiting for its arguments
+	uint8_t m_args[3];
+	uint8_t m_argc = 0;
+
+	void print(uint8_t c);
+	void column(uint8_t dots);
+	void newLine(void);
+	void newPage(void);
+	void endPage(void);
+	void writeRows(uint8_t count);
+	void post(std::string name, const char *type);
+	MOStream *create(std::string name);
+};
+
+class devPrinter: public iecDevice
+{
+public:
+	devPrinter(IEC &iec);
+	virtual ~devPrinter() {};
+
+ 	virtual uint8_t command(IEC::Data &iec_data) { return 0; };
+	virtual uint8_t execute(IEC::Data &iec_data) { return 0; };
+	virtual uint8_t status(void) { return 0; };
+
+	// Renders what the bus spooled, never while the bus is busy
+	void render(void);
+
+protected:
+	virtual void handleListenCommand(IEC::Data &iec_data) override;
+	virtual void handleListenData(void) override;
+	virtual void handleTalk(byte chan) override;
+	virtual void handleOpen(IEC::Data &iec_data) override;
+	virtual void handleClose(IEC::Data &iec_data) override;
+
+private:
+	PrinterSpool m_spool;
+	MPS801 m_mps801;
+	bool m_printing = false;	// renderer has a job open
+	uint8_t m_secondary = 0xFF;	// last secondary address, 7 is lower case
+
+	void renderSlice(size_t count);
+};
+
+#endif // DEVICE_PRINTER_H
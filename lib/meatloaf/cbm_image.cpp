@@ -78,7 +78,11 @@ size_t CBMImageStream::read(uint8_t* buf, size_t size) {
     if(seekCalled) {
         // if we have the stream set to a specific file already, either via seekNextEntry or seekPath, return bytes of the file here
         // or set the stream to EOF-like state, if whle file is completely read.
-        bytesRead = readFile(buf, size);
+        if ( size > m_bytesAvailable )
+            size = m_bytesAvailable;
+
+        if ( size )
+            bytesRead = readFile(buf, size);
 
     }
     else {
@@ -91,8 +95,8 @@ size_t CBMImageStream::read(uint8_t* buf, size_t size) {
 };
 
 bool CBMImageStream::isOpen() {
-
-    return m_isOpen;
+    // m_isOpen is never set, the image is open while its container is
+    return containerStream != nullptr && containerStream->isOpen();
 };
 
 
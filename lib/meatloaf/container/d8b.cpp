@@ -7,5 +7,7 @@
 MIStream* D8BFile::createIStream(std::shared_ptr<MIStream> containerIstream) {
     Debug_printv("[%s]", url.c_str());
 
-    return new D8BIStream(containerIstream);
+    auto image = new D8BIStream(containerIstream);
+    image->container_url = streamFile->url;
+    return image;
 }
@@ -419,10 +419,26 @@ size_t LittleOStream::write(const uint8_t *buf, size_t size) {
 
     if (result < 0) {
         DEBUGV("lfs_write rc=%d\n", result);
+        return 0;
     }
     return result;
 };
 
+bool LittleOStream::seek(size_t pos) {
+    if (!isOpen()) {
+        Debug_printv("Not open");
+        return false;
+    }
+    // Seeking past the end is fine, lfs pads the gap with zeros on the next write
+    return lfs_file_seek(&LittleFileSystem::lfsStruct, &handle->lfsFile, pos, LFS_SEEK_SET) >= 0;
+};
+
+// Relative files keep their record length in the 'r' attribute
+bool LittleOStream::setRecordLength(uint8_t length) {
+    int rc = lfs_setattr(&LittleFileSystem::lfsStruct, localPath.c_str(), 'r', (const void *)&length, sizeof(length));
+    return (rc == 0);
+};
+
 
 
 /********************************************************
@@ -456,7 +472,8 @@ size_t LittleIStream::available() {
 };
 
 size_t LittleIStream::size() {
-    return available();
+    if(!isOpen()) return 0;
+    return lfs_file_size(&LittleFileSystem::lfsStruct, &handle->lfsFile);
 };
 
 // uint8_t LittleIStream::read() {
@@ -489,7 +506,16 @@ bool LittleIStream::seek(size_t pos, SeekMode mode) {
         Debug_printv("Not open");
         return false;
     }
-    return (lfs_file_seek(&LittleFileSystem::lfsStruct, &handle->lfsFile, pos, mode))? true: false;
+    // lfs_file_seek returns the new offset, which is 0 for the start of the file
+    return (lfs_file_seek(&LittleFileSystem::lfsStruct, &handle->lfsFile, pos, mode) >= 0);
+}
+
+uint8_t LittleIStream::recordLength() {
+    uint8_t length = 0;
+    int rc = lfs_getattr(&LittleFileSystem::lfsStruct, localPath.c_str(), 'r', (void *)&length, sizeof(length));
+    if (rc != sizeof(length))
+        length = 0; // Not a relative file
+    return length;
 }
 
 
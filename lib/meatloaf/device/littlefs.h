@@ -175,6 +175,8 @@ public:
     //size_t write(uint8_t) override;
     size_t write(const uint8_t *buf, size_t size) override;
     bool isOpen();
+    bool seek(size_t pos) override;
+    bool setRecordLength(uint8_t length) override;
 
 protected:
     std::string localPath;
@@ -210,6 +212,7 @@ public:
     bool isOpen();
     virtual bool seek(size_t pos) override;
     virtual bool seek(size_t pos, SeekMode mode) override;
+    uint8_t recordLength() override;
 
 protected:
     std::string localPath;
@@ -1,14 +1,19 @@
 
 #include "d64.h"
 
+#include <algorithm>
+
 
 // D64 Utility Functions
 
-bool D64IStream::seekSector( uint8_t track, uint8_t sector, size_t offset )
+uint8_t D64IStream::sectorCount( uint8_t track )
 {
-	uint16_t sectorOffset = 0;
+    return sectorsPerTrack[speedZone(track - 1)];
+}
 
-    //Debug_printv("track[%d] sector[%d] offset[%d]", track, sector, offset);
+uint16_t D64IStream::blockAddress( uint8_t track, uint8_t sector )
+{
+	uint16_t sectorOffset = 0;
 
     track--;
 	for (uint8_t index = 0; index < track; ++index)
@@ -16,12 +21,18 @@ bool D64IStream::seekSector( uint8_t track, uint8_t sector, size_t offset )
 		sectorOffset += sectorsPerTrack[speedZone(index)];
         //Debug_printv("track[%d] speedZone[%d] secotorsPerTrack[%d] sectorOffset[%d]", (index + 1), speedZone(index), sectorsPerTrack[speedZone(index)], sectorOffset);
 	}
-	sectorOffset += sector;
 
-    this->track = track + 1;
+	return sectorOffset + sector;
+}
+
+bool D64IStream::seekSector( uint8_t track, uint8_t sector, size_t offset )
+{
+    //Debug_printv("track[%d] sector[%d] offset[%d]", track, sector, offset);
+
+    this->track = track;
     this->sector = sector;
 
-    return containerStream->seek( (sectorOffset * block_size) + offset );
+    return containerStream->seek( (blockAddress(track, sector) * block_size) + offset );
 }
 
 bool D64IStream::seekSector( std::vector<uint8_t> trackSectorOffset )
@@ -30,26 +41,220 @@ bool D64IStream::seekSector( std::vector<uint8_t> trackSectorOffset )
 }
 
 
-std::string D64IStream::readBlock(uint8_t track, uint8_t sector)
+bool D64IStream::isValidBlock( uint8_t track, uint8_t sector )
 {
-    return "";
+    if ( track < 1 || track > block_allocation_map.back().end_track )
+        return false;
+
+    return sector < sectorCount(track);
 }
 
-bool D64IStream::writeBlock(uint8_t track, uint8_t sector, std::string data)
+// A miss reads the next SECTOR_CACHE_LINE sectors in one go into the
+// least recently used line
+uint8_t *D64IStream::cachedSector( uint16_t address )
 {
-    return true;
+    if ( !cache_data )
+    {
+        cache_data.reset(new uint8_t[SECTOR_CACHE_LINES * SECTOR_CACHE_LINE * 256]);
+        cache_lines.assign(SECTOR_CACHE_LINES, { 0, 0, 0 });
+    }
+
+    cache_tick++;
+    size_t oldest = 0;
+    for ( size_t i = 0; i < cache_lines.size(); i++ )
+    {
+        auto &line = cache_lines[i];
+        if ( line.count && address >= line.first && address < line.first + line.count )
+        {
+            line.used = cache_tick;
+            return cache_data.get() + ((i * SECTOR_CACHE_LINE) + (address - line.first)) * 256;
+        }
+
+        if ( line.used < cache_lines[oldest].used )
+            oldest = i;
+    }
+
+    size_t blocks = containerStream->size() / block_size;
+    if ( address >= blocks )
+        return nullptr;
+
+    auto &line = cache_lines[oldest];
+    uint8_t *data = cache_data.get() + (oldest * SECTOR_CACHE_LINE * 256);
+    uint8_t count = ( blocks - address < SECTOR_CACHE_LINE ) ? blocks - address : SECTOR_CACHE_LINE;
+
+    line.count = 0;
+    if ( !containerStream->seek(address * block_size) )
+        return nullptr;
+    size_t bytes = containerStream->read(data, count * 256);
+    if ( bytes < 256 )
+        return nullptr;
+
+    line.first = address;
+    line.count = bytes / 256;
+    line.used = cache_tick;
+    //Debug_printv("address[%d] count[%d]", address, line.count);
+
+    return data;
 }
 
-bool D64IStream::allocateBlock( uint8_t track, uint8_t sector)
+bool D64IStream::readBlock( uint8_t track, uint8_t sector, uint8_t *data )
 {
+    if ( !isValidBlock(track, sector) )
+        return false;
+
+    uint8_t *cached = cachedSector( blockAddress(track, sector) );
+    if ( cached == nullptr )
+        return false;
+
+    memcpy(data, cached, 256);
     return true;
 }
 
-bool D64IStream::deallocateBlock( uint8_t track, uint8_t sector)
+bool D64IStream::isWritable( void )
+{
+    std::unique_ptr<MFile> image(MFSOwner::File(container_url));
+    if ( image == nullptr || image->streamFile == nullptr )
+        return false;
+
+    std::unique_ptr<MOStream> ostream(image->streamFile->outputStream());
+    return ostream != nullptr && ostream->isOpen();
+}
+
+// Written through to the image file right away, then the container
+// stream is reopened so directory and file reads see the change
+bool D64IStream::writeBlock( uint8_t track, uint8_t sector, const uint8_t *data )
+{
+    if ( !isValidBlock(track, sector) )
+        return false;
+
+    std::unique_ptr<MFile> image(MFSOwner::File(container_url));
+    if ( image == nullptr || image->streamFile == nullptr )
+        return false;
+
+    uint16_t address = blockAddress(track, sector);
+    std::unique_ptr<MOStream> ostream(image->streamFile->outputStream());
+    if ( ostream == nullptr || !ostream->isOpen() || !ostream->seek(address * block_size) )
+        return false;
+
+    bool ok = ostream->write(data, 256) == 256;
+    ostream->close();
+    Debug_printv("track[%d] sector[%d] ok[%d]", track, sector, ok);
+
+    containerStream->close();
+    containerStream->open();
+
+    // Keep a cached copy in step
+    for ( size_t i = 0; i < cache_lines.size(); i++ )
+    {
+        auto &line = cache_lines[i];
+        if ( line.count && address >= line.first && address < line.first + line.count )
+            memcpy(cache_data.get() + ((i * SECTOR_CACHE_LINE) + (address - line.first)) * 256, data, 256);
+    }
+
+    return ok;
+}
+
+bool D64IStream::findBAM( uint8_t track, BAMInfo &bam )
+{
+    for ( auto &b : block_allocation_map )
+    {
+        if ( track >= b.start_track && track <= b.end_track )
+        {
+            bam = b;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// BAM entries with more than 3 bytes start with the free count, the bitmap follows
+// 1 bits are free, sector 0 is bit 0 of the first bitmap byte
+bool D64IStream::isFreeBlock( uint8_t track, uint8_t sector )
+{
+    BAMInfo bam;
+    uint8_t data[256];
+    if ( !findBAM(track, bam) || !readBlock(bam.track, bam.sector, data) )
+        return false;
+
+    uint16_t position = bam.offset + ((track - bam.start_track) * bam.byte_count);
+    uint8_t *bits = data + position + ((bam.byte_count > 3) ? 1 : 0);
+
+    return bits[sector >> 3] bitand (1 << (sector bitand 7));
+}
+
+bool D64IStream::updateBAM( uint8_t track, uint8_t sector, bool allocate )
 {
+    BAMInfo bam;
+    uint8_t data[256];
+    if ( !isValidBlock(track, sector) || !findBAM(track, bam) || !readBlock(bam.track, bam.sector, data) )
+        return false;
+
+    uint16_t position = bam.offset + ((track - bam.start_track) * bam.byte_count);
+    uint8_t *bits = data + position + ((bam.byte_count > 3) ? 1 : 0);
+    uint8_t mask = 1 << (sector bitand 7);
+
+    // Already in the requested state
+    if ( (bits[sector >> 3] bitand mask) == (allocate ? 0 : mask) )
+        return false;
+
+    bits[sector >> 3] ^= mask;
+    if ( bam.byte_count > 3 )
+        data[position] += ( allocate ) ? -1 : 1;
+
+    if ( !writeBlock(bam.track, bam.sector, data) )
+        return false;
+
+    if ( bam.byte_count == 3 )
+    {
+        // D71 side two keeps its free counts in the side one BAM at $DD
+        auto &first = block_allocation_map.front();
+        if ( !readBlock(first.track, first.sector, data) )
+            return false;
+
+        data[0xDD + track - bam.start_track] += ( allocate ) ? -1 : 1;
+        return writeBlock(first.track, first.sector, data);
+    }
+
     return true;
 }
 
+// Like the 1541, a used block reports the next free one after it
+// The directory track is skipped, 0/0 when the disk is full
+bool D64IStream::allocateBlock( uint8_t &track, uint8_t &sector )
+{
+    if ( updateBAM(track, sector, true) )
+        return true;
+
+    uint8_t last_track = block_allocation_map.back().end_track;
+    uint8_t t = track;
+    uint16_t s = sector + 1;
+    for ( ; t >= 1 && t <= last_track; t++, s = 0 )
+    {
+        if ( t == directory_list_offset[0] )
+            continue;
+
+        for ( ; s < sectorCount(t); s++ )
+        {
+            if ( isFreeBlock(t, s) )
+            {
+                track = t;
+                sector = s;
+                return false;
+            }
+        }
+    }
+
+    track = 0;
+    sector = 0;
+    return false;
+}
+
+bool D64IStream::deallocateBlock( uint8_t track, uint8_t sector )
+{
+    return updateBAM(track, sector, false);
+}
+
 bool D64IStream::seekEntry( std::string filename )
 {
     uint8_t index = 1;
@@ -198,32 +403,45 @@ uint16_t D64IStream::blocksFree()
 size_t D64IStream::readFile(uint8_t* buf, size_t size) {
     size_t bytesRead = 0;
 
-    if ( sector_offset % block_size == 0 )
+    // Reads may span several blocks, so follow the track/sector links as we go
+    while ( bytesRead < size && m_bytesAvailable > 0 )
     {
-        // We are at the beginning of the block
-        // Read track/sector link
-        containerStream->read((uint8_t *)&next_track, 1);
-        containerStream->read((uint8_t *)&next_sector, 1);
-        sector_offset += 2;
-        //Debug_printv("next_track[%d] next_sector[%d] sector_offset[%d]", next_track, next_sector, sector_offset);
-    }
+        if ( sector_offset % block_size == 0 )
+        {
+            // We are at the beginning of the block
+            // Read track/sector link
+            containerStream->read((uint8_t *)&next_track, 1);
+            containerStream->read((uint8_t *)&next_sector, 1);
+            sector_offset = 2;
+            //Debug_printv("next_track[%d] next_sector[%d] sector_offset[%d]", next_track, next_sector, sector_offset);
+        }
 
-    bytesRead += containerStream->read(buf, size);
-    sector_offset += bytesRead;
-    m_bytesAvailable -= bytesRead;
+        size_t count = block_size - sector_offset;
+        if ( count > size - bytesRead )
+            count = size - bytesRead;
+        if ( count > m_bytesAvailable )
+            count = m_bytesAvailable;
 
-    if ( sector_offset % block_size == 0 )
-    {
-        // We are at the end of the block
-        // Follow track/sector link to move to next block
-        seekSector( next_track, next_sector );
-        //Debug_printv("track[%d] sector[%d] sector_offset[%d]", track, sector, sector_offset);
-    }
+        size_t r = containerStream->read(buf + bytesRead, count);
+        if ( r == 0 )
+            break;
 
-    // if ( !bytesRead )
-    // {
-    //     sector_offset = 0;
-    // }
+        bytesRead += r;
+        sector_offset += r;
+        m_bytesAvailable -= r;
+
+        if ( sector_offset == block_size )
+        {
+            // We are at the end of the block
+            // Follow track/sector link to move to next block
+            sector_offset = 0;
+            if ( next_track == 0 )
+                break;
+
+            seekSector( next_track, next_sector );
+            //Debug_printv("track[%d] sector[%d] sector_offset[%d]", track, sector, sector_offset);
+        }
+    }
 
     return bytesRead;
 }
@@ -240,6 +458,10 @@ bool D64IStream::seekPath(std::string path) {
     sector_offset = 0;
 
     entry_index = 0;
+    m_position = 0;
+
+    file_blocks.clear();
+    record_length = 0;
 
     // call image method to obtain file bytes here, return true on success:
     // return D64Image.seekFile(containerIStream, path);
@@ -251,30 +473,48 @@ bool D64IStream::seekPath(std::string path) {
         //auto blocks = (entry.blocks[0] << 8 | entry.blocks[1] >> 8);
         //auto blocks = (entry.blocks[0] * 256) + entry.blocks[1];
         Debug_printv("filename [%.16s] type[%s] start_track[%d] start_sector[%d]", entry.filename, type, entry.start_track, entry.start_sector);
-        seekSector(entry.start_track, entry.start_sector);
 
-        // Calculate file size
-        uint8_t t = 0;
-        uint8_t s = 0;
-        size_t blocks = 0; 
-        do
-        {
-            //Debug_printv("t[%d] s[%d]", t, s);
+        // Where the entry is, a relative file that grows rewrites it
+        entry_block = { track, sector };
+        entry_offset = ((entry_index - 1) % 8) * 32;
 
+        // Collect the data blocks of the file
+        uint8_t t = entry.start_track;
+        uint8_t s = entry.start_sector;
+        if ( (entry.file_type & 0b00000111) == 4 && readSideSectors() )
+        {
+            // Relative file, the side sectors already list every data block
+            // Only the last block is needed for its used byte count
+            record_length = entry.rel_record_length;
+            seekSector( file_blocks.back().track, file_blocks.back().sector );
             containerStream->read(&t, 1);
             containerStream->read(&s, 1);
-            blocks++;
-            seekSector( t, s );
-        } while ( t > 0 );
-        blocks--;
-        m_length = (blocks * 254) + s;
+        }
+        else
+        {
+            while ( t > 0 && file_blocks.size() < 0xFFFF )
+            {
+                //Debug_printv("t[%d] s[%d]", t, s);
+                file_blocks.push_back( { t, s } );
+
+                seekSector( t, s );
+                containerStream->read(&t, 1);
+                containerStream->read(&s, 1);
+            }
+        }
+
+        // Calculate file size
+        // sector byte of the last link is the index of the last used byte
+        size_t blocks = file_blocks.size();
+        m_length = ( blocks ) ? ((blocks - 1) * 254) + s - 1 : 0;
         m_bytesAvailable = m_length;
-        
+
         // Set position to beginning of file
-        seekSector( entry.start_track, entry.start_sector );
+        if ( blocks )
+            seekSector( entry.start_track, entry.start_sector );
+
+        Debug_printv("File Size: blocks[%d] size[%d] available[%d] record_length[%d]", blocks, m_length, m_bytesAvailable, record_length);
 
-        Debug_printv("File Size: blocks[%d] size[%d] available[%d]", (blocks + 1), m_length, m_bytesAvailable);
-        
         return true;
     }
     else
@@ -285,6 +525,295 @@ bool D64IStream::seekPath(std::string path) {
     return false;
 };
 
+// Side sectors hold the track/sector of every data block of a relative file.
+// On the 1581 a super side sector comes first and links to the side sectors.
+bool D64IStream::readSideSectors()
+{
+    uint8_t side_sector[256];
+    uint8_t t = entry.rel_start_track;
+    uint8_t s = entry.rel_start_sector;
+    uint8_t count = 0;
+
+    file_blocks.clear();
+    side_sectors.clear();
+    super_side_sector = { 0, 0 };
+    while ( t > 0 && count++ < 0xFF )
+    {
+        seekSector( t, s );
+        if ( containerStream->read(side_sector, sizeof(side_sector)) != sizeof(side_sector) )
+            break;
+
+        // Super side sector, follow its link to the first side sector
+        if ( side_sector[2] == 0xFE )
+        {
+            super_side_sector = { t, s };
+            t = side_sector[0];
+            s = side_sector[1];
+            continue;
+        }
+
+        side_sectors.push_back( { t, s } );
+        t = side_sector[0];
+        s = side_sector[1];
+
+        // In the last side sector the link sector is the last used byte
+        size_t last = ( t ) ? 0xFF : s;
+        for ( size_t i = 0x10; i + 1 <= last; i += 2 )
+        {
+            if ( side_sector[i] == 0 )
+                break;
+
+            file_blocks.push_back( { side_sector[i], side_sector[i + 1] } );
+        }
+    }
+
+    Debug_printv("side sectors[%d] data blocks[%d]", count, file_blocks.size());
+    return file_blocks.size() > 0;
+}
+
+// Every data block is in file_blocks, so any position is one lookup away
+bool D64IStream::seek(size_t pos)
+{
+    if ( !seekCalled )
+        return containerStream->seek(pos);
+
+    if ( pos > m_length )
+        return false;
+
+    m_position = pos;
+    m_bytesAvailable = m_length - pos;
+
+    size_t index = pos / 254;
+    if ( index >= file_blocks.size() )
+    {
+        // End of file
+        next_track = 0;
+        sector_offset = 0;
+        return true;
+    }
+
+    sector_offset = 2 + (pos % 254);
+    if ( index + 1 < file_blocks.size() )
+    {
+        next_track = file_blocks[index + 1].track;
+        next_sector = file_blocks[index + 1].sector;
+    }
+    else
+    {
+        next_track = 0;
+        next_sector = 0;
+    }
+
+    return seekSector( file_blocks[index].track, file_blocks[index].sector, sector_offset );
+}
+
+
+/********************************************************
+ * Relative file writes
+ ********************************************************/
+
+D64RelOStream::D64RelOStream(D64IStream* image, D64IStream* file) : m_image(image)
+{
+    m_blocks = file->file_blocks;
+    m_side_sectors = file->side_sectors;
+    m_super = file->super_side_sector;
+    m_entry = file->entry_block;
+    m_entry_offset = file->entry_offset;
+    m_record_length = file->record_length;
+    m_length = file->size();
+}
+
+bool D64RelOStream::seek(size_t pos)
+{
+    m_position = pos;
+    return true;
+}
+
+size_t D64RelOStream::write(const uint8_t *buf, size_t size)
+{
+    uint8_t data[256];
+    size_t written = 0;
+
+    while ( written < size )
+    {
+        size_t index = m_position / 254;
+        if ( index >= m_blocks.size() )
+        {
+            if ( !grow() )
+                break;
+            continue;
+        }
+
+        auto &block = m_blocks[index];
+        if ( !m_image->readBlock(block.track, block.sector, data) )
+            break;
+
+        size_t offset = m_position % 254;
+        size_t count = std::min(254 - offset, size - written);
+        memcpy(data + 2 + offset, buf + written, count);
+
+        // The last block links to nothing, its sector byte is the last used byte
+        size_t end = m_position + count;
+        if ( index + 1 == m_blocks.size() && end > m_length )
+            data[1] = 1 + (end - (index * 254));
+
+        if ( !m_image->writeBlock(block.track, block.sector, data) )
+            break;
+
+        written += count;
+        m_position = end;
+        if ( m_position > m_length )
+            m_length = m_position;
+    }
+
+    return written;
+}
+
+// A new data block after the last one, listed in the next free side sector slot
+bool D64RelOStream::grow(void)
+{
+    if ( m_blocks.empty() || m_side_sectors.empty() )
+        return false;
+
+    auto last = m_blocks.back();
+    uint8_t track = last.track;
+    uint8_t sector = last.sector;
+    if ( !allocate(track, sector) )
+        return false;
+
+    // A full side sector is followed by a new one
+    size_t slot = m_blocks.size() % 120;
+    if ( slot == 0 && !addSideSector(track, sector) )
+    {
+        m_image->deallocateBlock(track, sector);
+        return false;
+    }
+
+    uint8_t data[256] = { 0 };
+    data[1] = 1;
+    if ( !m_image->writeBlock(track, sector, data) )
+        return false;
+
+    // The old last block is full now and links to the new one
+    if ( !m_image->readBlock(last.track, last.sector, data) )
+        return false;
+    data[0] = track;
+    data[1] = sector;
+    if ( !m_image->writeBlock(last.track, last.sector, data) )
+        return false;
+
+    auto side = m_side_sectors.back();
+    if ( !m_image->readBlock(side.track, side.sector, data) )
+        return false;
+    data[0x10 + (slot * 2)] = track;
+    data[0x11 + (slot * 2)] = sector;
+    data[1] = 0x11 + (slot * 2);
+    if ( !m_image->writeBlock(side.track, side.sector, data) )
+        return false;
+
+    m_blocks.push_back( { track, sector } );
+    m_length = m_blocks.size() * 254 - 254;
+    return countBlocks(1);
+}
+
+// Like the 1541, the block after the given one or the next free one
+bool D64RelOStream::allocate(uint8_t &track, uint8_t &sector)
+{
+    if ( m_image->allocateBlock(track, sector) )
+        return true;
+
+    return track != 0 && m_image->allocateBlock(track, sector);
+}
+
+// Side sectors come in groups of six that list each other at $04, on the
+// 1581 the super side sector lists the first of every group
+bool D64RelOStream::addSideSector(uint8_t track, uint8_t sector)
+{
+    uint8_t t = track;
+    uint8_t s = sector;
+    if ( !allocate(t, s) )
+        return false;
+
+    size_t number = m_side_sectors.size();
+    size_t group = number / 6;
+    if ( group > 0 && (m_super.track == 0 || group >= 126) )
+    {
+        m_image->deallocateBlock(t, s);
+        return false;
+    }
+
+    uint8_t data[256];
+    m_side_sectors.push_back( { t, s } );
+
+    // Every side sector of the group lists the whole group
+    size_t first = group * 6;
+    for ( size_t i = first; i <= number; i++ )
+    {
+        auto side = m_side_sectors[i];
+        if ( i == number )
+        {
+            // Nothing listed yet, the link sector is the last used byte
+            memset(data, 0, sizeof(data));
+            data[1] = 0x0F;
+            data[2] = number % 6;
+            data[3] = m_record_length;
+        }
+        else if ( !m_image->readBlock(side.track, side.sector, data) )
+            return false;
+
+        for ( size_t j = first; j < m_side_sectors.size(); j++ )
+        {
+            data[0x04 + ((j - first) * 2)] = m_side_sectors[j].track;
+            data[0x05 + ((j - first) * 2)] = m_side_sectors[j].sector;
+        }
+
+        // The one before links to the new one
+        if ( i + 1 == number )
+        {
+            data[0] = t;
+            data[1] = s;
+        }
+
+        if ( !m_image->writeBlock(side.track, side.sector, data) )
+            return false;
+    }
+
+    // The last side sector of a full group links to the first of the next
+    if ( group > 0 && number % 6 == 0 )
+    {
+        auto side = m_side_sectors[number - 1];
+        if ( !m_image->readBlock(side.track, side.sector, data) )
+            return false;
+        data[0] = t;
+        data[1] = s;
+        if ( !m_image->writeBlock(side.track, side.sector, data) )
+            return false;
+
+        if ( !m_image->readBlock(m_super.track, m_super.sector, data) )
+            return false;
+        data[0x03 + (group * 2)] = t;
+        data[0x04 + (group * 2)] = s;
+        if ( !m_image->writeBlock(m_super.track, m_super.sector, data) )
+            return false;
+    }
+
+    return countBlocks(1);
+}
+
+// Blocks used, in the directory entry
+bool D64RelOStream::countBlocks(uint8_t count)
+{
+    uint8_t data[256];
+    if ( !m_image->readBlock(m_entry.track, m_entry.sector, data) )
+        return false;
+
+    uint16_t blocks = data[m_entry_offset + 0x1E] | (data[m_entry_offset + 0x1F] << 8);
+    blocks += count;
+    data[m_entry_offset + 0x1E] = blocks bitand 0xFF;
+    data[m_entry_offset + 0x1F] = blocks >> 8;
+    return m_image->writeBlock(m_entry.track, m_entry.sector, data);
+}
+
 
 /********************************************************
  * File implementations
@@ -293,7 +822,25 @@ bool D64IStream::seekPath(std::string path) {
 MIStream* D64File::createIStream(std::shared_ptr<MIStream> containerIstream) {
     Debug_printv("[%s]", url.c_str());
 
-    return new D64IStream(containerIstream);
+    auto image = new D64IStream(containerIstream);
+    image->container_url = streamFile->url;
+    return image;
+}
+
+MOStream* D64File::outputStream() {
+    if ( pathInStream == "" )
+        return nullptr;
+
+    std::unique_ptr<MIStream> istream(inputStream());
+    auto file = (D64IStream*)istream.get();
+    if ( file == nullptr || file->recordLength() == 0 || file->side_sectors.empty() )
+        return nullptr;
+
+    auto image = ImageBroker::obtain<D64IStream>(streamFile->url);
+    if ( image == nullptr || !image->isWritable() )
+        return nullptr;
+
+    return new D64RelOStream(image, file);
 }
 
 bool D64File::isDirectory() {
@@ -359,15 +906,15 @@ time_t D64File::getLastWrite() {
 }
 
 time_t D64File::getCreationTime() {
-    tm *entry_time = 0;
+    tm entry_time = { 0 };
     auto entry = ImageBroker::obtain<D64IStream>(streamFile->url)->entry;
-    entry_time->tm_year = entry.year + 1900;
-    entry_time->tm_mon = entry.month;
-    entry_time->tm_mday = entry.day;
-    entry_time->tm_hour = entry.hour;
-    entry_time->tm_min = entry.minute;
+    entry_time.tm_year = entry.year;
+    entry_time.tm_mon = entry.month ? entry.month - 1 : 0;
+    entry_time.tm_mday = entry.day;
+    entry_time.tm_hour = entry.hour;
+    entry_time.tm_min = entry.minute;
 
-    return mktime(entry_time);
+    return mktime(&entry_time);
 }
 
 bool D64File::exists() {
@@ -19,6 +19,14 @@
 #include "string_utils.h"
 #include "cbm_image.h"
 
+#if defined(ESP32)
+#define SECTOR_CACHE_LINES  4       // runs of consecutive sectors kept for block access
+#define SECTOR_CACHE_LINE   4       // sectors read at once on a miss
+#else
+#define SECTOR_CACHE_LINES  2
+#define SECTOR_CACHE_LINE   2
+#endif
+
 
 /********************************************************
  * Streams
@@ -29,6 +37,19 @@ class D64IStream : public CBMImageStream {
 public:
     D64IStream(std::shared_ptr<MIStream> is) : CBMImageStream(is) {};
 
+    // Block access for the DOS block commands (U1/U2, B-R/B-W, B-A/B-F)
+    // Writes go straight through to the image file named by container_url
+    std::string container_url;
+
+    bool isValidBlock( uint8_t track, uint8_t sector );
+    bool readBlock( uint8_t track, uint8_t sector, uint8_t *data );
+    bool writeBlock( uint8_t track, uint8_t sector, const uint8_t *data );
+    bool isWritable( void );
+
+    // false if the block is already in that state, next free block in track/sector
+    bool allocateBlock( uint8_t &track, uint8_t &sector );
+    bool deallocateBlock( uint8_t track, uint8_t sector );
+
 protected:
 
     struct Header {
@@ -65,6 +86,11 @@ protected:
         uint16_t blocks;
     };
 
+    struct BlockAddress {
+        uint8_t track;
+        uint8_t sector;
+    };
+
 
     // D64 Offsets
     std::vector<uint8_t> directory_header_offset = {18, 0, 0x90};
@@ -95,6 +121,9 @@ protected:
     virtual bool seekPath(std::string path) override;
     size_t readFile(uint8_t* buf, size_t size) override;
 
+    bool seek(size_t pos) override;
+    uint8_t recordLength() override { return record_length; };
+
     Header header;      // Directory header data
     Entry entry;        // Directory entry data
 
@@ -107,21 +136,44 @@ protected:
 
     uint8_t next_track = 0;
     uint8_t next_sector = 0;
-    uint8_t sector_offset = 0;
+    uint16_t sector_offset = 0;
+
+    // Data blocks of the seeked file in order, so any byte is one lookup away
+    std::vector<BlockAddress> file_blocks;
+    uint8_t record_length = 0;
+
+    // Relative files, where the seeked entry is and its side sectors in order
+    BlockAddress entry_block = { 0, 0 };
+    uint8_t entry_offset = 0;
+    std::vector<BlockAddress> side_sectors;
+    BlockAddress super_side_sector = { 0, 0 };     // 1581 only
+
+    // Recently used sectors, so sequential block reads don't hit the image file each time
+    struct CacheLine {
+        uint16_t first;     // block address of the first sector
+        uint8_t count;      // sectors held, fewer at the end of the image
+        uint32_t used;
+    };
+    std::vector<CacheLine> cache_lines;
+    std::unique_ptr<uint8_t[]> cache_data;
+    uint32_t cache_tick = 0;
+
+    uint8_t sectorCount( uint8_t track );
+    uint16_t blockAddress( uint8_t track, uint8_t sector );
+    uint8_t *cachedSector( uint16_t address );
+    bool findBAM( uint8_t track, BAMInfo &bam );
+    bool isFreeBlock( uint8_t track, uint8_t sector );
+    bool updateBAM( uint8_t track, uint8_t sector, bool allocate );
 
 private:
     void sendListing();
 
+    bool readSideSectors();
+
     bool seekEntry( std::string filename );
     bool seekEntry( size_t index = 0 );
 
 
-    std::string readBlock( uint8_t track, uint8_t sector );
-    bool writeBlock( uint8_t track, uint8_t sector, std::string data );    
-    bool allocateBlock( uint8_t track, uint8_t sector );
-    bool deallocateBlock( uint8_t track, uint8_t sector );
-
-
     // uint8_t d64_get_type(uint16_t imgsize)
     // {
     //     switch (imgsize)
@@ -157,6 +209,42 @@ private:
     friend class D82File;
     friend class D8BFile;
     friend class DNPFile;    
+    friend class D64RelOStream;
+};
+
+
+// Writes records of an existing relative file. Data blocks are changed in
+// place, new ones are allocated near the last and listed in the side
+// sectors, all through the block access of the image.
+class D64RelOStream : public MOStream {
+
+public:
+    D64RelOStream(D64IStream* image, D64IStream* file);
+
+    size_t position() override { return m_position; };
+    void close() override {};
+    bool open() override { return isOpen(); };
+    bool isOpen() override { return m_image != nullptr; };
+
+    bool seek(size_t pos) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+
+private:
+    D64IStream* m_image;    // the image from the broker, it outlives this stream
+
+    std::vector<D64IStream::BlockAddress> m_blocks;
+    std::vector<D64IStream::BlockAddress> m_side_sectors;
+    D64IStream::BlockAddress m_super;
+    D64IStream::BlockAddress m_entry;
+    uint8_t m_entry_offset;
+    uint8_t m_record_length;
+    size_t m_length;
+    size_t m_position = 0;
+
+    bool grow(void);
+    bool allocate(uint8_t &track, uint8_t &sector);
+    bool addSideSector(uint8_t track, uint8_t sector);
+    bool countBlocks(uint8_t count);
 };
 
 
@@ -177,6 +265,9 @@ public:
 
     MIStream* createIStream(std::shared_ptr<MIStream> containerIstream) override;
 
+    // Only records of relative files that are already on the disk
+    MOStream* outputStream() override;
+
     std::string petsciiName() override {
         // It's already in PETSCII
         mstr::replaceAll(name, "\\", "/");
@@ -7,5 +7,7 @@
 MIStream* D71File::createIStream(std::shared_ptr<MIStream> containerIstream) {
     Debug_printv("[%s]", url.c_str());
 
-    return new D71IStream(containerIstream);
+    auto image = new D71IStream(containerIstream);
+    image->container_url = streamFile->url;
+    return image;
 }
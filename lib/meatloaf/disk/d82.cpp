@@ -7,5 +7,7 @@
 MIStream* D82File::createIStream(std::shared_ptr<MIStream> containerIstream) {
     Debug_printv("[%s]", url.c_str());
 
-    return new D82IStream(containerIstream);
+    auto image = new D82IStream(containerIstream);
+    image->container_url = streamFile->url;
+    return image;
 }
\ No newline at end of file
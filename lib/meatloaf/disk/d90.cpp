@@ -7,5 +7,7 @@
 MIStream* D90File::createIStream(std::shared_ptr<MIStream> containerIstream) {
     Debug_printv("[%s]", url.c_str());
 
-    return new D90IStream(containerIstream);
+    auto image = new D90IStream(containerIstream);
+    image->container_url = streamFile->url;
+    return image;
 }
\ No newline at end of file
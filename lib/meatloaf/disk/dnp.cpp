@@ -8,5 +8,7 @@
 MIStream* DNPFile::createIStream(std::shared_ptr<MIStream> containerIstream) {
     Debug_printv("[%s]", url.c_str());
 
-    return new DNPIStream(containerIstream);
+    auto image = new DNPIStream(containerIstream);
+    image->container_url = streamFile->url;
+    return image;
 }
@@ -24,7 +24,12 @@
 
 // Network
 #include "network/http.h"
+#include "network/https.h"
 #include "network/smb.h"
+#include "network/tnfs.h"
+#include "network/ftp.h"
+#include "network/webdav.h"
+#include "network/tftp.h"
 #include "network/ws.h"
 
 // Scanners
@@ -54,6 +59,12 @@ LittleFileSystem defaultFS(FS_PHYS_ADDR, FS_PHYS_SIZE, FS_PHYS_PAGE, FS_PHYS_BLO
 
 // Scheme
 HttpFileSystem httpFS;
+HttpsFileSystem httpsFS;
+TnfsFileSystem tnfsFS;
+FtpFileSystem ftpFS;
+SmbFileSystem smbFS;
+WebdavFileSystem webdavFS;
+TftpFileSystem tftpFS;
 MLFileSystem mlFS;
 CServerFileSystem csFS;
 WSFileSystem wsFS;
@@ -77,7 +88,7 @@ TCRTFileSystem tcrtFS;
 
 // put all available filesystems in this array - first matching system gets the file!
 // fist in list is default
-std::vector<MFileSystem*> MFSOwner::availableFS{ &defaultFS, &d64FS, &d71FS, &d80FS, &d81FS, &d82FS, &d8bFS, &dnpFS, &t64FS, &tcrtFS, &mlFS, &httpFS, &wsFS };
+std::vector<MFileSystem*> MFSOwner::availableFS{ &defaultFS, &d64FS, &d71FS, &d80FS, &d81FS, &d82FS, &d8bFS, &dnpFS, &t64FS, &tcrtFS, &mlFS, &httpFS, &httpsFS, &tnfsFS, &ftpFS, &smbFS, &webdavFS, &tftpFS, &wsFS };
 
 bool MFSOwner::mount(std::string name) {
     Serial.print("MFSOwner::mount fs:");
@@ -49,6 +49,11 @@ public:
     uint16_t media_blocks_free = 0;
     uint16_t media_block_size = 256;
 
+    // Listing filter hints for backends that can filter on the server, the
+    // pattern in ASCII. The caller still checks every entry it gets back.
+    std::string dir_pattern;
+    std::string dir_types;
+
     bool operator!=(nullptr_t ptr);
 
     bool copyTo(MFile* dst);
@@ -27,6 +27,10 @@ public:
 class MOStream: public MStream {
 public:
     virtual size_t write(const uint8_t *buf, size_t size) = 0;
+
+    // For relative files, records are rewritten in place
+    virtual bool seek(size_t pos) { return false; };
+    virtual bool setRecordLength(uint8_t length) { return false; };
 };
 
 
@@ -63,6 +67,40 @@ public:
 
     virtual bool isBrowsable() { return false; };
     virtual bool isRandomAccess() { return false; };
+
+    // For relative files, fixed size of a record (0 for any other file)
+    virtual uint8_t recordLength() { return 0; };
+};
+
+// A whole file held in RAM, e.g. one that was prefetched
+class MemoryIStream: public MIStream {
+public:
+    MemoryIStream(std::shared_ptr<std::string> data) : m_data(data) {};
+
+    size_t position() override { return m_position; };
+    void close() override {};
+    bool open() override { return true; };
+    bool isOpen() override { return m_data != nullptr; };
+
+    bool seek(size_t pos) override {
+        if(pos > size())
+            return false;
+        m_position = pos;
+        return true;
+    };
+    size_t available() override { return size() - m_position; };
+    size_t size() override { return m_data->size(); };
+    size_t read(uint8_t* buf, size_t count) override {
+        if(count > available())
+            count = available();
+        memcpy(buf, m_data->data() + m_position, count);
+        m_position += count;
+        return count;
+    };
+
+private:
+    std::shared_ptr<std::string> m_data;
+    size_t m_position = 0;
 };
 
 
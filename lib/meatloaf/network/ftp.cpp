@@ -0,0 +1,673 @@
+#include "ftp.h"
+
+#include <time.h>
+
+// Paths from the url come without the leading slash
+static std::string ftpPath(const std::string &path) {
+    return mstr::startsWith(path, "/") ? path : "/" + path;
+}
+
+static time_t ftpTime(int year, int month, int day, int hour, int minute, int second) {
+    struct tm t = {};
+    t.tm_year = year - 1900;
+    t.tm_mon = month - 1;
+    t.tm_mday = day;
+    t.tm_hour = hour;
+    t.tm_min = minute;
+    t.tm_sec = second;
+    return mktime(&t);
+}
+
+// type=file;size=1234;modify=20230102030405; name
+static bool parseMlsd(const std::string &line, FtpEntry &entry) {
+    size_t space = line.find(' ');
+    if(space == std::string::npos)
+        return false;
+    entry.name = line.substr(space + 1);
+
+    auto facts = mstr::split(line.substr(0, space), ';');
+    for(auto &fact : facts) {
+        size_t equals = fact.find('=');
+        if(equals == std::string::npos)
+            continue;
+        std::string key = fact.substr(0, equals);
+        std::string value = fact.substr(equals + 1);
+        mstr::toLower(key);
+        mstr::toLower(value);
+
+        if(key == "type") {
+            // The directory itself and its parent
+            if(value == "cdir" || value == "pdir")
+                return false;
+            entry.dir = (value == "dir");
+        }
+        else if(key == "size" || key == "sizd") {
+            entry.size = atol(value.c_str());
+        }
+        else if(key == "modify") {
+            int y, mo, d, h, mi, s;
+            if(sscanf(value.c_str(), "%4d%2d%2d%2d%2d%2d", &y, &mo, &d, &h, &mi, &s) == 6)
+                entry.modified = ftpTime(y, mo, d, h, mi, s);
+        }
+    }
+    return entry.name.size();
+}
+
+// Unix:  drwxr-xr-x 2 user group 4096 Jan  1 12:00 name
+// DOS:   01-02-23  03:04PM       <DIR>          name
+static bool parseList(const std::string &line, FtpEntry &entry) {
+    std::vector<std::string> fields;
+    size_t i = 0;
+    bool dos = isdigit(line[0]);
+    size_t count = dos ? 3 : 8;
+    while(fields.size() < count && i < line.size()) {
+        size_t start = line.find_first_not_of(' ', i);
+        if(start == std::string::npos)
+            return false;
+        i = line.find(' ', start);
+        if(i == std::string::npos)
+            return false;
+        fields.push_back(line.substr(start, i - start));
+    }
+    size_t start = line.find_first_not_of(' ', i);
+    if(fields.size() < count || start == std::string::npos)
+        return false;
+    entry.name = line.substr(start);
+
+    if(dos) {
+        int mo, d, y, h, mi;
+        char half = 'A';
+        if(sscanf(fields[0].c_str(), "%d-%d-%d", &mo, &d, &y) == 3 && sscanf(fields[1].c_str(), "%d:%d%c", &h, &mi, &half) >= 2) {
+            if(y < 100)
+                y += (y < 70) ? 2000 : 1900;
+            h = (h % 12) + ((half == 'P') ? 12 : 0);
+            entry.modified = ftpTime(y, mo, d, h, mi, 0);
+        }
+        entry.dir = (fields[2] == "<DIR>");
+        entry.size = entry.dir ? 0 : atol(fields[2].c_str());
+        return true;
+    }
+
+    if(fields[0][0] == 'l') {
+        // A link, without where it points to
+        size_t arrow = entry.name.find(" -> ");
+        if(arrow != std::string::npos)
+            entry.name.resize(arrow);
+    }
+    entry.dir = (fields[0][0] == 'd');
+    entry.size = atol(fields[4].c_str());
+
+    // Within the last half year the time is there instead of the year
+    const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    const char *month = strstr(months, fields[5].c_str());
+    int mo = (month != nullptr && fields[5].size() == 3) ? (month - months) / 3 + 1 : 1;
+    int d = atoi(fields[6].c_str());
+    int y, h, mi;
+    if(sscanf(fields[7].c_str(), "%d:%d", &h, &mi) == 2) {
+        time_t now = time(nullptr);
+        struct tm *local = localtime(&now);
+        y = local->tm_year + 1900;
+        if(ftpTime(y, mo, d, h, mi, 0) > now + 86400)
+            y--;
+    }
+    else {
+        y = atoi(fields[7].c_str());
+        h = mi = 0;
+    }
+    entry.modified = ftpTime(y, mo, d, h, mi, 0);
+
+    return entry.name != "." && entry.name != "..";
+}
+
+
+/********************************************************
+ * Sessions
+ ********************************************************/
+
+std::list<std::shared_ptr<FtpSession>> FtpSession::m_sessions;
+
+std::shared_ptr<FtpSession> FtpSession::acquire(const PeoplesUrlParser &url) {
+    uint16_t port = url.port.size() ? atoi(url.port.c_str()) : FTP_PORT;
+    std::string user = url.user.size() ? url.user : "anonymous";
+
+    auto it = m_sessions.begin();
+    while(it != m_sessions.end()) {
+        auto session = *it;
+        if(session->m_busy || session->m_host != url.host || session->m_port != port || session->m_user != user) {
+            it++;
+            continue;
+        }
+
+        if(session->m_control.connected() && millis() - session->m_used < FTP_IDLE) {
+            Debug_printv("reusing control connection to [%s:%d]", url.host.c_str(), port);
+            m_sessions.splice(m_sessions.begin(), m_sessions, it);
+            session->m_busy = true;
+            return session;
+        }
+
+        // Logged out by now
+        it = m_sessions.erase(it);
+    }
+
+    std::shared_ptr<FtpSession> session(new FtpSession());
+    session->m_host = url.host;
+    session->m_port = port;
+    session->m_user = user;
+
+    IPAddress address;
+    if(!WiFi.hostByName(url.host.c_str(), address) || !session->m_control.connect(address, port)) {
+        Debug_printv("can't connect to [%s:%d]", url.host.c_str(), port);
+        return nullptr;
+    }
+    session->m_control.setNoDelay(true);
+
+    if(!session->login(url.user.size() ? url.pass : "meatloaf@"))
+        return nullptr;
+
+    session->m_busy = true;
+    m_sessions.push_front(session);
+    return session;
+}
+
+void FtpSession::release(std::shared_ptr<FtpSession> &session) {
+    if(session == nullptr)
+        return;
+
+    session->m_busy = false;
+    session->m_used = millis();
+    session.reset();
+
+    // Streams still using older ones keep them until they close
+    size_t idle = 0;
+    auto it = m_sessions.begin();
+    while(it != m_sessions.end()) {
+        if(!(*it)->m_busy && ++idle > FTP_SESSIONS)
+            it = m_sessions.erase(it);
+        else
+            it++;
+    }
+}
+
+FtpSession::~FtpSession() {
+    // Nobody waits for the answer
+    if(m_control.connected())
+        m_control.print("QUIT\r\n");
+    m_control.stop();
+}
+
+bool FtpSession::login(const std::string &pass) {
+    // 120 comes before 220 from servers that are still starting
+    int code;
+    do {
+        code = reply();
+    } while(code == 120);
+    if(code != 220)
+        return false;
+
+    code = command("USER " + m_user);
+    if(code == 331)
+        code = command("PASS " + pass);
+    if(code != 230) {
+        Debug_printv("login of [%s] to [%s] refused [%d]", m_user.c_str(), m_host.c_str(), code);
+        return false;
+    }
+    return true;
+}
+
+int FtpSession::command(const std::string &line, std::string *text) {
+    if(!mstr::startsWith(line, "PASS"))
+        Debug_printv("[%s] %s", m_host.c_str(), line.c_str());
+
+    std::string request = line + "\r\n";
+    if(m_control.write((const uint8_t *)request.data(), request.size()) != request.size()) {
+        m_control.stop();
+        return 0;
+    }
+    return reply(text);
+}
+
+// A line of a reply, the control connection is dropped when none comes
+bool FtpSession::line(std::string &text) {
+    text.clear();
+    uint32_t start = millis();
+    while(millis() - start < FTP_TIMEOUT) {
+        if(!m_control.available()) {
+            if(!m_control.connected())
+                break;
+            delay(1);
+            continue;
+        }
+
+        char c = m_control.read();
+        if(c == '\n') {
+            if(text.size() && text.back() == '\r')
+                text.pop_back();
+            return true;
+        }
+        text.push_back(c);
+    }
+
+    m_control.stop();
+    return false;
+}
+
+int FtpSession::reply(std::string *text) {
+    std::string last;
+    if(!line(last) || last.size() < 3)
+        return 0;
+    int code = atoi(last.substr(0, 3).c_str());
+
+    // Continued up to the line starting with the code and a space
+    if(last.size() > 3 && last[3] == '-') {
+        std::string end = last.substr(0, 3) + " ";
+        do {
+            if(!line(last))
+                return 0;
+        } while(!mstr::startsWith(last, end.c_str()));
+    }
+
+    // 421 is the server going away
+    if(code == 421)
+        m_control.stop();
+
+    if(text != nullptr)
+        *text = (last.size() > 4) ? last.substr(4) : "";
+    return code;
+}
+
+bool FtpSession::binary(void) {
+    if(!m_binary)
+        m_binary = (command("TYPE I") == 200);
+    return m_binary;
+}
+
+bool FtpSession::passive(WiFiClient &data) {
+    std::string text;
+    if(command("PASV", &text) != 227)
+        return false;
+
+    // Entering Passive Mode (h1,h2,h3,h4,p1,p2)
+    int h[6];
+    size_t at = text.find_first_of("0123456789");
+    if(at == std::string::npos || sscanf(text.c_str() + at, "%d,%d,%d,%d,%d,%d", &h[0], &h[1], &h[2], &h[3], &h[4], &h[5]) != 6)
+        return false;
+
+    // Servers behind NAT tell their inside address, the one we talk to is right
+    return data.connect(m_control.remoteIP(), (h[4] << 8) | h[5]);
+}
+
+bool FtpSession::list(const std::string &path, std::vector<FtpEntry> &entries) {
+    WiFiClient data;
+    if(!passive(data))
+        return false;
+
+    int code = command((m_mlsd ? "MLSD " : "LIST ") + path);
+    if(m_mlsd && code >= 500 && code != 550) {
+        // Not known here, LIST from now on
+        data.stop();
+        m_mlsd = false;
+        return list(path, entries);
+    }
+    if(code != 125 && code != 150) {
+        data.stop();
+        return false;
+    }
+
+    entries.clear();
+    std::string line;
+    auto parse = [&]() {
+        FtpEntry entry;
+        if(line.size() && (m_mlsd ? parseMlsd(line, entry) : parseList(line, entry)))
+            entries.push_back(entry);
+        line.clear();
+    };
+
+    uint8_t buffer[256];
+    uint32_t start = millis();
+    while(millis() - start < FTP_TIMEOUT) {
+        int n = data.available();
+        if(n <= 0) {
+            if(!data.connected())
+                break;
+            delay(1);
+            continue;
+        }
+
+        n = data.read(buffer, std::min((size_t)n, sizeof(buffer)));
+        for(int i = 0; i < n; i++) {
+            if(buffer[i] == '\n')
+                parse();
+            else if(buffer[i] != '\r')
+                line.push_back(buffer[i]);
+        }
+        start = millis();
+    }
+    parse();
+    data.stop();
+
+    code = reply();
+    Debug_printv("[%s] entries[%d] reply[%d]", path.c_str(), entries.size(), code);
+    return code == 226 || code == 250;
+}
+
+
+/********************************************************
+ * Listings
+ ********************************************************/
+
+std::list<FtpListings::Listing> FtpListings::m_listings;
+uint32_t FtpListings::hits = 0;
+uint32_t FtpListings::misses = 0;
+
+std::string FtpListings::key(const PeoplesUrlParser &url, const std::string &dir) {
+    return url.user + "@" + url.host + ":" + url.port + dir;
+}
+
+bool FtpListings::get(const PeoplesUrlParser &url, const std::string &dir, std::vector<FtpEntry> &entries) {
+    std::string k = key(url, dir);
+    for(auto it = m_listings.begin(); it != m_listings.end(); it++) {
+        if(it->key != k)
+            continue;
+
+        if(millis() - it->stamp < FTP_LISTING_TTL) {
+            m_listings.splice(m_listings.begin(), m_listings, it);
+            entries = m_listings.front().entries;
+            hits++;
+            return true;
+        }
+        m_listings.erase(it);
+        break;
+    }
+
+    misses++;
+    auto session = FtpSession::acquire(url);
+    if(session == nullptr)
+        return false;
+    bool listed = session->list(dir, entries);
+    FtpSession::release(session);
+    if(!listed)
+        return false;
+
+    m_listings.push_front({ k, entries, (uint32_t)millis() });
+    if(m_listings.size() > FTP_LISTINGS)
+        m_listings.pop_back();
+    return true;
+}
+
+void FtpListings::forget(const PeoplesUrlParser &url, const std::string &dir) {
+    std::string k = key(url, dir);
+    m_listings.remove_if([&k](const Listing &listing) { return listing.key == k; });
+}
+
+
+/********************************************************
+ * File impls
+ ********************************************************/
+
+MIStream* FtpFile::inputStream() {
+    // has to return OPENED stream
+    MIStream* istream = new FtpIStream(url);
+    istream->open();
+    return istream;
+}
+
+std::string FtpFile::parent(void) {
+    std::string p = ftpPath(path);
+    while(p.size() > 1 && mstr::endsWith(p, "/"))
+        p.pop_back();
+    size_t slash = p.rfind('/');
+    return (slash == 0) ? "/" : p.substr(0, slash);
+}
+
+// Looked up in the listing of the directory the file is in
+bool FtpFile::stat(void) {
+    if(m_statted)
+        return m_exists;
+
+    std::string p = ftpPath(path);
+    if(p == "/") {
+        m_statted = m_exists = m_entry.dir = true;
+        return true;
+    }
+
+    std::vector<FtpEntry> entries;
+    if(!FtpListings::get(*this, parent(), entries))
+        return false;
+
+    std::string n = p.substr(p.rfind('/') + 1);
+    m_statted = true;
+    m_exists = false;
+    for(auto &entry : entries) {
+        if(entry.name == n) {
+            m_entry = entry;
+            m_exists = true;
+            break;
+        }
+    }
+    return m_exists;
+}
+
+bool FtpFile::isDirectory() {
+    return stat() && m_entry.dir;
+}
+
+bool FtpFile::exists() {
+    return stat();
+}
+
+size_t FtpFile::size() {
+    return stat() ? m_entry.size : 0;
+}
+
+time_t FtpFile::getLastWrite() {
+    return stat() ? m_entry.modified : 0;
+}
+
+// FTP doesn't know it
+time_t FtpFile::getCreationTime() {
+    return getLastWrite();
+}
+
+bool FtpFile::call(const std::string &line, int expected) {
+    auto session = FtpSession::acquire(*this);
+    if(session == nullptr)
+        return false;
+    bool done = (session->command(line) == expected);
+    FtpSession::release(session);
+
+    FtpListings::forget(*this, parent());
+    m_statted = false;
+    return done;
+}
+
+bool FtpFile::mkDir() {
+    return call("MKD " + ftpPath(path), 257);
+}
+
+bool FtpFile::remove() {
+    return call((isDirectory() ? "RMD " : "DELE ") + ftpPath(path), 250);
+}
+
+bool FtpFile::rename(std::string dest) {
+    if(dest.empty())
+        return false;
+
+    // Only within this server
+    if(dest.find("://") != std::string::npos) {
+        PeoplesUrlParser parser;
+        parser.parseUrl(dest);
+        dest = parser.path;
+    }
+
+    auto session = FtpSession::acquire(*this);
+    if(session == nullptr)
+        return false;
+    bool done = session->command("RNFR " + ftpPath(path)) == 350
+        && session->command("RNTO " + ftpPath(dest)) == 250;
+    FtpSession::release(session);
+
+    FtpListings::forget(*this, parent());
+    m_statted = false;
+    return done;
+}
+
+bool FtpFile::rewindDirectory() {
+    m_next = 0;
+    m_listed = FtpListings::get(*this, ftpPath(path), m_entries);
+    return m_listed;
+}
+
+MFile* FtpFile::getNextFileInDir() {
+    if(!m_listed && !rewindDirectory())
+        return nullptr;
+
+    if(m_next >= m_entries.size()) {
+        m_listed = false;
+        return nullptr;
+    }
+
+    // The listing already told all there is to know
+    FtpEntry &entry = m_entries[m_next++];
+    auto file = new FtpFile(url + (mstr::endsWith(url, "/") ? "" : "/") + entry.name);
+    file->m_statted = true;
+    file->m_exists = true;
+    file->m_entry = entry;
+    return file;
+}
+
+
+/********************************************************
+ * Istream impls
+ ********************************************************/
+
+bool FtpIStream::open() {
+    PeoplesUrlParser parser;
+    parser.parseUrl(url);
+    m_path = ftpPath(parser.path);
+
+    m_session = FtpSession::acquire(parser);
+    if(m_session == nullptr || !m_session->binary()) {
+        FtpSession::release(m_session);
+        return false;
+    }
+
+    // SIZE counts bytes only in binary mode, servers without it are asked for the listing
+    std::string text;
+    int code = m_session->command("SIZE " + m_path, &text);
+    if(code == 213) {
+        m_size = atol(text.c_str());
+    }
+    else if(code >= 500 && code != 550) {
+        std::unique_ptr<FtpFile> file(new FtpFile(url));
+        if(!file->exists() || file->isDirectory()) {
+            FtpSession::release(m_session);
+            return false;
+        }
+        m_size = file->size();
+    }
+    else {
+        FtpSession::release(m_session);
+        return false;
+    }
+
+    // The transfer starts with the first read, wherever a seek put it
+    m_position = 0;
+    m_isOpen = true;
+    Debug_printv("[%s] size[%d]", url.c_str(), m_size);
+    return true;
+}
+
+void FtpIStream::close() {
+    if(m_session != nullptr) {
+        finish();
+        FtpSession::release(m_session);
+    }
+    m_isOpen = false;
+}
+
+bool FtpIStream::retrieve(void) {
+    if(!m_session->passive(m_data))
+        return false;
+
+    if(m_position && m_session->command("REST " + std::to_string(m_position)) != 350) {
+        m_data.stop();
+        return false;
+    }
+
+    int code = m_session->command("RETR " + m_path);
+    if(code != 125 && code != 150) {
+        m_data.stop();
+        return false;
+    }
+
+    m_transfer = true;
+    return true;
+}
+
+// Ends the transfer, whether or not all was sent
+void FtpIStream::finish(void) {
+    if(!m_transfer)
+        return;
+    m_transfer = false;
+    m_data.stop();
+
+    // The one answer to RETR, 226 when it was complete, 426 or 451 when not
+    m_session->reply();
+}
+
+// Whatever came, waiting only for the first bytes
+size_t FtpIStream::receive(uint8_t* buf, size_t size) {
+    uint32_t start = millis();
+    while(millis() - start < FTP_TIMEOUT) {
+        int n = m_data.available();
+        if(n > 0) {
+            n = m_data.read(buf, std::min((size_t)n, size));
+            return (n > 0) ? n : 0;
+        }
+        if(!m_data.connected())
+            break;
+        delay(1);
+    }
+    return 0;
+}
+
+bool FtpIStream::seek(size_t pos) {
+    if(pos > m_size)
+        return false;
+
+    // A bit further on is quicker read than asked for again
+    if(m_transfer && pos > m_position && pos - m_position < FTP_SKIP) {
+        uint8_t buffer[256];
+        while(m_position < pos) {
+            size_t n = receive(buffer, std::min(sizeof(buffer), pos - m_position));
+            if(n == 0)
+                break;
+            m_position += n;
+        }
+        if(m_position == pos)
+            return true;
+    }
+
+    if(pos != m_position)
+        finish();
+    m_position = pos;
+    return true;
+}
+
+size_t FtpIStream::read(uint8_t* buf, size_t size) {
+    if(size > available())
+        size = available();
+    if(size == 0 || !m_isOpen)
+        return 0;
+
+    if(!m_transfer && !retrieve())
+        return 0;
+
+    size_t count = receive(buf, size);
+    m_position += count;
+
+    // All of it, or the transfer broke off
+    if(count == 0 || m_position == m_size)
+        finish();
+    return count;
+}
@@ -1 +1,214 @@
 // FTP:// - File Transfer Protocol
+// https://www.rfc-editor.org/rfc/rfc959
+// https://www.rfc-editor.org/rfc/rfc3659 (SIZE, MDTM, REST, MLSD)
+//
+// A logged in control connection per server is kept between files, so
+// only the first request to a server pays for the login. Every transfer
+// still needs its own passive data connection.
+//
+// Listings are asked for with MLSD, or LIST on servers without it, and
+// kept for a while per directory. Files in a listed directory know their
+// size and time without asking again. Reads start with REST at the
+// position they are at, so a seek costs one new transfer.
+
+#ifndef MEATFILESYSTEM_SCHEME_FTP
+#define MEATFILESYSTEM_SCHEME_FTP
+
+#include "../../include/global_defines.h"
+#include "meat_io.h"
+
+#if defined(ESP32)
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#endif
+
+#include <list>
+#include <vector>
+
+#define FTP_PORT            21
+#define FTP_TIMEOUT         10000   // ms for a reply or data
+#define FTP_SESSIONS        2       // idle control connections kept
+#define FTP_IDLE            60000   // ms one may stay idle, servers log out after a few minutes
+#if defined(ESP32)
+#define FTP_LISTINGS        8       // directories whose listing is remembered
+#else
+#define FTP_LISTINGS        3
+#endif
+#define FTP_LISTING_TTL     30000   // ms
+#define FTP_SKIP            2048    // forward seeks shorter than this read on instead of restarting
+
+
+struct FtpEntry {
+    std::string name;
+    bool dir = false;
+    size_t size = 0;
+    time_t modified = 0;
+};
+
+
+/********************************************************
+ * Sessions and listings shared by all FTP files
+ ********************************************************/
+
+class FtpSession {
+public:
+    // Logged in and not used by any other stream, nullptr when the server
+    // can't be reached or refuses the login. Anonymous without a user.
+    static std::shared_ptr<FtpSession> acquire(const PeoplesUrlParser &url);
+    static void release(std::shared_ptr<FtpSession> &session);
+
+    // The reply code, 0 when none came. text gets the last line of it.
+    int command(const std::string &line, std::string *text = nullptr);
+    int reply(std::string *text = nullptr);
+
+    // Connects the data connection for the next transfer command
+    bool passive(WiFiClient &data);
+
+    bool list(const std::string &path, std::vector<FtpEntry> &entries);
+    bool binary(void);
+
+    ~FtpSession();
+
+private:
+    std::string m_host;
+    uint16_t m_port;
+    std::string m_user;
+    WiFiClient m_control;
+
+    bool m_busy = false;
+    uint32_t m_used = 0;
+    bool m_mlsd = true;     // until the server says it doesn't know it
+    bool m_binary = false;
+
+    bool login(const std::string &pass);
+    bool line(std::string &text);
+
+    static std::list<std::shared_ptr<FtpSession>> m_sessions;    // most recently used first
+};
+
+// Listings by directory, so the files in it need not ask for themselves
+class FtpListings {
+public:
+    // From the cache, or asks the server
+    static bool get(const PeoplesUrlParser &url, const std::string &dir, std::vector<FtpEntry> &entries);
+    static void forget(const PeoplesUrlParser &url, const std::string &dir);
+
+    static uint32_t hits;
+    static uint32_t misses;
+
+private:
+    struct Listing {
+        std::string key;
+        std::vector<FtpEntry> entries;
+        uint32_t stamp;
+    };
+    static std::list<Listing> m_listings;   // most recent first
+
+    static std::string key(const PeoplesUrlParser &url, const std::string &dir);
+};
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+class FtpFile: public MFile
+{
+public:
+    FtpFile(std::string path): MFile(path) {};
+
+    MIStream* createIStream(std::shared_ptr<MIStream> src) { return src.get(); };
+    MIStream* inputStream() override ; // has to return OPENED stream
+    MOStream* outputStream() override { return nullptr; };
+
+    bool isDirectory() override;
+    bool rewindDirectory() override;
+    MFile* getNextFileInDir() override;
+    bool mkDir() override;
+
+    bool exists() override;
+    bool remove() override;
+    bool rename(std::string dest);
+    time_t getLastWrite() override;
+    time_t getCreationTime() override;
+    size_t size() override;
+
+private:
+    // From the listing of the directory this file is in
+    bool m_statted = false;
+    bool m_exists = false;
+    FtpEntry m_entry;
+    bool stat(void);
+
+    std::vector<FtpEntry> m_entries;
+    size_t m_next = 0;
+    bool m_listed = false;
+
+    bool call(const std::string &line, int expected);
+    std::string parent(void);
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+class FtpIStream: public MIStream {
+public:
+    FtpIStream(std::string path) {
+        url = path;
+    }
+    ~FtpIStream() {
+        close();
+    }
+
+    // MStream methods
+    size_t position() override { return m_position; };
+    void close() override;
+    bool open() override;
+    bool isOpen() override { return m_isOpen; };
+
+    // MIStream methods
+    bool seek(size_t pos) override;
+    size_t available() override { return m_size - m_position; };
+    size_t size() override { return m_size; };
+    size_t read(uint8_t* buf, size_t size) override;
+
+protected:
+    std::string url;
+    bool m_isOpen = false;
+    size_t m_size = 0;
+    size_t m_position = 0;
+
+    std::shared_ptr<FtpSession> m_session;
+    std::string m_path;
+    WiFiClient m_data;
+    bool m_transfer = false;    // a RETR is running, its data is at m_position
+
+    bool retrieve(void);
+    void finish(void);
+    size_t receive(uint8_t* buf, size_t size);
+};
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class FtpFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new FtpFile(path);
+    }
+
+    bool handles(std::string name) {
+        std::string pattern = "ftp:";
+        return mstr::equals(name, pattern, false);
+    }
+public:
+    FtpFileSystem(): MFileSystem("ftp") {};
+};
+
+
+#endif /* MEATFILESYSTEM_SCHEME_FTP */
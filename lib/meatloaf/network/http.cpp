@@ -1,4 +1,194 @@
 #include "http.h"
+#include "http_cache.h"
+#include "https.h"
+
+/********************************************************
+ * Connection pool
+ ********************************************************/
+
+std::list<HttpPool::Connection> HttpPool::m_idle;
+std::list<HttpPool::Address> HttpPool::m_addresses;
+
+bool HttpPool::secure(const std::string &url) {
+    return mstr::startsWith(url, "https:", false);
+}
+
+void HttpPool::address(const std::string &url, std::string &host, uint16_t &port) {
+    // scheme://[user:pass@]host[:port]/path
+    size_t start = url.find("://");
+    start = (start == std::string::npos) ? 0 : start + 3;
+    size_t end = url.find_first_of("/?", start);
+    size_t at = url.rfind('@', end);
+    if(at != std::string::npos && at >= start)
+        start = at + 1;
+    host = url.substr(start, (end == std::string::npos) ? std::string::npos : end - start);
+
+    port = secure(url) ? 443 : 80;
+    size_t colon = host.find(':');
+    if(colon != std::string::npos) {
+        port = atoi(host.c_str() + colon + 1);
+        host.erase(colon);
+    }
+}
+
+WiFiClient HttpPool::acquire(const std::string &url) {
+    std::string host;
+    uint16_t port;
+    address(url, host, port);
+
+    // Nothing to match, the request resolves the host itself
+    if(m_idle.empty())
+        return WiFiClient();
+
+    uint32_t ip = 0;
+    bool resolved = resolve(host, ip);
+
+    for(auto it = m_idle.begin(); it != m_idle.end(); ) {
+        bool expired = millis() - it->used > HTTP_KEEPALIVE || !it->client.connected();
+        if(expired) {
+            it->client.stop();
+            it = m_idle.erase(it);
+        }
+        else if(resolved && it->ip == ip && it->port == port) {
+            WiFiClient client = it->client;
+            m_idle.erase(it);
+            Debug_printv("reusing connection to [%s:%d]", host.c_str(), port);
+            return client;
+        }
+        else
+            it++;
+    }
+
+    return WiFiClient();
+}
+
+bool HttpPool::resolve(const std::string &host, uint32_t &ip) {
+    for(auto it = m_addresses.begin(); it != m_addresses.end(); it++) {
+        if(it->host != host)
+            continue;
+
+        if(millis() - it->stamp > HTTP_ADDRESS_TTL) {
+            m_addresses.erase(it);
+            break;
+        }
+        ip = it->ip;
+        return true;
+    }
+
+    IPAddress address;
+    if(!WiFi.hostByName(host.c_str(), address))
+        return false;
+
+    ip = (uint32_t)address;
+    m_addresses.push_front( { host, ip, (uint32_t)millis() } );
+    if(m_addresses.size() > HTTP_POOL_SIZE * 2)
+        m_addresses.pop_back();
+    return true;
+}
+
+WiFiClient* HttpPool::connect(const std::string &url, WiFiClient &plain) {
+    if(secure(url))
+        return HttpsPool::acquire(url);
+
+    plain = acquire(url);
+    return &plain;
+}
+
+void HttpPool::disconnect(const std::string &url, WiFiClient *client, bool reusable) {
+    if(!reusable)
+        client->stop();
+
+    if(secure(url))
+        HttpsPool::release(client, reusable);
+    else {
+        if(reusable)
+            release(*client);
+        // Another stop() must not close the connection now in the pool
+        *client = WiFiClient();
+    }
+}
+
+void HttpPool::release(WiFiClient &client) {
+    if(!client.connected())
+        return;
+
+    m_idle.push_front( { (uint32_t)client.remoteIP(), client.remotePort(), client, (uint32_t)millis() } );
+    while(m_idle.size() > HTTP_POOL_SIZE) {
+        m_idle.back().client.stop();
+        m_idle.pop_back();
+    }
+}
+
+
+/********************************************************
+ * Metadata cache
+ ********************************************************/
+
+std::list<std::pair<std::string, HttpMeta>> HttpMetaCache::m_entries;
+std::unique_ptr<HttpIStream> HttpMetaCache::m_opened;
+std::string HttpMetaCache::m_openedUrl;
+uint32_t HttpMetaCache::m_openedStamp = 0;
+
+bool HttpMetaCache::get(const std::string &url, HttpMeta &meta) {
+    for(int attempt = 0; attempt < 2; attempt++) {
+        for(auto it = m_entries.begin(); it != m_entries.end(); it++) {
+            if(it->first != url)
+                continue;
+
+            if(millis() - it->second.stamp > HTTP_META_TTL) {
+                m_entries.erase(it);
+                break;
+            }
+
+            meta = it->second;
+            return true;
+        }
+
+        if(attempt)
+            break;
+
+        // No HEAD, the GET tells the same and its body is likely read next.
+        // open() puts what the response said.
+        std::unique_ptr<HttpIStream> stream(new HttpIStream(url));
+        stream->open();
+        if(stream->isOpen()) {
+            m_opened = std::move(stream);
+            m_openedUrl = url;
+            m_openedStamp = millis();
+        }
+    }
+
+    return false;
+}
+
+void HttpMetaCache::put(const std::string &url, HttpMeta meta) {
+    meta.stamp = millis();
+    for(auto it = m_entries.begin(); it != m_entries.end(); it++) {
+        if(it->first == url) {
+            m_entries.erase(it);
+            break;
+        }
+    }
+
+    m_entries.emplace_front(url, meta);
+    if(m_entries.size() > HTTP_META_SIZE)
+        m_entries.pop_back();
+}
+
+HttpIStream* HttpMetaCache::take(const std::string &url) {
+    expire();
+    if(m_opened == nullptr || m_openedUrl != url)
+        return nullptr;
+
+    return m_opened.release();
+}
+
+// A response nobody reads holds its connection, it is given up soon
+void HttpMetaCache::expire(void) {
+    if(m_opened != nullptr && millis() - m_openedStamp > HTTP_OPENED_TTL)
+        m_opened.reset();
+}
+
 
 /********************************************************
  * File impls
@@ -12,9 +202,7 @@ bool HttpFile::isDirectory() {
 MIStream* HttpFile::inputStream() {
     // has to return OPENED stream
     Debug_printv("[%s]", url.c_str());
-    MIStream* istream = new HttpIStream(url);
-    istream->open();
-    return istream;
+    return HttpCache::open(url);
 }
 
 MIStream* HttpFile::createIStream(std::shared_ptr<MIStream> is) {
@@ -38,24 +226,15 @@ time_t HttpFile::getCreationTime() {
 
 bool HttpFile::exists() {
     Debug_printv("[%s]", url.c_str());
-    // we may try open the stream to check if it exists
-    std::unique_ptr<MIStream> test(inputStream());
-    // remember that MIStream destuctor should close the stream!
-    return test->isOpen();
+    HttpMeta meta;
+    return HttpMetaCache::get(url, meta) && meta.exists;
 }
 
 size_t HttpFile::size() {
-    // we may take content-lenght from header if exists
-    std::unique_ptr<MIStream> test(inputStream());
-
-    size_t size = 0;
-
-    if(test->isOpen())
-        size = test->available();
-
-    test->close();
-
-    return size;
+    HttpMeta meta;
+    if(!HttpMetaCache::get(url, meta))
+        return 0;
+    return meta.size;
 }
 
 
@@ -112,40 +291,138 @@ bool HttpIStream::seek(size_t pos) {
     if(pos==m_position)
         return true;
 
-    if(isFriendlySkipper) {
-        char str[40];
-        // Range: bytes=91536-(91536+255)
-        snprintf(str, sizeof str, "bytes=%lu-%lu", (unsigned long)pos, ((unsigned long)pos + 255));
-        m_http.addHeader("range",str);
-        int httpCode = m_http.GET(); //Send the request
-        Debug_printv("httpCode[%d] str[%s]", httpCode, str);
-        if(httpCode != 200 || httpCode != 206)
-            return false;
+    if(pos > m_length)
+        return false;
 
-        Debug_printv("stream opened[%s]", url.c_str());
-        m_file = m_http.getStream();  //Get the response payload as Stream
+    if(isFriendlySkipper) {
+        // From now on reads go through the block cache
+        m_ranged = true;
         m_position = pos;
-        m_bytesAvailable = m_length-pos;
+        m_bytesAvailable = m_length - pos;
         return true;
+    }
+
+    if(pos<m_position) {
+        // skipping backward and range not supported, let's simply reopen the stream...
+        close();
+        if(!open())
+            return false;
+    }
+
+    // ... and then read until we reach pos
+    return skip(pos - m_position);
+}
+
+bool HttpIStream::skip(size_t count) {
+    uint8_t buffer[256];
+    while(count) {
+        size_t n = read(buffer, (count < sizeof(buffer)) ? count : sizeof(buffer));
+        if(n == 0)
+            return false;
+        count -= n;
+    }
+    return true;
+}
+
+bool HttpIStream::cached(size_t index) {
+    for(auto &block : m_blocks) {
+        if(block.index == index)
+            return true;
+    }
+    return false;
+}
 
-    } else {
-        if(pos<m_position) {
-            // skipping backward and range not supported, let's simply reopen the stream...
-            m_http.end();
-            bool op = open();
-            if(!op)
-                return false;
+HttpIStream::Block* HttpIStream::block(size_t index, size_t wanted) {
+    for(int attempt = 0; attempt < 2; attempt++) {
+        for(auto it = m_blocks.begin(); it != m_blocks.end(); it++) {
+            if(it->index == index) {
+                m_blocks.splice(m_blocks.begin(), m_blocks, it);
+                return &m_blocks.front();
+            }
         }
 
+        if(attempt)
+            break;
+
+        // The blocks after it this read needs too, up to the first one cached
+        size_t count = 1;
+        while(count < wanted && count < HTTP_BLOCKS && !cached(index + count))
+            count++;
+
+        if(!fetch(index, count))
+            return nullptr;
+    }
+    return nullptr;
+}
+
+bool HttpIStream::fetch(size_t index, size_t count) {
+    size_t start = index * HTTP_BLOCK_SIZE;
+    size_t end = start + count * HTTP_BLOCK_SIZE;
+    if(end > m_length)
+        end = m_length;
+    if(start >= end)
+        return false;
+
+    if(m_client == nullptr)
+        return false;
+
+    // Whatever is left of the last response would be read as this one
+    if(m_bodyLeft)
+        m_client->stop();
+    m_bodyLeft = 0;
+
+    // end() also forgets the headers added for the last request
+    m_http.end();
+    if(!m_http.begin(*m_client, url.c_str()))
+        return false;
+
+    char range[40];
+    snprintf(range, sizeof range, "bytes=%lu-%lu", (unsigned long)start, (unsigned long)end - 1);
+    m_http.addHeader("Range", range);
+    int httpCode = m_http.GET();
+    Debug_printv("httpCode[%d] range[%s]", httpCode, range);
+
+    if(httpCode == 200) {
+        // Range ignored, this is the whole file again, read on without blocks
+        isFriendlySkipper = false;
+        m_ranged = false;
+        m_bodyLeft = m_length;
+        size_t pos = m_position;
         m_position = 0;
-        // ... and then read until we reach pos
-        // while(m_position < pos) {
-        //  m_position+=m_file.readBytes(buffer, size);  <----------- trurn this on!!!!
-        // }
-        m_bytesAvailable = m_length-pos;
+        m_bytesAvailable = m_length;
+        skip(pos);
+        return false;
+    }
+    if(httpCode != 206)
+        return false;
 
-        return true;
+    m_bodyLeft = end - start;
+    for(size_t i = 0; i < count && m_bodyLeft; i++) {
+        // Least recently used block makes room
+        Block block;
+        if(m_blocks.size() >= HTTP_BLOCKS) {
+            block = std::move(m_blocks.back());
+            m_blocks.pop_back();
+        }
+        else
+            block.data.reset(new uint8_t[HTTP_BLOCK_SIZE]);
+
+        size_t len = (m_bodyLeft < HTTP_BLOCK_SIZE) ? m_bodyLeft : HTTP_BLOCK_SIZE;
+        block.index = index + i;
+        block.size = m_client->readBytes((char *)block.data.get(), len);
+        m_bodyLeft -= block.size;
+        bool complete = (block.size == len);
+        m_blocks.push_front(std::move(block));
+
+        if(!complete) {
+            // Timed out, a partial block is cached but nothing after it
+            m_client->stop();
+            m_bodyLeft = 0;
+            break;
+        }
     }
+
+    return true;
 }
 
 size_t HttpIStream::position() {
@@ -153,26 +430,62 @@ size_t HttpIStream::position() {
 }
 
 void HttpIStream::close() {
-    m_http.end();
+    // Only a connection with nothing left of the response can take another request
+    if(m_client != nullptr) {
+        bool reusable = m_isOpen && m_bodyLeft == 0;
+        if(!reusable)
+            m_client->stop();
+        m_http.end();
+        HttpPool::disconnect(url, m_client, reusable);
+        m_client = nullptr;
+    }
+    m_isOpen = false;
+    m_ranged = false;
+    m_blocks.clear();
 }
 
 bool HttpIStream::open() {
     //mstr::replaceAll(url, "HTTP:", "http:");
-    bool initOk = m_http.begin(m_file, url.c_str());
+    m_client = HttpPool::connect(url, m_file);
+    if(m_client == nullptr)
+        return false;
+
+    m_http.setReuse(true);
+    bool initOk = m_http.begin(*m_client, url.c_str());
     Debug_printv("input %s: someRc=%d", url.c_str(), initOk);
     if(!initOk)
         return false;
 
     // Setup response headers we want to collect
-    const char * headerKeys[] = {"accept-ranges", "content-type"};
-    const size_t numberOfHeaders = 2;
+    const char * headerKeys[] = {"accept-ranges", "content-type", "etag", "last-modified"};
+    const size_t numberOfHeaders = 4;
     m_http.collectHeaders(headerKeys, numberOfHeaders);
 
+    if(m_ifNoneMatch.size())
+        m_http.addHeader("If-None-Match", m_ifNoneMatch.c_str());
+    if(m_ifModifiedSince.size())
+        m_http.addHeader("If-Modified-Since", m_ifModifiedSince.c_str());
+
     //Send the request
     int httpCode = m_http.GET();
+    m_status = httpCode;
     Debug_printv("httpCode=%d", httpCode);
-    if(httpCode != 200)
+
+    if(httpCode == 304) {
+        // No body follows, the connection can take the next request
+        m_http.end();
+        HttpPool::disconnect(url, m_client, true);
+        m_client = nullptr;
         return false;
+    }
+
+    HttpMeta meta;
+    meta.exists = (httpCode == 200);
+    if(httpCode != 200) {
+        if(httpCode > 0)
+            HttpMetaCache::put(url, meta);
+        return false;
+    }
 
     // Accept-Ranges: bytes - if we get such header from any request, good!
     isFriendlySkipper = m_http.header("accept-ranges") == "bytes";
@@ -183,12 +496,22 @@ bool HttpIStream::open() {
     m_length = m_http.getSize();
     Debug_printv("length=%d", m_length);
     m_bytesAvailable = m_length;
+    m_bodyLeft = m_length;
+    m_position = 0;
 
     // Is this text?
     std::string ct = m_http.header("content-type").c_str();
     Debug_printv("content_type[%s]", ct.c_str());
     isText = mstr::isText(ct);
 
+    // The response tells everything a HEAD would have
+    meta.size = (m_http.getSize() > 0) ? m_length : 0;    // -1 when chunked
+    meta.ranges = isFriendlySkipper;
+    meta.type = ct;
+    meta.etag = m_http.header("etag").c_str();
+    meta.modified = m_http.header("last-modified").c_str();
+    HttpMetaCache::put(url, meta);
+
     return true;
 };
 
@@ -201,10 +524,39 @@ size_t HttpIStream::size() {
 };
 
 size_t HttpIStream::read(uint8_t* buf, size_t size) {
-    auto bytesRead= m_file.read((char *) buf, size);
-    m_bytesAvailable = m_file.available();
-    m_position+=bytesRead;
-    return bytesRead;
+    // Callers read ahead in blocks now, so never ask for more than is left
+    // and wait for the bytes instead of returning whatever is in the socket
+    if ( size > m_bytesAvailable )
+        size = m_bytesAvailable;
+
+    size_t done = 0;
+    while ( m_ranged && done < size ) {
+        size_t index = m_position / HTTP_BLOCK_SIZE;
+        size_t offset = m_position % HTTP_BLOCK_SIZE;
+        size_t last = (m_position + (size - done) - 1) / HTTP_BLOCK_SIZE;
+
+        Block* b = block(index, last - index + 1);
+        if ( b == nullptr || offset >= b->size )
+            break;
+
+        size_t n = b->size - offset;
+        if ( n > size - done )
+            n = size - done;
+        memcpy(buf + done, b->data.get() + offset, n);
+        done += n;
+        m_position += n;
+    }
+
+    // Straight from the response, also when the server turned out to ignore ranges
+    if ( !m_ranged && done < size ) {
+        size_t bytesRead = m_client->readBytes((char *) buf + done, size - done);
+        m_bodyLeft -= (bytesRead < m_bodyLeft) ? bytesRead : m_bodyLeft;
+        m_position += bytesRead;
+        done += bytesRead;
+    }
+
+    m_bytesAvailable = m_length - m_position;
+    return done;
 };
 
 bool HttpIStream::isOpen() {
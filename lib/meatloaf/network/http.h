@@ -13,6 +13,99 @@
 #include <ESP8266HTTPClient.h>
 #endif
 
+#include <list>
+
+#if defined(ESP32)
+#define HTTP_POOL_SIZE      4       // idle keep-alive connections kept
+#else
+#define HTTP_POOL_SIZE      2
+#endif
+#define HTTP_KEEPALIVE      10000   // ms a connection may stay idle, servers drop them soon after
+#define HTTP_META_SIZE      16      // urls whose metadata is remembered
+#define HTTP_META_TTL       30000   // ms
+#define HTTP_ADDRESS_TTL    60000   // ms a resolved host address is used
+#define HTTP_OPENED_TTL     2000    // ms the GET that answered for metadata waits to be read
+#if defined(ESP32)
+#define HTTP_BLOCK_SIZE     4096    // ranged reads fetch aligned blocks of this size
+#define HTTP_BLOCKS         8       // blocks cached per stream
+#else
+#define HTTP_BLOCK_SIZE     1024
+#define HTTP_BLOCKS         2
+#endif
+
+
+/********************************************************
+ * Connections and metadata shared by all HTTP streams
+ ********************************************************/
+
+// Idle connections by server address, so a redirect to another host can't
+// hand out a connection to the wrong server. A stream takes one for its
+// requests and gives it back once the response has been read completely.
+class HttpPool {
+public:
+    static WiFiClient acquire(const std::string &url);
+    static void release(WiFiClient &client);
+
+    // A connection for a request to url, from the TLS contexts for https.
+    // plain holds a plain connection, nullptr when no TLS context is free.
+    static WiFiClient* connect(const std::string &url, WiFiClient &plain);
+    static void disconnect(const std::string &url, WiFiClient *client, bool reusable);
+
+    static bool secure(const std::string &url);
+    static void address(const std::string &url, std::string &host, uint16_t &port);
+
+private:
+    struct Connection {
+        uint32_t ip;
+        uint16_t port;
+        WiFiClient client;
+        uint32_t used;
+    };
+    static std::list<Connection> m_idle;
+
+    // Hosts looked up lately, so taking a connection needs no DNS query
+    struct Address {
+        std::string host;
+        uint32_t ip;
+        uint32_t stamp;
+    };
+    static std::list<Address> m_addresses;     // most recent first
+    static bool resolve(const std::string &host, uint32_t &ip);
+};
+
+// What the server said about an url, from the GET of a stream
+struct HttpMeta {
+    bool exists = false;
+    size_t size = 0;
+    bool ranges = false;     // Accept-Ranges: bytes
+    std::string type;
+    std::string etag;
+    std::string modified;    // Last-Modified
+    uint32_t stamp = 0;
+};
+
+class HttpIStream;
+
+class HttpMetaCache {
+public:
+    // From the cache, or asks the server with a GET
+    static bool get(const std::string &url, HttpMeta &meta);
+    static void put(const std::string &url, HttpMeta meta);
+
+    // The GET that answered get(), if it is for url, so the read that
+    // usually follows needs no request of its own
+    static HttpIStream* take(const std::string &url);
+    static void expire(void);
+
+private:
+    static std::list<std::pair<std::string, HttpMeta>> m_entries;    // most recent first
+
+    static std::unique_ptr<HttpIStream> m_opened;
+    static std::string m_openedUrl;
+    static uint32_t m_openedStamp;
+};
+
+
 /********************************************************
  * File implementations
  ********************************************************/
@@ -101,16 +194,51 @@ public:
     size_t read(uint8_t* buf, size_t size) override;
     bool isOpen();
 
+    // Makes the next open() a conditional GET, it fails with notModified()
+    // when the copy these validators came with is still current
+    void ifChanged(const std::string &etag, const std::string &modified) {
+        m_ifNoneMatch = etag;
+        m_ifModifiedSince = modified;
+    }
+    bool notModified() { return m_status == 304; };
+
+    // What can be read without waiting for the network
+    size_t ready() {
+        if(m_ranged || m_client == nullptr)
+            return 0;
+        return std::min((size_t)m_client->available(), m_bytesAvailable);
+    };
+
 protected:
     std::string url;
-    bool m_isOpen;
+    bool m_isOpen = false;
+    int m_status = 0;
+    std::string m_ifNoneMatch;
+    std::string m_ifModifiedSince;
     size_t m_bytesAvailable = 0;
     size_t m_length = 0;
     size_t m_position = 0;
     bool isFriendlySkipper = false;
+    size_t m_bodyLeft = 0;      // of the response m_client is reading
 
     WiFiClient m_file;
+    WiFiClient* m_client = nullptr; // m_file, or a TLS context for https
 	HTTPClient m_http;
+
+    // After a seek, servers that take ranges are read in blocks. Adjacent
+    // missing blocks of one read are fetched with a single request.
+    struct Block {
+        size_t index;
+        size_t size;
+        std::unique_ptr<uint8_t[]> data;
+    };
+    std::list<Block> m_blocks;  // most recently used first
+    bool m_ranged = false;
+
+    Block* block(size_t index, size_t wanted);
+    bool cached(size_t index);
+    bool fetch(size_t index, size_t count);
+    bool skip(size_t count);
 };
 
 
@@ -0,0 +1,412 @@
+#include "http_cache.h"
+
+#include <algorithm>
+#include <vector>
+
+/********************************************************
+ * Cache
+ ********************************************************/
+
+uint32_t HttpCache::hits = 0;
+uint32_t HttpCache::misses = 0;
+
+std::unique_ptr<HttpCache::Download> HttpCache::s_download;
+std::list<std::pair<std::string, uint32_t>> HttpCache::s_fresh;
+uint32_t HttpCache::s_used = 0;
+
+#if defined(ESP32)
+TaskHandle_t HttpCache::s_loop = nullptr;
+
+bool HttpCache::onLoop(void) {
+    return xTaskGetCurrentTaskHandle() == s_loop;
+}
+#else
+bool HttpCache::onLoop(void) {
+    return true;
+}
+#endif
+
+MIStream* HttpCache::open(const std::string &url) {
+#if defined(ESP32)
+    // Files are only opened from the main loop
+    s_loop = xTaskGetCurrentTaskHandle();
+#endif
+
+    // The first open finds what the last session left
+    if(s_used == 0)
+        evict(0);
+
+    // Still downloading, read along
+    if(s_download != nullptr && s_download->info.url == url && !s_download->complete) {
+        hits++;
+        return new HttpCacheIStream(url, s_download->info.key, s_download->info.size);
+    }
+
+    Info info;
+    bool cached = load(infoPath(url), info) && info.url == url;
+    MIStream* copy = nullptr;
+
+    HttpIStream* source = nullptr;
+    if(cached && fresh(url)) {
+        copy = local(info.key);
+    }
+    else {
+        // The GET that just told the size, else a conditional one
+        bool current = false;
+        HttpMeta meta;
+        source = HttpMetaCache::take(url);
+        if(source != nullptr) {
+            current = cached && HttpMetaCache::get(url, meta) && meta.etag == info.etag && meta.modified == info.modified;
+        }
+        else {
+            source = new HttpIStream(url);
+            if(cached)
+                source->ifChanged(info.etag, info.modified);
+            source->open();
+            current = source->notModified();
+        }
+
+        if(current) {
+            copy = local(info.key);
+            refresh(url);
+        }
+        else if(cached && !source->isOpen()) {
+            // The server can't be reached
+            copy = local(info.key);
+        }
+    }
+
+    if(copy != nullptr) {
+        Debug_printv("url[%s] copy[%s]", url.c_str(), info.key.c_str());
+        delete source;
+        hits++;
+        info.used = ++s_used;
+        save(info);
+        return copy;
+    }
+
+    if(cached) {
+        // The copy is gone or outdated, the next one gets another name
+        remove(info);
+        if(source == nullptr || !source->isOpen()) {
+            delete source;
+            return open(url);
+        }
+    }
+
+    misses++;
+    info.url = url;
+    if(source->isOpen() && start(source, info))
+        return new HttpCacheIStream(url, info.key, info.size);
+
+    return source;
+}
+
+void HttpCache::step(void) {
+    HttpMetaCache::expire();
+
+    // Only what has arrived, the next pass takes the rest
+    auto download = s_download.get();
+    if(download != nullptr && !download->complete) {
+        size_t ready = download->source->ready();
+        if(ready) {
+            uint8_t buffer[HTTP_CACHE_CHUNK];
+            pull(buffer, std::min(ready, sizeof(buffer)));
+        }
+    }
+}
+
+// Only what can be revalidated later is kept, and not what fills half the cache
+bool HttpCache::start(HttpIStream *source, Info &info) {
+    if(s_download != nullptr && !s_download->complete)
+        return false;
+
+    HttpMeta meta;
+    HttpMetaCache::get(info.url, meta);
+    info.etag = meta.etag;
+    info.modified = meta.modified;
+    info.size = source->size();
+
+    if(source->isText || info.size == 0 || info.size > HTTP_CACHE_BUDGET / 2)
+        return false;
+    if(info.etag.empty() && info.modified.empty())
+        return false;
+
+    info.key = hash(info.url + "\n" + info.etag + "\n" + info.modified);
+    evict(info.size);
+
+    std::string path = copyPath(info.key) + ".tmp";
+    std::unique_ptr<MFile> file(MFSOwner::File(path));
+    file->remove();
+
+    s_download.reset(new Download);
+    s_download->info = info;
+    s_download->source.reset(source);
+    s_download->file.reset(file->outputStream());
+    if(s_download->file == nullptr || !s_download->file->isOpen()) {
+        // The source still serves this read, it just isn't kept
+        s_download->source.release();
+        s_download.reset();
+        return false;
+    }
+
+    Debug_printv("url[%s] key[%s] size[%d]", info.url.c_str(), info.key.c_str(), info.size);
+    return true;
+}
+
+// Reads on where the download is and keeps what was read
+size_t HttpCache::pull(uint8_t *buf, size_t size) {
+    auto download = s_download.get();
+    if(size > download->info.size - download->done)
+        size = download->info.size - download->done;
+
+    size_t count = download->source->read(buf, size);
+    bool kept = count && download->file->write(buf, count) == count;
+    if(!kept) {
+        abort();
+        return count;
+    }
+
+    download->done += count;
+    if(download->done == download->info.size)
+        finish();
+
+    return count;
+}
+
+void HttpCache::finish(void) {
+    auto download = s_download.get();
+    download->file->close();
+    download->file.reset();
+    download->source.reset();
+
+    std::string path = copyPath(download->info.key);
+    std::unique_ptr<MFile> file(MFSOwner::File(path + ".tmp"));
+    if(!file->rename(path)) {
+        abort();
+        return;
+    }
+
+    download->info.used = ++s_used;
+    save(download->info);
+    refresh(download->info.url);
+    download->complete = true;
+    Debug_printv("url[%s] complete", download->info.url.c_str());
+}
+
+void HttpCache::abort(void) {
+    Debug_printv("url[%s] at[%d]", s_download->info.url.c_str(), s_download->done);
+    s_download->file.reset();
+    std::unique_ptr<MFile> file(MFSOwner::File(copyPath(s_download->info.key) + ".tmp"));
+    file->remove();
+    s_download.reset();
+}
+
+// Least recently used copies go until needed more bytes fit, copies no
+// info file points to and unfinished downloads always
+void HttpCache::evict(size_t needed) {
+    std::unique_ptr<MFile> dir(MFSOwner::File(HTTP_CACHE_DIR));
+    if(!dir->exists()) {
+        std::unique_ptr<MFile> sys(MFSOwner::File("/.sys"));
+        sys->mkDir();
+        dir->mkDir();
+    }
+
+    std::vector<Info> infos;
+    std::vector<std::string> copies;
+    size_t total = 0;
+
+    std::unique_ptr<MFile> entry(dir->getNextFileInDir());
+    while(entry != nullptr) {
+        Info info;
+        if(mstr::endsWith(entry->url, ".inf") && load(entry->url, info)) {
+            infos.push_back(info);
+            total += info.size;
+            if(info.used > s_used)
+                s_used = info.used;
+        }
+        else if(mstr::endsWith(entry->url, ".dat") || mstr::endsWith(entry->url, ".tmp"))
+            copies.push_back(entry->url);
+        entry.reset(dir->getNextFileInDir());
+    }
+    if(s_used == 0)
+        s_used = 1;
+
+    for(auto &path : copies) {
+        bool kept = false;
+        for(auto &info : infos)
+            kept = kept || path == copyPath(info.key);
+        if(!kept) {
+            std::unique_ptr<MFile> file(MFSOwner::File(path));
+            file->remove();
+        }
+    }
+
+    std::sort(infos.begin(), infos.end(), [](const Info &a, const Info &b) { return a.used < b.used; });
+    for(auto &info : infos) {
+        if(total + needed <= HTTP_CACHE_BUDGET)
+            break;
+        Debug_printv("evict url[%s] size[%d]", info.url.c_str(), info.size);
+        remove(info);
+        total -= info.size;
+    }
+}
+
+MIStream* HttpCache::local(const std::string &key) {
+    std::unique_ptr<MFile> file(MFSOwner::File(copyPath(key)));
+    MIStream* istream = file->inputStream();
+    if(istream != nullptr && !istream->isOpen()) {
+        delete istream;
+        istream = nullptr;
+    }
+    return istream;
+}
+
+bool HttpCache::fresh(const std::string &url) {
+    for(auto &checked : s_fresh) {
+        if(checked.first == url)
+            return millis() - checked.second < HTTP_CACHE_FRESH;
+    }
+    return false;
+}
+
+void HttpCache::refresh(const std::string &url) {
+    s_fresh.remove_if([&url](const std::pair<std::string, uint32_t> &checked) { return checked.first == url; });
+    s_fresh.emplace_front(url, (uint32_t)millis());
+    if(s_fresh.size() > HTTP_META_SIZE)
+        s_fresh.pop_back();
+}
+
+// FNV-1a, names only need to be unique within the cache
+std::string HttpCache::hash(const std::string &text) {
+    uint32_t h = 2166136261u;
+    for(char c : text) {
+        h ^= (uint8_t)c;
+        h *= 16777619u;
+    }
+
+    char name[9];
+    snprintf(name, sizeof name, "%08x", h);
+    return name;
+}
+
+std::string HttpCache::infoPath(const std::string &url) {
+    return std::string(HTTP_CACHE_DIR "/") + hash(url) + ".inf";
+}
+
+std::string HttpCache::copyPath(const std::string &key) {
+    return std::string(HTTP_CACHE_DIR "/") + key + ".dat";
+}
+
+// One field per line: url, etag, last-modified, size, used, key
+bool HttpCache::load(const std::string &path, Info &info) {
+    std::unique_ptr<MFile> file(MFSOwner::File(path));
+    std::unique_ptr<MIStream> istream(file->exists() ? file->inputStream() : nullptr);
+    if(istream == nullptr || !istream->isOpen())
+        return false;
+
+    char text[512];
+    size_t length = istream->read((uint8_t *)text, sizeof(text) - 1);
+    text[length] = '\0';
+
+    auto fields = mstr::split(text, '\n');
+    if(fields.size() < 6)
+        return false;
+
+    info.url = fields[0];
+    info.etag = fields[1];
+    info.modified = fields[2];
+    info.size = atol(fields[3].c_str());
+    info.used = atol(fields[4].c_str());
+    info.key = fields[5];
+    return true;
+}
+
+bool HttpCache::save(Info &info) {
+    std::string text = info.url + "\n" + info.etag + "\n" + info.modified + "\n"
+        + std::to_string(info.size) + "\n" + std::to_string(info.used) + "\n" + info.key + "\n";
+
+    // Written files are not truncated, a shorter one would keep the old tail
+    std::unique_ptr<MFile> file(MFSOwner::File(infoPath(info.url)));
+    file->remove();
+    std::unique_ptr<MOStream> ostream(file->outputStream());
+    if(ostream == nullptr || !ostream->isOpen())
+        return false;
+
+    return ostream->write((const uint8_t *)text.data(), text.size()) == text.size();
+}
+
+void HttpCache::remove(const Info &info) {
+    std::unique_ptr<MFile> file(MFSOwner::File(infoPath(info.url)));
+    file->remove();
+    file.reset(MFSOwner::File(copyPath(info.key)));
+    file->remove();
+}
+
+
+/********************************************************
+ * Istream impls
+ ********************************************************/
+
+void HttpCacheIStream::close() {
+    m_local.reset();
+    m_remote.reset();
+}
+
+bool HttpCacheIStream::seek(size_t pos) {
+    if(pos > m_size)
+        return false;
+    m_position = pos;
+    return true;
+}
+
+size_t HttpCacheIStream::read(uint8_t* buf, size_t size) {
+    if(size > available())
+        size = available();
+    if(size == 0)
+        return 0;
+
+    size_t count = 0;
+    if(!HttpCache::onLoop()) {
+        count = fetch(buf, size);
+        m_position += count;
+        return count;
+    }
+
+    auto download = HttpCache::s_download.get();
+    bool downloading = download != nullptr && download->info.key == m_key && !download->complete;
+
+    if(m_local == nullptr && !downloading && !m_tried) {
+        // The copy is complete, or never will be
+        m_tried = true;
+        m_local.reset(HttpCache::local(m_key));
+        if(m_local != nullptr)
+            m_remote.reset();
+    }
+
+    if(m_local == nullptr && downloading && download->done == m_position) {
+        count = HttpCache::pull(buf, size);
+    }
+    else if(m_local != nullptr) {
+        if(m_local->position() != m_position)
+            m_local->seek(m_position);
+        count = m_local->read(buf, size);
+    }
+    else {
+        count = fetch(buf, size);
+    }
+
+    m_position += count;
+    return count;
+}
+
+// Not downloaded yet, already behind or not on the main loop, ask for it
+size_t HttpCacheIStream::fetch(uint8_t* buf, size_t size) {
+    if(m_remote == nullptr) {
+        m_remote.reset(new HttpIStream(m_url));
+        m_remote->open();
+    }
+    if(m_remote->position() != m_position)
+        m_remote->seek(m_position);
+    return m_remote->read(buf, size);
+}
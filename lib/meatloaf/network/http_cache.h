@@ -0,0 +1,130 @@
+// Local copies of remote images and programs on flash
+//
+// Every url has an info file named after a hash of the url, with the
+// validators (ETag, Last-Modified) its copy came with. The copy itself is
+// named after a hash of the url and validators, so a changed file never
+// overwrites the copy someone may still be reading.
+//
+// https://developer.mozilla.org/en-US/docs/Web/HTTP/Conditional_requests
+
+#ifndef MEATFILE_DEFINES_HTTP_CACHE_H
+#define MEATFILE_DEFINES_HTTP_CACHE_H
+
+#include "meat_io.h"
+#include "http.h"
+
+#include <list>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+#define HTTP_CACHE_DIR      "/.sys/cache"
+#if defined(ESP32)
+#define HTTP_CACHE_BUDGET   (1024 * 1024)   // flash the copies may take
+#else
+#define HTTP_CACHE_BUDGET   (256 * 1024)
+#endif
+#define HTTP_CACHE_FRESH    300000          // ms a revalidated copy is used without asking again
+#define HTTP_CACHE_CHUNK    1024            // at most downloaded per idle step
+
+
+class HttpCache {
+public:
+    // The local copy if it is current, otherwise the network, whose
+    // response fills a new copy when the url can be kept
+    static MIStream* open(const std::string &url);
+
+    // Continues the download, call while the bus is idle
+    static void step(void);
+
+    static uint32_t hits;
+    static uint32_t misses;
+
+private:
+    struct Info {
+        std::string url;
+        std::string etag;
+        std::string modified;
+        size_t size = 0;
+        uint32_t used = 0;      // higher is more recent
+        std::string key;        // of the copy
+    };
+
+    // The one copy being downloaded, the rest of it comes in step()
+    struct Download {
+        Info info;
+        std::unique_ptr<HttpIStream> source;
+        std::unique_ptr<MOStream> file;
+        size_t done = 0;
+        bool complete = false;
+    };
+    static std::unique_ptr<Download> s_download;
+
+    static std::list<std::pair<std::string, uint32_t>> s_fresh;    // urls revalidated lately
+    static uint32_t s_used;
+
+    // LittleFS has no locking, the cache and its copies are only used from
+    // the main loop. Readers on other tasks, like read ahead, get the network.
+    static bool onLoop(void);
+#if defined(ESP32)
+    static TaskHandle_t s_loop;
+#endif
+
+    static std::string hash(const std::string &text);
+    static std::string infoPath(const std::string &url);
+    static std::string copyPath(const std::string &key);
+    static bool load(const std::string &path, Info &info);
+    static bool save(Info &info);
+    static void remove(const Info &info);
+    static bool fresh(const std::string &url);
+    static void refresh(const std::string &url);
+    static void evict(size_t needed);
+
+    static MIStream* local(const std::string &key);
+    static bool start(HttpIStream *source, Info &info);
+    static size_t pull(uint8_t *buf, size_t size);
+    static void finish(void);
+    static void abort(void);
+
+friend class HttpCacheIStream;
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+// Reads an url whose copy is still downloading. Reads where the download
+// is continue it, anything else is fetched on demand until the copy is
+// complete, then the copy is read. Off the main loop it is always fetched.
+class HttpCacheIStream: public MIStream {
+public:
+    HttpCacheIStream(const std::string &url, const std::string &key, size_t size) :
+        m_url(url), m_key(key), m_size(size) {};
+
+    size_t position() override { return m_position; };
+    void close() override;
+    bool open() override { return true; };
+    bool isOpen() override { return true; };
+
+    bool seek(size_t pos) override;
+    size_t available() override { return m_size - m_position; };
+    size_t size() override { return m_size; };
+    size_t read(uint8_t* buf, size_t size) override;
+
+private:
+    std::string m_url;
+    std::string m_key;
+    size_t m_size;
+    size_t m_position = 0;
+
+    std::unique_ptr<MIStream> m_local;      // once the copy is complete
+    bool m_tried = false;
+    std::unique_ptr<HttpIStream> m_remote;  // on demand until then
+
+    size_t fetch(uint8_t* buf, size_t size);
+};
+
+#endif
@@ -0,0 +1,145 @@
+#include "https.h"
+
+#if defined(ESP8266)
+#include <LittleFS.h>
+#endif
+
+/********************************************************
+ * TLS contexts
+ ********************************************************/
+
+HttpsPool::Context HttpsPool::m_contexts[HTTPS_CONTEXTS];
+std::list<HttpsPool::Context> HttpsPool::m_spares;
+
+uint32_t HttpsPool::handshakes = 0;
+uint32_t HttpsPool::handshake_ms = 0;
+uint32_t HttpsPool::heap = 0;
+
+WiFiClient* HttpsPool::acquire(const std::string &url) {
+    std::string host;
+    uint16_t port;
+    HttpPool::address(url, host, port);
+
+    // Still connected to this server, no handshake at all
+    Context* idle = nullptr;
+    uint32_t waited = millis();
+    while(true) {
+        for(auto &context : m_contexts) {
+            if(context.busy)
+                continue;
+
+            if(context.client != nullptr && context.host == host && context.port == port && context.client->connected()) {
+                Debug_printv("reusing TLS connection to [%s:%d]", host.c_str(), port);
+                context.busy = true;
+                return context.client.get();
+            }
+
+            if(idle == nullptr || context.used < idle->used)
+                idle = &context;
+        }
+
+        if(idle != nullptr || millis() - waited >= HTTPS_WAIT)
+            break;
+        delay(10);
+    }
+
+    // The busy ones belong to streams still open, the open must not fail for that
+    bool spare = (idle == nullptr);
+    if(spare) {
+        Debug_printv("no TLS context free for [%s], using a spare", url.c_str());
+        m_spares.emplace_back();
+        idle = &m_spares.back();
+    }
+
+    configure(*idle, host, port);
+
+    uint32_t free = ESP.getFreeHeap();
+    uint32_t start = millis();
+    if(!idle->client->connect(host.c_str(), port)) {
+        Debug_printv("TLS connection to [%s:%d] failed", host.c_str(), port);
+        idle->client->stop();
+        if(spare)
+            m_spares.pop_back();
+        return nullptr;
+    }
+    handshakes++;
+    handshake_ms = millis() - start;
+    heap = free - ESP.getFreeHeap();
+    Debug_printv("[%s:%d] handshake[%dms] heap[%d]", host.c_str(), port, handshake_ms, heap);
+
+    idle->busy = true;
+    return idle->client.get();
+}
+
+void HttpsPool::release(WiFiClient *client, bool reusable) {
+    // Spares are not kept, their memory is what the pool is there to bound
+    for(auto it = m_spares.begin(); it != m_spares.end(); it++) {
+        if(it->client.get() == client) {
+            it->client->stop();
+            m_spares.erase(it);
+            return;
+        }
+    }
+
+    for(auto &context : m_contexts) {
+        if(context.client.get() == client) {
+            if(!reusable)
+                context.client->stop();
+            context.busy = false;
+            context.used = millis();
+            return;
+        }
+    }
+}
+
+// Settings take effect with the next connect()
+void HttpsPool::configure(Context &context, const std::string &host, uint16_t port) {
+    if(context.client == nullptr)
+        context.client.reset(new WiFiClientSecure());
+    context.client->stop();
+
+#if defined(ESP8266)
+    bool same = (context.host == host && context.port == port);
+#endif
+    context.host = host;
+    context.port = port;
+
+#if defined(ESP32)
+    // The bundle has to stay in memory while it is in use
+    static std::string bundle;
+    static bool loaded = false;
+    if(!loaded) {
+        loaded = true;
+        std::unique_ptr<MFile> file(MFSOwner::File(HTTPS_CERTS ".pem"));
+        std::unique_ptr<MIStream> istream(file->exists() ? file->inputStream() : nullptr);
+        if(istream != nullptr && istream->isOpen()) {
+            bundle.resize(istream->size());
+            bundle.resize(istream->read((uint8_t *)&bundle[0], bundle.size()));
+        }
+    }
+
+    if(bundle.size())
+        context.client->setCACert(bundle.c_str());
+    else
+        context.client->setInsecure();
+#else
+    static BearSSL::CertStore certs;
+    static int count = -1;
+    if(count < 0)
+        count = certs.initCertStore(LittleFS, HTTPS_CERTS ".idx", HTTPS_CERTS ".ar");
+
+    if(count > 0)
+        context.client->setCertStore(&certs);
+    else
+        context.client->setInsecure();
+
+    // Another server can't resume this session, and may take other records
+    if(!same) {
+        context.session = BearSSL::Session();
+        context.fragment = WiFiClientSecure::probeMaxFragmentLength(host.c_str(), port, HTTPS_FRAGMENT);
+    }
+    context.client->setSession(&context.session);
+    if(context.fragment)
+        context.client->setBufferSizes(HTTPS_FRAGMENT, 512);
+#endif
+}
@@ -1,4 +1,81 @@
 // HTTPS:// - Hypertext Transfer Protocol Secure
 // https://buger.dread.cz/simple-esp8266-https-client-without-verification-of-certificate-fingerprint.html
 // https://forum.arduino.cc/t/esp8266-httpclient-library-for-https/495245
-// 
+// https://arduino-esp8266.readthedocs.io/en/latest/esp8266wifi/bearssl-client-secure-class.html
+//
+// Same streams as HTTP, over one of a few TLS contexts that are kept
+// between requests. A context remembers its server's session, so the
+// next connection to it resumes instead of doing the full handshake.
+//
+// Certificates are checked against HTTPS_CERTS, a PEM bundle on ESP32 and
+// a BearSSL CertStore (certs.ar with its index) on ESP8266. Without one
+// servers are not verified.
+
+#ifndef MEATFILE_DEFINES_FSHTTPS_H
+#define MEATFILE_DEFINES_FSHTTPS_H
+
+#include "http.h"
+
+#include <WiFiClientSecure.h>
+
+#if defined(ESP32)
+#define HTTPS_CONTEXTS      3       // TLS connections kept between requests
+#define HTTPS_WAIT          500     // ms for another task to give a context back
+#else
+#define HTTPS_CONTEXTS      2
+#define HTTPS_WAIT          0
+#endif
+#define HTTPS_FRAGMENT      1024    // TLS record size asked for, where the server takes it
+#define HTTPS_CERTS         "/.sys/certs"
+
+
+class HttpsPool {
+public:
+    // A connected client, nullptr when the server can't be reached. With
+    // every context busy a spare one is made for this connection only.
+    static WiFiClient* acquire(const std::string &url);
+    static void release(WiFiClient *client, bool reusable);
+
+    static uint32_t handshakes;
+    static uint32_t handshake_ms;   // of the last one
+    static uint32_t heap;           // bytes the last connection took
+
+private:
+    struct Context {
+        std::unique_ptr<WiFiClientSecure> client;
+        std::string host;
+        uint16_t port = 0;
+        bool busy = false;
+        uint32_t used = 0;
+#if defined(ESP8266)
+        BearSSL::Session session;
+        bool fragment = false;      // server takes HTTPS_FRAGMENT records
+#endif
+    };
+    static Context m_contexts[HTTPS_CONTEXTS];
+    static std::list<Context> m_spares;
+
+    static void configure(Context &context, const std::string &host, uint16_t port);
+};
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class HttpsFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new HttpFile(path);
+    }
+
+    bool handles(std::string name) {
+        std::string pattern = "https:";
+        return mstr::equals(name, pattern, false);
+    }
+public:
+    HttpsFileSystem(): MFileSystem("https") {};
+};
+
+
+#endif
@@ -0,0 +1,1199 @@
+#include "smb.h"
+
+#include <MD5Builder.h>
+#include <time.h>
+
+// Numbers are little endian on the wire
+static void set16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void set32(uint8_t *p, uint32_t v) {
+    set16(p, v);
+    set16(p + 2, v >> 16);
+}
+
+static void set64(uint8_t *p, uint64_t v) {
+    set32(p, v);
+    set32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint64_t get64(const uint8_t *p) {
+    return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+static void append(std::vector<uint8_t> &to, const uint8_t *data, size_t size) {
+    to.insert(to.end(), data, data + size);
+}
+
+// 100ns since 1601
+static time_t smbTime(uint64_t time) {
+    return time ? (time_t)(time / 10000000ULL - 11644473600ULL) : 0;
+}
+
+static std::vector<uint8_t> smbUtf16(const std::string &text) {
+    std::vector<uint8_t> out;
+    size_t i = 0;
+    while(i < text.size()) {
+        uint8_t c = text[i];
+        uint32_t code = c;
+        size_t n = 1;
+        if((c bitand 0xE0) == 0xC0) {
+            code = c bitand 0x1F;
+            n = 2;
+        }
+        else if((c bitand 0xF0) == 0xE0) {
+            code = c bitand 0x0F;
+            n = 3;
+        }
+        else if((c bitand 0xF8) == 0xF0) {
+            code = c bitand 0x07;
+            n = 4;
+        }
+        for(size_t k = 1; k < n && i + k < text.size(); k++)
+            code = (code << 6) | (text[i + k] bitand 0x3F);
+        i += n;
+
+        if(code >= 0x10000) {
+            code -= 0x10000;
+            out.push_back((0xD800 + (code >> 10)) bitand 0xFF);
+            out.push_back((0xD800 + (code >> 10)) >> 8);
+            code = 0xDC00 + (code bitand 0x3FF);
+        }
+        out.push_back(code bitand 0xFF);
+        out.push_back(code >> 8);
+    }
+    return out;
+}
+
+static std::string smbUtf8(const uint8_t *text, size_t size) {
+    std::string out;
+    for(size_t i = 0; i + 1 < size; i += 2) {
+        uint32_t code = get16(text + i);
+        if(code >= 0xD800 && code < 0xDC00 && i + 3 < size) {
+            code = 0x10000 + ((code - 0xD800) << 10) + (get16(text + i + 2) - 0xDC00);
+            i += 2;
+        }
+
+        if(code < 0x80) {
+            out.push_back(code);
+        }
+        else if(code < 0x800) {
+            out.push_back(0xC0 | (code >> 6));
+            out.push_back(0x80 | (code bitand 0x3F));
+        }
+        else if(code < 0x10000) {
+            out.push_back(0xE0 | (code >> 12));
+            out.push_back(0x80 | ((code >> 6) bitand 0x3F));
+            out.push_back(0x80 | (code bitand 0x3F));
+        }
+        else {
+            out.push_back(0xF0 | (code >> 18));
+            out.push_back(0x80 | ((code >> 12) bitand 0x3F));
+            out.push_back(0x80 | ((code >> 6) bitand 0x3F));
+            out.push_back(0x80 | (code bitand 0x3F));
+        }
+    }
+    return out;
+}
+
+// share/dir/file into the share and the path in it, with backslashes
+static void smbSplit(const std::string &path, std::string &share, std::string &in) {
+    std::string p = path;
+    while(mstr::startsWith(p, "/"))
+        p.erase(0, 1);
+    while(mstr::endsWith(p, "/"))
+        p.pop_back();
+
+    size_t slash = p.find('/');
+    share = p.substr(0, slash);
+    in = (slash == std::string::npos) ? "" : p.substr(slash + 1);
+    mstr::replaceAll(in, "/", "\\");
+}
+
+static std::string smbParent(const std::string &in) {
+    size_t slash = in.rfind('\\');
+    return (slash == std::string::npos) ? "" : in.substr(0, slash);
+}
+
+static std::string smbName(const std::string &in) {
+    size_t slash = in.rfind('\\');
+    return (slash == std::string::npos) ? in : in.substr(slash + 1);
+}
+
+
+/********************************************************
+ * NTLM
+ ********************************************************/
+
+// Only for the NT hash of the password
+static void md4(const uint8_t *data, size_t size, uint8_t digest[16]) {
+    std::vector<uint8_t> m(data, data + size);
+    m.push_back(0x80);
+    while(m.size() % 64 != 56)
+        m.push_back(0);
+    uint8_t bits[8];
+    set64(bits, (uint64_t)size * 8);
+    append(m, bits, 8);
+
+    auto rotate = [](uint32_t x, int s) { return (x << s) | (x >> (32 - s)); };
+    const int shifts[3][4] = { { 3, 7, 11, 19 }, { 3, 5, 9, 13 }, { 3, 9, 11, 15 } };
+    const int third[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+
+    uint32_t h[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+    for(size_t block = 0; block < m.size(); block += 64) {
+        uint32_t x[16];
+        for(int i = 0; i < 16; i++)
+            x[i] = get32(&m[block + i * 4]);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        for(int round = 0; round < 3; round++) {
+            for(int i = 0; i < 16; i++) {
+                uint32_t f;
+                int k;
+                if(round == 0) {
+                    f = (b bitand c) | (~b bitand d);
+                    k = i;
+                }
+                else if(round == 1) {
+                    f = ((b bitand c) | (b bitand d) | (c bitand d)) + 0x5A827999;
+                    k = (i % 4) * 4 + i / 4;
+                }
+                else {
+                    f = (b ^ c ^ d) + 0x6ED9EBA1;
+                    k = third[i];
+                }
+                uint32_t t = rotate(a + f + x[k], shifts[round][i % 4]);
+                a = d;
+                d = c;
+                c = b;
+                b = t;
+            }
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+    }
+
+    for(int i = 0; i < 4; i++)
+        set32(digest + i * 4, h[i]);
+}
+
+static void hmacMd5(const uint8_t *key, size_t keySize, const std::vector<uint8_t> &data, uint8_t digest[16]) {
+    uint8_t pad[64] = { 0 };
+    memcpy(pad, key, keySize);
+
+    for(int i = 0; i < 64; i++)
+        pad[i] ^= 0x36;
+    MD5Builder inner;
+    inner.begin();
+    inner.add(pad, sizeof(pad));
+    inner.add((uint8_t *)data.data(), data.size());
+    inner.calculate();
+    uint8_t hash[16];
+    inner.getBytes(hash);
+
+    for(int i = 0; i < 64; i++)
+        pad[i] ^= 0x36 ^ 0x5C;
+    MD5Builder outer;
+    outer.begin();
+    outer.add(pad, sizeof(pad));
+    outer.add(hash, sizeof(hash));
+    outer.calculate();
+    outer.getBytes(digest);
+}
+
+// NTLMv2 answers to the server challenge, with the target info it sent
+static void ntlmv2(const std::string &domain, const std::string &user, const std::string &pass,
+    const uint8_t *challenge, const uint8_t *info, size_t infoSize,
+    std::vector<uint8_t> &lm, std::vector<uint8_t> &nt) {
+
+    uint8_t hash[16];
+    auto password = smbUtf16(pass);
+    md4(password.data(), password.size(), hash);
+
+    std::string upper = user;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    uint8_t key[16];
+    hmacMd5(hash, sizeof(hash), smbUtf16(upper + domain), key);
+
+    // The server's time when it says it, ours otherwise
+    uint8_t stamp[8];
+    bool stamped = false;
+    set64(stamp, ((uint64_t)time(nullptr) + 11644473600ULL) * 10000000ULL);
+    for(size_t i = 0; i + 4 <= infoSize; ) {
+        uint16_t id = get16(info + i);
+        uint16_t length = get16(info + i + 2);
+        if(id == 0 || i + 4 + length > infoSize)
+            break;
+        if(id == 7 && length == 8) {
+            memcpy(stamp, info + i + 4, 8);
+            stamped = true;
+        }
+        i += 4 + length;
+    }
+
+    uint8_t client[8];
+    for(auto &c : client)
+        c = random(256);
+
+    std::vector<uint8_t> blob = { 1, 1, 0, 0, 0, 0, 0, 0 };
+    append(blob, stamp, 8);
+    append(blob, client, 8);
+    blob.insert(blob.end(), 4, 0);
+    append(blob, info, infoSize);
+    blob.insert(blob.end(), 4, 0);
+
+    std::vector<uint8_t> message(challenge, challenge + 8);
+    append(message, blob.data(), blob.size());
+    uint8_t proof[16];
+    hmacMd5(key, sizeof(key), message, proof);
+    nt.assign(proof, proof + 16);
+    append(nt, blob.data(), blob.size());
+
+    // Not sent when the server gave its time
+    if(stamped) {
+        lm.assign(24, 0);
+    }
+    else {
+        message.assign(challenge, challenge + 8);
+        append(message, client, 8);
+        uint8_t response[16];
+        hmacMd5(key, sizeof(key), message, response);
+        lm.assign(response, response + 16);
+        append(lm, client, 8);
+    }
+}
+
+
+/********************************************************
+ * Requests
+ ********************************************************/
+
+// The handle of the create before it in the same compound
+static const uint8_t smbRelated[16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+#define SMB_READ_ACCESS     0x00120089  // read data, attributes and extended attributes
+#define SMB_LIST_ACCESS     0x00100081  // list, read attributes
+#define SMB_INFO_ACCESS     0x00100080  // read attributes
+#define SMB_DELETE_ACCESS   0x00110080  // delete, read attributes
+
+#define SMB_FILE_OPEN       1
+#define SMB_FILE_CREATE     2
+
+#define SMB_DIRECTORY_FILE      0x00000001
+#define SMB_NON_DIRECTORY_FILE  0x00000040
+#define SMB_DELETE_ON_CLOSE     0x00001000
+
+static SmbSession::Message smbCreate(const std::string &path, uint32_t access, uint32_t disposition, uint32_t options) {
+    SmbSession::Message message;
+    message.command = SMB2_CREATE;
+
+    auto name = smbUtf16(path);
+    auto &b = message.body;
+    b.assign(56, 0);
+    set16(&b[0], 57);
+    set32(&b[4], 2);            // impersonation
+    set32(&b[24], access);
+    set32(&b[32], 7);           // others may read, write and delete
+    set32(&b[36], disposition);
+    set32(&b[40], options);
+    set16(&b[44], 64 + 56);
+    set16(&b[46], name.size());
+    append(b, name.data(), name.size());
+    if(name.empty())
+        b.push_back(0);
+    return message;
+}
+
+static SmbSession::Message smbRead(const uint8_t *file, uint64_t offset, uint32_t length) {
+    SmbSession::Message message;
+    message.command = SMB2_READ;
+
+    auto &b = message.body;
+    b.assign(49, 0);
+    set16(&b[0], 49);
+    b[2] = 64 + 16;             // where the data goes in the answer
+    set32(&b[4], length);
+    set64(&b[8], offset);
+    memcpy(&b[16], file, 16);
+    return message;
+}
+
+static SmbSession::Message smbQuery(const uint8_t *file, bool restart, uint32_t length) {
+    SmbSession::Message message;
+    message.command = SMB2_QUERY_DIRECTORY;
+
+    auto pattern = smbUtf16("*");
+    auto &b = message.body;
+    b.assign(32, 0);
+    set16(&b[0], 33);
+    b[2] = 0x01;                // FileDirectoryInformation
+    b[3] = restart ? 0x01 : 0;
+    memcpy(&b[8], file, 16);
+    set16(&b[24], 64 + 32);
+    set16(&b[26], pattern.size());
+    set32(&b[28], length);
+    append(b, pattern.data(), pattern.size());
+    return message;
+}
+
+static SmbSession::Message smbRename(const uint8_t *file, const std::string &path) {
+    SmbSession::Message message;
+    message.command = SMB2_SET_INFO;
+
+    auto name = smbUtf16(path);
+    auto &b = message.body;
+    b.assign(32 + 20, 0);
+    set16(&b[0], 33);
+    b[2] = 0x01;                // file
+    b[3] = 10;                  // FileRenameInformation
+    set32(&b[4], 20 + name.size());
+    set16(&b[8], 64 + 32);
+    memcpy(&b[16], file, 16);
+    set32(&b[48], name.size());
+    append(b, name.data(), name.size());
+    return message;
+}
+
+static SmbSession::Message smbClose(const uint8_t *file) {
+    SmbSession::Message message;
+    message.command = SMB2_CLOSE;
+
+    auto &b = message.body;
+    b.assign(24, 0);
+    set16(&b[0], 24);
+    memcpy(&b[8], file, 16);
+    return message;
+}
+
+// What a create answers about the file it opened
+static void smbCreated(const uint8_t *answer, SmbEntry &entry) {
+    entry.created = smbTime(get64(answer + 8));
+    entry.modified = smbTime(get64(answer + 24));
+    entry.size = get64(answer + 48);
+    entry.dir = get32(answer + 56) bitand 0x10;
+}
+
+
+/********************************************************
+ * Sessions
+ ********************************************************/
+
+std::list<std::shared_ptr<SmbSession>> SmbSession::m_sessions;
+
+std::shared_ptr<SmbSession> SmbSession::acquire(const PeoplesUrlParser &url) {
+    uint16_t port = url.port.size() ? atoi(url.port.c_str()) : SMB_PORT;
+
+    auto it = m_sessions.begin();
+    while(it != m_sessions.end()) {
+        auto session = *it;
+        if(session->m_busy || session->m_host != url.host || session->m_port != port || session->m_user != url.user) {
+            it++;
+            continue;
+        }
+
+        if(session->m_connection.connected()) {
+            m_sessions.splice(m_sessions.begin(), m_sessions, it);
+            session->m_busy = true;
+            return session;
+        }
+
+        // The server dropped it
+        it = m_sessions.erase(it);
+    }
+
+    std::shared_ptr<SmbSession> session(new SmbSession());
+    session->m_host = url.host;
+    session->m_port = port;
+    session->m_user = url.user;
+
+    IPAddress address;
+    if(!WiFi.hostByName(url.host.c_str(), address) || !session->m_connection.connect(address, port)) {
+        Debug_printv("can't connect to [%s:%d]", url.host.c_str(), port);
+        return nullptr;
+    }
+    session->m_connection.setNoDelay(true);
+
+    std::string domain;
+    std::string user = url.user;
+    size_t semicolon = user.find(';');
+    if(semicolon != std::string::npos) {
+        domain = user.substr(0, semicolon);
+        user = user.substr(semicolon + 1);
+    }
+    if(!session->negotiate() || !session->setup(domain, user, url.pass))
+        return nullptr;
+
+    session->m_busy = true;
+    m_sessions.push_front(session);
+    return session;
+}
+
+void SmbSession::release(std::shared_ptr<SmbSession> &session) {
+    if(session == nullptr)
+        return;
+
+    // Idle ones don't hold on to answers
+    session->m_frame.reset();
+    session->m_capacity = 0;
+    session->m_busy = false;
+    session->m_used = millis();
+    session.reset();
+
+    size_t idle = 0;
+    auto it = m_sessions.begin();
+    while(it != m_sessions.end()) {
+        if(!(*it)->m_busy && ++idle > SMB_SESSIONS)
+            it = m_sessions.erase(it);
+        else
+            it++;
+    }
+}
+
+SmbSession::~SmbSession() {
+    // The server cleans up after the connection
+    m_connection.stop();
+}
+
+bool SmbSession::negotiate(void) {
+    const uint16_t dialects[] = { 0x0202, 0x0210, 0x0300, 0x0302 };
+
+    Message message;
+    message.command = SMB2_NEGOTIATE;
+    auto &b = message.body;
+    b.assign(36, 0);
+    set16(&b[0], 36);
+    set16(&b[2], sizeof(dialects) / sizeof(dialects[0]));
+    set16(&b[4], 0x0001);       // signing enabled, not required
+    for(int i = 12; i < 28; i++)
+        b[i] = random(256);     // client guid
+    for(auto dialect : dialects) {
+        uint8_t d[2];
+        set16(d, dialect);
+        append(b, d, 2);
+    }
+
+    if(!exchange("", &message, 1) || message.status != SMB_STATUS_SUCCESS || message.size < 64)
+        return false;
+
+    const uint8_t *answer = this->answer(message);
+    uint16_t security = get16(answer + 2);
+    m_dialect = get16(answer + 4);
+    m_maxTransact = get32(answer + 28);
+    m_maxRead = std::min((size_t)get32(answer + 32), (size_t)SMB_READ_SIZE);
+
+    Debug_printv("[%s] dialect[%.4X] read[%d] transact[%d] security[%d]", m_host.c_str(), m_dialect, m_maxRead, m_maxTransact, security);
+    if(security bitand 0x0002) {
+        Debug_printv("[%s] wants signing", m_host.c_str());
+        return false;
+    }
+    return m_maxRead > 0;
+}
+
+// NTLMSSP, without the SPNEGO wrapping servers do without
+bool SmbSession::setup(const std::string &domain, const std::string &user, const std::string &pass) {
+    // unicode, target info, NTLM with extended session security, 128 and 56 bit
+    uint32_t flags = 0xA0888205;
+
+    auto request = [this](const std::vector<uint8_t> &token, Message &message) {
+        message.command = SMB2_SESSION_SETUP;
+        auto &b = message.body;
+        b.assign(24, 0);
+        set16(&b[0], 25);
+        set16(&b[12], 64 + 24);
+        set16(&b[14], token.size());
+        append(b, token.data(), token.size());
+        return exchange("", &message, 1);
+    };
+
+    std::vector<uint8_t> negotiate(32, 0);
+    memcpy(&negotiate[0], "NTLMSSP", 8);
+    set32(&negotiate[8], 1);
+    set32(&negotiate[12], flags);
+
+    Message first;
+    if(!request(negotiate, first) || first.status != SMB_STATUS_MORE_PROCESSING_REQUIRED || first.size < 8)
+        return false;
+
+    // The challenge, its buffers are from the header start
+    const uint8_t *header = answer(first) - 64;
+    size_t offset = get16(answer(first) + 4);
+    size_t length = get16(answer(first) + 6);
+    const uint8_t *challenge = header + offset;
+    if(offset + length > first.size + 64 || length < 48 || memcmp(challenge, "NTLMSSP", 8) != 0 || get32(challenge + 8) != 2)
+        return false;
+
+    size_t infoSize = get16(challenge + 40);
+    size_t infoOffset = get32(challenge + 44);
+    if(infoOffset + infoSize > length)
+        infoSize = 0;
+
+    std::vector<uint8_t> lm;
+    std::vector<uint8_t> nt;
+    if(user.empty()) {
+        // Anonymous
+        flags |= 0x00000800;
+        lm.assign(1, 0);
+    }
+    else {
+        ntlmv2(domain, user, pass, challenge + 24, challenge + infoOffset, infoSize, lm, nt);
+    }
+
+    // Fields of length, room and offset, then flags and the payload
+    std::vector<uint8_t> authenticate(64, 0);
+    memcpy(&authenticate[0], "NTLMSSP", 8);
+    set32(&authenticate[8], 3);
+    set32(&authenticate[60], flags);
+    auto field = [&authenticate](size_t at, const std::vector<uint8_t> &value) {
+        set16(&authenticate[at], value.size());
+        set16(&authenticate[at + 2], value.size());
+        set32(&authenticate[at + 4], authenticate.size());
+        append(authenticate, value.data(), value.size());
+    };
+    field(28, smbUtf16(domain));
+    field(36, smbUtf16(user));
+    field(44, smbUtf16("MEATLOAF"));
+    field(12, lm);
+    field(20, nt);
+    set32(&authenticate[56], authenticate.size());   // no session key
+
+    Message second;
+    if(!request(authenticate, second) || second.status != SMB_STATUS_SUCCESS || second.size < 8) {
+        Debug_printv("[%s] login of [%s] refused [%.8X]", m_host.c_str(), user.c_str(), second.status);
+        return false;
+    }
+
+    // guest 0x01, anonymous 0x02, encrypted 0x04
+    uint16_t session = get16(answer(second) + 2);
+    if(session bitand 0x0004) {
+        Debug_printv("[%s] wants encryption", m_host.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool SmbSession::tree(const std::string &share, uint32_t &id) {
+    for(auto &tree : m_trees) {
+        if(tree.first == share) {
+            id = tree.second;
+            return true;
+        }
+    }
+
+    auto path = smbUtf16("\\\\" + m_host + "\\" + share);
+    Message message;
+    message.command = SMB2_TREE_CONNECT;
+    auto &b = message.body;
+    b.assign(8, 0);
+    set16(&b[0], 9);
+    set16(&b[4], 64 + 8);
+    set16(&b[6], path.size());
+    append(b, path.data(), path.size());
+
+    if(!exchange("", &message, 1) || message.status != SMB_STATUS_SUCCESS || message.size < 16) {
+        Debug_printv("[%s] share [%s] refused [%.8X]", m_host.c_str(), share.c_str(), message.status);
+        return false;
+    }
+
+    // Disks only, and only without encryption
+    const uint8_t *answer = this->answer(message);
+    if(answer[2] != 0x01 || (get32(answer + 4) bitand 0x8000))
+        return false;
+
+    id = get32(answer - 64 + 36);
+    m_trees.emplace_back(share, id);
+    return true;
+}
+
+bool SmbSession::exchange(const std::string &share, Message *messages, size_t count) {
+    uint32_t id = 0;
+    if(share.size() && !tree(share, id))
+        return false;
+
+    if(!send(id, messages, count)) {
+        m_connection.stop();
+        return false;
+    }
+
+    // Answers to compounds usually come in one frame, but may come in more
+    const uint8_t smb2[] = { 0xFE, 'S', 'M', 'B' };
+    m_length = 0;
+    size_t answered = 0;
+    while(answered < count) {
+        size_t at = m_length;
+        if(!receive())
+            return false;
+
+        while(at + 64 <= m_length) {
+            const uint8_t *header = m_frame.get() + at;
+            if(memcmp(header, smb2, 4) != 0) {
+                Debug_printv("[%s] not an SMB2 answer", m_host.c_str());
+                m_connection.stop();
+                return false;
+            }
+
+            uint32_t status = get32(header + 8);
+            uint32_t flags = get32(header + 16);
+            uint32_t next = get32(header + 20);
+            uint64_t sequence = get64(header + 24);
+            size_t size = next ? next : m_length - at;
+            if(at + size > m_length)
+                break;
+
+            // Interim, the real answer follows
+            if(status != SMB_STATUS_PENDING || !(flags bitand 0x02)) {
+                if(get16(header + 12) == SMB2_SESSION_SETUP)
+                    m_session = get64(header + 40);
+
+                for(size_t i = 0; i < count; i++) {
+                    if(messages[i].id == sequence) {
+                        messages[i].status = status;
+                        messages[i].offset = at + 64;
+                        messages[i].size = size - 64;
+                        answered++;
+                    }
+                }
+            }
+
+            if(next == 0)
+                break;
+            at += next;
+        }
+    }
+    return true;
+}
+
+bool SmbSession::send(uint32_t tree, Message *messages, size_t count) {
+    std::vector<uint8_t> out(4, 0);
+    for(size_t i = 0; i < count; i++) {
+        size_t start = out.size();
+        out.resize(start + 64, 0);
+        uint8_t *header = &out[start];
+        header[0] = 0xFE;
+        header[1] = 'S';
+        header[2] = 'M';
+        header[3] = 'B';
+        set16(header + 4, 64);
+        set16(header + 6, m_dialect >= 0x0210 ? 1 : 0);     // credit charge
+        set16(header + 12, messages[i].command);
+        set16(header + 14, 64);                             // credits asked for
+        set32(header + 16, i ? 0x04 : 0);                   // related to the one before
+        set64(header + 24, m_sequence);
+        set32(header + 32, 0xFEFF);                         // process id
+        set32(header + 36, tree);
+        set64(header + 40, m_session);
+        messages[i].id = m_sequence++;
+
+        append(out, messages[i].body.data(), messages[i].body.size());
+
+        // Each one starts 8 byte aligned
+        if(i + 1 < count) {
+            while((out.size() - start) % 8)
+                out.push_back(0);
+            set32(&out[start + 20], out.size() - start);
+        }
+    }
+
+    size_t length = out.size() - 4;
+    out[1] = length >> 16;
+    out[2] = length >> 8;
+    out[3] = length;
+    return m_connection.write(out.data(), out.size()) == out.size();
+}
+
+// One frame more after what was received so far
+bool SmbSession::receive(void) {
+    uint8_t head[4];
+    if(!fill(head, sizeof(head)))
+        return false;
+    size_t length = (head[1] << 16) | (head[2] << 8) | head[3];
+
+    if(m_length + length > m_capacity) {
+        std::unique_ptr<uint8_t[]> frame(new (std::nothrow) uint8_t[m_length + length]);
+        if(frame == nullptr) {
+            Debug_printv("[%s] no memory for [%d] bytes", m_host.c_str(), m_length + length);
+            m_connection.stop();
+            return false;
+        }
+        if(m_length)
+            memcpy(frame.get(), m_frame.get(), m_length);
+        m_frame = std::move(frame);
+        m_capacity = m_length + length;
+    }
+
+    if(!fill(m_frame.get() + m_length, length))
+        return false;
+    m_length += length;
+    return true;
+}
+
+bool SmbSession::fill(uint8_t *buf, size_t size) {
+    uint32_t start = millis();
+    while(size) {
+        int n = m_connection.available();
+        if(n <= 0) {
+            if(!m_connection.connected() || millis() - start > SMB_TIMEOUT) {
+                m_connection.stop();
+                return false;
+            }
+            delay(1);
+            continue;
+        }
+
+        n = m_connection.read(buf, std::min((size_t)n, size));
+        if(n > 0) {
+            buf += n;
+            size -= n;
+            start = millis();
+        }
+    }
+    return true;
+}
+
+bool SmbSession::info(const std::string &share, const std::string &path, SmbEntry &entry) {
+    Message messages[] = {
+        smbCreate(path, SMB_INFO_ACCESS, SMB_FILE_OPEN, 0),
+        smbClose(smbRelated)
+    };
+    if(!exchange(share, messages, 2) || messages[0].status != SMB_STATUS_SUCCESS || messages[0].size < 88)
+        return false;
+
+    smbCreated(answer(messages[0]), entry);
+    entry.name = smbName(path);
+    return true;
+}
+
+// Batches of FileDirectoryInformation on the handle the create opened
+bool SmbSession::list(const std::string &share, const std::string &path, std::vector<SmbEntry> &entries) {
+    uint32_t length = std::min((size_t)SMB_LIST_SIZE, m_maxTransact);
+    Message open[] = {
+        smbCreate(path, SMB_LIST_ACCESS, SMB_FILE_OPEN, SMB_DIRECTORY_FILE),
+        smbQuery(smbRelated, true, length)
+    };
+    if(!exchange(share, open, 2) || open[0].status != SMB_STATUS_SUCCESS || open[0].size < 88)
+        return false;
+
+    uint8_t file[16];
+    memcpy(file, answer(open[0]) + 64, 16);
+
+    entries.clear();
+    Message query = open[1];
+    bool listed = true;
+    while(true) {
+        if(query.status == SMB_STATUS_NO_MORE_FILES)
+            break;
+        if(query.status != SMB_STATUS_SUCCESS || query.size < 8) {
+            listed = false;
+            break;
+        }
+
+        const uint8_t *header = answer(query) - 64;
+        size_t offset = get16(answer(query) + 2);
+        size_t size = get32(answer(query) + 4);
+        if(offset + size > query.size + 64) {
+            listed = false;
+            break;
+        }
+
+        // next, index, created, accessed, written, changed, size, allocated, attributes, name length, name
+        const uint8_t *info = header + offset;
+        size_t at = 0;
+        while(at + 64 <= size) {
+            const uint8_t *item = info + at;
+            size_t nameSize = get32(item + 60);
+            if(at + 64 + nameSize > size)
+                break;
+
+            SmbEntry entry;
+            entry.name = smbUtf8(item + 64, nameSize);
+            entry.created = smbTime(get64(item + 8));
+            entry.modified = smbTime(get64(item + 24));
+            entry.size = get64(item + 40);
+            uint32_t attributes = get32(item + 56);
+            entry.dir = attributes bitand 0x10;
+
+            // Hidden and system files, the directory itself and its parent
+            if(!(attributes bitand 0x06) && entry.name != "." && entry.name != "..")
+                entries.push_back(entry);
+
+            uint32_t next = get32(item);
+            if(next == 0)
+                break;
+            at += next;
+        }
+
+        query = smbQuery(file, false, length);
+        if(!exchange(share, &query, 1))
+            return false;
+    }
+
+    Message close = smbClose(file);
+    exchange(share, &close, 1);
+
+    // Folders first, then by name
+    std::sort(entries.begin(), entries.end(), [](const SmbEntry &a, const SmbEntry &b) {
+        if(a.dir != b.dir)
+            return a.dir;
+        return strcasecmp(a.name.c_str(), b.name.c_str()) < 0;
+    });
+
+    Debug_printv("[%s\\%s] entries[%d]", share.c_str(), path.c_str(), entries.size());
+    return listed;
+}
+
+
+/********************************************************
+ * Listings
+ ********************************************************/
+
+std::list<SmbListings::Listing> SmbListings::m_listings;
+uint32_t SmbListings::hits = 0;
+uint32_t SmbListings::misses = 0;
+
+std::string SmbListings::key(const PeoplesUrlParser &url, const std::string &share, const std::string &dir) {
+    return url.user + "@" + url.host + ":" + url.port + "\\" + share + "\\" + dir;
+}
+
+// Fresh, or the end of the list
+std::list<SmbListings::Listing>::iterator SmbListings::lookup(const std::string &key) {
+    for(auto it = m_listings.begin(); it != m_listings.end(); it++) {
+        if(it->key != key)
+            continue;
+
+        if(millis() - it->stamp < SMB_LISTING_TTL)
+            return it;
+        m_listings.erase(it);
+        break;
+    }
+    return m_listings.end();
+}
+
+bool SmbListings::get(const PeoplesUrlParser &url, const std::string &share, const std::string &dir, std::vector<SmbEntry> &entries) {
+    std::string k = key(url, share, dir);
+    auto it = lookup(k);
+    if(it != m_listings.end()) {
+        m_listings.splice(m_listings.begin(), m_listings, it);
+        entries = m_listings.front().entries;
+        hits++;
+        return true;
+    }
+
+    misses++;
+    auto session = SmbSession::acquire(url);
+    if(session == nullptr)
+        return false;
+    bool listed = session->list(share, dir, entries);
+    SmbSession::release(session);
+    if(!listed)
+        return false;
+
+    m_listings.push_front({ k, entries, (uint32_t)millis() });
+    if(m_listings.size() > SMB_LISTINGS)
+        m_listings.pop_back();
+    return true;
+}
+
+bool SmbListings::find(const PeoplesUrlParser &url, const std::string &share, const std::string &dir, const std::string &name, SmbEntry &entry) {
+    auto it = lookup(key(url, share, dir));
+    if(it == m_listings.end())
+        return false;
+
+    // Listed without it, so it isn't there
+    hits++;
+    entry = SmbEntry();
+    for(auto &listed : it->entries) {
+        if(listed.name == name) {
+            entry = listed;
+            break;
+        }
+    }
+    return true;
+}
+
+void SmbListings::forget(const PeoplesUrlParser &url, const std::string &share, const std::string &dir) {
+    std::string k = key(url, share, dir);
+    m_listings.remove_if([&k](const Listing &listing) { return listing.key == k; });
+}
+
+
+/********************************************************
+ * File impls
+ ********************************************************/
+
+MIStream* SmbFile::inputStream() {
+    // has to return OPENED stream
+    MIStream* istream = new SmbIStream(url);
+    istream->open();
+    return istream;
+}
+
+bool SmbFile::stat(void) {
+    if(m_statted)
+        return m_exists;
+
+    std::string share, in;
+    smbSplit(path, share, in);
+
+    // The server itself, its shares can't be listed
+    if(share.empty()) {
+        m_statted = m_exists = m_entry.dir = true;
+        return true;
+    }
+
+    // A listing kept of the directory answers without asking
+    if(in.size() && SmbListings::find(*this, share, smbParent(in), smbName(in), m_entry)) {
+        m_statted = true;
+        m_exists = m_entry.name.size();
+        return m_exists;
+    }
+
+    auto session = SmbSession::acquire(*this);
+    if(session == nullptr)
+        return false;
+    m_exists = session->info(share, in, m_entry);
+    m_statted = true;
+    SmbSession::release(session);
+    return m_exists;
+}
+
+bool SmbFile::isDirectory() {
+    return stat() && m_entry.dir;
+}
+
+bool SmbFile::exists() {
+    return stat();
+}
+
+size_t SmbFile::size() {
+    return stat() ? m_entry.size : 0;
+}
+
+time_t SmbFile::getLastWrite() {
+    return stat() ? m_entry.modified : 0;
+}
+
+time_t SmbFile::getCreationTime() {
+    return stat() ? m_entry.created : 0;
+}
+
+bool SmbFile::change(SmbSession::Message *messages, size_t count) {
+    std::string share, in;
+    smbSplit(path, share, in);
+    if(share.empty() || in.empty())
+        return false;
+
+    auto session = SmbSession::acquire(*this);
+    if(session == nullptr)
+        return false;
+    bool done = session->exchange(share, messages, count);
+    for(size_t i = 0; i < count; i++)
+        done = done && messages[i].status == SMB_STATUS_SUCCESS;
+    SmbSession::release(session);
+
+    SmbListings::forget(*this, share, smbParent(in));
+    m_statted = false;
+    return done;
+}
+
+bool SmbFile::mkDir() {
+    std::string share, in;
+    smbSplit(path, share, in);
+    SmbSession::Message messages[] = {
+        smbCreate(in, SMB_INFO_ACCESS, SMB_FILE_CREATE, SMB_DIRECTORY_FILE),
+        smbClose(smbRelated)
+    };
+    return change(messages, 2);
+}
+
+bool SmbFile::remove() {
+    std::string share, in;
+    smbSplit(path, share, in);
+    SmbSession::Message messages[] = {
+        smbCreate(in, SMB_DELETE_ACCESS, SMB_FILE_OPEN, SMB_DELETE_ON_CLOSE),
+        smbClose(smbRelated)
+    };
+    return change(messages, 2);
+}
+
+bool SmbFile::rename(std::string dest) {
+    if(dest.empty())
+        return false;
+
+    // Only within this share
+    if(dest.find("://") != std::string::npos) {
+        PeoplesUrlParser parser;
+        parser.parseUrl(dest);
+        dest = parser.path;
+    }
+    std::string share, in, destShare, destIn;
+    smbSplit(path, share, in);
+    smbSplit(dest, destShare, destIn);
+    if(destShare != share)
+        return false;
+
+    SmbSession::Message messages[] = {
+        smbCreate(in, SMB_DELETE_ACCESS, SMB_FILE_OPEN, 0),
+        smbRename(smbRelated, destIn),
+        smbClose(smbRelated)
+    };
+    bool done = change(messages, 3);
+    SmbListings::forget(*this, share, smbParent(destIn));
+    return done;
+}
+
+bool SmbFile::rewindDirectory() {
+    std::string share, in;
+    smbSplit(path, share, in);
+
+    m_next = 0;
+    m_listed = share.size() && SmbListings::get(*this, share, in, m_entries);
+    return m_listed;
+}
+
+MFile* SmbFile::getNextFileInDir() {
+    if(!m_listed && !rewindDirectory())
+        return nullptr;
+
+    if(m_next >= m_entries.size()) {
+        m_listed = false;
+        return nullptr;
+    }
+
+    // The listing already told all there is to know
+    SmbEntry &entry = m_entries[m_next++];
+    auto file = new SmbFile(url + (mstr::endsWith(url, "/") ? "" : "/") + entry.name);
+    file->m_statted = true;
+    file->m_exists = true;
+    file->m_entry = entry;
+    return file;
+}
+
+
+/********************************************************
+ * Istream impls
+ ********************************************************/
+
+bool SmbIStream::open() {
+    m_url.parseUrl(url);
+    smbSplit(m_url.path, m_share, m_path);
+    if(m_share.empty() || m_path.empty())
+        return false;
+
+    // The first block comes with the size
+    if(!fetch(0))
+        return false;
+
+    m_position = 0;
+    m_isOpen = true;
+    Debug_printv("[%s] size[%d] reads[%d]", url.c_str(), m_size, m_readSize);
+    return true;
+}
+
+void SmbIStream::close() {
+    m_frame.reset();
+    m_data = nullptr;
+    m_blockSize = 0;
+    m_isOpen = false;
+}
+
+// Create, read and close in one go, once more on a new connection when
+// the server dropped the one kept
+bool SmbIStream::fetch(size_t start) {
+    // The heap may only have room for one block
+    m_frame.reset();
+    m_data = nullptr;
+    m_blockSize = 0;
+
+    for(int attempt = 0; attempt < 2; attempt++) {
+        auto session = SmbSession::acquire(m_url);
+        if(session == nullptr)
+            return false;
+
+        if(m_readSize == 0) {
+#if defined(ESP32)
+            size_t room = ESP.getMaxAllocHeap();
+#else
+            size_t room = ESP.getMaxFreeBlockSize();
+#endif
+            m_readSize = session->readSize();
+            while(m_readSize > 1024 && m_readSize * 2 > room)
+                m_readSize /= 2;
+        }
+        start -= start % m_readSize;
+
+        SmbSession::Message messages[] = {
+            smbCreate(m_path, SMB_READ_ACCESS, SMB_FILE_OPEN, SMB_NON_DIRECTORY_FILE),
+            smbRead(smbRelated, start, m_readSize),
+            smbClose(smbRelated)
+        };
+        bool exchanged = session->exchange(m_share, messages, 3);
+        if(!exchanged || messages[0].status != SMB_STATUS_SUCCESS || messages[0].size < 88) {
+            SmbSession::release(session);
+            if(!exchanged)
+                continue;
+            return false;
+        }
+
+        SmbEntry entry;
+        smbCreated(session->answer(messages[0]), entry);
+        m_size = entry.size;
+        m_blockStart = start;
+
+        const SmbSession::Message &read = messages[1];
+        bool done = (read.status == SMB_STATUS_END_OF_FILE);
+        if(read.status == SMB_STATUS_SUCCESS && read.size >= 16) {
+            // The data is where the header says, from the header start
+            const uint8_t *answer = session->answer(read);
+            size_t at = read.offset - 64 + answer[2];
+            size_t length = get32(answer + 4);
+            if(at + length <= read.offset + read.size) {
+                m_frame = session->keep();
+                m_data = m_frame.get() + at;
+                m_blockSize = length;
+                done = true;
+            }
+        }
+        SmbSession::release(session);
+        return done;
+    }
+    return false;
+}
+
+bool SmbIStream::seek(size_t pos) {
+    if(pos > m_size)
+        return false;
+    m_position = pos;
+    return true;
+}
+
+size_t SmbIStream::read(uint8_t* buf, size_t size) {
+    if(size > available())
+        size = available();
+    if(size == 0)
+        return 0;
+
+    if(m_data == nullptr || m_position < m_blockStart || m_position >= m_blockStart + m_blockSize) {
+        if(!fetch(m_position) || m_position >= m_blockStart + m_blockSize)
+            return 0;
+    }
+
+    size_t offset = m_position - m_blockStart;
+    size_t count = std::min(size, m_blockSize - offset);
+    memcpy(buf, m_data + offset, count);
+    m_position += count;
+    return count;
+}
@@ -0,0 +1,457 @@
+#include "tftp.h"
+
+// Numbers are big endian on the wire
+static uint16_t tftp16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+
+/********************************************************
+ * Servers
+ ********************************************************/
+
+std::list<std::shared_ptr<TftpServer>> TftpServer::m_servers;
+
+std::shared_ptr<TftpServer> TftpServer::get(const std::string &host, uint16_t port) {
+    for(auto it = m_servers.begin(); it != m_servers.end(); it++) {
+        if((*it)->m_host != host || (*it)->m_port != port)
+            continue;
+
+        m_servers.splice(m_servers.begin(), m_servers, it);
+        return m_servers.front();
+    }
+
+    std::shared_ptr<TftpServer> server(new TftpServer());
+    server->m_host = host;
+    server->m_port = port;
+    if(!WiFi.hostByName(host.c_str(), server->m_address))
+        return nullptr;
+
+    m_servers.push_front(server);
+    if(m_servers.size() > TFTP_SERVERS)
+        m_servers.pop_back();
+    return server;
+}
+
+void TftpServer::measured(uint32_t rtt) {
+    if(!m_measured) {
+        m_measured = true;
+        m_srtt = rtt;
+        m_rttvar = rtt / 2;
+    }
+    else {
+        uint32_t delta = (m_srtt > rtt) ? m_srtt - rtt : rtt - m_srtt;
+        m_rttvar = (3 * m_rttvar + delta) / 4;
+        m_srtt = (7 * m_srtt + rtt) / 8;
+    }
+
+    m_rto = m_srtt + std::max((uint32_t)1, 4 * m_rttvar);
+    m_rto = std::max((uint32_t)TFTP_RTO_MIN, std::min(m_rto, (uint32_t)TFTP_RTO_MAX));
+}
+
+void TftpServer::backoff(void) {
+    m_rto = std::min(m_rto * 2, (uint32_t)TFTP_RTO_MAX);
+}
+
+bool TftpServer::size(const std::string &path, bool &exists, size_t &size) {
+    for(auto it = m_sizes.begin(); it != m_sizes.end(); it++) {
+        if(it->path != path)
+            continue;
+
+        if(millis() - it->stamp > TFTP_SIZE_TTL) {
+            m_sizes.erase(it);
+            return false;
+        }
+        exists = it->exists;
+        size = it->size;
+        return true;
+    }
+    return false;
+}
+
+void TftpServer::put(const std::string &path, bool exists, size_t size) {
+    m_sizes.remove_if([&path](const Size &s) { return s.path == path; });
+    m_sizes.push_front({ path, exists, size, (uint32_t)millis() });
+    if(m_sizes.size() > TFTP_SIZES)
+        m_sizes.pop_back();
+}
+
+
+/********************************************************
+ * File impls
+ ********************************************************/
+
+MIStream* TftpFile::inputStream() {
+    // has to return OPENED stream
+    MIStream* istream = new TftpIStream(url);
+    istream->open();
+    return istream;
+}
+
+// A transfer started for its tsize and given up again
+bool TftpFile::stat(void) {
+    if(m_statted)
+        return m_exists;
+
+    auto server = TftpServer::get(host, port.size() ? atoi(port.c_str()) : TFTP_PORT);
+    if(server == nullptr)
+        return false;
+    if(server->size(path, m_exists, m_size)) {
+        m_statted = true;
+        return m_exists;
+    }
+
+    TftpIStream probe(url, TFTP_BLOCK, 1);
+    m_exists = probe.open();
+    m_size = probe.size();
+
+    // Only a file the server said isn't there is known not to be
+    m_statted = m_exists || probe.missing();
+    return m_exists;
+}
+
+bool TftpFile::exists() {
+    return stat();
+}
+
+// 0 from servers without tsize
+size_t TftpFile::size() {
+    return stat() ? m_size : 0;
+}
+
+
+/********************************************************
+ * Istream impls
+ ********************************************************/
+
+bool TftpIStream::open() {
+    PeoplesUrlParser parser;
+    parser.parseUrl(url);
+    m_path = parser.path;
+
+    m_server = TftpServer::get(parser.host, parser.port.size() ? atoi(parser.port.c_str()) : TFTP_PORT);
+    if(m_server == nullptr)
+        return false;
+
+    // One more for the zero after a text
+    size_t largest = std::max(m_blksizeWanted, (size_t)TFTP_BLOCK) + 5;
+    m_packet.reset(new (std::nothrow) uint8_t[largest]);
+    m_block.reset(new (std::nothrow) uint8_t[largest]);
+    if(m_packet == nullptr || m_block == nullptr) {
+        close();
+        return false;
+    }
+
+    m_tid = 0;
+    m_blksize = TFTP_BLOCK;
+    m_window = 1;
+    m_size = 0;
+    m_sized = false;
+    m_missing = false;
+    m_position = 0;
+    m_blockSize = 0;
+    m_offset = 0;
+    m_number = 0;
+    m_unacked = 0;
+    m_last = false;
+    m_gap = false;
+
+    m_udp.begin(0);
+    if(!request()) {
+        if(m_missing)
+            m_server->put(m_path, false, 0);
+        close();
+        return false;
+    }
+
+    if(m_sized)
+        m_server->put(m_path, true, m_size);
+    m_isOpen = true;
+    Debug_printv("[%s] size[%d] blksize[%d] window[%d] rto[%d]", url.c_str(), m_size, m_blksize, m_window, m_server->timeout());
+    return true;
+}
+
+void TftpIStream::close() {
+    // The server would send the rest until it gives up
+    if(m_isOpen && !(m_last && m_unacked == 0))
+        abort();
+
+    m_udp.stop();
+    m_packet.reset();
+    m_block.reset();
+    m_isOpen = false;
+}
+
+// Sent again with the options until an answer comes, without them when
+// the server refuses them
+bool TftpIStream::request(void) {
+    std::string rrq;
+    rrq += '\0';
+    rrq += (char)TFTP_RRQ;
+    rrq += m_path + '\0' + "octet" + '\0';
+
+    bool options = m_server->options;
+    if(options) {
+        rrq += "blksize" + std::string(1, '\0') + std::to_string(m_blksizeWanted) + '\0';
+        if(m_windowWanted > 1)
+            rrq += "windowsize" + std::string(1, '\0') + std::to_string(m_windowWanted) + '\0';
+        rrq += "tsize" + std::string(1, '\0') + "0" + '\0';
+        rrq += "timeout" + std::string(1, '\0') + "1" + '\0';
+    }
+
+    for(int tries = 0; tries < TFTP_RETRIES; tries++) {
+        uint32_t sent = millis();
+        m_udp.beginPacket(m_server->address(), m_server->port());
+        m_udp.write((const uint8_t *)rrq.data(), rrq.size());
+        if(!m_udp.endPacket())
+            break;
+
+        while(millis() - sent < m_server->timeout()) {
+            int opcode = receive();
+            if(opcode == 0) {
+                delay(1);
+                continue;
+            }
+
+            // Only first tries are measured, an answer to a repeat could be to either
+            if(tries == 0)
+                m_server->measured(millis() - sent);
+
+            if(opcode == TFTP_ERROR) {
+                uint16_t code = tftp16(m_packet.get() + 2);
+                Debug_printv("[%s] error[%d] %s", m_path.c_str(), code, (const char *)m_packet.get() + 4);
+                if(code == TFTP_BAD_OPTIONS && options) {
+                    m_server->options = false;
+                    m_tid = 0;
+                    return request();
+                }
+                m_missing = (code == TFTP_NOT_FOUND);
+                return false;
+            }
+
+            if(opcode == TFTP_OACK) {
+                // name and value pairs, those not answered are not taken
+                const char *p = (const char *)m_packet.get() + 2;
+                const char *end = (const char *)m_packet.get() + m_received;
+                while(p < end) {
+                    std::string name = p;
+                    p += name.size() + 1;
+                    if(p >= end)
+                        break;
+                    std::string value = p;
+                    p += value.size() + 1;
+
+                    mstr::toLower(name);
+                    size_t number = strtoul(value.c_str(), nullptr, 10);
+                    if(name == "blksize" && number >= 8)
+                        m_blksize = std::min(number, m_blksizeWanted);
+                    else if(name == "windowsize" && number >= 1)
+                        m_window = std::min(number, m_windowWanted);
+                    else if(name == "tsize") {
+                        m_size = number;
+                        m_sized = true;
+                    }
+                }
+                m_blockSize = 0;
+                ack(0);
+                return true;
+            }
+
+            if(opcode == TFTP_DATA && tftp16(m_packet.get() + 2) == 1) {
+                // Options ignored, the first block is already here
+                std::swap(m_packet, m_block);
+                m_blockSize = m_received - 4;
+                m_number = 1;
+                m_last = (m_blockSize < m_blksize);
+                ack(1);
+                return true;
+            }
+        }
+
+        // Answers to the request before come from another port
+        m_server->backoff();
+        m_tid = 0;
+    }
+
+    Debug_printv("[%s] no answer", m_path.c_str());
+    return false;
+}
+
+// The opcode of a datagram from the server, 0 when none came
+int TftpIStream::receive(void) {
+    int size = m_udp.parsePacket();
+    if(size <= 0)
+        return 0;
+
+    if((uint32_t)m_udp.remoteIP() != (uint32_t)m_server->address()) {
+        m_udp.read(m_packet.get(), 4);
+        return 0;
+    }
+
+    // The first answer picks the port of the transfer, a second transfer
+    // started by a repeated request is told to stop
+    uint16_t port = m_udp.remotePort();
+    if(m_tid == 0)
+        m_tid = port;
+    else if(port != m_tid) {
+        const uint8_t error[] = { 0, TFTP_ERROR, 0, 5, 'T', 'I', 'D', 0 };
+        m_udp.beginPacket(m_server->address(), port);
+        m_udp.write(error, sizeof(error));
+        m_udp.endPacket();
+        return 0;
+    }
+
+    size = m_udp.read(m_packet.get(), std::max(m_blksizeWanted, (size_t)TFTP_BLOCK) + 4);
+    if(size < 4)
+        return 0;
+    m_received = size;
+
+    // The texts in errors and options end with a zero even when cut short
+    int opcode = tftp16(m_packet.get());
+    if(opcode == TFTP_ERROR || opcode == TFTP_OACK)
+        m_packet[size] = 0;
+    return opcode;
+}
+
+void TftpIStream::ack(uint16_t number) {
+    const uint8_t packet[] = { 0, TFTP_ACK, (uint8_t)(number >> 8), (uint8_t)(number bitand 0xFF) };
+    m_udp.beginPacket(m_server->address(), m_tid);
+    m_udp.write(packet, sizeof(packet));
+    m_udp.endPacket();
+    m_acked = m_since = millis();
+    m_unacked = 0;
+}
+
+void TftpIStream::abort(void) {
+    const uint8_t packet[] = { 0, TFTP_ERROR, 0, 0, 'c', 'l', 'o', 's', 'e', 'd', 0 };
+    m_udp.beginPacket(m_server->address(), m_tid);
+    m_udp.write(packet, sizeof(packet));
+    m_udp.endPacket();
+}
+
+// The block after the last one in order, ACKed at the end of each window
+bool TftpIStream::next(void) {
+    int tries = 0;
+    bool waited = false;
+    while(true) {
+        int opcode = receive();
+        if(opcode == 0) {
+            if(millis() - m_since < m_server->timeout()) {
+                waited = true;
+                delay(1);
+                continue;
+            }
+
+            // Lost, the server goes on after the last one in order
+            if(++tries > TFTP_RETRIES) {
+                Debug_printv("[%s] block[%d] lost", m_path.c_str(), (uint16_t)(m_number + 1));
+                return false;
+            }
+            m_server->backoff();
+            ack(m_number);
+            m_repeated = true;
+            retransmits++;
+            continue;
+        }
+
+        if(opcode == TFTP_ERROR) {
+            Debug_printv("[%s] error[%d] %s", m_path.c_str(), tftp16(m_packet.get() + 2), (const char *)m_packet.get() + 4);
+            return false;
+        }
+        if(opcode != TFTP_DATA)
+            continue;
+
+        // Older ones are repeats, a newer one means one between got lost.
+        // One ACK again per gap, the blocks after it are already coming.
+        uint16_t number = tftp16(m_packet.get() + 2);
+        if(number != (uint16_t)(m_number + 1)) {
+            if((uint16_t)(number - m_number) < 0x8000 && !m_gap) {
+                m_gap = true;
+                ack(m_number);
+                m_repeated = true;
+                retransmits++;
+            }
+            continue;
+        }
+
+        // The first block of a window measures the ACK before it, unless
+        // that was sent more than once or the block was waiting already
+        if(m_unacked == 0 && !m_repeated && waited)
+            m_server->measured(millis() - m_acked);
+        m_repeated = false;
+        m_gap = false;
+
+        std::swap(m_packet, m_block);
+        m_blockSize = m_received - 4;
+        m_offset = 0;
+        m_number = number;
+        m_unacked++;
+        m_since = millis();
+        m_last = (m_blockSize < m_blksize);
+        if(m_unacked >= m_window || m_last)
+            ack(m_number);
+        return true;
+    }
+}
+
+bool TftpIStream::seek(size_t pos) {
+    if(pos == m_position)
+        return true;
+    if(m_sized && pos > m_size)
+        return false;
+
+    // Only forward, going back starts over
+    if(pos < m_position) {
+        close();
+        if(!open())
+            return false;
+    }
+    return skip(pos - m_position);
+}
+
+bool TftpIStream::skip(size_t count) {
+    while(count) {
+        if(m_offset == m_blockSize && (m_last || !next()))
+            return false;
+
+        size_t n = std::min(count, m_blockSize - m_offset);
+        m_offset += n;
+        m_position += n;
+        count -= n;
+    }
+    return true;
+}
+
+size_t TftpIStream::available() {
+    if(m_sized)
+        return m_size - m_position;
+
+    // At least a block more until the last one is in
+    size_t left = m_blockSize - m_offset;
+    return m_last ? left : left + m_blksize;
+}
+
+size_t TftpIStream::read(uint8_t* buf, size_t size) {
+    if(!m_isOpen)
+        return 0;
+
+    size_t done = 0;
+    while(done < size) {
+        if(m_offset == m_blockSize && (m_last || !next()))
+            break;
+
+        size_t n = std::min(size - done, m_blockSize - m_offset);
+        memcpy(buf + done, m_block.get() + 4 + m_offset, n);
+        m_offset += n;
+        m_position += n;
+        done += n;
+    }
+
+    // Servers without tsize tell the size at the end
+    if(m_last && m_offset == m_blockSize && !m_sized) {
+        m_size = m_position;
+        m_sized = true;
+        m_server->put(m_path, true, m_size);
+    }
+    return done;
+}
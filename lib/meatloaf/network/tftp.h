@@ -1,3 +1,242 @@
 // TFTP:// - Trivial File Transfer Protocol
 // https://en.wikipedia.org/wiki/Trivial_File_Transfer_Protocol
+// https://www.rfc-editor.org/rfc/rfc1350
+// https://www.rfc-editor.org/rfc/rfc2347 (options)
+// https://www.rfc-editor.org/rfc/rfc2348 (blksize)
+// https://www.rfc-editor.org/rfc/rfc2349 (timeout, tsize)
+// https://www.rfc-editor.org/rfc/rfc7440 (windowsize)
 //
+// Read only, and without listings, TFTP has neither. Blocks as large as
+// fit in one unfragmented datagram are asked for, and a window of them
+// is sent before the server waits for an ACK, so the next window is on
+// its way while this one is read. Servers that refuse the options get
+// the plain 512 bytes a time of RFC 1350.
+//
+// A lost block is noticed by the gap in the numbers or by the timeout,
+// which comes from the round trips measured to that server so far. The
+// last block received in order is ACKed again, and the server goes on
+// from there.
+
+#ifndef MEATFILESYSTEM_SCHEME_TFTP
+#define MEATFILESYSTEM_SCHEME_TFTP
+
+#include "../../include/global_defines.h"
+#include "meat_io.h"
+
+#if defined(ESP32)
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#endif
+#include <WiFiUdp.h>
+
+#include <list>
+
+#define TFTP_PORT           69
+#define TFTP_BLOCK          512     // without options
+#if defined(ESP32)
+#define TFTP_BLKSIZE        1468    // 1500 MTU less the IP, UDP and TFTP headers
+#define TFTP_WINDOW         4       // fits the UDP receive queue of lwIP
+#else
+#define TFTP_BLKSIZE        1024
+#define TFTP_WINDOW         2
+#endif
+#define TFTP_SERVERS        4       // whose round trips and sizes are remembered
+#define TFTP_SIZES          16      // files per server
+#define TFTP_SIZE_TTL       30000   // ms
+#define TFTP_RETRIES        6
+#define TFTP_RTO_MIN        10      // ms
+#define TFTP_RTO_MAX        2000
+
+// Opcodes
+#define TFTP_RRQ            1
+#define TFTP_DATA           3
+#define TFTP_ACK            4
+#define TFTP_ERROR          5
+#define TFTP_OACK           6
+
+// Errors
+#define TFTP_NOT_FOUND      1
+#define TFTP_BAD_OPTIONS    8
+
+
+/********************************************************
+ * Servers
+ ********************************************************/
+
+// What was learned about a server, kept for the next transfer from it
+class TftpServer {
+public:
+    static std::shared_ptr<TftpServer> get(const std::string &host, uint16_t port);
+
+    IPAddress address(void) { return m_address; };
+    uint16_t port(void) { return m_port; };
+
+    // Retransmission timeout from the round trips measured so far
+    uint32_t timeout(void) { return m_rto; };
+    void measured(uint32_t rtt);
+    void backoff(void);
+
+    bool options = true;    // until the server refuses them
+
+    // Sizes told by tsize or by the end of a transfer, false when unknown
+    bool size(const std::string &path, bool &exists, size_t &size);
+    void put(const std::string &path, bool exists, size_t size);
+
+private:
+    std::string m_host;
+    uint16_t m_port;
+    IPAddress m_address;
+
+    // RFC 6298 estimator, in ms
+    bool m_measured = false;
+    uint32_t m_srtt = 0;
+    uint32_t m_rttvar = 0;
+    uint32_t m_rto = 500;
+
+    struct Size {
+        std::string path;
+        bool exists;
+        size_t size;
+        uint32_t stamp;
+    };
+    std::list<Size> m_sizes;    // most recent first
+
+    static std::list<std::shared_ptr<TftpServer>> m_servers;    // most recently used first
+};
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+class TftpFile: public MFile
+{
+public:
+    TftpFile(std::string path): MFile(path) {};
+
+    MIStream* createIStream(std::shared_ptr<MIStream> src) { return src.get(); };
+    MIStream* inputStream() override ; // has to return OPENED stream
+    MOStream* outputStream() override { return nullptr; };
+
+    bool isDirectory() override { return false; };
+    bool rewindDirectory() override { return false; };
+    MFile* getNextFileInDir() override { return nullptr; };
+    bool mkDir() override { return false; };
+
+    bool exists() override;
+    bool remove() override { return false; };
+    bool rename(std::string dest) { return false; };
+    time_t getLastWrite() override { return 0; };
+    time_t getCreationTime() override { return 0; };
+    size_t size() override;
+
+private:
+    // From tsize, asked for by starting a transfer
+    bool m_statted = false;
+    bool m_exists = false;
+    size_t m_size = 0;
+    bool stat(void);
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+class TftpIStream: public MIStream {
+public:
+    // Block size and window asked for, the server may answer with less
+    TftpIStream(std::string path, size_t blksize = TFTP_BLKSIZE, size_t window = TFTP_WINDOW) {
+        url = path;
+        m_blksizeWanted = blksize;
+        m_windowWanted = window;
+    }
+    ~TftpIStream() {
+        close();
+    }
+
+    // MStream methods
+    size_t position() override { return m_position; };
+    void close() override;
+    bool open() override;
+    bool isOpen() override { return m_isOpen; };
+
+    // MIStream methods
+    bool seek(size_t pos) override;
+    size_t available() override;
+    size_t size() override { return m_size; };
+    size_t read(uint8_t* buf, size_t size) override;
+
+    // Without tsize the size is known once the last block is in
+    bool sized(void) { return m_sized; };
+    bool missing(void) { return m_missing; };
+
+    // What the server agreed to, and how the transfer went
+    size_t blksize(void) { return m_blksize; };
+    size_t window(void) { return m_window; };
+    uint32_t retransmits = 0;
+
+protected:
+    std::string url;
+    bool m_isOpen = false;
+    size_t m_size = 0;
+    bool m_sized = false;
+    bool m_missing = false;
+    size_t m_position = 0;
+
+    std::shared_ptr<TftpServer> m_server;
+    std::string m_path;
+    WiFiUDP m_udp;
+    uint16_t m_tid = 0;         // the server's port for this transfer
+
+    size_t m_blksizeWanted;
+    size_t m_windowWanted;
+    size_t m_blksize = TFTP_BLOCK;
+    size_t m_window = 1;
+
+    // The last block received in order
+    std::unique_ptr<uint8_t[]> m_packet;   // the one received last
+    size_t m_received = 0;
+    std::unique_ptr<uint8_t[]> m_block;
+    size_t m_blockSize = 0;
+    size_t m_offset = 0;
+    uint16_t m_number = 0;
+    size_t m_unacked = 0;       // blocks since the last ACK
+    bool m_last = false;
+    bool m_gap = false;         // ACKed again for a lost block
+
+    // When the last ACK went, and whether it went more than once
+    uint32_t m_acked = 0;
+    bool m_repeated = false;
+    uint32_t m_since = 0;       // the last ACK or block, for the timeout
+
+    bool request(void);
+    bool next(void);
+    int receive(void);
+    void ack(uint16_t number);
+    void abort(void);
+    bool skip(size_t count);
+};
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class TftpFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new TftpFile(path);
+    }
+
+    bool handles(std::string name) {
+        std::string pattern = "tftp:";
+        return mstr::equals(name, pattern, false);
+    }
+public:
+    TftpFileSystem(): MFileSystem("tftp") {};
+};
+
+
+#endif /* MEATFILESYSTEM_SCHEME_TFTP */
@@ -0,0 +1,593 @@
+#include "tnfs.h"
+
+// Numbers are little endian on the wire
+static uint16_t tnfs16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t tnfs32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Paths from the url come without the leading slash the server wants
+static std::string tnfsPath(const std::string &path) {
+    return mstr::startsWith(path, "/") ? path : "/" + path;
+}
+
+
+/********************************************************
+ * Session
+ ********************************************************/
+
+std::list<std::shared_ptr<TnfsSession>> TnfsSession::m_sessions;
+
+std::shared_ptr<TnfsSession> TnfsSession::get(const std::string &host, uint16_t port) {
+    for(auto it = m_sessions.begin(); it != m_sessions.end(); it++) {
+        if((*it)->m_host != host || (*it)->m_port != port)
+            continue;
+
+        m_sessions.splice(m_sessions.begin(), m_sessions, it);
+        auto session = m_sessions.front();
+        if(!session->m_mounted && !session->mount())
+            return nullptr;
+        return session;
+    }
+
+    std::shared_ptr<TnfsSession> session(new TnfsSession());
+    session->m_host = host;
+    session->m_port = port;
+    if(!WiFi.hostByName(host.c_str(), session->m_address))
+        return nullptr;
+    session->m_udp.begin(0);
+    if(!session->mount())
+        return nullptr;
+
+    // Streams still using an older one keep it until they close
+    m_sessions.push_front(session);
+    if(m_sessions.size() > TNFS_SESSIONS)
+        m_sessions.pop_back();
+    return session;
+}
+
+TnfsSession::~TnfsSession() {
+    // Nobody waits for the answer, the server drops idle sessions anyway
+    if(m_mounted)
+        send(TNFS_UMOUNT, nullptr, 0);
+    m_udp.stop();
+}
+
+bool TnfsSession::mount(void) {
+    // Version 1.2, the root of the server, no user and no password
+    const uint8_t data[] = { 0x02, 0x01, '/', 0, 0, 0 };
+    TnfsReply reply;
+
+    m_id = 0;
+    if(call(TNFS_MOUNT, data, sizeof(data), reply) != TNFS_OK)
+        return false;
+
+    m_id = reply.session;
+    if(reply.size >= 4) {
+        // The server says how soon it may be asked again
+        uint32_t retry = tnfs16(reply.data + 2);
+        m_minimum = std::max((uint32_t)TNFS_RTO_MIN, std::min(retry, (uint32_t)TNFS_RTO_MAX));
+    }
+    m_mounted = true;
+    Debug_printv("[%s:%d] session[%.4X] version[%d.%d] retry[%d]", m_host.c_str(), m_port, m_id, reply.data[1], reply.data[0], m_minimum);
+    return true;
+}
+
+bool TnfsSession::transmit(uint8_t sequence, uint8_t command, const uint8_t *data, size_t size) {
+    static uint8_t packet[TNFS_PACKET];
+    if(size + 4 > sizeof(packet))
+        return false;
+
+    packet[0] = m_id bitand 0xFF;
+    packet[1] = m_id >> 8;
+    packet[2] = sequence;
+    packet[3] = command;
+    if(size)
+        memcpy(packet + 4, data, size);
+
+    m_udp.beginPacket(m_address, m_port);
+    m_udp.write(packet, size + 4);
+    return m_udp.endPacket();
+}
+
+uint8_t TnfsSession::send(uint8_t command, const uint8_t *data, size_t size) {
+    uint8_t sequence = m_sequence++;
+    transmit(sequence, command, data, size);
+    return sequence;
+}
+
+bool TnfsSession::receive(TnfsReply &reply) {
+    static uint8_t packet[TNFS_PACKET + 5];
+    if(m_udp.parsePacket() <= 0)
+        return false;
+
+    size_t size = m_udp.read(packet, sizeof(packet));
+    if(size < 5 || m_udp.remotePort() != m_port)
+        return false;
+
+    reply.session = tnfs16(packet);
+    reply.sequence = packet[2];
+    reply.command = packet[3];
+    reply.status = packet[4];
+    reply.size = size - 5;
+    memcpy(reply.data, packet + 5, reply.size);
+
+    // Only a mount tells which session it is for
+    return reply.command == TNFS_MOUNT || reply.session == m_id;
+}
+
+uint8_t TnfsSession::call(uint8_t command, const uint8_t *data, size_t size, TnfsReply &reply) {
+    uint8_t sequence = m_sequence++;
+
+    // The same sequence number each time, the server answers a repeat
+    // of its last request without doing it again
+    for(int tries = 0; tries < TNFS_RETRIES; tries++) {
+        uint32_t sent = millis();
+        if(!transmit(sequence, command, data, size))
+            break;
+
+        while(millis() - sent < m_rto) {
+            if(!receive(reply)) {
+                delay(1);
+                continue;
+            }
+            if(reply.sequence != sequence || reply.command != command)
+                continue;   // late answer to something before
+
+            // Only first tries are measured, an answer to a repeat could be to either
+            if(tries == 0)
+                measured(millis() - sent);
+            return reply.status;
+        }
+        backoff();
+    }
+
+    Debug_printv("[%s:%d] command[%.2X] no answer", m_host.c_str(), m_port, command);
+    m_mounted = false;  // mount again next time
+    return TNFS_TIMEOUT;
+}
+
+void TnfsSession::measured(uint32_t rtt) {
+    if(!m_measured) {
+        m_measured = true;
+        m_srtt = rtt;
+        m_rttvar = rtt / 2;
+    }
+    else {
+        uint32_t delta = (m_srtt > rtt) ? m_srtt - rtt : rtt - m_srtt;
+        m_rttvar = (3 * m_rttvar + delta) / 4;
+        m_srtt = (7 * m_srtt + rtt) / 8;
+    }
+
+    m_rto = m_srtt + std::max((uint32_t)1, 4 * m_rttvar);
+    m_rto = std::max(m_minimum, std::min(m_rto, (uint32_t)TNFS_RTO_MAX));
+}
+
+void TnfsSession::backoff(void) {
+    m_rto = std::min(m_rto * 2, (uint32_t)TNFS_RTO_MAX);
+}
+
+
+/********************************************************
+ * File impls
+ ********************************************************/
+
+std::shared_ptr<TnfsSession> TnfsFile::session(void) {
+    return TnfsSession::get(host, port.size() ? atoi(port.c_str()) : TNFS_PORT);
+}
+
+MIStream* TnfsFile::inputStream() {
+    // has to return OPENED stream
+    MIStream* istream = new TnfsIStream(url);
+    istream->open();
+    return istream;
+}
+
+bool TnfsFile::stat(void) {
+    if(m_statted)
+        return m_exists;
+
+    auto s = session();
+    if(s == nullptr)
+        return false;
+
+    std::string p = tnfsPath(path);
+    TnfsReply reply;
+    uint8_t status = s->call(TNFS_STAT, (const uint8_t *)p.c_str(), p.size() + 1, reply);
+
+    // mode, uid, gid, size, atime, mtime, ctime
+    m_statted = (status != TNFS_TIMEOUT);
+    m_exists = (status == TNFS_OK && reply.size >= 22);
+    if(m_exists) {
+        m_dir = (tnfs16(reply.data) bitand 0170000) == 0040000;
+        m_size = tnfs32(reply.data + 6);
+        m_mtime = tnfs32(reply.data + 14);
+        m_ctime = tnfs32(reply.data + 18);
+    }
+    return m_exists;
+}
+
+bool TnfsFile::isDirectory() {
+    return stat() && m_dir;
+}
+
+bool TnfsFile::exists() {
+    return stat();
+}
+
+size_t TnfsFile::size() {
+    return stat() ? m_size : 0;
+}
+
+time_t TnfsFile::getLastWrite() {
+    return stat() ? m_mtime : 0;
+}
+
+time_t TnfsFile::getCreationTime() {
+    return stat() ? m_ctime : 0;
+}
+
+bool TnfsFile::mkDir() {
+    auto s = session();
+    if(s == nullptr)
+        return false;
+
+    TnfsReply reply;
+    m_statted = false;
+    std::string p = tnfsPath(path);
+    return s->call(TNFS_MKDIR, (const uint8_t *)p.c_str(), p.size() + 1, reply) == TNFS_OK;
+}
+
+bool TnfsFile::remove() {
+    auto s = session();
+    if(s == nullptr)
+        return false;
+
+    TnfsReply reply;
+    uint8_t command = isDirectory() ? TNFS_RMDIR : TNFS_UNLINK;
+    m_statted = false;
+    std::string p = tnfsPath(path);
+    return s->call(command, (const uint8_t *)p.c_str(), p.size() + 1, reply) == TNFS_OK;
+}
+
+bool TnfsFile::rename(std::string dest) {
+    auto s = session();
+    if(s == nullptr || dest.empty())
+        return false;
+
+    // Only within this server
+    if(dest.find("://") != std::string::npos) {
+        PeoplesUrlParser parser;
+        parser.parseUrl(dest);
+        dest = parser.path;
+    }
+
+    std::string data = tnfsPath(path);
+    data.push_back('\0');
+    data += tnfsPath(dest);
+    data.push_back('\0');
+
+    TnfsReply reply;
+    m_statted = false;
+    return s->call(TNFS_RENAME, (const uint8_t *)data.data(), data.size(), reply) == TNFS_OK;
+}
+
+bool TnfsFile::rewindDirectory() {
+    closeDir();
+    m_entries.clear();
+    m_dirEnd = false;
+
+    auto s = session();
+    if(s == nullptr)
+        return false;
+
+    // Folders first and sorted, hidden and special files skipped, no pattern
+    std::string data("\0\0\0\0\0", 5);
+    data += tnfsPath(path);
+    data.push_back('\0');
+
+    TnfsReply reply;
+    if(s->call(TNFS_OPENDIRX, (const uint8_t *)data.data(), data.size(), reply) != TNFS_OK || reply.size < 1)
+        return false;
+
+    m_dirHandle = reply.data[0];
+    m_dirOpen = true;
+    return true;
+}
+
+// As many entries as fit into one answer
+bool TnfsFile::readDir(void) {
+    auto s = session();
+    if(s == nullptr)
+        return false;
+
+    const uint8_t data[] = { m_dirHandle, 0 };
+    TnfsReply reply;
+    uint8_t status = s->call(TNFS_READDIRX, data, sizeof(data), reply);
+    if(status != TNFS_OK || reply.size < 4) {
+        m_dirEnd = true;
+        return false;
+    }
+
+    // count, status, position, then flags, size, mtime, ctime, name
+    uint8_t count = reply.data[0];
+    m_dirEnd = (count == 0) || (reply.data[1] bitand 0x01);
+
+    size_t i = 4;
+    while(count-- && i + 13 < reply.size) {
+        Entry entry;
+        entry.dir = reply.data[i] bitand 0x01;
+        entry.size = tnfs32(reply.data + i + 1);
+        entry.mtime = tnfs32(reply.data + i + 5);
+        entry.ctime = tnfs32(reply.data + i + 9);
+        i += 13;
+
+        const char *name = (const char *)reply.data + i;
+        size_t length = strnlen(name, reply.size - i);
+        entry.name.assign(name, length);
+        i += length + 1;
+
+        if(entry.name != "." && entry.name != "..")
+            m_entries.push_back(entry);
+    }
+    return true;
+}
+
+void TnfsFile::closeDir(void) {
+    if(!m_dirOpen)
+        return;
+    m_dirOpen = false;
+
+    auto s = session();
+    if(s == nullptr)
+        return;
+
+    TnfsReply reply;
+    s->call(TNFS_CLOSEDIR, &m_dirHandle, 1, reply);
+}
+
+MFile* TnfsFile::getNextFileInDir() {
+    if(!m_dirOpen && !rewindDirectory())
+        return nullptr;
+
+    if(m_entries.empty() && !m_dirEnd)
+        readDir();
+
+    if(m_entries.empty()) {
+        closeDir();
+        return nullptr;
+    }
+
+    // The listing already told all STAT would
+    Entry entry = m_entries.front();
+    m_entries.pop_front();
+
+    auto file = new TnfsFile(url + (mstr::endsWith(url, "/") ? "" : "/") + entry.name);
+    file->m_statted = true;
+    file->m_exists = true;
+    file->m_dir = entry.dir;
+    file->m_size = entry.size;
+    file->m_mtime = entry.mtime;
+    file->m_ctime = entry.ctime;
+    return file;
+}
+
+
+/********************************************************
+ * Istream impls
+ ********************************************************/
+
+bool TnfsIStream::open() {
+    PeoplesUrlParser parser;
+    parser.parseUrl(url);
+    m_path = tnfsPath(parser.path);
+
+    m_session = TnfsSession::get(parser.host, parser.port.size() ? atoi(parser.port.c_str()) : TNFS_PORT);
+    if(m_session == nullptr)
+        return false;
+
+    TnfsReply reply;
+    if(m_session->call(TNFS_STAT, (const uint8_t *)m_path.c_str(), m_path.size() + 1, reply) != TNFS_OK || reply.size < 22)
+        return false;
+    m_size = tnfs32(reply.data + 6);
+
+    // The handles for more reads in flight are opened once they are needed
+    if(!openHandle())
+        return false;
+
+    m_position = 0;
+    m_isOpen = true;
+    Debug_printv("[%s] size[%d]", url.c_str(), m_size);
+    return true;
+}
+
+bool TnfsIStream::openHandle(void) {
+    if(m_opened == TNFS_WINDOW)
+        return false;
+
+    // Read only, no permissions to create with
+    std::string data("\x01\0\0\0", 4);
+    data += m_path;
+    data.push_back('\0');
+
+    TnfsReply reply;
+    if(m_session->call(TNFS_OPEN, (const uint8_t *)data.data(), data.size(), reply) != TNFS_OK || reply.size < 1)
+        return false;
+
+    m_handles[m_opened++] = reply.data[0];
+    return true;
+}
+
+void TnfsIStream::close() {
+    TnfsReply reply;
+    for(size_t i = 0; i < m_opened; i++)
+        m_session->call(TNFS_CLOSE, &m_handles[i], 1, reply);
+    m_opened = 0;
+
+    m_session.reset();
+    m_blocks.clear();
+    m_isOpen = false;
+}
+
+bool TnfsIStream::seek(size_t pos) {
+    if(pos > m_size)
+        return false;
+    m_position = pos;
+    return true;
+}
+
+size_t TnfsIStream::read(uint8_t* buf, size_t size) {
+    if(!m_isOpen)
+        return 0;
+    if(size > available())
+        size = available();
+
+    size_t done = 0;
+    while(done < size) {
+        size_t offset = m_position % TNFS_BLOCK;
+        Block* b = block(m_position / TNFS_BLOCK);
+        if(b == nullptr || offset >= b->size)
+            break;
+
+        size_t n = std::min(b->size - offset, size - done);
+        memcpy(buf + done, b->data.get() + offset, n);
+        done += n;
+        m_position += n;
+    }
+    return done;
+}
+
+bool TnfsIStream::cached(size_t index) {
+    for(auto &block : m_blocks) {
+        if(block.index == index)
+            return true;
+    }
+    return false;
+}
+
+TnfsIStream::Block* TnfsIStream::block(size_t index) {
+    for(int attempt = 0; attempt < 2; attempt++) {
+        for(auto it = m_blocks.begin(); it != m_blocks.end(); it++) {
+            if(it->index == index) {
+                m_blocks.splice(m_blocks.begin(), m_blocks, it);
+                return &m_blocks.front();
+            }
+        }
+
+        if(attempt)
+            break;
+
+        // The blocks after it too, up to the first one cached
+        size_t count = 1;
+        while(count < TNFS_WINDOW && (index + count) * TNFS_BLOCK < m_size && !cached(index + count))
+            count++;
+
+        if(!fetch(index, count))
+            return nullptr;
+    }
+    return nullptr;
+}
+
+// Every block with its own handle, a seek and a read are sent together
+bool TnfsIStream::fetch(size_t index, size_t count) {
+    while(m_opened < count && openHandle())
+        ;
+    count = std::min(count, m_opened);
+    if(count == 0)
+        return false;
+
+    struct Slot {
+        uint8_t handle;
+        size_t index;
+        uint8_t seek;       // sequence numbers
+        uint8_t read;
+        bool sought;
+        bool done;
+        bool repeated;
+        uint8_t tries;
+        uint32_t sent;
+    } slots[TNFS_WINDOW];
+
+    auto request = [this](Slot &slot) {
+        uint32_t offset = slot.index * TNFS_BLOCK;
+        const uint8_t seek[] = { slot.handle, 0x00, (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16), (uint8_t)(offset >> 24) };
+        const uint8_t read[] = { slot.handle, TNFS_BLOCK bitand 0xFF, TNFS_BLOCK >> 8 };
+        slot.seek = m_session->send(TNFS_LSEEK, seek, sizeof(seek));
+        slot.read = m_session->send(TNFS_READ, read, sizeof(read));
+        slot.sought = false;
+        slot.sent = millis();
+    };
+
+    for(size_t i = 0; i < count; i++) {
+        slots[i] = { m_handles[i], index + i, 0, 0, false, false, false, 0, 0 };
+        request(slots[i]);
+    }
+
+    static TnfsReply reply;
+    size_t left = count;
+    while(left) {
+        if(m_session->receive(reply)) {
+            for(size_t i = 0; i < count; i++) {
+                Slot &slot = slots[i];
+                if(slot.done)
+                    continue;
+
+                if(reply.command == TNFS_LSEEK && reply.sequence == slot.seek) {
+                    slot.sought = (reply.status == TNFS_OK);
+                    break;
+                }
+
+                // A read answered before its seek may have read anywhere, it waits to be sent again
+                if(reply.command != TNFS_READ || reply.sequence != slot.read || !slot.sought)
+                    continue;
+
+                if(reply.status != TNFS_OK && reply.status != TNFS_EOF)
+                    return false;
+
+                size_t size = (reply.status == TNFS_OK && reply.size >= 2) ? tnfs16(reply.data) : 0;
+                size = std::min(size, std::min(reply.size - 2, (size_t)TNFS_BLOCK));
+
+                // Least recently used block makes room
+                Block block;
+                if(m_blocks.size() >= TNFS_BLOCKS) {
+                    block = std::move(m_blocks.back());
+                    m_blocks.pop_back();
+                }
+                else
+                    block.data.reset(new uint8_t[TNFS_BLOCK]);
+                block.index = slot.index;
+                block.size = size;
+                memcpy(block.data.get(), reply.data + 2, size);
+                m_blocks.push_front(std::move(block));
+
+                if(!slot.repeated)
+                    m_session->measured(millis() - slot.sent);
+                slot.done = true;
+                left--;
+                break;
+            }
+            continue;
+        }
+
+        // Lost on the way there or back, the pair goes again with new numbers
+        uint32_t now = millis();
+        for(size_t i = 0; i < count; i++) {
+            Slot &slot = slots[i];
+            if(slot.done || now - slot.sent < m_session->timeout())
+                continue;
+
+            if(++slot.tries > TNFS_RETRIES) {
+                Debug_printv("[%s] block[%d] no answer", url.c_str(), slot.index);
+                return false;
+            }
+            m_session->backoff();
+            slot.repeated = true;
+            request(slot);
+        }
+        delay(1);
+    }
+    return true;
+}
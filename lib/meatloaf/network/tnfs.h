@@ -2,3 +2,250 @@
 // https://www.bytedelight.com/?page_id=3515
 // https://github.com/FujiNetWIFI/spectranet/blob/master/tnfs/tnfs-protocol.md
 //
+// UDP requests, each with a sequence number the server answers with. A
+// request sent again with the same number gets the last answer again, so
+// only the last request may be retried as it is. Reads are pipelined over
+// several handles of the same file, each read is a seek and a read, and
+// that pair is simply sent again with new numbers when an answer is lost.
+
+#ifndef MEATFILESYSTEM_SCHEME_TNFS
+#define MEATFILESYSTEM_SCHEME_TNFS
+
+#include "../../include/global_defines.h"
+#include "meat_io.h"
+
+#if defined(ESP32)
+#include <WiFi.h>
+#elif defined(ESP8266)
+#include <ESP8266WiFi.h>
+#endif
+#include <WiFiUdp.h>
+
+#include <list>
+
+#define TNFS_PORT           16384
+#define TNFS_PACKET         532     // largest datagram either side sends
+#define TNFS_BLOCK          512     // largest read every server answers
+#if defined(ESP32)
+#define TNFS_WINDOW         4       // reads in flight per stream
+#define TNFS_BLOCKS         16      // blocks cached per stream
+#else
+#define TNFS_WINDOW         2
+#define TNFS_BLOCKS         4
+#endif
+#define TNFS_SESSIONS       2       // servers kept mounted
+#define TNFS_RETRIES        5
+#define TNFS_RTO_MIN        20      // ms
+#define TNFS_RTO_MAX        2000
+
+// Commands
+#define TNFS_MOUNT          0x00
+#define TNFS_UMOUNT         0x01
+#define TNFS_CLOSEDIR       0x12
+#define TNFS_MKDIR          0x13
+#define TNFS_RMDIR          0x14
+#define TNFS_OPENDIRX       0x17
+#define TNFS_READDIRX       0x18
+#define TNFS_READ           0x21
+#define TNFS_CLOSE          0x23
+#define TNFS_STAT           0x24
+#define TNFS_LSEEK          0x25
+#define TNFS_UNLINK         0x26
+#define TNFS_RENAME         0x28
+#define TNFS_OPEN           0x29
+
+// Status
+#define TNFS_OK             0x00
+#define TNFS_ENOENT         0x02
+#define TNFS_EMFILE         0x10
+#define TNFS_ENOSYS         0x16
+#define TNFS_EOF            0x21
+#define TNFS_TIMEOUT        0xFF    // ours, no answer came
+
+struct TnfsReply {
+    uint16_t session;
+    uint8_t sequence;
+    uint8_t command;
+    uint8_t status;
+    uint8_t data[TNFS_PACKET];
+    size_t size;
+};
+
+
+/********************************************************
+ * Session
+ ********************************************************/
+
+// One mount of a server, kept for every file on it
+class TnfsSession {
+public:
+    // Mounted, or nullptr when the server doesn't answer
+    static std::shared_ptr<TnfsSession> get(const std::string &host, uint16_t port);
+
+    // Sends a request until its answer comes, the status is returned
+    uint8_t call(uint8_t command, const uint8_t *data, size_t size, TnfsReply &reply);
+
+    // For requests in flight at the same time
+    uint8_t send(uint8_t command, const uint8_t *data, size_t size);
+    bool receive(TnfsReply &reply);
+
+    // Retransmission timeout from the round trips measured so far
+    uint32_t timeout(void) { return m_rto; };
+    void measured(uint32_t rtt);
+    void backoff(void);
+
+    bool mounted(void) { return m_mounted; };
+
+    ~TnfsSession();
+
+private:
+    std::string m_host;
+    uint16_t m_port;
+    IPAddress m_address;
+    WiFiUDP m_udp;
+
+    bool m_mounted = false;
+    uint16_t m_id = 0;
+    uint8_t m_sequence = 0;
+
+    // RFC 6298 estimator, in ms
+    bool m_measured = false;
+    uint32_t m_srtt = 0;
+    uint32_t m_rttvar = 0;
+    uint32_t m_rto = 500;
+    uint32_t m_minimum = TNFS_RTO_MIN;
+
+    bool mount(void);
+    bool transmit(uint8_t sequence, uint8_t command, const uint8_t *data, size_t size);
+
+    static std::list<std::shared_ptr<TnfsSession>> m_sessions;    // most recently used first
+};
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+class TnfsFile: public MFile
+{
+public:
+    TnfsFile(std::string path): MFile(path) {};
+    ~TnfsFile() {
+        closeDir();
+    }
+
+    MIStream* createIStream(std::shared_ptr<MIStream> src) { return src.get(); };
+    MIStream* inputStream() override ; // has to return OPENED stream
+    MOStream* outputStream() override { return nullptr; };
+
+    bool isDirectory() override;
+    bool rewindDirectory() override;
+    MFile* getNextFileInDir() override;
+    bool mkDir() override;
+
+    bool exists() override;
+    bool remove() override;
+    bool rename(std::string dest);
+    time_t getLastWrite() override;
+    time_t getCreationTime() override;
+    size_t size() override;
+
+private:
+    // From STAT, or from the listing this file came from
+    bool m_statted = false;
+    bool m_exists = false;
+    bool m_dir = false;
+    size_t m_size = 0;
+    time_t m_mtime = 0;
+    time_t m_ctime = 0;
+    bool stat(void);
+
+    // Listing, a batch of entries per READDIRX
+    struct Entry {
+        std::string name;
+        bool dir;
+        size_t size;
+        time_t mtime;
+        time_t ctime;
+    };
+    std::list<Entry> m_entries;
+    bool m_dirOpen = false;
+    bool m_dirEnd = false;
+    uint8_t m_dirHandle = 0;
+    bool readDir(void);
+    void closeDir(void);
+
+    std::shared_ptr<TnfsSession> session(void);
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+class TnfsIStream: public MIStream {
+public:
+    TnfsIStream(std::string path) {
+        url = path;
+    }
+    ~TnfsIStream() {
+        close();
+    }
+
+    // MStream methods
+    size_t position() override { return m_position; };
+    void close() override;
+    bool open() override;
+    bool isOpen() override { return m_isOpen; };
+
+    // MIStream methods
+    bool seek(size_t pos) override;
+    size_t available() override { return m_size - m_position; };
+    size_t size() override { return m_size; };
+    size_t read(uint8_t* buf, size_t size) override;
+
+protected:
+    std::string url;
+    bool m_isOpen = false;
+    size_t m_size = 0;
+    size_t m_position = 0;
+
+    std::shared_ptr<TnfsSession> m_session;
+    std::string m_path;
+    uint8_t m_handles[TNFS_WINDOW];     // the file opened once per read in flight
+    size_t m_opened = 0;
+    bool openHandle(void);
+
+    struct Block {
+        size_t index;
+        size_t size;
+        std::unique_ptr<uint8_t[]> data;
+    };
+    std::list<Block> m_blocks;  // most recently used first
+
+    Block* block(size_t index);
+    bool cached(size_t index);
+    bool fetch(size_t index, size_t count);
+};
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class TnfsFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new TnfsFile(path);
+    }
+
+    bool handles(std::string name) {
+        std::string pattern = "tnfs:";
+        return mstr::equals(name, pattern, false);
+    }
+public:
+    TnfsFileSystem(): MFileSystem("tnfs") {};
+};
+
+
+#endif /* MEATFILESYSTEM_SCHEME_TNFS */
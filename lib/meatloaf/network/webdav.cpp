@@ -0,0 +1,528 @@
+#include "webdav.h"
+
+#include <algorithm>
+#include "tinyxml2.h"
+
+// Percent encoded, except for the slashes between names
+static std::string davEncode(const std::string &path) {
+    std::string encoded;
+    char hex[4];
+    for(unsigned char c : path) {
+        if(isalnum(c) || (c && strchr("/-_.~!$&'()*+,;=:@", c)))
+            encoded += c;
+        else {
+            snprintf(hex, sizeof(hex), "%%%02X", c);
+            encoded += hex;
+        }
+    }
+    return encoded;
+}
+
+// Unlike a query, a '+' in a path is a '+'
+static std::string davDecode(const std::string &path) {
+    std::string decoded;
+    for(size_t i = 0; i < path.size(); i++) {
+        if(path[i] == '%' && i + 2 < path.size() && isxdigit(path[i + 1]) && isxdigit(path[i + 2])) {
+            decoded += (char)strtol(path.substr(i + 1, 2).c_str(), nullptr, 16);
+            i += 2;
+        }
+        else
+            decoded += path[i];
+    }
+    return decoded;
+}
+
+// Seconds since 1970 of a UTC date
+static time_t davTime(int year, int month, int day, int hour, int minute, int second) {
+    year -= (month <= 2);
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int yoe = year - era * 400;
+    int doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = (long)era * 146097 + doe - 719468;
+    return days * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+// Tue, 13 Oct 2015 17:07:35 GMT or 2015-10-13T17:07:35Z
+static time_t davDate(const char *text) {
+    int y, mo, d, h, mi, s;
+    char month[4];
+    if(sscanf(text, "%d-%d-%dT%d:%d:%d", &y, &mo, &d, &h, &mi, &s) == 6)
+        return davTime(y, mo, d, h, mi, s);
+
+    const char *comma = strchr(text, ',');
+    if(comma != nullptr && sscanf(comma + 1, "%d %3s %d %d:%d:%d", &d, month, &y, &h, &mi, &s) == 6) {
+        const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+        const char *found = strstr(months, month);
+        if(found != nullptr)
+            return davTime(y, (found - months) / 3 + 1, d, h, mi, s);
+    }
+    return 0;
+}
+
+// Element names come with whatever prefix the server gave DAV:
+static const char* davLocal(const char *name) {
+    const char *colon = strchr(name, ':');
+    return colon ? colon + 1 : name;
+}
+
+static tinyxml2::XMLElement* davChild(tinyxml2::XMLElement *parent, const char *name) {
+    if(parent == nullptr)
+        return nullptr;
+    for(auto child = parent->FirstChildElement(); child != nullptr; child = child->NextSiblingElement()) {
+        if(strcmp(davLocal(child->Name()), name) == 0)
+            return child;
+    }
+    return nullptr;
+}
+
+// /dir/name from an href, which may also be a whole url
+static std::string davHref(const std::string &href) {
+    std::string path = href;
+    size_t scheme = path.find("://");
+    if(scheme != std::string::npos) {
+        size_t slash = path.find('/', scheme + 3);
+        path = (slash == std::string::npos) ? "/" : path.substr(slash);
+    }
+    path = davDecode(path);
+    while(path.size() > 1 && mstr::endsWith(path, "/"))
+        path.pop_back();
+    return path;
+}
+
+
+/********************************************************
+ * PROPFIND answers
+ ********************************************************/
+
+// Takes the multistatus answer as it comes in, from the HTTP client that
+// also takes the chunks apart, and parses each <response> as soon as its
+// end is in
+class WebdavParser: public Stream {
+public:
+    WebdavParser(const std::string &dir, std::vector<WebdavEntry> &entries): m_entries(entries) {
+        m_dir = davHref(dir);
+    }
+
+    size_t write(uint8_t c) override {
+        return write(&c, 1);
+    }
+
+    size_t write(const uint8_t *buf, size_t size) override {
+        if(m_failed)
+            return 0;
+
+        m_buffer.append((const char *)buf, size);
+        while(true) {
+            size_t end = find(0, true);
+            if(end == std::string::npos)
+                break;
+            end = m_buffer.find('>', end);
+            if(end == std::string::npos)
+                break;
+
+            size_t start = find(0, false);
+            if(start != std::string::npos && start < end)
+                parse(m_buffer.c_str() + start, end + 1 - start);
+            m_buffer.erase(0, end + 1);
+        }
+
+        // Only what may be the start of the next one is kept
+        size_t start = find(0, false);
+        if(start == std::string::npos) {
+            size_t tag = m_buffer.rfind('<');
+            m_buffer.erase(0, (tag == std::string::npos) ? m_buffer.size() : tag);
+        }
+        else
+            m_buffer.erase(0, start);
+
+        if(m_buffer.size() > WEBDAV_RESPONSE_SIZE) {
+            Debug_printv("response too large in [%s]", m_dir.c_str());
+            m_failed = true;
+            return 0;
+        }
+        return size;
+    }
+
+    int available() override { return 0; };
+    int read() override { return -1; };
+    int peek() override { return -1; };
+    void flush() override {};
+
+    bool failed() { return m_failed; };
+
+private:
+    std::string m_dir;
+    std::vector<WebdavEntry> &m_entries;
+    std::string m_buffer;
+    bool m_failed = false;
+    tinyxml2::XMLDocument m_document;
+
+    // The next complete <response> or </response> tag, with any prefix
+    size_t find(size_t from, bool closing) {
+        while((from = m_buffer.find('<', from)) != std::string::npos) {
+            size_t name = from + 1;
+            if(name < m_buffer.size() && m_buffer[name] == '/') {
+                if(!closing) {
+                    from++;
+                    continue;
+                }
+                name++;
+            }
+            else if(closing) {
+                from++;
+                continue;
+            }
+
+            size_t end = m_buffer.find_first_of(" \t\r\n/>", name);
+            if(end == std::string::npos)
+                return std::string::npos;
+
+            std::string tag = m_buffer.substr(name, end - name);
+            if(strcmp(davLocal(tag.c_str()), "response") == 0)
+                return from;
+            from++;
+        }
+        return std::string::npos;
+    }
+
+    void parse(const char *xml, size_t size) {
+        if(m_document.Parse(xml, size) != tinyxml2::XML_SUCCESS)
+            return;
+
+        auto response = m_document.RootElement();
+        auto href = davChild(response, "href");
+        if(href == nullptr || href->GetText() == nullptr)
+            return;
+
+        // The directory itself comes too
+        std::string path = davHref(href->GetText());
+        if(path == m_dir)
+            return;
+
+        WebdavEntry entry;
+        entry.name = path.substr(path.rfind('/') + 1);
+        if(entry.name.empty())
+            return;
+
+        // Only the properties the server has, a propstat with 404 has the others
+        bool found = false;
+        for(auto propstat = response->FirstChildElement(); propstat != nullptr; propstat = propstat->NextSiblingElement()) {
+            if(strcmp(davLocal(propstat->Name()), "propstat") != 0)
+                continue;
+
+            auto status = davChild(propstat, "status");
+            if(status == nullptr || status->GetText() == nullptr || strstr(status->GetText(), " 200") == nullptr)
+                continue;
+
+            auto prop = davChild(propstat, "prop");
+            if(prop == nullptr)
+                continue;
+            found = true;
+
+            auto type = davChild(prop, "resourcetype");
+            if(type != nullptr && davChild(type, "collection") != nullptr)
+                entry.dir = true;
+
+            auto length = davChild(prop, "getcontentlength");
+            if(length != nullptr && length->GetText() != nullptr)
+                entry.size = strtoul(length->GetText(), nullptr, 10);
+
+            auto modified = davChild(prop, "getlastmodified");
+            if(modified != nullptr && modified->GetText() != nullptr)
+                entry.modified = davDate(modified->GetText());
+
+            auto created = davChild(prop, "creationdate");
+            if(created != nullptr && created->GetText() != nullptr)
+                entry.created = davDate(created->GetText());
+        }
+
+        if(found)
+            m_entries.push_back(entry);
+    }
+};
+
+
+/********************************************************
+ * Requests
+ ********************************************************/
+
+// Over a pooled connection, the answer to response when it is a 207.
+// Redirects are not followed, the client would turn them into GETs.
+static int davRequest(const std::string &url, const char *method, const std::string &depth, const std::string &destination, const char *body, Stream *response) {
+    WiFiClient plain;
+    WiFiClient* client = HttpPool::connect(url, plain);
+    if(client == nullptr)
+        return -1;
+
+    HTTPClient http;
+    http.setUserAgent(USER_AGENT);
+    http.setTimeout(10000);
+    http.setReuse(true);
+
+    if(!http.begin(*client, url.c_str())) {
+        HttpPool::disconnect(url, client, false);
+        return -1;
+    }
+
+    if(depth.size())
+        http.addHeader("Depth", depth.c_str());
+    if(destination.size()) {
+        http.addHeader("Destination", destination.c_str());
+        http.addHeader("Overwrite", "F");
+    }
+    if(body != nullptr)
+        http.addHeader("Content-Type", "application/xml; charset=utf-8");
+
+    int httpCode = http.sendRequest(method, (uint8_t *)body, body ? strlen(body) : 0);
+    Debug_printv("[%s] %s httpCode[%d]", url.c_str(), method, httpCode);
+
+    // Only a connection whose answer was read completely can be used again
+    bool reusable = (httpCode > 0 && http.getSize() == 0);
+    if(httpCode == 207 && response != nullptr)
+        reusable = http.writeToStream(response) >= 0;
+
+    http.end();
+    HttpPool::disconnect(url, client, reusable);
+    return httpCode;
+}
+
+
+/********************************************************
+ * Listings
+ ********************************************************/
+
+std::list<WebdavListings::Listing> WebdavListings::m_listings;
+uint32_t WebdavListings::hits = 0;
+uint32_t WebdavListings::misses = 0;
+
+bool WebdavListings::get(const std::string &dir, std::vector<WebdavEntry> &entries) {
+    for(auto it = m_listings.begin(); it != m_listings.end(); it++) {
+        if(it->dir != dir)
+            continue;
+
+        if(millis() - it->stamp < WEBDAV_LISTING_TTL) {
+            m_listings.splice(m_listings.begin(), m_listings, it);
+            entries = m_listings.front().entries;
+            hits++;
+            return true;
+        }
+        m_listings.erase(it);
+        break;
+    }
+
+    misses++;
+    if(!propfind(dir, entries))
+        return false;
+
+    m_listings.push_front({ dir, entries, (uint32_t)millis() });
+    if(m_listings.size() > WEBDAV_LISTINGS)
+        m_listings.pop_back();
+    return true;
+}
+
+void WebdavListings::forget(const std::string &dir) {
+    m_listings.remove_if([&dir](const Listing &listing) { return listing.dir == dir; });
+}
+
+bool WebdavListings::propfind(const std::string &dir, std::vector<WebdavEntry> &entries) {
+    const char *body =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<D:propfind xmlns:D=\"DAV:\"><D:prop>"
+        "<D:resourcetype/><D:getcontentlength/><D:getlastmodified/><D:creationdate/>"
+        "</D:prop></D:propfind>";
+
+    uint32_t start = millis();
+    entries.clear();
+    PeoplesUrlParser parser;
+    parser.parseUrl(dir);
+    WebdavParser listing("/" + parser.path, entries);
+    int httpCode = davRequest(dir, "PROPFIND", "1", "", body, &listing);
+    if(httpCode != 207 || listing.failed())
+        return false;
+
+    // Folders first, then by name
+    std::sort(entries.begin(), entries.end(), [](const WebdavEntry &a, const WebdavEntry &b) {
+        if(a.dir != b.dir)
+            return a.dir;
+        return strcasecmp(a.name.c_str(), b.name.c_str()) < 0;
+    });
+
+    Debug_printv("[%s] entries[%d] in %u ms", dir.c_str(), entries.size(), millis() - start);
+    return true;
+}
+
+
+/********************************************************
+ * File impls
+ ********************************************************/
+
+// The same place over http, directories end with a slash
+std::string WebdavFile::http(bool dir) {
+    std::string p = path;
+    while(mstr::endsWith(p, "/"))
+        p.pop_back();
+    if(dir && p.size())
+        p += "/";
+
+    std::string url = mstr::endsWith(scheme, "s", false) ? "https://" : "http://";
+    if(user.size())
+        url += user + (pass.size() ? ":" + pass : "") + "@";
+    url += host;
+    if(port.size())
+        url += ":" + port;
+    return url + "/" + davEncode(p);
+}
+
+std::string WebdavFile::parent(void) {
+    std::string p = http();
+    size_t slash = p.rfind('/');
+    return p.substr(0, slash + 1);
+}
+
+// Looked up in the listing of the directory the file is in
+bool WebdavFile::stat(void) {
+    if(m_statted)
+        return m_exists;
+
+    std::string p = path;
+    while(mstr::endsWith(p, "/"))
+        p.pop_back();
+    if(p.empty()) {
+        m_statted = m_exists = m_entry.dir = true;
+        return true;
+    }
+
+    std::vector<WebdavEntry> entries;
+    if(!WebdavListings::get(parent(), entries))
+        return false;
+
+    std::string n = p.substr(p.rfind('/') + 1);
+    m_statted = true;
+    m_exists = false;
+    for(auto &entry : entries) {
+        if(entry.name == n) {
+            m_entry = entry;
+            m_exists = true;
+            break;
+        }
+    }
+    return m_exists;
+}
+
+MIStream* WebdavFile::inputStream() {
+    // has to return OPENED stream
+    MIStream* istream = new WebdavIStream(http(), size());
+    if(stat() && !m_entry.dir)
+        istream->open();
+    return istream;
+}
+
+bool WebdavFile::isDirectory() {
+    return stat() && m_entry.dir;
+}
+
+bool WebdavFile::exists() {
+    return stat();
+}
+
+size_t WebdavFile::size() {
+    return stat() ? m_entry.size : 0;
+}
+
+time_t WebdavFile::getLastWrite() {
+    return stat() ? m_entry.modified : 0;
+}
+
+time_t WebdavFile::getCreationTime() {
+    return stat() ? m_entry.created : 0;
+}
+
+bool WebdavFile::call(const char *method, const std::string &destination) {
+    bool dir = isDirectory();
+    int httpCode = davRequest(http(dir), method, "", destination, nullptr, nullptr);
+
+    WebdavListings::forget(parent());
+    if(dir)
+        WebdavListings::forget(http(true));
+    m_statted = false;
+    return httpCode >= 200 && httpCode < 300;
+}
+
+bool WebdavFile::mkDir() {
+    return call("MKCOL");
+}
+
+bool WebdavFile::remove() {
+    return call("DELETE");
+}
+
+bool WebdavFile::rename(std::string dest) {
+    if(dest.empty())
+        return false;
+
+    // Only within this server, as a whole url without the login
+    if(dest.find("://") != std::string::npos) {
+        PeoplesUrlParser parser;
+        parser.parseUrl(dest);
+        dest = parser.path;
+    }
+    while(mstr::startsWith(dest, "/"))
+        dest.erase(0, 1);
+
+    std::string destination = mstr::endsWith(scheme, "s", false) ? "https://" : "http://";
+    destination += host + (port.size() ? ":" + port : "") + "/" + davEncode(dest);
+    if(isDirectory())
+        destination += "/";
+
+    WebdavFile target(url);
+    target.path = dest;
+    WebdavListings::forget(target.parent());
+    return call("MOVE", destination);
+}
+
+bool WebdavFile::rewindDirectory() {
+    m_next = 0;
+    m_listed = WebdavListings::get(http(true), m_entries);
+    return m_listed;
+}
+
+MFile* WebdavFile::getNextFileInDir() {
+    if(!m_listed && !rewindDirectory())
+        return nullptr;
+
+    if(m_next >= m_entries.size()) {
+        m_listed = false;
+        return nullptr;
+    }
+
+    // The listing already told all there is to know
+    WebdavEntry &entry = m_entries[m_next++];
+    auto file = new WebdavFile(url + (mstr::endsWith(url, "/") ? "" : "/") + entry.name);
+    file->m_statted = true;
+    file->m_exists = true;
+    file->m_entry = entry;
+    return file;
+}
+
+
+/********************************************************
+ * Istream impls
+ ********************************************************/
+
+// Nothing is asked for until the first read, which fetches its block
+bool WebdavIStream::open() {
+    m_client = HttpPool::connect(url, m_file);
+    if(m_client == nullptr)
+        return false;
+
+    m_http.setReuse(true);
+    isFriendlySkipper = true;
+    m_ranged = true;
+    m_position = 0;
+    m_bytesAvailable = m_length;
+    m_bodyLeft = 0;
+    m_isOpen = true;
+    Debug_printv("[%s] size[%d]", url.c_str(), m_length);
+    return true;
+}
@@ -1,3 +1,149 @@
 // WEBDAV:// - Web Distributed Authoring and Versioning
 // http://www.webdav.org/specs/
+// https://www.rfc-editor.org/rfc/rfc4918
 //
+// webdav://[user:password@]server[:port]/path, or dav://, over HTTP. With
+// webdavs:// or davs:// over HTTPS. Connections come from the HTTP pool.
+//
+// A directory is listed with a single Depth: 1 PROPFIND. Its answer is
+// parsed a <response> at a time while it comes in, so the whole of it is
+// never in memory. Listings are kept for a while per directory, and files
+// in a listed directory know their size and times without asking again.
+//
+// Reads are ranged GETs of blocks from the start, with the size from the
+// listing, so images can be mounted and read anywhere without fetching
+// all of them first.
+
+#ifndef MEATFILESYSTEM_SCHEME_WEBDAV
+#define MEATFILESYSTEM_SCHEME_WEBDAV
+
+#include "../../include/global_defines.h"
+#include "meat_io.h"
+#include "http.h"
+
+#include <list>
+#include <vector>
+
+#if defined(ESP32)
+#define WEBDAV_LISTINGS         8       // directories whose listing is remembered
+#else
+#define WEBDAV_LISTINGS         3
+#endif
+#define WEBDAV_LISTING_TTL      30000   // ms
+#define WEBDAV_RESPONSE_SIZE    4096    // largest <response> of a listing
+
+
+struct WebdavEntry {
+    std::string name;
+    bool dir = false;
+    size_t size = 0;
+    time_t modified = 0;
+    time_t created = 0;
+};
+
+
+/********************************************************
+ * Listings shared by all WebDAV files
+ ********************************************************/
+
+// Listings by directory url, so the files in it need not ask for themselves
+class WebdavListings {
+public:
+    // From the cache, or asks the server
+    static bool get(const std::string &dir, std::vector<WebdavEntry> &entries);
+    static void forget(const std::string &dir);
+
+    static uint32_t hits;
+    static uint32_t misses;
+
+private:
+    struct Listing {
+        std::string dir;
+        std::vector<WebdavEntry> entries;
+        uint32_t stamp;
+    };
+    static std::list<Listing> m_listings;   // most recent first
+
+    static bool propfind(const std::string &dir, std::vector<WebdavEntry> &entries);
+};
+
+
+/********************************************************
+ * File implementations
+ ********************************************************/
+
+class WebdavFile: public MFile
+{
+public:
+    WebdavFile(std::string path): MFile(path) {};
+
+    MIStream* createIStream(std::shared_ptr<MIStream> src) { return src.get(); };
+    MIStream* inputStream() override ; // has to return OPENED stream
+    MOStream* outputStream() override { return nullptr; };
+
+    bool isDirectory() override;
+    bool rewindDirectory() override;
+    MFile* getNextFileInDir() override;
+    bool mkDir() override;
+
+    bool exists() override;
+    bool remove() override;
+    bool rename(std::string dest);
+    time_t getLastWrite() override;
+    time_t getCreationTime() override;
+    size_t size() override;
+
+private:
+    // From the listing of the directory this file is in
+    bool m_statted = false;
+    bool m_exists = false;
+    WebdavEntry m_entry;
+    bool stat(void);
+
+    std::vector<WebdavEntry> m_entries;
+    size_t m_next = 0;
+    bool m_listed = false;
+
+    std::string http(bool dir = false);
+    std::string parent(void);
+    bool call(const char *method, const std::string &destination = "");
+};
+
+
+/********************************************************
+ * Streams
+ ********************************************************/
+
+// An HTTP stream that reads in ranged blocks from the first byte on
+class WebdavIStream: public HttpIStream {
+public:
+    WebdavIStream(std::string path, size_t size): HttpIStream(path) {
+        m_length = size;
+    }
+
+    bool open() override;
+};
+
+
+/********************************************************
+ * FS
+ ********************************************************/
+
+class WebdavFileSystem: public MFileSystem
+{
+    MFile* getFile(std::string path) override {
+        return new WebdavFile(path);
+    }
+
+    bool handles(std::string name) {
+        return mstr::equals(name, (char *)"webdav:", false)
+            || mstr::equals(name, (char *)"dav:", false)
+            || mstr::equals(name, (char *)"webdavs:", false)
+            || mstr::equals(name, (char *)"davs:", false);
+    }
+public:
+    WebdavFileSystem(): MFileSystem("webdav") {};
+};
+
+
+#endif /* MEATFILESYSTEM_SCHEME_WEBDAV */
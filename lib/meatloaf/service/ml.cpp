@@ -114,6 +114,12 @@ bool MLFile::rewindDirectory() {
     //String post_data = std::string("p=" + mstr::urlEncode(path)).c_str(); // pathInStream will return here /c64.meatloaf.cc/some/directory
     std::string post_data = "p=" + mstr::urlEncode(path);
 
+    // Servers that know the filter send only matching entries
+    if ( dir_pattern.size() )
+        post_data += "&f=" + mstr::urlEncode(dir_pattern);
+    if ( dir_types.size() )
+        post_data += "&t=" + dir_types;
+
 	// Connect to HTTP server
 	Serial.printf("\r\nConnecting!\r\n--------------------\r\n%s\r\n%s\r\n", ml_url.c_str(), post_data.c_str());
 	if (!m_http.begin(m_file, ml_url.c_str()))
@@ -181,8 +187,9 @@ bool MLIStream::open() {
     std::string ml_url = "http://" + urlParser.host + "/api";
     std::string post_data = "p=" + urlParser.path;
 
+    m_client = &m_file;
     m_http.setReuse(true);
-    bool initOk = m_http.begin(m_file, ml_url.c_str());
+    bool initOk = m_http.begin(*m_client, ml_url.c_str());
     Debug_printv("input %s: someRc=%d, post[%s]", ml_url.c_str(), initOk, post_data.c_str());
     if(!initOk)
         return false;
@@ -193,12 +200,14 @@ bool MLIStream::open() {
     if(httpCode != 200)
         return false;
 
-    // Accept-Ranges: bytes - if we get such header from any request, good!
-    isFriendlySkipper = m_http.header("accept-ranges") == "bytes";
+    // Ranged reads would have to go through the API too
+    isFriendlySkipper = false;
     m_isOpen = true;
     Debug_printv("[%s]", ml_url.c_str());
     m_length = m_http.getSize();
     Debug_printv("length=%d", m_length);
     m_bytesAvailable = m_length;
+    m_bodyLeft = m_length;
+    m_position = 0;
     return true;
 };
\ No newline at end of file
@@ -13,12 +13,8 @@ size_t oiecbuf::easyWrite(bool lastOne) {
     // if this is last character in the file
     Debug_printv("IEC easyWrite writes:");
 
-    for(auto b = pbase(); b<pptr()-1; b++) {
-        Serial.printf("%c",*b);
-        if(m_iec->send(*b)) written++;
-        else
-            break;
-    }
+    if(pptr() - pbase() > 1)
+        written = m_iec->send((const uint8_t*)pbase(), pptr() - pbase() - 1);
 
     if(lastOne) {
         // ok, so we have last character, signal it
@@ -0,0 +1,212 @@
+#include "read_ahead.h"
+
+#include <vector>
+
+#include "string_utils.h"
+
+/********************************************************
+ * ReadAheadIStream
+ ********************************************************/
+
+uint32_t ReadAheadIStream::reads = 0;
+uint32_t ReadAheadIStream::underruns = 0;
+size_t ReadAheadIStream::lowest = READ_AHEAD_SIZE;
+
+std::list<ReadAheadIStream*> ReadAheadIStream::s_streams;
+
+#if defined(ESP32)
+SemaphoreHandle_t ReadAheadIStream::s_lock = nullptr;
+bool ReadAheadIStream::s_task = false;
+
+void ReadAheadIStream::lock(void) {
+    if(s_lock == nullptr)
+        s_lock = xSemaphoreCreateMutex();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+}
+
+void ReadAheadIStream::unlock(void) {
+    xSemaphoreGive(s_lock);
+}
+#else
+void ReadAheadIStream::lock(void) {}
+void ReadAheadIStream::unlock(void) {}
+#endif
+
+ReadAheadIStream::ReadAheadIStream(MIStream* source) : m_source(source) {
+    isText = source->isText;
+    m_size = source->size();
+    m_start = source->position();
+    m_ring.reset(new uint8_t[READ_AHEAD_SIZE]);
+
+    lock();
+    s_streams.push_back(this);
+    unlock();
+}
+
+ReadAheadIStream::~ReadAheadIStream() {
+    close();
+}
+
+bool ReadAheadIStream::wanted(MFile* file) {
+    if(file == nullptr || file->pathInStream.size() || !network(file))
+        return false;
+
+    lock();
+    bool free = s_streams.size() < READ_AHEAD_STREAMS;
+    unlock();
+    return free;
+}
+
+bool ReadAheadIStream::network(MFile* file) {
+    if(file == nullptr)
+        return false;
+
+    const char* schemes[] = { "http", "https", "ml", "cs", "ws", "wss", "ftp", "webdav", "dav", "webdavs", "davs" };
+    for(auto scheme : schemes) {
+        if(mstr::equals(file->scheme, (char*)scheme, false))
+            return true;
+    }
+    return false;
+}
+
+// The lock only guards the list and the claims, network reads are
+// done without it so one slow stream holds up nobody else
+bool ReadAheadIStream::claim(void) {
+    lock();
+    bool claimed = !m_busy;
+    m_busy = true;
+    unlock();
+    return claimed;
+}
+
+void ReadAheadIStream::wait(void) {
+    while(!claim())
+        delay(1);
+}
+
+void ReadAheadIStream::close() {
+    lock();
+    s_streams.remove(this);
+    unlock();
+
+    // A fill in progress still uses the source
+    wait();
+    if(m_ring != nullptr) {
+        m_source->close();
+        m_ring.reset();
+    }
+    m_busy = false;
+}
+
+bool ReadAheadIStream::seek(size_t pos) {
+    // Forward within what is buffered, skipping is free
+    if(pos >= position() && pos <= m_start + m_head) {
+        m_tail = pos - m_start;
+        return true;
+    }
+
+    wait();
+    bool sought = m_source->seek(pos);
+    m_start = m_source->position();
+    m_head = 0;
+    m_tail = 0;
+    m_end = !sought;
+    m_busy = false;
+
+    return sought;
+}
+
+size_t ReadAheadIStream::read(uint8_t* buf, size_t count) {
+    if(m_ring == nullptr)
+        return 0;
+
+    size_t buffered = m_head - m_tail;
+    reads++;
+    if(buffered < lowest)
+        lowest = buffered;
+
+    if(buffered == 0 && !m_end) {
+        // The network fell behind, wait for it here
+        underruns++;
+        wait();
+        if(m_head == m_tail)
+            fill(count);
+        m_busy = false;
+        buffered = m_head - m_tail;
+    }
+
+    if(count > buffered)
+        count = buffered;
+
+    // At most two pieces, the ring may wrap
+    size_t offset = m_tail bitand (READ_AHEAD_SIZE - 1);
+    size_t first = std::min(count, (size_t)READ_AHEAD_SIZE - offset);
+    memcpy(buf, m_ring.get() + offset, first);
+    memcpy(buf + first, m_ring.get(), count - first);
+    m_tail += count;
+
+    return count;
+}
+
+// Reads up to count more bytes from the source, the stream must be claimed
+size_t ReadAheadIStream::fill(size_t count) {
+    if(m_ring == nullptr || m_end)
+        return 0;
+
+    size_t room = READ_AHEAD_SIZE - (m_head - m_tail);
+    if(count > room)
+        count = room;
+
+    size_t total = 0;
+    while(total < count) {
+        size_t offset = m_head bitand (READ_AHEAD_SIZE - 1);
+        size_t piece = std::min(count - total, (size_t)READ_AHEAD_SIZE - offset);
+        size_t got = m_source->read(m_ring.get() + offset, piece);
+        if(got == 0) {
+            // A timeout is tried again on the next pass
+            if(m_source->available() == 0)
+                m_end = true;
+            break;
+        }
+        m_head += got;
+        total += got;
+    }
+
+    return total;
+}
+
+void ReadAheadIStream::service(void) {
+#if defined(ESP32)
+    // The fill task is started with the first stream and stays
+    if(!s_task && s_streams.size()) {
+        s_task = true;
+        xTaskCreatePinnedToCore(task, "readahead", 4096, nullptr, 1, nullptr, 0);
+    }
+#else
+    for(auto stream : s_streams)
+        stream->fill(READ_AHEAD_SLICE);
+#endif
+}
+
+#if defined(ESP32)
+void ReadAheadIStream::task(void* parameter) {
+    while(true) {
+        // What is claimed here stays valid, close() waits for it
+        std::vector<ReadAheadIStream*> claimed;
+        lock();
+        for(auto stream : s_streams) {
+            if(!stream->m_busy) {
+                stream->m_busy = true;
+                claimed.push_back(stream);
+            }
+        }
+        unlock();
+
+        for(auto stream : claimed) {
+            stream->fill(READ_AHEAD_SLICE);
+            stream->m_busy = false;
+        }
+        delay(5);
+    }
+}
+#endif
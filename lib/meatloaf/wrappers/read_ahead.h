@@ -0,0 +1,91 @@
+#ifndef MEATFILESYSTEM_WRAPPERS_READ_AHEAD
+#define MEATFILESYSTEM_WRAPPERS_READ_AHEAD
+
+#include "../../../include/global_defines.h"
+
+#include <list>
+#include <memory>
+
+#include "meat_io.h"
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#endif
+
+#if defined(ESP32)
+#define READ_AHEAD_SIZE     16384   // per stream, power of two
+#define READ_AHEAD_STREAMS  2       // streams buffered at the same time
+#else
+#define READ_AHEAD_SIZE     2048
+#define READ_AHEAD_STREAMS  1
+#endif
+#define READ_AHEAD_SLICE    512     // bytes read from the network per step
+
+/********************************************************
+ * ReadAheadIStream
+ *
+ * Keeps a ring of what comes next in a sequential network
+ * stream topped up while the bus is idle, so a LOAD does
+ * not wait for the network on every block it sends.
+ ********************************************************/
+
+class ReadAheadIStream: public MIStream {
+public:
+    // Takes ownership of an opened source
+    ReadAheadIStream(MIStream* source);
+    ~ReadAheadIStream();
+
+    // Network files that are not inside a container, while a ring is free
+    static bool wanted(MFile* file);
+
+    // Only the network is slow enough to be worth the RAM
+    static bool network(MFile* file);
+
+    // Tops up every ring, call while the bus is idle
+    static void service(void);
+
+    static uint32_t reads;
+    static uint32_t underruns;      // reads that had to wait for the network
+    static size_t lowest;           // fewest bytes buffered when a read came
+
+    size_t position() override { return m_start + m_tail; };
+    void close() override;
+    bool open() override { return isOpen(); };
+    bool isOpen() override { return m_ring != nullptr && m_source->isOpen(); };
+
+    bool seek(size_t pos) override;
+    size_t available() override { return ( m_size > position() ) ? m_size - position() : 0; };
+    size_t size() override { return m_size; };
+    size_t read(uint8_t* buf, size_t count) override;
+
+    uint8_t recordLength() override { return m_source->recordLength(); };
+
+private:
+    std::unique_ptr<MIStream> m_source;
+    std::unique_ptr<uint8_t[]> m_ring;
+    size_t m_size = 0;
+
+    // Only fill() moves m_head and only the reader moves m_tail,
+    // anything that uses the source claims the stream first
+    size_t m_start = 0;             // source position of the first byte put
+    volatile size_t m_head = 0;     // bytes put since m_start
+    volatile size_t m_tail = 0;     // bytes taken since m_start
+    volatile bool m_end = false;
+    volatile bool m_busy = false;   // the source is in use, without the lock held
+
+    bool claim(void);
+    void wait(void);
+    size_t fill(size_t count);
+
+    static std::list<ReadAheadIStream*> s_streams;
+    static void lock(void);
+    static void unlock(void);
+#if defined(ESP32)
+    static SemaphoreHandle_t s_lock;
+    static bool s_task;
+    static void task(void* parameter);
+#endif
+};
+
+#endif
@@ -1,5 +1,7 @@
 #include "U8Char.h"
 
+#include <cstring>
+
 // from https://style64.org/petscii/
 
 // PETSCII table in UTF8
@@ -32,6 +34,48 @@ const char16_t U8Char::utf8map[] = {
 
 };
 
+// Reverse of utf8map in two levels, the high byte of a code point picks
+// a page of 256 PETSCII codes. Only the handful of pages used exist.
+namespace {
+    const uint8_t missing_page = 0xFF;
+
+    struct PetsciiTable {
+        uint8_t page_of[256];
+        uint8_t pages[6][256];  // 0x00, 0x20, 0x21, 0x25 and 0x27 in use
+
+        PetsciiTable(const char16_t* map, char missing) {
+            memset(page_of, missing_page, sizeof(page_of));
+            memset(pages, missing, sizeof(pages));
+            uint8_t used = 0;
+
+            // Backwards, so the lowest PETSCII code wins like the linear scan did
+            for(int i = 255; i >= 0; i--) {
+                char16_t ch = map[i];
+                if(ch == 0 && i != 0)
+                    continue;
+
+                uint8_t hi = ch >> 8;
+                if(page_of[hi] == missing_page) {
+                    if(used == sizeof(pages) / sizeof(pages[0]))
+                        continue;
+                    page_of[hi] = used++;
+                }
+                pages[page_of[hi]][ch & 0xFF] = i;
+            }
+        }
+
+        uint8_t lookup(char16_t ch, char missing) const {
+            uint8_t page = page_of[ch >> 8];
+            return (page == missing_page) ? missing : pages[page][ch & 0xFF];
+        }
+    };
+
+    const PetsciiTable& petsciiTable(const char16_t* map) {
+        static PetsciiTable table(map, '?');
+        return table;
+    }
+}
+
 void U8Char::fromUtf8Stream(std::istream* reader) {
     uint8_t byte = reader->get();
     if(byte<=0x7f) {
@@ -77,9 +121,50 @@ std::string U8Char::toUtf8() {
 }
 
 uint8_t U8Char::toPetscii() {
-    for(int i = 0; i<256; i++) {
-        if(utf8map[i]==ch)
-            return i;
+    return petsciiTable(utf8map).lookup(ch, missing);
+}
+
+size_t U8Char::toPetscii(const uint8_t* in, size_t len, uint8_t* out, size_t& consumed) {
+    const PetsciiTable& table = petsciiTable(utf8map);
+    const uint8_t* ascii = table.pages[table.page_of[0]];
+    size_t i = 0;
+    size_t o = 0;
+
+    while(i < len) {
+        // Four plain ASCII bytes at a time
+        if(i + 4 <= len) {
+            uint32_t word;
+            memcpy(&word, in + i, 4);
+            if((word & 0x80808080) == 0) {
+                out[o++] = ascii[in[i++]];
+                out[o++] = ascii[in[i++]];
+                out[o++] = ascii[in[i++]];
+                out[o++] = ascii[in[i++]];
+                continue;
+            }
+        }
+
+        uint8_t byte = in[i];
+        if(byte <= 0x7f) {
+            out[o++] = ascii[byte];
+            i++;
+            continue;
+        }
+
+        size_t length = ((byte & 0b11100000) == 0b11000000) ? 2 : ((byte & 0b11110000) == 0b11100000) ? 3 : 1;
+        if(i + length > len)
+            break;
+
+        char16_t ch = 0;
+        if(length == 2)
+            ch = ((byte & 0b11111) << 6) | (in[i+1] & 0b111111);
+        else if(length == 3)
+            ch = ((byte & 0b1111) << 12) | ((in[i+1] & 0b111111) << 6) | (in[i+2] & 0b111111);
+
+        out[o++] = (ch == 0) ? '?' : table.lookup(ch, '?');
+        i += length;
     }
-    return missing;
+
+    consumed = i;
+    return o;
 }
\ No newline at end of file
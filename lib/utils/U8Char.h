@@ -28,6 +28,10 @@ public:
 
     std::string toUtf8();
     uint8_t toPetscii();
+
+    // Buffer to buffer, out needs room for len bytes. A sequence cut off at the
+    // end of in is left unconsumed, consumed tells where to continue from.
+    static size_t toPetscii(const uint8_t* in, size_t len, uint8_t* out, size_t& consumed);
 };
 
 #endif /* MEATLIB_UTILS_U8CHAR */
@@ -68,7 +68,7 @@ bool DeviceDB::select(uint8_t new_device_id)
     else
     {
         // Create New Settings
-        deserializeJson(m_device, F("{\"id\":0,\"media\":0,\"partition\":0,\"url\":\"\",\"path\":\"/\",\"archive\":\"\",\"image\":\"\"}"));
+        deserializeJson(m_device, F("{\"id\":0,\"media\":0,\"partition\":0,\"url\":\"\",\"path\":\"/\",\"archive\":\"\",\"image\":\"\",\"warp\":false}"));
         m_device["id"] = new_device_id;
         Debug_printv("created id[%d]", (uint8_t)m_device["id"]);
     }
@@ -175,4 +175,16 @@ void DeviceDB::image(std::string image)
         m_dirty = true;
     }
 }
+bool DeviceDB::warp()
+{
+    return m_device["warp"];
+}
+void DeviceDB::warp(bool warp)
+{
+    if (warp != m_device["warp"])
+    {
+        m_device["warp"] = warp;
+        m_dirty = true;
+    }
+}
 
@@ -50,6 +50,8 @@ public:
     void archive(std::string archive);
     std::string image();
     void image(std::string image);
+    bool warp();
+    void warp(bool warp);
 
     bool select(uint8_t device);
 
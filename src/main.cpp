@@ -98,6 +98,13 @@ void setup()
         // Setup IEC Bus
         iec.enabledDevices = DEVICE_MASK;
         iec.enableDevice(30);
+#if defined(VIRTUAL_PRINTER)
+        drive.attach(4, &printer);
+        drive.attach(5, &printer);
+#endif
+#if defined(NETWORK_DEVICE)
+        drive.attach(NETWORK_DEVICE, &network);
+#endif
         iec.init();
         Serial.println("IEC Bus Initialized");
 
@@ -142,6 +149,10 @@ void loop()
 
     modem.service();
     //cli.readSerial();
+#if defined(TRUE_DRIVE)
+    if ( Drive1541::running() )
+        bus_state = statemachine::idle;
+#endif
     if ( bus_state != statemachine::idle )
     {
         //Debug_printv("before[%d]", bus_state);
@@ -149,6 +160,16 @@ void loop()
             bus_state = statemachine::idle;
         //Debug_printv("after[%d]", bus_state);
     }
+    if ( bus_state == statemachine::idle )
+        drive.idle();
+#if defined(VIRTUAL_PRINTER)
+    if ( bus_state == statemachine::idle )
+        printer.render();
+#endif
+#if defined(NETWORK_DEVICE)
+    if ( bus_state == statemachine::idle )
+        network.poll();
+#endif
 
 
 #ifdef DEBUG_TIMING
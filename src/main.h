@@ -72,6 +72,8 @@ SDFSConfig fileSystemConfig = SDFSConfig();
 #include "iec.h"
 #include "iec_device.h"
 #include "drive.h"
+#include "printer.h"
+#include "network.h"
 #include "ESPModem.h"
 #include "ml_tests.h"
 
@@ -89,6 +91,12 @@ bool initFailed = false;
 
 static IEC iec;
 static devDrive drive ( iec );
+#if defined(VIRTUAL_PRINTER)
+static devPrinter printer ( iec );
+#endif
+#if defined(NETWORK_DEVICE)
+static devNetwork network ( iec );
+#endif
 
 
 //Zimodem modem;